@@ -0,0 +1,52 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Throughput of the message digests supported by the Lua/APR binding. Every
+ algorithm hashes the same in-memory string using the one shot interface and
+ then a temporary file on disk using the *_file() interface. Usage:
+
+   lua digests.lua [MEGABYTES] [SECONDS]
+
+--]]
+
+local apr = require 'apr'
+
+local megabytes = tonumber(arg[1]) or 64
+local seconds = tonumber(arg[2]) or 2
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+local algorithms = { 'md5', 'sha1', 'sha256', 'sha512', 'crc32c', 'xxh3' }
+
+-- Hash the input until the time is up and return the throughput in MB/s.
+local function measure(hash, input, size)
+  local count, started = 0, apr.time_now()
+  repeat
+    assert(hash(input))
+    count = count + 1
+  until apr.time_now() - started >= seconds
+  return (size * count) / (apr.time_now() - started) / 1024 / 1024
+end
+
+-- Generate the input (some random data repeated).
+local random = io.open('/dev/urandom', 'rb')
+local block = random and random:read(1024 * 1024) or string.rep('Lua/APR ', 1024 * 128)
+if random then random:close() end
+local data = block:rep(megabytes)
+local tmpfile = os.tmpname()
+local handle = assert(io.open(tmpfile, 'wb'))
+assert(handle:write(data))
+assert(handle:close())
+
+msg("Hashing %i MB, %i seconds per algorithm ..", megabytes, seconds)
+msg("%-10s %12s %12s", 'Algorithm', 'String', 'File')
+for _, name in ipairs(algorithms) do
+  local in_memory = measure(apr[name], data, #data)
+  local on_disk = measure(apr[name .. '_file'], tmpfile, #data)
+  msg("%-10s %7.0f MB/s %7.0f MB/s", name, in_memory, on_disk)
+end
+
+os.remove(tmpfile)
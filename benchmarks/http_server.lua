@@ -0,0 +1,85 @@
+#!/usr/bin/env lua
+
+--[[
+
+ Benchmark of the HTTP server engine (apr.http_server()) using a load
+ generator that runs in the same process. The server and the clients each run
+ in their own threads; every client keeps one persistent connection open and
+ sends requests one after another. Usage:
+
+   lua http_server.lua [SERVER_THREADS] [CLIENT_THREADS] [SECONDS]
+
+ To compare with the example webservers you can also point ApacheBench at the
+ server (see webservers.sh) by passing zero client threads.
+
+--]]
+
+local apr = require 'apr'
+
+local server_threads = tonumber(arg[1]) or 2
+local client_threads = tonumber(arg[2]) or 4
+local seconds = tonumber(arg[3]) or 5
+local port = math.random(10000, 40000)
+
+local function msg(...)
+  io.stderr:write(string.format(...), '\n')
+end
+
+-- Start the servers.
+assert(apr.http_server_threads(server_threads, {
+  host = '127.0.0.1',
+  port = port,
+  handler = function(request)
+    return 200, { ['Content-Type'] = 'text/plain' }, 'Hello from Lua/APR!\n'
+  end,
+}))
+
+if client_threads == 0 then
+  msg("Serving on http://127.0.0.1:%i/ with %i threads, press Control-C to stop ..", port, server_threads)
+  while true do apr.sleep(60) end
+end
+
+-- Start the clients.
+local clients = {}
+for i = 1, client_threads do
+  clients[i] = assert(apr.thread(function(port, seconds)
+    local apr = require 'apr'
+    local socket = assert(apr.socket_create())
+    for i = 1, 50 do
+      if socket:connect('127.0.0.1', port) then break end
+      apr.sleep(0.1)
+    end
+    local request = 'GET / HTTP/1.1\r\nHost: localhost\r\n\r\n'
+    local deadline = apr.time_now() + seconds
+    local count, bytes = 0, 0
+    while apr.time_now() < deadline do
+      assert(socket:write(request))
+      local length = 0
+      for line in socket:lines() do
+        if line == '' or line == '\r' then break end
+        length = tonumber(line:match '^[Cc]ontent%-[Ll]ength:%s*(%d+)') or length
+      end
+      bytes = bytes + #assert(socket:read(length))
+      count = count + 1
+    end
+    assert(socket:close())
+    return count, bytes
+  end, port, seconds))
+end
+
+-- Collect the results.
+local requests, bytes = 0, 0
+for _, client in ipairs(clients) do
+  local status, count, size = client:join()
+  assert(status, count)
+  requests = requests + count
+  bytes = bytes + size
+end
+
+msg("Server threads:      %i", server_threads)
+msg("Client threads:      %i", client_threads)
+msg("Requests per second: %.2f", requests / seconds)
+msg("Transfer rate:       %.2f Kbytes/sec (body only)", bytes / seconds / 1024)
+
+-- The server threads keep running until the process exits.
+os.exit(0)
@@ -13,10 +13,13 @@
 -- automatic rebasing between git feature branches and the master branch).
 local SOURCES = [[
   base64.c
+  chunked.c
+  connpool.c
   crypt.c
   date.c
   dbd.c
   dbm.c
+  digest.c
   env.c
   filepath.c
   fnmatch.c
@@ -28,19 +31,27 @@ local SOURCES = [[
   memcache.c
   getopt.c
   http.c
+  http_client.c
+  http_parser.c
+  http_server.c
+  pipeline.c
   pollset.c
   proc.c
+  resolver.c
   shm.c
   signal.c
   str.c
   thread.c
   thread_queue.c
   time.c
+  tls.c
   uri.c
   user.c
   uuid.c
+  websocket.c
   xlate.c
   xml.c
+  zlib.c
   serialize.c
   apr.lua
   lua_apr.c
@@ -472,10 +483,12 @@ local function htmlencode(s)
 end
 
 local custom_sorting = {
-  ['crypt.c'] = [[ apr.md5 apr.md5_encode apr.password_validate
-    apr.password_get apr.md5_init md5_context:update md5_context:digest
-    md5_context:reset apr.sha1 apr.sha1_init sha1_context:update
-    sha1_context:digest sha1_context:reset ]],
+  ['crypt.c'] = [[ apr.md5 apr.md5_file apr.md5_encode apr.password_validate
+    apr.password_validator apr.password_validate_batch validator:validate
+    validator:results validator:close apr.password_get apr.md5_init
+    md5_context:update md5_context:update_from md5_context:digest
+    md5_context:reset apr.sha1 apr.sha1_file apr.sha1_init sha1_context:update
+    sha1_context:update_from sha1_context:digest sha1_context:reset ]],
   ['thread.c'] = [[ apr.thread apr.thread_yield thread:status thread:join ]],
   ['serialize.c'] = [[ apr.serialize apr.unserialize apr.ref apr.deref ]],
   ['io_file.c'] = [[ apr.file_link apr.file_copy apr.file_append
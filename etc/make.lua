@@ -3,7 +3,7 @@
  Supporting code for the UNIX makefile of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: December 4, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -152,6 +152,33 @@ local function getcflags()
   end
   -- Let the C source code know whether libapreq2 is available.
   flags[#flags + 1] = '-DLUA_APR_HAVE_APREQ=' .. (have_apreq and 1 or 0)
+  -- Compiler flags for OpenSSL (used for TLS support).
+  local have_openssl = readcmd 'pkg-config --exists openssl' == 0
+  if have_openssl then
+    mergeflags(flags, 'pkg-config --cflags openssl')
+  elseif DEBUG then
+    message "Warning: Failed to determine OpenSSL compiler flags."
+  end
+  -- Let the C source code know whether OpenSSL is available.
+  flags[#flags + 1] = '-DLUA_APR_HAVE_OPENSSL=' .. (have_openssl and 1 or 0)
+  -- Compiler flags for zlib (used for compression streams).
+  local have_zlib = readcmd 'pkg-config --exists zlib' == 0
+  if have_zlib then
+    mergeflags(flags, 'pkg-config --cflags zlib')
+  elseif DEBUG then
+    message "Warning: Failed to determine zlib compiler flags."
+  end
+  -- Let the C source code know whether zlib is available.
+  flags[#flags + 1] = '-DLUA_APR_HAVE_ZLIB=' .. (have_zlib and 1 or 0)
+  -- Compiler flags for Expat (used for event driven XML parsing).
+  local have_expat = readcmd 'pkg-config --exists expat' == 0
+  if have_expat then
+    mergeflags(flags, 'pkg-config --cflags expat')
+  elseif DEBUG then
+    message "Warning: Failed to determine Expat compiler flags."
+  end
+  -- Let the C source code know whether Expat is available.
+  flags[#flags + 1] = '-DLUA_APR_HAVE_EXPAT=' .. (have_expat and 1 or 0)
   return table.concat(flags, ' ')
 end
 
@@ -178,6 +205,12 @@ local function getlflags()
   if DEBUG and #flags == 0 then
     message "Warning: Failed to determine apreq2 linker flags."
   end
+  -- Linker flags for OpenSSL.
+  mergeflags(flags, 'pkg-config --libs openssl')
+  -- Linker flags for zlib.
+  mergeflags(flags, 'pkg-config --libs zlib')
+  -- Linker flags for Expat.
+  mergeflags(flags, 'pkg-config --libs expat')
   return table.concat(flags, ' ')
 end
 
@@ -3,7 +3,7 @@
   Example: HTTP client
 
   Author: Peter Odding <peter@peterodding.com>
-  Last Change: December 30, 2010
+  Last Change: October 18, 2026
   Homepage: http://peterodding.com/code/lua/apr/
   License: MIT
 
@@ -18,14 +18,13 @@
       $ time lua examples/download.lua $URL > $FILE
       0,03s user 0,02s system 9% cpu 0,549 total
 
-  Note that this script and Lua/APR in general are a bit handicapped in that
-  they don't support [HTTPS] [https] because the Apache Portable Runtime does
-  not support encrypted network communication.
+  The script uses `apr.http_request()` which takes care of connection reuse
+  and chunked transfer encoding (pass an `output` file or function to stream
+  large downloads instead of collecting them in memory).
 
   [url]: http://en.wikipedia.org/wiki/Uniform_Resource_Locator
   [wget]: http://en.wikipedia.org/wiki/wget
   [curl]: http://en.wikipedia.org/wiki/cURL
-  [https]: http://en.wikipedia.org/wiki/HTTPS
 
 ]]
 
@@ -42,30 +41,16 @@ local function assert(...)
 end
 
 local function getpage(url)
-  local components = assert(apr.uri_parse(url))
-  assert(components.scheme == 'http', "invalid protocol!")
-  local port = assert(components.port or apr.uri_port_of_scheme(components.scheme))
-  local socket = assert(apr.socket_create())
-  assert(socket:connect(components.hostname, port))
-  local pathinfo = assert(apr.uri_unparse(components, 'pathinfo'))
-  assert(socket:write('GET ', pathinfo, ' HTTP/1.0\r\n',
-                      'Host: ', components.hostname, '\r\n',
-                      '\r\n'))
-  local statusline = assert(socket:read(), 'HTTP response missing status line!')
-  local protocol, statuscode, reason = assert(statusline:match '^(%S+)%s+(%S+)%s+(.-)$')
-  local redirect = statuscode:find '^30[123]$'
-  for line in socket:lines() do
-    local name, value = line:match '^(%S+):%s+(.-)\r?$'
-    if name and value then
-      if redirect and name:lower() == 'location' then
-        io.stderr:write("Following redirect to ", value, " ..\n")
-        return getpage(value)
-      end
-    else
-      return (assert(socket:read '*a', 'HTTP response missing body?!'))
-    end
+  local response = assert(apr.http_request { url = url })
+  local status = response.status
+  if status == 301 or status == 302 or status == 303 then
+    local location = assert(response.headers.location, 'HTTP redirect without location!')
+    io.stderr:write("Following redirect to ", location, " ..\n")
+    return getpage(location)
+  elseif status ~= 200 then
+    error(response.reason)
   end
-  if statuscode ~= '200' then error(reason) end
+  return response.body
 end
 
 local usage = "Please provide a URL to download as argument"
@@ -3,7 +3,7 @@
  Lua source code for the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: December 7, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -320,6 +320,391 @@ function apr.getopt(usage, config)
   end
 end
 
+-- apr.loop([size]) -> loop {{{1
+--
+-- Create a scheduler that runs coroutines on top of a pollset, so that code
+-- handling many network connections can be written as straight-line code. On
+-- success a loop object is returned, otherwise a nil followed by an error
+-- message is returned. The optional number @size is the maximum number of
+-- sockets that can be waited on at the same time (defaults to 1024).
+--
+-- Inside a coroutine started with `loop:spawn()` the `socket:read()`,
+-- `socket:write()`, `socket:lines()`, `socket:accept()`, `socket:connect()`
+-- and `socket:tls_handshake()` methods are transparently non-blocking: The
+-- socket is switched to non-blocking mode on first use and when an operation
+-- would block, the coroutine yields to the loop which resumes it once the
+-- pollset reports the socket as ready. Outside of the loop's coroutines these
+-- methods behave as usual. Here's a simple echo server:
+--
+--     local loop = assert(apr.loop())
+--     local server = assert(apr.socket_create())
+--     assert(server:bind('*', 8080))
+--     assert(server:listen(100))
+--     loop:spawn(function()
+--       while true do
+--         local client = assert(server:accept())
+--         loop:spawn(function()
+--           for line in client:lines() do
+--             assert(client:write(line, '\n'))
+--           end
+--           assert(client:close())
+--         end)
+--       end
+--     end)
+--     assert(loop:run())
+--
+-- Loop objects support the following methods:
+--
+--  * `loop:spawn(f, ...)` creates a coroutine that will call the function @f
+--    with the given arguments the next time the loop gets to run
+--
+--  * `loop:run()` runs the loop until all its coroutines have finished and
+--    then returns true. When one of the coroutines raises an error it is
+--    propagated by `loop:run()`
+--
+--  * `loop:wait(object [, events])` suspends the current coroutine until the
+--    socket, file or thread queue @object is readable (when @events is
+--    `'input'`, the default) or writable (when @events is `'output'`)
+--
+--  * `loop:sleep(seconds)` suspends the current coroutine for the given
+--    number of seconds without blocking other coroutines
+--
+--  * `loop:resolve(host [, family])` resolves a host name using the
+--    resolver described under `apr.resolver()` and suspends the current
+--    coroutine until the IP addresses are known. The return values are the
+--    same as for `apr.host_to_addr()`. `socket:connect()` uses this so that
+--    DNS lookups don't block other coroutines
+--
+--  * `loop:password_validate(password, digest)` validates a password on the
+--    helper threads of a validator created with `apr.password_validator()`
+--    and suspends the current coroutine until the result is known. The
+--    return values are the same as for `apr.password_validate()`
+--
+-- Note that a socket can only be waited on by one coroutine at a time and
+-- that sockets used in a loop stay in non-blocking mode afterwards.
+--
+-- Part of the "Pollset" module.
+
+local loop_methods = {}
+loop_methods.__index = loop_methods
+
+local loop_tasks = setmetatable({}, { __mode = 'k' })
+local nonblocking = setmetatable({}, { __mode = 'k' })
+local WAITING = {} -- yielded by coroutines that are woken up by the loop
+
+local function loop_current(socket)
+  local loop = loop_tasks[coroutine.running() or false]
+  if loop and not nonblocking[socket] then
+    assert(socket:timeout_set(false))
+    nonblocking[socket] = true
+  end
+  return loop
+end
+
+local function install_socket_methods()
+  local socket = assert(apr.socket_create())
+  local methods = getmetatable(socket).__index
+  assert(socket:close())
+  local read, write, accept, connect = methods.read, methods.write, methods.accept, methods.connect
+  local tls_want = methods.tls_want
+
+  -- TLS sockets may have to write in order to read and the other way around.
+  local function wait_ready(loop, socket, events)
+    loop:wait(socket, tls_want and tls_want(socket) or events)
+  end
+
+  local function read_one(loop, socket, format)
+    while true do
+      local value, errmsg, errcode
+      if format == nil then
+        value, errmsg, errcode = read(socket)
+      else
+        value, errmsg, errcode = read(socket, format)
+      end
+      if errcode ~= 'EAGAIN' then return value, errmsg, errcode end
+      wait_ready(loop, socket, 'input')
+    end
+  end
+
+  function methods:read(...)
+    local loop = loop_current(self)
+    if not loop then return read(self, ...) end
+    local n = select('#', ...)
+    if n <= 1 then return read_one(loop, self, (...)) end
+    -- Read one value at a time so that no input is lost when we have to wait.
+    local results = {}
+    for i = 1, n do
+      local value, errmsg, errcode = read_one(loop, self, (select(i, ...)))
+      if errmsg then return nil, errmsg, errcode end
+      results[i] = value
+      if value == nil then return unpack(results, 1, i) end
+    end
+    return unpack(results, 1, n)
+  end
+
+  -- Wait until output that was buffered by a non-blocking write is sent.
+  local function flush_pending(loop, socket, status, errmsg, errcode)
+    while status and errmsg == 'buffered' do
+      wait_ready(loop, socket, 'output')
+      status, errmsg, errcode = write(socket)
+    end
+    return status, errmsg, errcode
+  end
+
+  function methods:write(...)
+    local loop = loop_current(self)
+    if not loop then return write(self, ...) end
+    local status, errmsg, errcode = write(self, ...)
+    while errcode == 'EAGAIN' do
+      -- Too much output was pending so nothing was written.
+      wait_ready(loop, self, 'output')
+      status, errmsg, errcode = write(self, ...)
+    end
+    return flush_pending(loop, self, status, errmsg, errcode)
+  end
+
+  local ws_read, ws_write = methods.ws_read, methods.ws_write
+
+  function methods:ws_read(...)
+    local loop = loop_current(self)
+    if not loop then return ws_read(self, ...) end
+    while true do
+      -- Partial messages stay buffered, so reading again is safe.
+      local opcode, payload, extra = ws_read(self, ...)
+      if extra ~= 'EAGAIN' then return opcode, payload, extra end
+      wait_ready(loop, self, 'input')
+    end
+  end
+
+  function methods:ws_write(...)
+    local loop = loop_current(self)
+    if not loop then return ws_write(self, ...) end
+    local status, errmsg, errcode = ws_write(self, ...)
+    while errcode == 'EAGAIN' do
+      wait_ready(loop, self, 'output')
+      status, errmsg, errcode = ws_write(self, ...)
+    end
+    return flush_pending(loop, self, status, errmsg, errcode)
+  end
+
+  local lines = methods.lines
+  function methods:lines()
+    if not loop_current(self) then return lines(self) end
+    return function()
+      local line, errmsg = self:read()
+      if errmsg then error(errmsg, 2) end
+      return line
+    end
+  end
+
+  function methods:accept()
+    local loop = loop_current(self)
+    if not loop then return accept(self) end
+    while true do
+      local client, errmsg, errcode = accept(self)
+      if errcode ~= 'EAGAIN' then return client, errmsg, errcode end
+      loop:wait(self, 'input')
+    end
+  end
+
+  function methods:connect(host, port)
+    local loop = loop_current(self)
+    if not loop then return connect(self, host, port) end
+    -- Resolve the host name on a helper thread; this primes the DNS cache
+    -- so that connect() below doesn't block on the lookup.
+    local address, errmsg, errcode = loop:resolve(host, 'unspec')
+    if not address then return nil, errmsg, errcode end
+    while true do
+      -- Once the socket is writable connecting again reports the outcome.
+      local status, errmsg, errcode = connect(self, host, port)
+      if errcode ~= 'EINPROGRESS' and errcode ~= 'EAGAIN' then
+        return status, errmsg, errcode
+      end
+      loop:wait(self, 'output')
+    end
+  end
+
+  if methods.tls_handshake then
+    local tls_handshake = methods.tls_handshake
+    function methods:tls_handshake()
+      local loop = loop_current(self)
+      if not loop then return tls_handshake(self) end
+      while true do
+        local status, errmsg, errcode = tls_handshake(self)
+        if errcode ~= 'EAGAIN' then return status, errmsg, errcode end
+        wait_ready(loop, self, 'input')
+      end
+    end
+  end
+
+  install_socket_methods = function() end
+end
+
+function apr.loop(size)
+  install_socket_methods()
+  local pollset, errmsg, errcode = apr.pollset(size or 1024)
+  if not pollset then return nil, errmsg, errcode end
+  return setmetatable({ pollset = pollset, ready = {}, waiting = {}, tasks = 0 }, loop_methods)
+end
+
+function loop_methods:spawn(f, ...)
+  local task = coroutine.create(f)
+  loop_tasks[task] = self
+  self.tasks = self.tasks + 1
+  table.insert(self.ready, { task, n = select('#', ...), ... })
+  return task
+end
+
+function loop_methods:wait(object, events)
+  local task = coroutine.running()
+  assert(task and loop_tasks[task] == self, "loop:wait() called outside of loop")
+  assert(not self.waiting[object], "object is already being waited on")
+  local status, errmsg, errcode = self.pollset:add(object, events or 'input')
+  if not status then return nil, errmsg, errcode end
+  self.waiting[object] = task
+  coroutine.yield(WAITING)
+  return self.pollset:remove(object)
+end
+
+function loop_methods:sleep(seconds)
+  local task = coroutine.running()
+  assert(task and loop_tasks[task] == self, "loop:sleep() called outside of loop")
+  self.pollset:timer(seconds * 1000000, function()
+    table.insert(self.ready, { task, n = 0 })
+  end)
+  coroutine.yield(WAITING)
+end
+
+function loop_methods:resolve(host, family)
+  local task = coroutine.running()
+  assert(task and loop_tasks[task] == self, "loop:resolve() called outside of loop")
+  local resolver = self.resolver
+  if not resolver then
+    -- Without threads lookups can only be performed synchronously.
+    if not apr.resolver then return apr.host_to_addr(host, family) end
+    local status, errmsg, errcode
+    resolver, errmsg, errcode = apr.resolver()
+    if not resolver then return nil, errmsg, errcode end
+    status, errmsg, errcode = self.pollset:add(resolver, 'input')
+    if not status then
+      resolver:close()
+      return nil, errmsg, errcode
+    end
+    self.resolver, self.lookups = resolver, {}
+  end
+  local result = { resolver:lookup(host, family) }
+  if not result[1] then return nil, result[2], result[3] end
+  -- Numeric addresses and cached host names are resolved immediately.
+  if result[2] then return unpack(result, 2) end
+  self.lookups[result[1]] = task
+  local lookup = coroutine.yield(WAITING)
+  if lookup.addresses then return unpack(lookup.addresses) end
+  return nil, lookup.error, lookup.code
+end
+
+function loop_methods:password_validate(password, digest)
+  local task = coroutine.running()
+  assert(task and loop_tasks[task] == self, "loop:password_validate() called outside of loop")
+  local validator = self.validator
+  if not validator then
+    -- Without threads passwords can only be validated synchronously.
+    if not apr.password_validator then return apr.password_validate(password, digest) end
+    local status, errmsg, errcode
+    validator, errmsg, errcode = apr.password_validator()
+    if not validator then return nil, errmsg, errcode end
+    status, errmsg, errcode = self.pollset:add(validator, 'input')
+    if not status then
+      validator:close()
+      return nil, errmsg, errcode
+    end
+    self.validator, self.validations = validator, {}
+  end
+  self.validations[validator:validate(password, digest)] = task
+  local validation = coroutine.yield(WAITING)
+  if validation.valid then return true end
+  return nil, validation.error, validation.code
+end
+
+function loop_methods:run()
+  local waiting = self.waiting
+  local function wakeup(object)
+    local task = waiting[object]
+    if object == self.resolver then
+      for _, lookup in ipairs(object:results()) do
+        task = self.lookups[lookup.id]
+        self.lookups[lookup.id] = nil
+        if task then table.insert(self.ready, { task, n = 1, lookup }) end
+      end
+    elseif object == self.validator then
+      for _, validation in ipairs(object:results()) do
+        task = self.validations[validation.id]
+        self.validations[validation.id] = nil
+        if task then table.insert(self.ready, { task, n = 1, validation }) end
+      end
+    elseif task then
+      waiting[object] = nil
+      table.insert(self.ready, { task, n = 0 })
+    end
+  end
+  while self.tasks > 0 do
+    -- Resume the coroutines that are ready to run.
+    while self.ready[1] do
+      local ready = self.ready
+      self.ready = {}
+      for _, entry in ipairs(ready) do
+        local task = entry[1]
+        local ok, result = coroutine.resume(task, unpack(entry, 2, entry.n + 1))
+        if not ok or coroutine.status(task) == 'dead' then
+          loop_tasks[task] = nil
+          self.tasks = self.tasks - 1
+          if not ok then error(result, 0) end
+        elseif result ~= WAITING then
+          -- The coroutine yielded voluntarily.
+          table.insert(self.ready, { task, n = 0 })
+        end
+      end
+    end
+    if self.tasks == 0 then break end
+    -- Wait for sockets to become ready or for timers to expire.
+    local readable, writable, errcode = self.pollset:poll(-1)
+    if not readable then return nil, writable, errcode end
+    for _, object in ipairs(readable) do wakeup(object) end
+    for _, object in ipairs(writable) do wakeup(object) end
+  end
+  return true
+end
+
+-- apr.http_server_threads(count, options) -> threads {{{1
+--
+-- Start @count threads that each run an HTTP server created by
+-- `apr.http_server()` with the given @options. Every thread gets its own
+-- listening socket on the same port (using `SO_REUSEPORT`) so the kernel
+-- distributes connections between the threads and the threads don't share
+-- any state. Because of this @options should include a port number. The
+-- handler is copied to each thread, so it can only refer to upvalues that
+-- can be serialized. On success a list of thread objects is returned,
+-- otherwise a nil followed by an error message is returned. A thread ends
+-- when a handler calls `request.server:stop()`, after which `thread:join()`
+-- returns the result of `server:run()`.
+--
+-- Part of the "HTTP server" module.
+
+function apr.http_server_threads(count, options)
+  local threads = {}
+  for i = 1, count do
+    local thread, message, code = apr.thread(function(options)
+      local apr = require 'apr'
+      options.reuseport = true
+      local server, message, code = apr.http_server(options)
+      if not server then return nil, message, code end
+      return server:run()
+    end, options)
+    if not thread then return nil, message, code end
+    threads[i] = thread
+  end
+  return threads
+end
+
 -- apr.serialize(...) -> string {{{1
 --
 -- Serialize any number of Lua values (a tuple) into a source code string. When
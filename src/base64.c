@@ -1,7 +1,7 @@
 /* Base64 encoding module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: January 2, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -12,12 +12,561 @@
  * example in e-mail attachments and [data:] [data_uris] URLs. You can read
  * more about base64 encoding in [this] [base64] Wikipedia article.
  *
+ * Unlike the base64 functions of APR the functions in this module don't
+ * depend on NUL terminated strings so they're binary safe, and when the
+ * processor supports them (this is checked at run time) they use SSSE3 or
+ * AVX2 instructions to encode and decode 12 or 24 bytes at a time. The
+ * decoder ignores whitespace (e.g. the line breaks in e-mail attachments) and
+ * reports any other character that isn't part of the base64 alphabet as an
+ * error.
+ *
+ * Large amounts of data can be encoded or decoded incrementally using the
+ * objects returned by `apr.base64_encoder()` and `apr.base64_decoder()`,
+ * which accept input split at arbitrary boundaries and can read directly
+ * from files and sockets:
+ *
+ *     > decoder = apr.base64_decoder()
+ *     > output = assert(apr.file_open('attachment.bin', 'wb'))
+ *     > assert(output:write(assert(decoder:update_from(socket, content_length))))
+ *     > assert(output:write(assert(decoder:finish())))
+ *
  * [base64]: http://en.wikipedia.org/wiki/Base64
  * [data_uris]: http://en.wikipedia.org/wiki/Data_URI_scheme
  */
 
 #include "lua_apr.h"
-#include <apr_base64.h>
+#include <string.h>
+
+#if ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define BASE64_X86 1
+# include <immintrin.h>
+#else
+# define BASE64_X86 0
+#endif
+
+/* Largest inputs whose output fits in the buffer returned by luaL_prepbuffer(). */
+#define ENCODE_BLOCKSIZE (LUAL_BUFFERSIZE / 4 * 3)
+#define DECODE_BLOCKSIZE ((LUAL_BUFFERSIZE / 3 - 1) * 4)
+
+/* Entries in the decoding table that aren't base64 digits. */
+#define BASE64_SPACE 64
+#define BASE64_PAD 65
+
+/* Internal functions {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  int decode;
+  lua_apr_base64_state state;
+} lua_apr_base64_object;
+
+static const char base64_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Values of the base64 digits (anything above 63 isn't a digit). */
+static const unsigned char base64_values[256] = {
+  255, 255, 255, 255, 255, 255, 255, 255, 255,  64,  64,  64,  64,  64, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   64, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+   52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255,  65, 255, 255,
+  255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+   15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+  255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+   41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+/* encode_scalar() -- encode groups of three bytes using portable C {{{2 */
+
+static apr_size_t encode_scalar(char *out, const unsigned char *in, apr_size_t len)
+{
+  char *p = out;
+  apr_uint32_t v;
+
+  for (; len >= 3; in += 3, len -= 3, p += 4) {
+    v = ((apr_uint32_t)in[0] << 16) | ((apr_uint32_t)in[1] << 8) | in[2];
+    p[0] = base64_digits[v >> 18];
+    p[1] = base64_digits[(v >> 12) & 63];
+    p[2] = base64_digits[(v >> 6) & 63];
+    p[3] = base64_digits[v & 63];
+  }
+
+  return p - out;
+}
+
+/* decode_scalar() -- decode groups of four base64 digits using portable C {{{2
+ *
+ * Stops at the first group that contains anything other than base64 digits
+ * (whitespace, padding or invalid characters) and returns the number of
+ * characters that were decoded.
+ */
+
+static apr_size_t decode_scalar(unsigned char *out, const char *in, apr_size_t len)
+{
+  const unsigned char *s = (const unsigned char*)in;
+  apr_uint32_t a, b, c, d, v;
+  apr_size_t i;
+
+  for (i = 0; i + 4 <= len; i += 4, out += 3) {
+    a = base64_values[s[i]];
+    b = base64_values[s[i+1]];
+    c = base64_values[s[i+2]];
+    d = base64_values[s[i+3]];
+    if ((a | b | c | d) & 0xC0)
+      break;
+    v = (a << 18) | (b << 12) | (c << 6) | d;
+    out[0] = (unsigned char)(v >> 16);
+    out[1] = (unsigned char)(v >> 8);
+    out[2] = (unsigned char)v;
+  }
+
+  return i;
+}
+
+#if BASE64_X86
+
+/* The vectorized encoder and decoder are based on the algorithms described
+ * by Wojciech Muła and Daniel Lemire in "Faster Base64 Encoding and Decoding
+ * Using AVX2 Instructions" (ACM Transactions on the Web, 2018). */
+
+/* encode_ssse3() -- encode 12 bytes at a time using SSSE3 {{{2 */
+
+__attribute__((target("ssse3")))
+static __m128i encode_translate_ssse3(__m128i in)
+{
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i indices, result, less;
+
+  /* Split three bytes into four groups of six bits, one per byte. */
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  indices = _mm_or_si128(
+      _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+      _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
+
+  /* Map the values 0..63 to the offsets of their ranges in the alphabet. */
+  result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(offsets, result), indices);
+}
+
+__attribute__((target("ssse3")))
+static apr_size_t encode_ssse3(char *out, const unsigned char *in, apr_size_t len)
+{
+  apr_size_t done = 0;
+
+  /* Each iteration reads 16 bytes but consumes only 12 of them. */
+  while (len - done >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + done));
+    _mm_storeu_si128((__m128i*)out, encode_translate_ssse3(v));
+    out += 16, done += 12;
+  }
+
+  return done;
+}
+
+/* encode_avx2() -- encode 24 bytes at a time using AVX2 {{{2 */
+
+__attribute__((target("avx2")))
+static apr_size_t encode_avx2(char *out, const unsigned char *in, apr_size_t len)
+{
+  const __m256i shuffle = _mm256_set_epi8(
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i offsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  apr_size_t done = 0;
+  __m256i v, indices, result, less;
+
+  /* Each iteration reads 28 bytes but consumes only 24 of them. */
+  while (len - done >= 28) {
+    v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + done))),
+        _mm_loadu_si128((const __m128i*)(in + done + 12)), 1);
+    v = _mm256_shuffle_epi8(v, shuffle);
+    indices = _mm256_or_si256(
+        _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040)),
+        _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010)));
+    result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, result), indices);
+    _mm256_storeu_si256((__m256i*)out, result);
+    out += 32, done += 24;
+  }
+
+  return done;
+}
+
+/* decode_ssse3() -- decode 16 base64 digits at a time using SSSE3 {{{2
+ *
+ * Every iteration stores 16 bytes of which only 12 are valid. The caller
+ * provides room for the output of @len characters, so as long as at least 24
+ * characters are left the extra bytes are overwritten by later output.
+ */
+
+__attribute__((target("ssse3")))
+static apr_size_t decode_ssse3(unsigned char *out, const char *in, apr_size_t len)
+{
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04,
+      0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0,
+      0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2F);
+  apr_size_t done = 0;
+  __m128i v, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+  while (len - done >= 24) {
+    v = _mm_loadu_si128((const __m128i*)(in + done));
+    hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    lo_nibbles = _mm_and_si128(v, mask_2f);
+    hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    /* Leave anything that isn't a base64 digit to the scalar code. */
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+      break;
+    roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    v = _mm_add_epi8(v, roll);
+    /* Pack four groups of six bits into three bytes. */
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i*)out, v);
+    out += 12, done += 16;
+  }
+
+  return done;
+}
+
+/* decode_avx2() -- decode 32 base64 digits at a time using AVX2 {{{2
+ *
+ * Every iteration stores 32 bytes of which only 24 are valid, which is safe
+ * as long as at least 44 characters are left (see decode_ssse3()).
+ */
+
+__attribute__((target("avx2")))
+static apr_size_t decode_avx2(unsigned char *out, const char *in, apr_size_t len)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+  apr_size_t done = 0;
+  __m256i v, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+  while (len - done >= 44) {
+    v = _mm256_loadu_si256((const __m256i*)(in + done));
+    hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+    lo_nibbles = _mm256_and_si256(v, mask_2f);
+    hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+      break;
+    roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    v = _mm256_add_epi8(v, roll);
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, pack);
+    /* Move the 12 valid bytes of both halves next to each other. */
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i*)out, v);
+    out += 24, done += 32;
+  }
+
+  return done;
+}
+
+#endif
+
+/* encode_blocks() -- encode a multiple of three bytes {{{2 */
+
+static apr_size_t encode_blocks(char *out, const unsigned char *in, apr_size_t len)
+{
+  apr_size_t done = 0;
+
+# if BASE64_X86
+  if (lua_apr_cpu_features & LUA_APR_CPU_AVX2)
+    done = encode_avx2(out, in, len);
+  else if (lua_apr_cpu_features & LUA_APR_CPU_SSSE3)
+    done = encode_ssse3(out, in, len);
+# endif
+
+  return done / 3 * 4 + encode_scalar(out + done / 3 * 4, in + done, len - done);
+}
+
+/* decode_blocks() -- decode groups of four base64 digits {{{2
+ *
+ * Returns the number of characters decoded (see decode_scalar()). The output
+ * buffer must have room for the output of @len characters.
+ */
+
+static apr_size_t decode_blocks(unsigned char *out, const char *in, apr_size_t len)
+{
+  apr_size_t done = 0;
+
+# if BASE64_X86
+  if (lua_apr_cpu_features & LUA_APR_CPU_AVX2)
+    done = decode_avx2(out, in, len);
+  else if (lua_apr_cpu_features & LUA_APR_CPU_SSSE3)
+    done = decode_ssse3(out, in, len);
+# endif
+
+  return done + decode_scalar(out + done / 4 * 3, in + done, len - done);
+}
+
+/* base64_encode_update() -- incrementally encode data in base64 {{{2
+ *
+ * Encode @len bytes of @in, keeping up to two bytes in @state until the next
+ * call. Writes at most BASE64_ENCODED_MAX(len) characters to @out and returns
+ * the number of characters written.
+ */
+
+apr_size_t base64_encode_update(lua_apr_base64_state *state, char *out, const unsigned char *in, apr_size_t len)
+{
+  char *p = out;
+  apr_size_t n;
+
+  /* Complete a group of three bytes split between calls. */
+  if (state->count > 0) {
+    for (; state->count < 3 && len > 0; state->count++, len--)
+      state->bits = (state->bits << 8) | *in++;
+    if (state->count < 3)
+      return 0;
+    p[0] = base64_digits[state->bits >> 18];
+    p[1] = base64_digits[(state->bits >> 12) & 63];
+    p[2] = base64_digits[(state->bits >> 6) & 63];
+    p[3] = base64_digits[state->bits & 63];
+    p += 4;
+    state->bits = state->count = 0;
+  }
+
+  n = len - len % 3;
+  p += encode_blocks(p, in, n);
+  for (in += n, len -= n; len > 0; len--, state->count++)
+    state->bits = (state->bits << 8) | *in++;
+
+  return p - out;
+}
+
+/* base64_encode_final() -- finish incremental encoding {{{2
+ *
+ * Writes the remaining (padded) output to @out (at most four characters),
+ * resets @state and returns the number of characters written.
+ */
+
+apr_size_t base64_encode_final(lua_apr_base64_state *state, char *out)
+{
+  apr_uint32_t bits = state->bits << (state->count == 1 ? 16 : 8);
+  apr_size_t n = 0;
+
+  if (state->count > 0) {
+    out[0] = base64_digits[bits >> 18];
+    out[1] = base64_digits[(bits >> 12) & 63];
+    out[2] = state->count == 2 ? base64_digits[(bits >> 6) & 63] : '=';
+    out[3] = '=';
+    n = 4;
+  }
+  memset(state, 0, sizeof *state);
+
+  return n;
+}
+
+/* flush_bits() -- decode the digits of an incomplete group {{{2 */
+
+static unsigned char *flush_bits(lua_apr_base64_state *state, unsigned char *p)
+{
+  if (state->count == 2) {
+    *p++ = (unsigned char)(state->bits >> 4);
+  } else if (state->count == 3) {
+    *p++ = (unsigned char)(state->bits >> 10);
+    *p++ = (unsigned char)(state->bits >> 2);
+  }
+  state->bits = state->count = 0;
+  return p;
+}
+
+/* base64_decode_update() -- incrementally decode base64 data {{{2
+ *
+ * Decode @len characters of @in, keeping up to three base64 digits in @state
+ * until the next call. Whitespace is ignored. Writes at most
+ * BASE64_DECODED_MAX(len) bytes to @out and sets @outlen to the number of
+ * bytes written. Returns APR_EINVAL when the input contains characters that
+ * aren't part of the base64 alphabet or when there's data after the padding.
+ */
+
+apr_status_t base64_decode_update(lua_apr_base64_state *state, unsigned char *out,
+    apr_size_t *outlen, const char *in, apr_size_t len)
+{
+  const unsigned char *s = (const unsigned char*)in, *end = s + len;
+  unsigned char *p = out;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n;
+  int value;
+
+  while (s < end) {
+    if (state->count == 0 && !state->end) {
+      n = decode_blocks(p, (const char*)s, (apr_size_t)(end - s) & ~(apr_size_t)3);
+      p += n / 4 * 3, s += n;
+      if (s == end)
+        break;
+    }
+    value = base64_values[*s++];
+    if (value < 64 && !state->end) {
+      state->bits = (state->bits << 6) | value;
+      if (++state->count == 4) {
+        p[0] = (unsigned char)(state->bits >> 16);
+        p[1] = (unsigned char)(state->bits >> 8);
+        p[2] = (unsigned char)state->bits;
+        p += 3;
+        state->bits = state->count = 0;
+      }
+    } else if (value == BASE64_PAD && !state->end && state->count >= 2) {
+      /* The first padding character ends the data. */
+      state->padding = 3 - state->count;
+      state->end = 1;
+      p = flush_bits(state, p);
+    } else if (value == BASE64_PAD && state->end && state->padding > 0) {
+      state->padding--;
+    } else if (value != BASE64_SPACE) {
+      status = APR_EINVAL;
+      memset(state, 0, sizeof *state);
+      break;
+    }
+  }
+  *outlen = p - out;
+
+  return status;
+}
+
+/* base64_decode_final() -- finish incremental decoding {{{2
+ *
+ * Writes the bytes encoded by a final group without padding to @out (at most
+ * two bytes), sets @outlen to the number of bytes written and resets @state.
+ * Returns APR_EINVAL when the input was truncated.
+ */
+
+apr_status_t base64_decode_final(lua_apr_base64_state *state, unsigned char *out, apr_size_t *outlen)
+{
+  apr_status_t status = state->count == 1 ? APR_EINVAL : APR_SUCCESS;
+
+  *outlen = status == APR_SUCCESS ? flush_bits(state, out) - out : 0;
+  memset(state, 0, sizeof *state);
+
+  return status;
+}
+
+/* codec_update() -- add the output of an encoder or decoder to a buffer {{{2 */
+
+static apr_status_t codec_update(luaL_Buffer *buffer, lua_apr_base64_state *state,
+    int decode, const char *input, size_t length)
+{
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n, size;
+  char *output;
+
+  while (length > 0 && status == APR_SUCCESS) {
+#   if LUA_VERSION_NUM >= 502
+    /* Reserve room for all of the output at once. */
+    n = length;
+    output = luaL_prepbuffsize(buffer, decode ? BASE64_DECODED_MAX(n) : BASE64_ENCODED_MAX(n));
+#   else
+    n = decode ? DECODE_BLOCKSIZE : ENCODE_BLOCKSIZE;
+    if (n > length)
+      n = length;
+    output = luaL_prepbuffer(buffer);
+#   endif
+    if (decode)
+      status = base64_decode_update(state, (unsigned char*)output, &size, input, n);
+    else
+      size = base64_encode_update(state, output, (const unsigned char*)input, n);
+    luaL_addsize(buffer, size);
+    input += n, length -= n;
+  }
+
+  return status;
+}
+
+/* codec_final() {{{2 */
+
+static apr_status_t codec_final(luaL_Buffer *buffer, lua_apr_base64_state *state, int decode)
+{
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t size;
+  char *output;
+
+  output = luaL_prepbuffer(buffer);
+  if (decode)
+    status = base64_decode_final(state, (unsigned char*)output, &size);
+  else
+    size = base64_encode_final(state, output);
+  luaL_addsize(buffer, size);
+
+  return status;
+}
+
+/* codec_update_from() -- feed data read from a stream to a codec {{{2 */
+
+typedef struct {
+  luaL_Buffer buffer;
+  lua_apr_base64_object *object;
+  apr_status_t status;
+} codec_stream;
+
+static void codec_update_from(void *context, const void *data, apr_size_t length)
+{
+  codec_stream *stream = context;
+
+  /* Ignore the rest of the stream after an error. */
+  if (stream->status == APR_SUCCESS)
+    stream->status = codec_update(&stream->buffer, &stream->object->state,
+                                  stream->object->decode, data, length);
+}
+
+/* check_codec() {{{2 */
+
+static lua_apr_base64_object *check_codec(lua_State *L, int idx)
+{
+  return check_object(L, idx, &lua_apr_base64_type);
+}
+
+/* new_codec() {{{2 */
+
+static int new_codec(lua_State *L, int decode)
+{
+  lua_apr_base64_object *object;
+
+  object = new_object(L, &lua_apr_base64_type);
+  if (object == NULL)
+    return push_error_memory(L);
+  object->decode = decode;
+  memset(&object->state, 0, sizeof object->state);
+
+  return 1;
+}
 
 /* apr.base64_encode(plain) -> coded {{{1
  *
@@ -38,48 +587,190 @@
 
 int lua_apr_base64_encode(lua_State *L)
 {
-  size_t plain_len, coded_len;
-  apr_pool_t *memory_pool;
+  lua_apr_base64_state state;
+  luaL_Buffer buffer;
   const char *plain;
-  char *coded;
+  size_t length;
+
+  plain = luaL_checklstring(L, 1, &length);
+  memset(&state, 0, sizeof state);
+  luaL_buffinit(L, &buffer);
+  codec_update(&buffer, &state, 0, plain, length);
+  codec_final(&buffer, &state, 0);
+  luaL_pushresult(&buffer);
 
-  memory_pool = to_pool(L);
-  plain = luaL_checklstring(L, 1, &plain_len);
-  coded_len = apr_base64_encode_len(plain_len);
-  coded = apr_palloc(memory_pool, coded_len);
-  if (coded == NULL)
-    return push_error_memory(L);
-  coded_len = apr_base64_encode(coded, plain, plain_len);
-  if (coded_len > 0 && coded[coded_len - 1] == '\0')
-    coded_len--;
-  lua_pushlstring(L, coded, coded_len);
   return 1;
 }
 
 /* apr.base64_decode(coded) -> plain {{{1
  *
- * Decode the base64 encoded string @coded. On success the decoded string is
+ * Decode the base64 encoded string @coded. Whitespace in @coded is ignored
+ * and the padding at the end is optional. On success the decoded string is
  * returned, otherwise a nil followed by an error message is returned.
  */
 
 int lua_apr_base64_decode(lua_State *L)
 {
-  size_t plain_len, coded_len;
-  apr_pool_t *memory_pool;
+  lua_apr_base64_state state;
+  luaL_Buffer buffer;
   const char *coded;
-  char *plain;
+  size_t length;
+  apr_status_t status;
+
+  coded = luaL_checklstring(L, 1, &length);
+  memset(&state, 0, sizeof state);
+  luaL_buffinit(L, &buffer);
+  status = codec_update(&buffer, &state, 1, coded, length);
+  if (status == APR_SUCCESS)
+    status = codec_final(&buffer, &state, 1);
+  if (status != APR_SUCCESS)
+    return push_error_message(L, "invalid base64 data");
+  luaL_pushresult(&buffer);
+
+  return 1;
+}
+
+/* apr.base64_encoder() -> encoder {{{1
+ *
+ * Create an object that encodes data in base64 incrementally. The data can be
+ * split at arbitrary boundaries. Encoders support the methods
+ * `encoder:update()`, `encoder:update_from()` and `encoder:finish()` which
+ * are documented under the decoder object returned by `apr.base64_decoder()`.
+ * The coded output of an encoder is the same as that of `apr.base64_encode()`
+ * for the concatenation of its input.
+ */
+
+int lua_apr_base64_encoder(lua_State *L)
+{
+  return new_codec(L, 0);
+}
+
+/* apr.base64_decoder() -> decoder {{{1
+ *
+ * Create an object that decodes base64 data incrementally. The data can be
+ * split at arbitrary boundaries.
+ */
+
+int lua_apr_base64_decoder(lua_State *L)
+{
+  return new_codec(L, 1);
+}
+
+/* decoder:update(input) -> output {{{1
+ *
+ * Add the string @input to the encoder or decoder. Returns the output that's
+ * available so far, which may be an empty string (encoders keep up to two
+ * bytes and decoders up to three characters until more input is available).
+ * When a decoder finds invalid base64 data it returns a nil followed by an
+ * error message and resets itself.
+ */
+
+static int codec_update_method(lua_State *L)
+{
+  lua_apr_base64_object *object;
+  luaL_Buffer buffer;
+  const char *input;
+  size_t length;
+
+  object = check_codec(L, 1);
+  input = luaL_checklstring(L, 2, &length);
+  luaL_buffinit(L, &buffer);
+  if (codec_update(&buffer, &object->state, object->decode, input, length) != APR_SUCCESS)
+    return push_error_message(L, "invalid base64 data");
+  luaL_pushresult(&buffer);
 
-  memory_pool = to_pool(L);
-  coded = luaL_checklstring(L, 1, &coded_len);
-  plain_len = apr_base64_decode_len(coded);
-  plain = apr_palloc(memory_pool, plain_len);
-  if (plain == NULL)
-    return push_error_memory(L);
-  plain_len = apr_base64_decode(plain, coded);
-  if (plain_len > 0 && plain[plain_len - 1] == '\0')
-    plain_len--;
-  lua_pushlstring(L, plain, plain_len);
   return 1;
 }
 
+/* decoder:update_from(stream [, limit]) -> output {{{1
+ *
+ * Read from the file, socket or shared memory segment @stream until the end
+ * of the stream or until @limit bytes have been read, and add the data to the
+ * encoder or decoder. Data that was already buffered by the stream is used
+ * first. Returns the output like `decoder:update()` does, otherwise a nil
+ * followed by an error message is returned.
+ */
+
+static int codec_update_from_method(lua_State *L)
+{
+  codec_stream stream;
+  int pushed;
+
+  stream.object = check_codec(L, 1);
+  stream.status = APR_SUCCESS;
+  luaL_buffinit(L, &stream.buffer);
+  /* hash_stream() pushes the number of bytes read or an error. */
+  pushed = hash_stream(L, codec_update_from, &stream);
+  if (pushed != 1)
+    return pushed;
+  lua_pop(L, 1);
+  if (stream.status != APR_SUCCESS)
+    return push_error_message(L, "invalid base64 data");
+  luaL_pushresult(&stream.buffer);
+
+  return 1;
+}
+
+/* decoder:finish() -> output {{{1
+ *
+ * Get the remaining output of the encoder or decoder and reset it so that it
+ * can be used again. For encoders this includes the padding. Decoders return
+ * a nil followed by an error message when the input was truncated.
+ */
+
+static int codec_finish_method(lua_State *L)
+{
+  lua_apr_base64_object *object;
+  luaL_Buffer buffer;
+
+  object = check_codec(L, 1);
+  luaL_buffinit(L, &buffer);
+  if (codec_final(&buffer, &object->state, object->decode) != APR_SUCCESS)
+    return push_error_message(L, "invalid base64 data");
+  luaL_pushresult(&buffer);
+
+  return 1;
+}
+
+/* decoder:__tostring() {{{1 */
+
+static int codec_tostring(lua_State *L)
+{
+  lua_apr_base64_object *object = check_codec(L, 1);
+  lua_pushfstring(L, "base64 %s (%p)", object->decode ? "decoder" : "encoder", object);
+  return 1;
+}
+
+/* decoder:__gc() {{{1 */
+
+static int codec_gc(lua_State *L)
+{
+  release_object((lua_apr_refobj*)check_codec(L, 1));
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_Reg codec_methods[] = {
+  { "update", codec_update_method },
+  { "update_from", codec_update_from_method },
+  { "finish", codec_finish_method },
+  { NULL, NULL }
+};
+
+static luaL_Reg codec_metamethods[] = {
+  { "__tostring", codec_tostring },
+  { "__eq", objects_equal },
+  { "__gc", codec_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_base64_type = {
+  "lua_apr_base64_object*",      /* metatable name in registry */
+  "base64 codec",                /* friendly object name */
+  sizeof(lua_apr_base64_object), /* structure size */
+  codec_methods,                 /* methods table */
+  codec_metamethods              /* metamethods table */
+};
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
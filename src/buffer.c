@@ -1,7 +1,7 @@
 /* Buffered I/O interface for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: November 6, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -14,6 +14,11 @@
  *  - read_buffer() was based on the following references:
  *     - http://www.lua.org/source/5.1/liolib.c.html#g_read
  *     - http://www.lua.org/manual/5.1/manual.html#pdf-file:read
+ *  - Buffers are released as soon as they've been drained (all buffered input
+ *    was consumed or all buffered output was written) so that idle objects
+ *    (think thousands of keep-alive connections) don't hold on to memory.
+ *    Released buffers of the default size are kept on a free list shared by
+ *    all threads so that busy objects don't call malloc() all the time.
  *
  * Status:
  * I don't like this code at all but it's a core part of the value in the
@@ -28,7 +33,13 @@
  */
 
 #include "lua_apr.h"
+#include <apr_atomic.h>
 #include <apr_lib.h>
+#include <apr_thread_mutex.h>
+
+/* Output buffered for a non-blocking stream that would block is limited to
+ * this size so that a slow peer can't make us use unbounded memory. */
+#define BUFFER_PENDING_MAX (1024 * 1024)
 
 /* Subtract a from b without producing negative values. */
 #define SAFE_SUB(a, b) ((a) <= (b) ? (b) - (a) : 0)
@@ -41,6 +52,7 @@
 #define SPACE(B) (B->unmanaged ? SAFE_SUB(B->index, B->size) : SAFE_SUB(B->limit, B->size))
 #define SUCCESS_OR_EOF(B, S) ((S) == APR_SUCCESS || CHECK_FOR_EOF(B, S))
 #define CHECK_FOR_EOF(B, S) (APR_STATUS_IS_EOF(S) || (B)->unmanaged)
+#define SUCCESS_OR_EAGAIN(S) ((S) == APR_SUCCESS || APR_STATUS_IS_EAGAIN(S))
 #define DEBUG_BUFFER(B) do { \
   LUA_APR_DBG("buffer.index = %i", (B)->index); \
   LUA_APR_DBG("buffer.limit = %i", (B)->limit); \
@@ -50,6 +62,31 @@
 #ifndef lua_str2number
 #define lua_str2number(s,p)	strtod((s), (p))
 #endif /* lua_str2number */
+
+/* The maximum number of released buffers kept on the free list. */
+#define BUFFER_CACHE_MAX 256
+
+/* Drained buffers that grew beyond this size are released so that a single
+ * large read or write doesn't pin the memory. Smaller buffers are kept by
+ * their object until it's closed, so repeated reads don't reallocate. */
+#define BUFFER_RELEASE_MIN (256 * 1024)
+
+/* The free list is only used when objects get their first buffer and when
+ * they're closed, so the lock below is never taken on the hot path. */
+static char *buffer_cache = NULL;   /* free list linked through the buffers */
+static size_t buffer_cache_count = 0; /* number of buffers on the free list */
+static volatile apr_uint32_t buffer_bytes_used = 0; /* bytes in buffers owned by objects */
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *buffer_mutex = NULL;
+# define buffer_lock() do { \
+  if (buffer_mutex != NULL) apr_thread_mutex_lock(buffer_mutex); } while (0)
+# define buffer_unlock() do { \
+  if (buffer_mutex != NULL) apr_thread_mutex_unlock(buffer_mutex); } while (0)
+#else
+# define buffer_lock() ((void)0)
+# define buffer_unlock() ((void)0)
+#endif
 /* Internal functions. {{{1 */
 
 /* find_win32_eol() {{{2 */
@@ -86,6 +123,81 @@ static void binary_to_text(lua_apr_buffer *B)
   }
 }
 
+/* resize_buffer() {{{2
+ *
+ * Change the size of a managed buffer, taking buffers of the default size
+ * from the free list when possible.
+ */
+
+static apr_status_t resize_buffer(lua_apr_buffer *B, size_t newsize)
+{
+  char *newdata = NULL;
+
+  if (B->data == NULL && newsize == LUA_APR_BUFSIZE) {
+    buffer_lock();
+    if (buffer_cache != NULL) {
+      newdata = buffer_cache;
+      buffer_cache = *(char**)newdata;
+      buffer_cache_count--;
+    }
+    buffer_unlock();
+  }
+
+  if (newdata == NULL) {
+    newdata = realloc(B->data, newsize);
+    if (newdata == NULL)
+      return APR_ENOMEM;
+  }
+
+  /* Unsigned arithmetic wraps, so this also works for buffers that shrink. */
+  apr_atomic_add32(&buffer_bytes_used, (apr_uint32_t) (newsize - B->size));
+  B->data = newdata;
+  B->size = newsize;
+
+  return APR_SUCCESS;
+}
+
+/* release_buffer() {{{2
+ *
+ * Release the memory of a managed buffer, putting buffers of the default size
+ * on the free list.
+ */
+
+static void release_buffer(lua_apr_buffer *B)
+{
+  char *data = B->data;
+
+  apr_atomic_sub32(&buffer_bytes_used, (apr_uint32_t) B->size);
+  if (B->size == LUA_APR_BUFSIZE) {
+    buffer_lock();
+    if (buffer_cache_count < BUFFER_CACHE_MAX) {
+      *(char**)data = buffer_cache;
+      buffer_cache = data;
+      buffer_cache_count++;
+      data = NULL;
+    }
+    buffer_unlock();
+  }
+
+  free(data);
+  B->data = NULL;
+  B->index = 0;
+  B->limit = 0;
+  B->size = 0;
+}
+
+/* release_drained_buffer() {{{2 */
+
+static void release_drained_buffer(lua_apr_buffer *B)
+{
+  if (!B->unmanaged && B->data != NULL && AVAIL(B) == 0) {
+    if (B->size > BUFFER_RELEASE_MIN)
+      release_buffer(B);
+    else
+      B->index = B->limit = 0;
+  }
+}
+
 /* shift_buffer() {{{2 */
 
 static void shift_buffer(lua_apr_buffer *B)
@@ -106,7 +218,6 @@ static apr_status_t grow_buffer(lua_apr_buffer *B)
 {
   apr_status_t status = APR_SUCCESS;
   size_t newsize = LUA_APR_BUFSIZE;
-  char *newdata;
 
   /* Don't do anything for unmanaged buffers. */
   if (B->unmanaged)
@@ -114,15 +225,9 @@ static apr_status_t grow_buffer(lua_apr_buffer *B)
 
   if (B->size >= newsize)
     newsize = B->size / 2 * 3;
-  newdata = realloc(B->data, newsize);
-  if (newdata != NULL) {
-    B->data = newdata;
-    B->size = newsize;
-    /* TODO Initialize new space to all zero bytes to make Valgrind happy?
-    memset(&B->data[B->limit + 1], 0, B->size - B->limit - 1); */
-  } else {
-    status = APR_ENOMEM;
-  }
+  status = resize_buffer(B, newsize);
+  /* TODO Initialize new space to all zero bytes to make Valgrind happy?
+  memset(&B->data[B->limit + 1], 0, B->size - B->limit - 1); */
 
   return status;
 }
@@ -142,8 +247,11 @@ static apr_status_t fill_buffer(lua_apr_readbuf *input, apr_size_t len)
   shift_buffer(B);
 
   /* Try to grow the buffer? */
-  if (!(B->limit < B->size))
+  if (!(B->limit < B->size)) {
     status = grow_buffer(B);
+    if (status != APR_SUCCESS)
+      return status;
+  }
 
   /* Add more data to buffer. */
   len -= AVAIL(B);
@@ -156,6 +264,103 @@ static apr_status_t fill_buffer(lua_apr_readbuf *input, apr_size_t len)
   return status;
 }
 
+/* flush_output() {{{2
+ *
+ * Flush the write buffer of a stream (also used from C code that doesn't run
+ * on a Lua stack, see pipeline.c).
+ */
+
+apr_status_t flush_output(lua_apr_writebuf *output, int soft)
+{
+  lua_apr_buffer *B = &output->buffer;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t len;
+
+  /* Don't do anything for unmanaged buffers. */
+  if (output->buffer.unmanaged)
+    return status;
+
+  /* Flush the internal write buffer. */
+  while ((len = AVAIL(B)) > 0 && status == APR_SUCCESS) {
+    status = output->write(output->object, CURSOR(B), &len);
+    B->index += len;
+  }
+
+  /* Shift any remaining data down, or reset (and maybe release) a drained buffer. */
+  if (AVAIL(B) == 0)
+    release_drained_buffer(B);
+  else
+    shift_buffer(B);
+
+  /* Not sure whether deeper layers perform buffering of their own?! */
+  if (status == APR_SUCCESS && !soft)
+    status = output->flush(output->object);
+
+  return status;
+}
+
+/* write_data() {{{2
+ *
+ * Copy a string to the write buffer of a stream, flushing the buffer when it
+ * fills up. The @status argument makes it possible to keep buffering input
+ * without flushing after a non-blocking write would have blocked.
+ */
+
+static apr_status_t write_data(lua_apr_writebuf *output, const char *data, size_t length, apr_status_t status)
+{
+  lua_apr_buffer *B = &output->buffer;
+  apr_status_t error;
+  size_t size;
+  char *match;
+  int add_eol;
+
+  while (length > 0 && SUCCESS_OR_EAGAIN(status)) {
+    /* Allocate write buffer on first use (or after it was drained). */
+    if (B->data == NULL && !B->unmanaged) {
+      error = resize_buffer(B, LUA_APR_BUFSIZE);
+      if (error != APR_SUCCESS)
+        return error;
+    }
+    if (SPACE(B) > 0) { /* copy range of bytes to buffer? */
+      size = length;
+      add_eol = 0;
+      if (size > SPACE(B)) { /* never write past end of buffer */
+        size = SPACE(B);
+      }
+      if (output->text_mode) { /* copy no more than one line in text mode */
+        match = memchr(data, '\n', size);
+        if (match != NULL) {
+          size = match - data; /* don't copy EOL directly */
+          if (size + 2 <= SPACE(B))
+            add_eol = 1; /* append EOL after copying line? */
+        }
+      }
+      if (size > 0) { /* copy range of bytes to buffer! */
+        memcpy(&B->data[B->limit], data, size);
+        B->limit += size;
+        data += size;
+        length -= size;
+      }
+      if (add_eol) { /* add end of line sequence to buffer? */
+        memcpy(&B->data[B->limit], "\r\n", 2);
+        B->limit += 2;
+        data += 1;
+        length -= 1;
+      }
+    }
+    if (AVAIL(B) > 0 && SPACE(B) <= 1) { /* flush buffer contents? */
+      if (!APR_STATUS_IS_EAGAIN(status))
+        status = flush_output(output, 1);
+      /* When a non-blocking write would block the remaining input is
+       * buffered so that the caller only has to retry the flush. */
+      if (APR_STATUS_IS_EAGAIN(status) && (error = grow_buffer(B)) != APR_SUCCESS)
+        status = error;
+    }
+  }
+
+  return status;
+}
+
 /* read_line() {{{2 */
 
 static apr_status_t read_line(lua_State *L, lua_apr_readbuf *input)
@@ -254,7 +459,7 @@ static apr_status_t read_chars(lua_State *L, lua_apr_readbuf *input, apr_size_t
       break;
     }
     /* Check if we have enough input or reached EOF with buffered input. */
-    cornercase = input->text_mode && B->data[SAFE_SUB(1, AVAIL(B))] == '\r';
+    cornercase = input->text_mode && AVAIL(B) > 0 && B->data[SAFE_SUB(1, AVAIL(B))] == '\r';
     if ((n <= AVAIL(B) && !cornercase) || CHECK_FOR_EOF(B, status)) {
       if (n > AVAIL(B))
         n = AVAIL(B);
@@ -286,6 +491,9 @@ static apr_status_t read_all(lua_State *L, lua_apr_readbuf *input)
     do {
       status = fill_buffer(input, APR_SIZE_MAX);
     } while (status == APR_SUCCESS);
+    /* Keep the buffered input when a non-blocking read would block. */
+    if (!SUCCESS_OR_EOF(B, status))
+      return status;
     if (input->text_mode)
       binary_to_text(B);
   }
@@ -304,6 +512,7 @@ static int read_lines_cb(lua_State *L)
 
   B = lua_touserdata(L, lua_upvalueindex(1));
   status = read_line(L, B);
+  release_drained_buffer(&B->buffer);
   if (status == APR_SUCCESS)
     return 1;
   else if (CHECK_FOR_EOF(&B->buffer, status))
@@ -373,17 +582,40 @@ void init_unmanaged_buffers(lua_State *L,
   output->buffer.size = size;
 }
 
+/* buffer_cache_init() {{{1
+ *
+ * Initialize the free list of buffers (only once per process).
+ */
+
+apr_status_t buffer_cache_init(apr_pool_t *pool)
+{
+# if APR_HAS_THREADS
+  return apr_thread_mutex_create(&buffer_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+# else
+  return APR_SUCCESS;
+# endif
+}
+
+/* buffer_stats() {{{1
+ *
+ * Get the number of bytes held by the buffers of objects and the number of
+ * bytes held by the free list.
+ */
+
+void buffer_stats(size_t *used, size_t *cached)
+{
+  *used = apr_atomic_read32(&buffer_bytes_used);
+  buffer_lock();
+  *cached = buffer_cache_count * LUA_APR_BUFSIZE;
+  buffer_unlock();
+}
+
 /* free_buffer() {{{1 */
 
 void free_buffer(lua_State *L, lua_apr_buffer *B)
 {
-  if (!B->unmanaged && B->data != NULL) {
-    free(B->data);
-    B->data = NULL;
-    B->index = 0;
-    B->limit = 0;
-    B->size = 0;
-  }
+  if (!B->unmanaged && B->data != NULL)
+    release_buffer(B);
 }
 
 /* read_lines() {{{1 */
@@ -442,89 +674,147 @@ int read_buffer(lua_State *L, lua_apr_readbuf *B)
     nresults = push_error_status(L, status);
   }
 
+  release_drained_buffer(&B->buffer);
+
   return nresults;
 }
 
-/* write_buffer() {{{1 */
+/* queue_values() {{{2
+ *
+ * Write the values from stack index 2 onwards to a stream, optionally followed
+ * by a soft flush. Returns APR_INCOMPLETE when a non-blocking write would have
+ * blocked and (part of) the values remain buffered, or an EAGAIN status when
+ * nothing was written because too much output is already pending.
+ */
 
-int write_buffer(lua_State *L, lua_apr_writebuf *output)
+static apr_status_t queue_values(lua_State *L, lua_apr_writebuf *output, int flush)
 {
   lua_apr_buffer *B = &output->buffer;
   apr_status_t status = APR_SUCCESS;
-  int i, add_eol, n = lua_gettop(L);
-  size_t length, size;
+  int i, n = lua_gettop(L);
+  size_t length, total = 0;
   const char *data;
-  char *match;
 
-  if (B->data == NULL) { /* allocate write buffer on first use */
-    B->data = malloc(LUA_APR_BUFSIZE);
-    if (B->data == NULL)
-      return APR_ENOMEM;
-    B->size = LUA_APR_BUFSIZE;
+  for (i = 2; i <= n; i++) {
+    luaL_checklstring(L, i, &length);
+    total += length;
   }
 
-  for (i = 2; i <= n && status == APR_SUCCESS; i++) {
-    data = luaL_checklstring(L, i, &length);
-    while (length > 0 && status == APR_SUCCESS) {
-      if (SPACE(B) > 0) { /* copy range of bytes to buffer? */
-        size = length;
-        add_eol = 0;
-        if (size > SPACE(B)) { /* never write past end of buffer */
-          size = SPACE(B);
-        }
-        if (output->text_mode) { /* copy no more than one line in text mode */
-          match = memchr(data, '\n', size);
-          if (match != NULL) {
-            size = match - data; /* don't copy EOL directly */
-            if (size + 2 <= SPACE(B))
-              add_eol = 1; /* append EOL after copying line? */
-          }
-        }
-        if (size > 0) { /* copy range of bytes to buffer! */
-          memcpy(&B->data[B->limit], data, size);
-          B->limit += size;
-          data += size;
-          length -= size;
-        }
-        if (add_eol) { /* add end of line sequence to buffer? */
-          memcpy(&B->data[B->limit], "\r\n", 2);
-          B->limit += 2;
-          data += 1;
-          length -= 1;
-        }
-      }
-      if (AVAIL(B) > 0 && SPACE(B) <= 1) /* flush buffer contents? */
-        status = flush_buffer(L, output, 1);
-    }
+  /* Only accept more data when the peer is consuming the backlog. */
+  if (!B->unmanaged && total > 0 && AVAIL(B) > 0 && AVAIL(B) + total > BUFFER_PENDING_MAX) {
+    status = flush_output(output, 1);
+    if (status != APR_SUCCESS)
+      return status;
+  }
+
+  for (i = 2; i <= n && SUCCESS_OR_EAGAIN(status); i++) {
+    data = lua_tolstring(L, i, &length);
+    status = write_data(output, data, length, status);
+  }
+  if (flush && status == APR_SUCCESS)
+    status = flush_output(output, 1);
+
+  /* All values were accepted but not everything could be written yet. */
+  return APR_STATUS_IS_EAGAIN(status) ? APR_INCOMPLETE : status;
+}
+
+/* push_write_status() {{{2 */
+
+static int push_write_status(lua_State *L, apr_status_t status)
+{
+  if (status == APR_INCOMPLETE) {
+    lua_pushboolean(L, 1);
+    lua_pushliteral(L, "buffered");
+    return 2;
   }
 
   return push_status(L, status);
 }
 
-/* flush_buffer() {{{1 */
+/* write_buffer() {{{1
+ *
+ * Write values to a stream. Pushes true on success, true followed by the
+ * string "buffered" when the stream is non-blocking and output is still
+ * pending, or nil followed by an error message and code. The error code
+ * "EAGAIN" means that nothing was written (try again later).
+ */
 
-apr_status_t flush_buffer(lua_State *L, lua_apr_writebuf *output, int soft)
+int write_buffer(lua_State *L, lua_apr_writebuf *output)
+{
+  return push_write_status(L, queue_values(L, output, 0));
+}
+
+/* write_flush() {{{1
+ *
+ * Like write_buffer() followed by a soft flush (used by sockets).
+ */
+
+int write_flush(lua_State *L, lua_apr_writebuf *output)
+{
+  return push_write_status(L, queue_values(L, output, 1));
+}
+
+/* write_output() {{{1
+ *
+ * Write a string to a stream from C code that doesn't run on a Lua stack (see
+ * pipeline.c). Large strings skip the write buffer of managed binary streams
+ * (the buffer is flushed first so that the order of the data is preserved).
+ */
+
+apr_status_t write_output(lua_apr_writebuf *output, const char *data, size_t length)
 {
   lua_apr_buffer *B = &output->buffer;
   apr_status_t status = APR_SUCCESS;
   apr_size_t len;
 
-  /* Don't do anything for unmanaged buffers. */
-  if (output->buffer.unmanaged)
-    return status;
+  /* Shared memory segments can't grow. */
+  if (B->unmanaged) {
+    if (length > SAFE_SUB(B->limit, B->size))
+      return APR_ENOSPC;
+    memcpy(&B->data[B->limit], data, length);
+    B->limit += length;
+    return APR_SUCCESS;
+  }
 
-  /* Flush the internal write buffer. */
-  while ((len = AVAIL(B)) > 0 && status == APR_SUCCESS) {
-    status = output->write(output->object, CURSOR(B), &len);
-    B->index += len;
+  if (!output->text_mode && length >= LUA_APR_BUFSIZE) {
+    status = flush_output(output, 1);
+    while (length > 0 && status == APR_SUCCESS) {
+      len = length;
+      status = output->write(output->object, data, &len);
+      data += len;
+      length -= len;
+    }
   }
 
-  /* Shift any remaining data down. */
-  shift_buffer(B);
+  return write_data(output, data, length, status);
+}
 
-  /* Not sure whether deeper layers perform buffering of their own?! */
-  if (status == APR_SUCCESS && !soft)
-    status = output->flush(output->object);
+/* fill_input() {{{1
+ *
+ * Read more input into the buffer of a stream. Used by C code that parses
+ * buffered input in place (see http_client.c) instead of through Lua strings.
+ */
 
-  return status;
+apr_status_t fill_input(lua_apr_readbuf *input)
+{
+  lua_apr_buffer *B = &input->buffer;
+  return fill_buffer(input, AVAIL(B) + LUA_APR_BUFSIZE);
+}
+
+/* drain_input() {{{1
+ *
+ * Mark @n bytes of buffered input as consumed.
+ */
+
+void drain_input(lua_apr_readbuf *input, size_t n)
+{
+  input->buffer.index += n;
+  release_drained_buffer(&input->buffer);
+}
+
+/* flush_buffer() {{{1 */
+
+apr_status_t flush_buffer(lua_State *L, lua_apr_writebuf *output, int soft)
+{
+  return flush_output(output, soft);
 }
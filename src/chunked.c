@@ -0,0 +1,474 @@
+/* Chunked transfer encoding module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * This module implements the [chunked transfer coding] [chunked] of HTTP/1.1
+ * as stream objects layered on top of socket objects. A chunked writer frames
+ * every call to `writer:write()` as a single chunk, writing the chunk header,
+ * the data and the trailing CRLF to the socket's write buffer in one go:
+ *
+ *     assert(client:write 'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n')
+ *     local writer = client:chunked_writer()
+ *     for line in io.lines 'server.log' do
+ *       assert(writer:write(line, '\n'))
+ *     end
+ *     assert(writer:close())
+ *
+ * A chunked reader decodes the framing while filling its input buffer, so
+ * `reader:read()` and `reader:lines()` see only the body of the message:
+ *
+ *     local reader = socket:chunked_reader()
+ *     for line in reader:lines() do print(line) end
+ *
+ * Neither object takes ownership of the socket: Closing a chunked writer
+ * writes the last chunk and closing a chunked reader skips the remaining
+ * chunks, after which the socket can be used for the next message.
+ *
+ * [chunked]: http://tools.ietf.org/html/rfc2616#section-3.6.1
+ */
+
+#include "lua_apr.h"
+#include <apr_lib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Maximum length of a chunk header or trailer line. */
+#define CHUNKED_MAX_LINE 8192
+
+/* Decoder states of chunked readers. */
+#define CHUNKED_SIZE     0 /* expecting a chunk header */
+#define CHUNKED_DATA     1 /* reading chunk data */
+#define CHUNKED_CRLF     2 /* expecting the CRLF after chunk data */
+#define CHUNKED_TRAILERS 3 /* skipping trailers after the last chunk */
+#define CHUNKED_DONE     4 /* end of the chunked body */
+#define CHUNKED_CLOSED   5 /* the stream was closed */
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_readbuf input; /* decoded data of readers */
+  lua_apr_socket *socket;
+  int state;
+  apr_off_t remaining;
+  const char *error;
+} lua_apr_chunked;
+
+static lua_apr_objtype lua_apr_chunked_reader_type;
+static lua_apr_objtype lua_apr_chunked_writer_type;
+
+/* new_chunked() -- create a stream on top of the socket at stack index 1 {{{2 */
+
+static lua_apr_chunked *new_chunked(lua_State *L, lua_apr_objtype *T)
+{
+  lua_apr_chunked *object;
+  lua_apr_socket *socket;
+
+  socket = check_object(L, 1, &lua_apr_socket_type);
+  if (socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  object = new_object(L, T);
+  object->socket = socket;
+  object->state = CHUNKED_SIZE;
+
+  /* Keep the socket alive for as long as the stream is reachable. */
+  object_env_private(L, -1);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "socket");
+  lua_pop(L, 1);
+
+  return object;
+}
+
+/* check_chunked() -- get an open stream from the Lua stack {{{2 */
+
+static lua_apr_chunked *check_chunked(lua_State *L, int idx, lua_apr_objtype *T)
+{
+  lua_apr_chunked *object = check_object(L, idx, T);
+  if (object->state == CHUNKED_CLOSED)
+    luaL_error(L, "attempt to use a closed %s", T->friendlyname);
+  if (object->socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  return object;
+}
+
+/* push_chunked_error() -- push error results for a reader {{{2 */
+
+static int push_chunked_error(lua_State *L, lua_apr_chunked *object, int nresults)
+{
+  if (object->error == NULL)
+    return nresults;
+  lua_settop(L, 1);
+  return push_error_message(L, object->error);
+}
+
+/* peek_line() -- get a complete line from the socket without consuming it {{{2 */
+
+static apr_status_t peek_line(lua_apr_chunked *object, const char **line, size_t *length)
+{
+  lua_apr_readbuf *input = &object->socket->input;
+  lua_apr_buffer *B = &input->buffer;
+  const char *cursor, *eol;
+  apr_status_t status;
+  size_t avail, scanned = 0;
+
+  for (;;) {
+    avail = B->limit - B->index;
+    if (avail > scanned) {
+      cursor = &B->data[B->index];
+      eol = memchr(cursor + scanned, '\n', avail - scanned);
+      if (eol != NULL) {
+        *line = cursor;
+        *length = eol - cursor + 1;
+        return APR_SUCCESS;
+      }
+      scanned = avail;
+    }
+    if (scanned > CHUNKED_MAX_LINE) {
+      object->error = "chunk header too long";
+      return APR_EGENERAL;
+    }
+    status = fill_input(input);
+    if (APR_STATUS_IS_EOF(status)) {
+      object->error = "chunked body ended prematurely";
+      return APR_EGENERAL;
+    } else if (status != APR_SUCCESS) {
+      return status;
+    }
+  }
+}
+
+/* parse_chunk_size() -- parse the hexadecimal size in a chunk header {{{2 */
+
+static int parse_chunk_size(const char *line, size_t length, apr_off_t *size)
+{
+  size_t i = 0;
+  apr_off_t value = 0;
+
+  while (i < length && apr_isxdigit(line[i])) {
+    int digit = apr_isdigit(line[i]) ? line[i] - '0' : (apr_tolower(line[i]) - 'a' + 10);
+    if (i >= sizeof(apr_off_t) * 2 - 1) /* don't overflow apr_off_t */
+      return 0;
+    value = (value << 4) | digit;
+    i++;
+  }
+  if (i == 0)
+    return 0;
+  /* Skip whitespace and chunk extensions, which aren't used by anyone. */
+  while (i < length && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+  if (i < length && line[i] != ';' && line[i] != '\r' && line[i] != '\n')
+    return 0;
+  *size = value;
+  return 1;
+}
+
+/* chunked_read() -- read decoded data (called by fill_buffer()) {{{2 */
+
+static apr_status_t lua_apr_cc chunked_read(void *data, char *buffer, apr_size_t *len)
+{
+  lua_apr_chunked *object = data;
+  lua_apr_readbuf *input = &object->socket->input;
+  lua_apr_buffer *B = &input->buffer;
+  apr_status_t status;
+  apr_size_t wanted = *len, avail;
+  const char *line;
+  size_t length;
+
+  *len = 0;
+  if (object->error != NULL)
+    return APR_EGENERAL;
+
+  /* Process framing until we're in the data of a chunk. Each line is only
+   * consumed once it has been received completely, so that non-blocking
+   * sockets can simply retry after EAGAIN. */
+  while (object->state != CHUNKED_DATA) {
+    if (object->state == CHUNKED_DONE || object->state == CHUNKED_CLOSED)
+      return APR_EOF;
+    status = peek_line(object, &line, &length);
+    if (status != APR_SUCCESS)
+      return status;
+    switch (object->state) {
+      case CHUNKED_SIZE:
+        if (!parse_chunk_size(line, length, &object->remaining)) {
+          object->error = "invalid chunk header";
+          return APR_EGENERAL;
+        }
+        object->state = object->remaining > 0 ? CHUNKED_DATA : CHUNKED_TRAILERS;
+        break;
+      case CHUNKED_CRLF:
+        if (!(length == 1 || (length == 2 && line[0] == '\r'))) {
+          object->error = "missing CRLF after chunk data";
+          return APR_EGENERAL;
+        }
+        object->state = CHUNKED_SIZE;
+        break;
+      case CHUNKED_TRAILERS:
+        /* Trailers are skipped up to the empty line that ends the body. */
+        if (length == 1 || (length == 2 && line[0] == '\r'))
+          object->state = CHUNKED_DONE;
+        break;
+    }
+    drain_input(input, length);
+  }
+
+  if ((apr_off_t) wanted > object->remaining)
+    wanted = (apr_size_t) object->remaining;
+
+  avail = B->limit - B->index;
+  if (avail > 0) {
+    /* Copy data that was already buffered by the socket. */
+    if (wanted > avail)
+      wanted = avail;
+    memcpy(buffer, &B->data[B->index], wanted);
+    drain_input(input, wanted);
+    status = APR_SUCCESS;
+  } else {
+    /* Receive data straight into the buffer of the reader. */
+    status = input->read(input->object, buffer, &wanted);
+    if (APR_STATUS_IS_EOF(status)) {
+      object->error = "chunked body ended prematurely";
+      return APR_EGENERAL;
+    } else if (status != APR_SUCCESS) {
+      return status;
+    }
+  }
+
+  object->remaining -= wanted;
+  if (object->remaining == 0)
+    object->state = CHUNKED_CRLF;
+  *len = wanted;
+
+  return status;
+}
+
+/* socket:chunked_writer() -> writer {{{1
+ *
+ * Create a stream that writes to @socket using the chunked transfer coding of
+ * HTTP/1.1. The writer supports the following methods:
+ *
+ *  - `writer:write(value [, ...])` concatenates the values into a single
+ *    chunk. The chunk header, data and trailing CRLF are formatted directly
+ *    in the write buffer of @socket and written with a single system call
+ *    when they fit. Writing empty strings doesn't write anything (an empty
+ *    chunk would end the body)
+ *  - `writer:close([trailers])` writes the last chunk followed by the header
+ *    fields in the optional table @trailers. The socket is not closed
+ *
+ * Both methods return true on success, otherwise they return a nil followed
+ * by an error message.
+ */
+
+int socket_chunked_writer(lua_State *L)
+{
+  new_chunked(L, &lua_apr_chunked_writer_type);
+  return 1;
+}
+
+/* socket:chunked_reader() -> reader {{{1
+ *
+ * Create a stream that reads a body in the chunked transfer coding of
+ * HTTP/1.1 from @socket. The reader implements `reader:read()` and
+ * `reader:lines()` just like file objects and reports the end of the body
+ * as the end of the stream. Only the data that belongs to the body is
+ * consumed from @socket. Trailers are skipped. `reader:close()` skips any
+ * remaining chunks so that the next message can be read from @socket.
+ *
+ * Invalid chunk headers and bodies that end prematurely are reported by
+ * returning a nil followed by an error message.
+ */
+
+int socket_chunked_reader(lua_State *L)
+{
+  lua_apr_chunked *object;
+
+  object = new_chunked(L, &lua_apr_chunked_reader_type);
+  object->input.object = object;
+  object->input.read = chunked_read;
+
+  return 1;
+}
+
+/* writer:write(value [, ...]) -> status {{{1 */
+
+static int chunked_writer_write(lua_State *L)
+{
+  lua_apr_chunked *object;
+  size_t total = 0, length;
+  char header[32];
+  int i, n;
+
+  object = check_chunked(L, 1, &lua_apr_chunked_writer_type);
+  n = lua_gettop(L);
+  for (i = 2; i <= n; i++) {
+    luaL_checklstring(L, i, &length);
+    total += length;
+  }
+  if (total == 0) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  /* Surround the values with the chunk header and trailing CRLF. */
+  sprintf(header, "%lx\r\n", (unsigned long) total);
+  lua_pushstring(L, header);
+  lua_insert(L, 2);
+  lua_pushliteral(L, "\r\n");
+
+  return write_flush(L, &object->socket->output);
+}
+
+/* writer:close([trailers]) -> status {{{1 */
+
+static int chunked_writer_close(lua_State *L)
+{
+  lua_apr_chunked *object;
+  int nresults;
+
+  object = check_chunked(L, 1, &lua_apr_chunked_writer_type);
+  lua_settop(L, 2);
+  lua_pushliteral(L, "0\r\n");
+  if (!lua_isnil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {
+      /* Leave each formatted trailer below the key. */
+      luaL_argcheck(L, lua_type(L, -2) == LUA_TSTRING, 2, "trailer names must be strings");
+      luaL_checkstack(L, 2, "too many trailers");
+      lua_pushfstring(L, "%s: %s\r\n", lua_tostring(L, -2), luaL_checkstring(L, -1));
+      lua_replace(L, -2);
+      lua_insert(L, -2);
+    }
+  }
+  lua_pushliteral(L, "\r\n");
+  lua_remove(L, 2);
+
+  /* On EAGAIN nothing was written and the call can be repeated. */
+  nresults = write_flush(L, &object->socket->output);
+  if (lua_toboolean(L, -nresults))
+    object->state = CHUNKED_CLOSED;
+
+  return nresults;
+}
+
+/* reader:read([format, ...]) -> mixed value {{{1 */
+
+static int chunked_reader_read(lua_State *L)
+{
+  lua_apr_chunked *object;
+
+  object = check_chunked(L, 1, &lua_apr_chunked_reader_type);
+  return push_chunked_error(L, object, read_buffer(L, &object->input));
+}
+
+/* reader:lines() -> iterator {{{1 */
+
+static int chunked_reader_lines(lua_State *L)
+{
+  lua_apr_chunked *object;
+
+  object = check_chunked(L, 1, &lua_apr_chunked_reader_type);
+  return read_lines(L, &object->input);
+}
+
+/* reader:close() -> status {{{1 */
+
+static int chunked_reader_close(lua_State *L)
+{
+  lua_apr_chunked *object;
+  apr_status_t status = APR_SUCCESS;
+  char scratch[LUA_APR_BUFSIZE];
+  apr_size_t len;
+
+  object = check_chunked(L, 1, &lua_apr_chunked_reader_type);
+  while (status == APR_SUCCESS) {
+    len = sizeof scratch;
+    status = chunked_read(object, scratch, &len);
+  }
+  if (!APR_STATUS_IS_EOF(status)) {
+    /* Keep the reader open so that EAGAIN can be retried. */
+    if (object->error != NULL)
+      return push_error_message(L, object->error);
+    return push_error_status(L, status);
+  }
+  free_buffer(L, &object->input.buffer);
+  object->state = CHUNKED_CLOSED;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* stream:__tostring() {{{1 */
+
+static int chunked_tostring(lua_State *L)
+{
+  lua_apr_objtype *T = &lua_apr_chunked_reader_type;
+  lua_apr_chunked *object;
+
+  if (!object_has_type(L, 1, T, 1))
+    T = &lua_apr_chunked_writer_type;
+  object = check_object(L, 1, T);
+  if (object->state != CHUNKED_CLOSED)
+    lua_pushfstring(L, "%s (%p)", T->friendlyname, object);
+  else
+    lua_pushfstring(L, "%s (closed)", T->friendlyname);
+
+  return 1;
+}
+
+/* stream:__gc() {{{1 */
+
+static int chunked_gc(lua_State *L)
+{
+  lua_apr_objtype *T = &lua_apr_chunked_reader_type;
+  lua_apr_chunked *object;
+
+  if (!object_has_type(L, 1, T, 1))
+    T = &lua_apr_chunked_writer_type;
+  object = check_object(L, 1, T);
+  free_buffer(L, &object->input.buffer);
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg chunked_reader_methods[] = {
+  { "read", chunked_reader_read },
+  { "lines", chunked_reader_lines },
+  { "close", chunked_reader_close },
+  { NULL, NULL }
+};
+
+static luaL_reg chunked_writer_methods[] = {
+  { "write", chunked_writer_write },
+  { "close", chunked_writer_close },
+  { NULL, NULL }
+};
+
+static luaL_reg chunked_metamethods[] = {
+  { "__tostring", chunked_tostring },
+  { "__gc", chunked_gc },
+  { NULL, NULL }
+};
+
+/* Chunked streams are left out of lua_apr_types[] because they refer to their
+ * socket through their environment in the Lua state that created them. */
+
+static lua_apr_objtype lua_apr_chunked_reader_type = {
+  "lua_apr_chunked_reader*",   /* metatable name in registry */
+  "chunked reader",            /* friendly object name */
+  sizeof(lua_apr_chunked),     /* structure size */
+  chunked_reader_methods,      /* methods table */
+  chunked_metamethods          /* metamethods table */
+};
+
+static lua_apr_objtype lua_apr_chunked_writer_type = {
+  "lua_apr_chunked_writer*",   /* metatable name in registry */
+  "chunked writer",            /* friendly object name */
+  sizeof(lua_apr_chunked),     /* structure size */
+  chunked_writer_methods,      /* methods table */
+  chunked_metamethods          /* metamethods table */
+};
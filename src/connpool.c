@@ -0,0 +1,531 @@
+/* Connection pool module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Clients that talk to the same servers over and over again spend a lot of
+ * time resolving host names, performing TCP handshakes and creating memory
+ * pools. A connection pool keeps connected sockets around after you're done
+ * with them so that the next request to the same host and port can reuse the
+ * connection:
+ *
+ *     local pool = assert(apr.connection_pool { max_per_host = 4 })
+ *     local socket = assert(pool:acquire('localhost', 8080))
+ *     assert(socket:write 'GET / HTTP/1.1\r\nHost: localhost\r\n\r\n')
+ *     -- ... read the complete response ...
+ *     assert(pool:release(socket))
+ *
+ * Connection pools are built on top of [APR resource lists] [reslist] and
+ * can be shared between threads using `apr.thread()`, `apr.ref()` or thread
+ * queues. Closing or garbage collecting an acquired socket discards the
+ * connection instead of returning it to the pool. Connections using TLS (see
+ * `socket:tls_wrap()`) keep their TLS session while they're in the pool, so
+ * the next user of the connection gets a socket with TLS already enabled.
+ *
+ * [reslist]: http://apr.apache.org/docs/apr/trunk/group___a_p_r___util___r_l.html
+ */
+
+#include "lua_apr.h"
+#if APR_HAS_THREADS
+#include <apr_reslist.h>
+#include <apr_hash.h>
+#include <apr_poll.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#define check_connpool(L, idx) \
+  ((lua_apr_connpool*)check_object((L), (idx), &lua_apr_connpool_type))
+
+/* State shared by all references to a connection pool (allocated from the
+ * pool's memory pool so that apr.ref() can move the object around). */
+typedef struct {
+  apr_pool_t *memory_pool;
+  apr_thread_mutex_t *mutex;      /* protects the fields below */
+  apr_hash_t *hosts;              /* "host:port" -> connpool_host */
+  int max_per_host;
+  apr_interval_time_t idle_timeout, acquire_timeout;
+  lua_Number hits, misses;
+  int acquired;                   /* number of sockets handed out */
+  int closed;                     /* destroy when the last socket returns? */
+} connpool_state;
+
+/* Resource list for a single host and port. */
+typedef struct {
+  connpool_state *state;
+  const char *hostname;
+  apr_port_t port;
+  apr_reslist_t *reslist;
+} connpool_host;
+
+/* Pooled connection (a resource in the resource list). */
+typedef struct lua_apr_pooled_socket {
+  connpool_host *host;
+  apr_pool_t *pool;
+  apr_socket_t *handle;
+  int family;
+  struct lua_apr_tls *tls;        /* TLS state while the connection is idle */
+  int reused;
+} lua_apr_pooled_socket;
+
+/* Structure for connection pool objects. */
+typedef struct {
+  lua_apr_refobj header;
+  connpool_state *state;
+} lua_apr_connpool;
+
+/* socket_construct() {{{2 */
+
+static apr_status_t socket_construct(void **resource, void *params, apr_pool_t *unused)
+{
+  connpool_host *host = params;
+  lua_apr_pooled_socket *conn;
+  apr_sockaddr_t *address;
+  apr_socket_t *handle;
+  apr_pool_t *pool;
+  apr_status_t status;
+
+  /* Each connection gets its own pool so that it can be destroyed on its own. */
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return status;
+  /* Resolved for every new connection (through the DNS cache, which honors
+   * its time to live) without holding the lock of the connection pool. */
+  status = dns_resolve(&address, host->hostname, APR_UNSPEC, host->port, pool);
+  if (status == APR_SUCCESS)
+    status = apr_socket_create(&handle, address->family, SOCK_STREAM, APR_PROTO_TCP, pool);
+  if (status == APR_SUCCESS)
+    status = apr_socket_connect(handle, address);
+  if (status == APR_SUCCESS) {
+    conn = apr_pcalloc(pool, sizeof *conn);
+    conn->host = host;
+    conn->pool = pool;
+    conn->handle = handle;
+    conn->family = address->family;
+    *resource = conn;
+  } else
+    apr_pool_destroy(pool);
+
+  return status;
+}
+
+/* socket_destruct() {{{2 */
+
+static apr_status_t socket_destruct(void *resource, void *params, apr_pool_t *unused)
+{
+  lua_apr_pooled_socket *conn = resource;
+  apr_status_t status;
+
+# if LUA_APR_HAVE_OPENSSL
+  if (conn->tls != NULL)
+    tls_shutdown(conn->tls);
+# endif
+  status = apr_socket_close(conn->handle);
+  apr_pool_destroy(conn->pool);
+
+  return status;
+}
+
+/* socket_idle() {{{2
+ *
+ * Check that nothing can be read from an idle connection: Either the other
+ * side closed it or it sent data that no request asked for (e.g. a late
+ * response), which must not be mistaken for the response to the next request.
+ */
+
+static int socket_idle(lua_apr_pooled_socket *conn)
+{
+  apr_pollfd_t fd;
+  apr_int32_t num = 0;
+  apr_status_t status;
+
+  memset(&fd, 0, sizeof fd);
+  fd.p = conn->pool;
+  fd.desc_type = APR_POLL_SOCKET;
+  fd.desc.s = conn->handle;
+  fd.reqevents = APR_POLLIN;
+  status = apr_poll(&fd, 1, &num, 0);
+
+  return (status == APR_SUCCESS || APR_STATUS_IS_TIMEUP(status)) && num == 0;
+}
+
+/* get_host() {{{2 */
+
+static apr_status_t get_host(lua_State *L, connpool_state *state, const char *hostname, apr_port_t port, connpool_host **result)
+{
+  apr_status_t status = APR_SUCCESS;
+  connpool_host *host;
+  apr_pool_t *pool;
+  const char *key;
+
+  key = lua_pushfstring(L, "%s:%d", hostname, (int) port);
+  apr_thread_mutex_lock(state->mutex);
+  host = apr_hash_get(state->hosts, key, APR_HASH_KEY_STRING);
+  if (host == NULL) {
+    status = apr_pool_create(&pool, state->memory_pool);
+    if (status == APR_SUCCESS) {
+      host = apr_pcalloc(pool, sizeof *host);
+      host->state = state;
+      host->hostname = apr_pstrdup(pool, hostname);
+      host->port = port;
+      status = apr_reslist_create(&host->reslist, 0, state->max_per_host,
+          state->max_per_host, state->idle_timeout, socket_construct,
+          socket_destruct, host, pool);
+      if (status == APR_SUCCESS) {
+        if (state->acquire_timeout > 0)
+          apr_reslist_timeout_set(host->reslist, state->acquire_timeout);
+        apr_hash_set(state->hosts, apr_pstrdup(pool, key), APR_HASH_KEY_STRING, host);
+      } else {
+        apr_pool_destroy(pool);
+        host = NULL;
+      }
+    }
+  }
+  apr_thread_mutex_unlock(state->mutex);
+  *result = host;
+
+  return status;
+}
+
+/* return_socket() {{{2
+ *
+ * Return a connection to its resource list (or destroy it when it's not
+ * reusable) and destroy the connection pool when it was closed while this
+ * was the last connection handed out.
+ */
+
+static apr_status_t return_socket(lua_apr_pooled_socket *conn, int reusable)
+{
+  connpool_host *host = conn->host;
+  connpool_state *state = host->state;
+  apr_status_t status;
+  int destroy;
+
+  if (reusable) {
+    conn->reused = 1;
+    status = apr_reslist_release(host->reslist, conn);
+  } else
+    status = apr_reslist_invalidate(host->reslist, conn);
+
+  apr_thread_mutex_lock(state->mutex);
+  state->acquired--;
+  destroy = state->closed && state->acquired == 0;
+  apr_thread_mutex_unlock(state->mutex);
+  if (destroy)
+    apr_pool_destroy(state->memory_pool);
+
+  return status;
+}
+
+/* detach_socket() {{{2
+ *
+ * Make the socket object forget about a pooled connection. The memory pool of
+ * the connection is destroyed when the connection isn't reused, so the TLS
+ * state allocated from it (if any) is either shut down or kept with the
+ * connection for its next user.
+ */
+
+static lua_apr_pooled_socket *detach_socket(lua_State *L, lua_apr_socket *socket, int reusable)
+{
+  lua_apr_pooled_socket *conn = socket->pooled;
+
+  conn->tls = NULL;
+# if LUA_APR_HAVE_OPENSSL
+  if (socket->tls != NULL) {
+    if (reusable)
+      conn->tls = tls_detach(socket);
+    else
+      tls_close(socket);
+  }
+# endif
+  free_buffer(L, &socket->input.buffer);
+  free_buffer(L, &socket->output.buffer);
+  socket->pooled = NULL;
+  socket->handle = NULL;
+  socket->pool = NULL;
+
+  return conn;
+}
+
+/* connpool_discard() {{{2
+ *
+ * Called by socket:close() and the garbage collector for sockets that were
+ * acquired from a connection pool and never released.
+ */
+
+apr_status_t connpool_discard(lua_State *L, lua_apr_socket *socket)
+{
+  return return_socket(detach_socket(L, socket, 0), 0);
+}
+
+/* connpool_reused() -- check whether a socket was used by an earlier user {{{2 */
+
+int connpool_reused(lua_apr_socket *socket)
+{
+  return socket->pooled != NULL && socket->pooled->reused;
+}
+
+/* close_connpool() {{{2 */
+
+static void close_connpool(lua_apr_connpool *object)
+{
+  connpool_state *state = object->state;
+  int destroy;
+
+  if (object_collectable((lua_apr_refobj*)object) && state != NULL) {
+    apr_thread_mutex_lock(state->mutex);
+    state->closed = 1;
+    destroy = state->acquired == 0;
+    apr_thread_mutex_unlock(state->mutex);
+    /* Otherwise the last socket to be returned destroys the pool. */
+    if (destroy)
+      apr_pool_destroy(state->memory_pool);
+  }
+  object->state = NULL;
+  release_object((lua_apr_refobj*)object);
+}
+
+/* apr.connection_pool([options]) -> pool {{{1
+ *
+ * Create a pool of outbound TCP connections keyed by host name and port
+ * number. On success the pool object is returned, otherwise a nil followed by
+ * an error message is returned. The optional table @options supports the
+ * following fields:
+ *
+ *  - `max_per_host` is the maximum number of connections (in use and idle)
+ *    to a single host and port (defaults to 8)
+ *  - `idle_timeout` is the number of seconds after which idle connections
+ *    are closed (defaults to 0 which means idle connections are kept open)
+ *  - `timeout` is the maximum number of seconds `pool:acquire()` waits when
+ *    all connections to a host are in use (defaults to 0 which means wait
+ *    forever)
+ */
+
+int lua_apr_connection_pool(lua_State *L)
+{
+  lua_apr_connpool *object;
+  connpool_state *state;
+  apr_pool_t *pool;
+  apr_status_t status;
+  int max_per_host = 8;
+  lua_Number idle_timeout = 0, acquire_timeout = 0;
+
+  lua_settop(L, 1);
+  if (!lua_isnil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "max_per_host");
+    if (!lua_isnil(L, -1))
+      max_per_host = luaL_checkint(L, -1);
+    lua_getfield(L, 1, "idle_timeout");
+    if (!lua_isnil(L, -1))
+      idle_timeout = luaL_checknumber(L, -1);
+    lua_getfield(L, 1, "timeout");
+    if (!lua_isnil(L, -1))
+      acquire_timeout = luaL_checknumber(L, -1);
+    lua_settop(L, 1);
+  }
+  luaL_argcheck(L, max_per_host > 0, 1, "max_per_host must be positive");
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  state = apr_pcalloc(pool, sizeof *state);
+  state->memory_pool = pool;
+  state->hosts = apr_hash_make(pool);
+  state->max_per_host = max_per_host;
+  state->idle_timeout = (apr_interval_time_t) (idle_timeout * APR_USEC_PER_SEC);
+  state->acquire_timeout = (apr_interval_time_t) (acquire_timeout * APR_USEC_PER_SEC);
+  status = apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (status != APR_SUCCESS) {
+    apr_pool_destroy(pool);
+    return push_error_status(L, status);
+  }
+
+  object = new_object(L, &lua_apr_connpool_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->state = state;
+
+  return 1;
+}
+
+/* pool:acquire(host, port) -> socket {{{1
+ *
+ * Get a connected socket for the given @host and @port. An idle connection is
+ * reused when available, otherwise a new connection is made. On success the
+ * socket is returned, otherwise a nil followed by an error message is
+ * returned. When you're done with the socket, give it back using
+ * `pool:release()`. The host name is resolved whenever a new connection is
+ * made using the DNS cache (see `apr.dns_cache()`), so changes to DNS records
+ * are picked up once the cached addresses expire.
+ */
+
+static int connpool_acquire(lua_State *L)
+{
+  lua_apr_connpool *object;
+  lua_apr_pooled_socket *conn = NULL;
+  lua_apr_socket *socket;
+  connpool_state *state;
+  connpool_host *host;
+  apr_status_t status;
+
+  object = check_connpool(L, 1);
+  state = object->state;
+  status = get_host(L, state, luaL_checkstring(L, 2), (apr_port_t) luaL_checkinteger(L, 3), &host);
+  lua_pop(L, 1);
+  while (status == APR_SUCCESS) {
+    status = apr_reslist_acquire(host->reslist, (void**)&conn);
+    if (status != APR_SUCCESS || !conn->reused || socket_idle(conn))
+      break;
+    /* The other side closed the idle connection. */
+    apr_reslist_invalidate(host->reslist, conn);
+  }
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  apr_thread_mutex_lock(state->mutex);
+  if (conn->reused)
+    state->hits++;
+  else
+    state->misses++;
+  state->acquired++;
+  apr_thread_mutex_unlock(state->mutex);
+
+  socket = socket_wrap(L, conn->handle, conn->pool, conn->family, APR_PROTO_TCP);
+  socket->pooled = conn;
+# if LUA_APR_HAVE_OPENSSL
+  if (conn->tls != NULL)
+    tls_attach(socket, conn->tls);
+# endif
+  /* Keep the connection pool alive as long as the socket is alive. */
+  object_env_private(L, -1);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "connection_pool");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* pool:release(socket) -> reused {{{1
+ *
+ * Give a socket acquired using `pool:acquire()` back to the pool. The
+ * connection is checked before it's kept for reuse: Connections with unread
+ * input (buffered or still in the kernel), unwritten output, an unfinished
+ * TLS handshake or a peer that has closed the connection are closed. Returns
+ * true when the connection was kept, false when it was closed. Either way
+ * @socket can no longer be used afterwards.
+ */
+
+static int connpool_release(lua_State *L)
+{
+  lua_apr_connpool *object;
+  lua_apr_pooled_socket *conn;
+  lua_apr_socket *socket;
+  lua_apr_buffer *input, *output;
+  int reusable;
+
+  object = check_connpool(L, 1);
+  socket = check_object(L, 2, &lua_apr_socket_type);
+  conn = socket->pooled;
+  luaL_argcheck(L, conn != NULL && conn->host->state == object->state, 2,
+      "socket wasn't acquired from this connection pool");
+
+  /* Perform some health checks. */
+  input = &socket->input.buffer;
+  output = &socket->output.buffer;
+  reusable = input->index >= input->limit;
+# if LUA_APR_HAVE_OPENSSL
+  if (reusable && socket->tls != NULL)
+    reusable = tls_reusable(socket->tls);
+# endif
+  if (reusable && output->index < output->limit)
+    reusable = flush_buffer(L, &socket->output, 1) == APR_SUCCESS;
+  if (reusable)
+    reusable = socket_idle(conn);
+  /* Restore blocking mode for the next user. */
+  if (reusable)
+    reusable = apr_socket_timeout_set(conn->handle, -1) == APR_SUCCESS;
+
+  detach_socket(L, socket, reusable);
+  return_socket(conn, reusable);
+  lua_pushboolean(L, reusable);
+
+  return 1;
+}
+
+/* pool:stats() -> statistics {{{1
+ *
+ * Get statistics about the connection pool. Returns a table with the
+ * following fields:
+ *
+ *  - `hits` is the number of times an idle connection was reused
+ *  - `misses` is the number of times a new connection had to be made
+ *  - `acquired` is the number of sockets that are currently handed out
+ *  - `hosts` is the number of distinct host and port combinations
+ */
+
+static int connpool_stats(lua_State *L)
+{
+  lua_apr_connpool *object;
+  connpool_state *state;
+
+  object = check_connpool(L, 1);
+  state = object->state;
+  lua_createtable(L, 0, 4);
+  apr_thread_mutex_lock(state->mutex);
+  lua_pushnumber(L, state->hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, state->misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, state->acquired);
+  lua_setfield(L, -2, "acquired");
+  lua_pushinteger(L, apr_hash_count(state->hosts));
+  lua_setfield(L, -2, "hosts");
+  apr_thread_mutex_unlock(state->mutex);
+
+  return 1;
+}
+
+/* pool:__tostring() {{{1 */
+
+static int connpool_tostring(lua_State *L)
+{
+  lua_apr_connpool *object = check_connpool(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_connpool_type.friendlyname, object->state);
+  return 1;
+}
+
+/* pool:__gc() {{{1 */
+
+static int connpool_gc(lua_State *L)
+{
+  close_connpool(check_connpool(L, 1));
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_Reg connpool_methods[] = {
+  { "acquire", connpool_acquire },
+  { "release", connpool_release },
+  { "stats", connpool_stats },
+  { NULL, NULL }
+};
+
+static luaL_Reg connpool_metamethods[] = {
+  { "__tostring", connpool_tostring },
+  { "__eq", objects_equal },
+  { "__gc", connpool_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_connpool_type = {
+  "lua_apr_connpool*",      /* metatable name in registry */
+  "connection pool",        /* friendly object name */
+  sizeof(lua_apr_connpool), /* structure size */
+  connpool_methods,         /* methods table */
+  connpool_metamethods      /* metamethods table */
+};
+
+#endif
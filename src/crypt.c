@@ -1,7 +1,7 @@
 /* Cryptography routines module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: June 30, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -11,6 +11,14 @@
  * digest and read passwords from standard input while masking the characters
  * typed by the user.
  *
+ * Validating a password against a bcrypt or APR-MD5 digest is deliberately
+ * slow, a single validation can easily take tens of milliseconds. Servers
+ * that handle many clients on a single thread can use
+ * `apr.password_validator()` to validate passwords on a pool of helper
+ * threads and get notified through a pollset when the results are available,
+ * while `apr.password_validate_batch()` validates a list of credentials in
+ * parallel using all processors.
+ *
  * The MD5 and SHA1 functions can be used to hash binary data. This is useful
  * because the hash is only 16 or 32 bytes long, yet it still changes
  * significantly when the binary data changes by just one byte.
@@ -41,7 +49,17 @@
 #include "lua_apr.h"
 #include <apr_lib.h>
 #include <apr_md5.h>
+#include <apr_mmap.h>
 #include <apr_sha1.h>
+#include <apr_atomic.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_proc.h>
+#include <stdlib.h>
+#include <string.h>
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 /* Internal functions {{{1 */
 
@@ -89,6 +107,156 @@ static lua_apr_sha1_ctx *sha1_check(lua_State *L, int idx, int valid)
   return context;
 }
 
+/* Size of the buffer used to hash files and streams. */
+#define HASH_BUFSIZE (1024 * 16)
+
+/* Size of the windows used to hash memory mapped files. */
+#define HASH_MMAPSIZE (1024 * 1024 * 16)
+
+static void md5_update_cb(void *context, const void *data, apr_size_t length)
+{
+  apr_md5_update(context, data, length);
+}
+
+static void sha1_update_cb(void *context, const void *data, apr_size_t length)
+{
+  apr_sha1_update_binary(context, data, (unsigned int)length);
+}
+
+int push_digest(lua_State *L, unsigned char *digest, int length, int binary)
+{
+  char formatted[64*2 + 1]; /* large enough for SHA-512 */
+  int pushed = 1;
+
+  if (binary) {
+    lua_pushlstring(L, (const char *)digest, length);
+  } else if (format_digest(formatted, digest, length)) {
+    lua_pushlstring(L, (const char *)formatted, length * 2);
+    clear_stack(formatted);
+  } else {
+    pushed = push_error_message(L, "could not format message digest");
+  }
+  clear_mem(digest, length);
+
+  return pushed;
+}
+
+/* Feed the contents of a file to a message digest without creating Lua
+ * strings. Memory mapping is used where available, otherwise (or when
+ * mapping fails) the file is read using a fixed size buffer. */
+
+apr_status_t hash_file(lua_State *L, lua_apr_hash_f update, void *context)
+{
+  apr_status_t status;
+  apr_pool_t *pool;
+  apr_file_t *handle;
+  apr_size_t length;
+  const char *path;
+  char buffer[HASH_BUFSIZE];
+# if APR_HAS_MMAP
+  apr_finfo_t info;
+  apr_mmap_t *mm;
+  apr_off_t offset = 0;
+  apr_size_t size;
+# endif
+
+  path = luaL_checkstring(L, 1);
+  status = apr_pool_create(&pool, to_pool(L));
+  if (status != APR_SUCCESS)
+    return status;
+  status = apr_file_open(&handle, path, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool);
+  if (status != APR_SUCCESS)
+    goto done;
+
+# if APR_HAS_MMAP
+  status = apr_file_info_get(&info, APR_FINFO_SIZE, handle);
+  while (status == APR_SUCCESS && offset < info.size) {
+    size = HASH_MMAPSIZE;
+    if ((apr_off_t) size > info.size - offset)
+      size = (apr_size_t) (info.size - offset);
+    if (apr_mmap_create(&mm, handle, offset, size, APR_MMAP_READ, pool) != APR_SUCCESS)
+      break; /* fall back to reading the rest of the file */
+    update(context, mm->mm, size);
+    apr_mmap_delete(mm);
+    offset += size;
+  }
+  if (status == APR_SUCCESS && offset > 0)
+    status = apr_file_seek(handle, APR_SET, &offset);
+# endif
+
+  while (status == APR_SUCCESS) {
+    length = sizeof buffer;
+    status = apr_file_read(handle, buffer, &length);
+    if (status == APR_SUCCESS)
+      update(context, buffer, length);
+  }
+  if (APR_STATUS_IS_EOF(status))
+    status = APR_SUCCESS;
+  clear_stack(buffer);
+
+done:
+  apr_pool_destroy(pool);
+  return status;
+}
+
+/* Feed (at most @limit bytes of) a file, socket or shared memory segment to
+ * a message digest (or a base64 encoder or decoder). Data that was already
+ * buffered by the stream is used first, after that the stream is read using a
+ * fixed size buffer. */
+
+int hash_stream(lua_State *L, lua_apr_hash_f update, void *context)
+{
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output;
+  lua_apr_buffer *B;
+  apr_status_t status = APR_SUCCESS;
+  apr_off_t limit, total = 0;
+  apr_size_t length;
+  char buffer[HASH_BUFSIZE];
+
+  if (object_has_type(L, 2, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = check_object(L, 2, &lua_apr_file_type);
+    if (file->handle == NULL)
+      luaL_error(L, "attempt to use a closed file");
+    input = &file->input;
+  } else if (object_has_type(L, 2, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, 2, &lua_apr_socket_type);
+    if (socket->handle == NULL)
+      luaL_error(L, "attempt to use a closed socket");
+    input = &socket->input;
+  } else if (!shm_buffers(L, 2, &input, &output)) {
+    luaL_argerror(L, 2, "file, socket or shared memory expected");
+  }
+  limit = lua_isnoneornil(L, 3) ? -1 : (apr_off_t) luaL_checknumber(L, 3);
+  B = &input->buffer;
+
+  while (limit < 0 || total < limit) {
+    length = sizeof buffer;
+    if (limit >= 0 && (apr_off_t) length > limit - total)
+      length = (apr_size_t) (limit - total);
+    if (B->index < B->limit) {
+      if (length > B->limit - B->index)
+        length = B->limit - B->index;
+      update(context, &B->data[B->index], length);
+      drain_input(input, length);
+    } else if (B->unmanaged) {
+      break;
+    } else {
+      status = input->read(input->object, buffer, &length);
+      if (status != APR_SUCCESS)
+        break;
+      update(context, buffer, length);
+    }
+    total += length;
+  }
+  clear_stack(buffer);
+
+  if (status != APR_SUCCESS && !APR_STATUS_IS_EOF(status))
+    return push_error_status(L, status);
+  lua_pushnumber(L, (lua_Number) total);
+  return 1;
+}
+
 /* apr.md5_encode(password, salt) -> digest {{{1
  *
  * Encode the string @password using the [MD5] [md5] algorithm and a [salt]
@@ -146,6 +314,474 @@ int lua_apr_password_validate(lua_State *L)
   return push_status(L, status);
 }
 
+#if APR_HAS_THREADS
+
+/* Number of helper threads when the number of processors is unknown. */
+#define VALIDATOR_THREADS 4
+
+/* Upper limit on the number of helper threads. */
+#define VALIDATOR_MAX_THREADS 64
+
+#define check_validator(L, idx) \
+  ((lua_apr_validator_object*)check_object((L), (idx), &lua_apr_validator_type))
+
+/* Queued or completed validation (allocated using malloc() because requests
+ * are created by one thread and freed by another). The password and digest
+ * are stored back to back in the flexible array at the end. */
+typedef struct password_request {
+  struct password_request *next;
+  int id;
+  apr_status_t status;
+  size_t length;
+  char *digest;
+  char password[1];
+} password_request;
+
+/* State shared by the validator object and its helper threads. */
+typedef struct {
+  apr_pool_t *memory_pool;
+  apr_thread_mutex_t *mutex;     /* protects the fields below */
+  apr_thread_cond_t *cond;       /* signals new requests to the helper threads */
+  apr_thread_t *threads[VALIDATOR_MAX_THREADS];
+  int thread_count;
+  apr_file_t *signal_in, *signal_out;
+  password_request *pending, *pending_tail;
+  password_request *done, *done_tail;
+  int next_id, shutdown;
+} validator_state;
+
+/* Structure for password validator objects. */
+typedef struct {
+  lua_apr_refobj header;
+  validator_state *state;
+} lua_apr_validator_object;
+
+/* Credentials validated by apr.password_validate_batch(). */
+typedef struct {
+  const char *password, *digest;
+  apr_status_t status;
+} batch_item;
+
+/* State shared by the threads of apr.password_validate_batch(). */
+typedef struct {
+  batch_item *items;
+  apr_uint32_t count;
+  volatile apr_uint32_t next;
+} batch_state;
+
+/* processor_count() -- get the default number of helper threads {{{2 */
+
+static int processor_count(void)
+{
+  long count = 0;
+
+# if defined(WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  count = info.dwNumberOfProcessors;
+# elif defined(_SC_NPROCESSORS_ONLN)
+  count = sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+
+  if (count <= 0)
+    return VALIDATOR_THREADS;
+  return count < VALIDATOR_MAX_THREADS ? (int) count : VALIDATOR_MAX_THREADS;
+}
+
+/* check_thread_count() {{{2 */
+
+static int check_thread_count(lua_State *L, int idx)
+{
+  int count = luaL_optint(L, idx, processor_count());
+  luaL_argcheck(L, count >= 1 && count <= VALIDATOR_MAX_THREADS, idx,
+      "number of threads out of range");
+  return count;
+}
+
+/* free_password_requests() {{{2 */
+
+static void free_password_requests(password_request *request)
+{
+  password_request *next;
+
+  for (; request != NULL; request = next) {
+    next = request->next;
+    clear_mem(request->password, request->length);
+    free(request);
+  }
+}
+
+/* validator_worker() -- the helper threads that validate passwords {{{2 */
+
+static void* APR_THREAD_FUNC validator_worker(apr_thread_t *thread, void *data)
+{
+  validator_state *state = data;
+  password_request *request;
+  apr_size_t len;
+
+  apr_thread_mutex_lock(state->mutex);
+  for (;;) {
+    while (state->pending == NULL && !state->shutdown)
+      apr_thread_cond_wait(state->cond, state->mutex);
+    if (state->shutdown)
+      break;
+    request = state->pending;
+    state->pending = request->next;
+    if (state->pending == NULL)
+      state->pending_tail = NULL;
+    apr_thread_mutex_unlock(state->mutex);
+
+    request->next = NULL;
+    request->status = apr_password_validate(request->password, request->digest);
+    /* Don't keep the plain text password around until results() is called. */
+    clear_mem(request->password, request->length);
+
+    apr_thread_mutex_lock(state->mutex);
+    if (state->done_tail != NULL)
+      state->done_tail->next = request;
+    else
+      state->done = request;
+    state->done_tail = request;
+    /* Wake up the pollset (the pipe is non-blocking so this never stalls). */
+    len = 1;
+    apr_file_write(state->signal_out, "", &len);
+  }
+  apr_thread_mutex_unlock(state->mutex);
+
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+/* stop_workers() -- stop and join the helper threads {{{2 */
+
+static void stop_workers(validator_state *state)
+{
+  apr_status_t unused;
+  int i;
+
+  apr_thread_mutex_lock(state->mutex);
+  state->shutdown = 1;
+  apr_thread_cond_broadcast(state->cond);
+  apr_thread_mutex_unlock(state->mutex);
+  /* Waits for the validations in progress, if any. */
+  for (i = 0; i < state->thread_count; i++)
+    apr_thread_join(&unused, state->threads[i]);
+  state->thread_count = 0;
+}
+
+/* close_validator() {{{2 */
+
+static void close_validator(lua_apr_validator_object *object)
+{
+  validator_state *state = object->state;
+
+  if (object_collectable((lua_apr_refobj*)object) && state != NULL) {
+    stop_workers(state);
+    free_password_requests(state->pending);
+    free_password_requests(state->done);
+    apr_pool_destroy(state->memory_pool);
+  }
+  object->state = NULL;
+  release_object((lua_apr_refobj*)object);
+}
+
+/* check_validator_open() {{{2 */
+
+static validator_state *check_validator_open(lua_State *L, int idx)
+{
+  lua_apr_validator_object *object = check_validator(L, idx);
+  if (object->state == NULL)
+    luaL_error(L, "attempt to use a closed password validator");
+  return object->state;
+}
+
+/* validator_signal_get() {{{2
+ *
+ * Get the pipe used by the helper threads to signal completed validations,
+ * so that password validators can be added to pollsets.
+ */
+
+apr_file_t *validator_signal_get(lua_State *L, int idx)
+{
+  return check_validator_open(L, idx)->signal_in;
+}
+
+/* batch_run() -- validate credentials until none are left {{{2 */
+
+static void batch_run(batch_state *batch)
+{
+  apr_uint32_t i;
+
+  while ((i = apr_atomic_inc32(&batch->next)) < batch->count)
+    batch->items[i].status = apr_password_validate(batch->items[i].password,
+                                                   batch->items[i].digest);
+}
+
+/* batch_worker() {{{2 */
+
+static void* APR_THREAD_FUNC batch_worker(apr_thread_t *thread, void *data)
+{
+  batch_run(data);
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+/* apr.password_validator([threads]) -> validator {{{1
+ *
+ * Create a password validator that runs `apr.password_validate()` on a pool
+ * of helper threads so that slow digests don't block the calling thread. The
+ * optional @threads argument gives the number of helper threads, it defaults
+ * to the number of processors. On success the validator object is returned,
+ * otherwise a nil followed by an error message is returned. Validators can be
+ * added to a pollset for `'input'`; the validator is reported as readable
+ * when one or more validations have completed and `validator:results()`
+ * should be called. The coroutine scheduler created by `apr.loop()` provides
+ * `loop:password_validate()` which uses a validator.
+ */
+
+int lua_apr_password_validator(lua_State *L)
+{
+  lua_apr_validator_object *object;
+  validator_state *state;
+  apr_pool_t *pool;
+  apr_status_t status;
+  int i, count;
+
+  count = check_thread_count(L, 1);
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  state = apr_pcalloc(pool, sizeof *state);
+  state->memory_pool = pool;
+  state->next_id = 1;
+  status = apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_cond_create(&state->cond, pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_create(&state->signal_in, &state->signal_out, pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(state->signal_in, 0);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(state->signal_out, 0);
+  for (i = 0; i < count && status == APR_SUCCESS; i++) {
+    status = apr_thread_create(&state->threads[i], NULL, validator_worker, state, pool);
+    if (status == APR_SUCCESS)
+      state->thread_count++;
+  }
+  if (status != APR_SUCCESS) {
+    if (state->mutex != NULL && state->cond != NULL)
+      stop_workers(state);
+    apr_pool_destroy(pool);
+    return push_error_status(L, status);
+  }
+
+  object = new_object(L, &lua_apr_validator_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->state = state;
+
+  return 1;
+}
+
+/* apr.password_validate_batch(credentials [, threads]) -> results {{{1
+ *
+ * Validate a list of credentials in parallel using several threads. The
+ * @credentials argument is a list of `{ password, digest }` pairs and the
+ * result is a list of booleans in the same order, where true means that the
+ * password matches its digest (as in `apr.password_validate()`). The
+ * optional @threads argument gives the number of threads to use, it defaults
+ * to the number of processors. The calling thread takes part in the work and
+ * blocks until all credentials have been validated.
+ */
+
+int lua_apr_password_validate_batch(lua_State *L)
+{
+  apr_thread_t *threads[VALIDATOR_MAX_THREADS];
+  apr_status_t status, unused;
+  apr_pool_t *pool;
+  batch_state batch;
+  int i, count, started;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  count = check_thread_count(L, 2);
+  status = apr_pool_create(&pool, to_pool(L));
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  /* The strings stay referenced by the table while the threads use them. */
+  batch.count = (apr_uint32_t) lua_objlen(L, 1);
+  batch.next = 0;
+  batch.items = apr_palloc(pool, sizeof batch.items[0] * (batch.count + 1));
+  for (i = 0; i < (int) batch.count; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    if (!lua_istable(L, -1)) {
+      apr_pool_destroy(pool);
+      return luaL_argerror(L, 1, "expected list of { password, digest } pairs");
+    }
+    lua_rawgeti(L, -1, 1);
+    lua_rawgeti(L, -2, 2);
+    /* No number to string coercion: the result would be garbage collected. */
+    if (lua_type(L, -2) != LUA_TSTRING || lua_type(L, -1) != LUA_TSTRING) {
+      apr_pool_destroy(pool);
+      return luaL_argerror(L, 1, "expected list of { password, digest } pairs");
+    }
+    batch.items[i].password = lua_tostring(L, -2);
+    batch.items[i].digest = lua_tostring(L, -1);
+    lua_pop(L, 3);
+  }
+
+  /* Start at most one helper thread per remaining credential. */
+  if ((apr_uint32_t) count > batch.count)
+    count = batch.count > 0 ? (int) batch.count : 1;
+  for (started = 0; started < count - 1; started++)
+    if (apr_thread_create(&threads[started], NULL, batch_worker, &batch, pool) != APR_SUCCESS)
+      break;
+  batch_run(&batch);
+  for (i = 0; i < started; i++)
+    apr_thread_join(&unused, threads[i]);
+
+  lua_createtable(L, batch.count, 0);
+  for (i = 0; i < (int) batch.count; i++) {
+    lua_pushboolean(L, batch.items[i].status == APR_SUCCESS);
+    lua_rawseti(L, -2, i + 1);
+  }
+  apr_pool_destroy(pool);
+
+  return 1;
+}
+
+/* validator:validate(password, digest) -> id {{{1
+ *
+ * Queue the validation of the string @password against @digest (see
+ * `apr.password_validate()`). Returns a number that identifies the
+ * validation in the table returned by `validator:results()`.
+ */
+
+static int validator_validate(lua_State *L)
+{
+  validator_state *state;
+  password_request *request;
+  const char *password, *digest;
+  size_t password_length, digest_length;
+  int id;
+
+  state = check_validator_open(L, 1);
+  password = luaL_checklstring(L, 2, &password_length);
+  digest = luaL_checklstring(L, 3, &digest_length);
+
+  request = malloc(sizeof *request + password_length + digest_length + 1);
+  if (request == NULL)
+    raise_error_memory(L);
+  memset(request, 0, sizeof *request);
+  request->length = password_length + digest_length + 2;
+  request->digest = request->password + password_length + 1;
+  memcpy(request->password, password, password_length + 1);
+  memcpy(request->digest, digest, digest_length + 1);
+
+  apr_thread_mutex_lock(state->mutex);
+  id = request->id = state->next_id++;
+  if (state->pending_tail != NULL)
+    state->pending_tail->next = request;
+  else
+    state->pending = request;
+  state->pending_tail = request;
+  apr_thread_cond_signal(state->cond);
+  apr_thread_mutex_unlock(state->mutex);
+
+  lua_pushinteger(L, id);
+  return 1;
+}
+
+/* validator:results() -> results {{{1
+ *
+ * Get the completed validations. Returns a list of tables with the fields
+ * `id` (the number returned by `validator:validate()`) and `valid` (a
+ * boolean). When `valid` is false the fields `error` and `code` contain the
+ * error message and error code that `apr.password_validate()` would have
+ * returned. Each completed validation is returned only once. When no
+ * validations have completed an empty list is returned.
+ */
+
+static int validator_results(lua_State *L)
+{
+  validator_state *state;
+  password_request *requests, *request;
+  char buffer[LUA_APR_BUFSIZE];
+  apr_size_t len;
+  int i = 0;
+
+  state = check_validator_open(L, 1);
+  lua_settop(L, 1);
+
+  apr_thread_mutex_lock(state->mutex);
+  /* Consume the pending wakeups. */
+  do {
+    len = sizeof buffer;
+  } while (apr_file_read(state->signal_in, buffer, &len) == APR_SUCCESS
+      && len == sizeof buffer);
+  requests = state->done;
+  state->done = state->done_tail = NULL;
+  apr_thread_mutex_unlock(state->mutex);
+
+  lua_newtable(L);
+  for (request = requests; request != NULL; request = request->next) {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, request->id);
+    lua_setfield(L, -2, "id");
+    lua_pushboolean(L, request->status == APR_SUCCESS);
+    lua_setfield(L, -2, "valid");
+    if (request->status != APR_SUCCESS) {
+      /* push_error_status() pushes nil, message, code. */
+      push_error_status(L, request->status);
+      lua_setfield(L, -4, "code");
+      lua_setfield(L, -3, "error");
+      lua_pop(L, 1);
+    }
+    lua_rawseti(L, 2, ++i);
+  }
+  free_password_requests(requests);
+
+  return 1;
+}
+
+/* validator:close() -> status {{{1
+ *
+ * Stop the helper threads and release the resources of the validator.
+ * Pending validations are abandoned. Returns true on success.
+ */
+
+static int validator_close(lua_State *L)
+{
+  check_validator_open(L, 1);
+  close_validator(check_validator(L, 1));
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* validator:__tostring() {{{1 */
+
+static int validator_tostring(lua_State *L)
+{
+  lua_apr_validator_object *object = check_validator(L, 1);
+
+  if (object->state != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_validator_type.friendlyname, object->state);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_validator_type.friendlyname);
+
+  return 1;
+}
+
+/* validator:__gc() {{{1 */
+
+static int validator_gc(lua_State *L)
+{
+  close_validator(check_validator(L, 1));
+  return 0;
+}
+
+#endif
+
 /* apr.password_get(prompt) -> password {{{1
  *
  * Display the string @prompt on the command-line prompt and read in a password
@@ -176,6 +812,32 @@ int lua_apr_password_get(lua_State *L)
   return pushed;
 }
 
+/* apr.md5_file(path [, binary]) -> digest {{{1
+ *
+ * Calculate the [MD5] [md5] message digest of the file at @path. The file is
+ * memory mapped (or read using a fixed size buffer where that isn't possible)
+ * so hashing large files doesn't create any Lua strings. On success the
+ * digest is returned as a string of 32 hexadecimal characters, or a string of
+ * 16 bytes if @binary evaluates to true. Otherwise a nil followed by an error
+ * message is returned.
+ */
+
+int lua_apr_md5_file(lua_State *L)
+{
+  apr_status_t status;
+  apr_md5_ctx_t context;
+  unsigned char digest[APR_MD5_DIGESTSIZE];
+
+  apr_md5_init(&context);
+  status = hash_file(L, md5_update_cb, &context);
+  if (status == APR_SUCCESS)
+    status = apr_md5_final(digest, &context);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  return push_digest(L, digest, count(digest), lua_toboolean(L, 2));
+}
+
 /* apr.md5_init() -> md5_context {{{1
  *
  * Create and return an object that can be used to calculate [MD5] [md5]
@@ -237,6 +899,24 @@ static int md5_update(lua_State *L)
   return push_status(L, status);
 }
 
+/* md5_context:update_from(stream [, length]) -> count {{{1
+ *
+ * Continue an [MD5] [md5] message digest operation by processing the data
+ * read from @stream, which can be a file, socket or shared memory segment.
+ * When @length is given no more than this number of bytes is read, otherwise
+ * @stream is read until the end. The data is never converted to Lua strings.
+ * On success the number of bytes processed is returned, otherwise a nil
+ * followed by an error message is returned.
+ */
+
+static int md5_update_from(lua_State *L)
+{
+  lua_apr_md5_ctx *object;
+
+  object = md5_check(L, 1, 1);
+  return hash_stream(L, md5_update_cb, &object->context);
+}
+
 /* md5_context:digest([binary]) -> digest {{{1
  *
  * End an [MD5] [md5] message digest operation. On success the digest is
@@ -253,23 +933,16 @@ static int md5_digest(lua_State *L)
   apr_status_t status;
   lua_apr_md5_ctx *object;
   unsigned char digest[APR_MD5_DIGESTSIZE];
-  char formatted[APR_MD5_DIGESTSIZE*2 + 1];
-  int binary, pushed = 1;
+  int pushed;
 
   object = md5_check(L, 1, 1);
-  binary = lua_toboolean(L, 2);
   status = apr_md5_final(digest, &object->context);
   if (status != APR_SUCCESS) {
     pushed = push_error_status(L, status);
-  } else if (binary) {
-    lua_pushlstring(L, (const char *)digest, count(digest));
-  } else if (format_digest(formatted, digest, count(digest))) {
-    lua_pushlstring(L, (const char *)formatted, count(formatted) - 1);
-    clear_stack(formatted);
+    clear_stack(digest);
   } else {
-    pushed = push_error_message(L, "could not format MD5 digest");
+    pushed = push_digest(L, digest, count(digest), lua_toboolean(L, 2));
   }
-  clear_stack(digest);
   object->finalized = 1;
 
   return pushed;
@@ -320,6 +993,29 @@ static int md5_gc(lua_State *L)
   return 1;
 }
 
+/* apr.sha1_file(path [, binary]) -> digest {{{1
+ *
+ * Calculate the [SHA1] [sha1] message digest of the file at @path without
+ * creating any Lua strings. On success the digest is returned as a string of
+ * 40 hexadecimal characters, or a string of 20 bytes if @binary evaluates to
+ * true. Otherwise a nil followed by an error message is returned.
+ */
+
+int lua_apr_sha1_file(lua_State *L)
+{
+  apr_status_t status;
+  apr_sha1_ctx_t context;
+  unsigned char digest[APR_SHA1_DIGESTSIZE];
+
+  apr_sha1_init(&context);
+  status = hash_file(L, sha1_update_cb, &context);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  apr_sha1_final(digest, &context);
+
+  return push_digest(L, digest, count(digest), lua_toboolean(L, 2));
+}
+
 /* apr.sha1_init() -> sha1_context {{{1
  *
  * Create and return an object that can be used to calculate [SHA1] [sha1]
@@ -357,6 +1053,20 @@ static int sha1_update(lua_State *L)
   return push_status(L, APR_SUCCESS);
 }
 
+/* sha1_context:update_from(stream [, length]) -> count {{{1
+ *
+ * Continue an [SHA1] [sha1] message digest operation by processing the data
+ * read from @stream. See `md5_context:update_from()` for details.
+ */
+
+static int sha1_update_from(lua_State *L)
+{
+  lua_apr_sha1_ctx *object;
+
+  object = sha1_check(L, 1, 1);
+  return hash_stream(L, sha1_update_cb, &object->context);
+}
+
 /* sha1_context:digest([binary]) -> digest {{{1
  *
  * End an [SHA1] [sha1] message digest operation. On success the digest is
@@ -372,21 +1082,11 @@ static int sha1_digest(lua_State *L)
 {
   lua_apr_sha1_ctx *object;
   unsigned char digest[APR_SHA1_DIGESTSIZE];
-  char formatted[APR_SHA1_DIGESTSIZE*2 + 1];
-  int binary, pushed = 1;
+  int pushed;
 
   object = sha1_check(L, 1, 1);
-  binary = lua_toboolean(L, 2);
   apr_sha1_final(digest, &object->context);
-  if (binary) {
-    lua_pushlstring(L, (const char *)digest, count(digest));
-  } else if (format_digest(formatted, digest, count(digest))) {
-    lua_pushlstring(L, (const char *)formatted, count(formatted) - 1);
-    clear_stack(formatted);
-  } else {
-    pushed = push_error_message(L, "could not format SHA1 digest");
-  }
-  clear_stack(digest);
+  pushed = push_digest(L, digest, count(digest), lua_toboolean(L, 2));
   object->finalized = 1;
 
   return pushed;
@@ -439,6 +1139,7 @@ static int sha1_gc(lua_State *L)
 static luaL_reg md5_methods[] = {
   { "reset", md5_reset },
   { "update", md5_update },
+  { "update_from", md5_update_from },
   { "digest", md5_digest },
   { NULL, NULL },
 };
@@ -461,6 +1162,7 @@ lua_apr_objtype lua_apr_md5_type = {
 static luaL_reg sha1_methods[] = {
   { "reset", sha1_reset },
   { "update", sha1_update },
+  { "update_from", sha1_update_from },
   { "digest", sha1_digest },
   { NULL, NULL },
 };
@@ -480,4 +1182,30 @@ lua_apr_objtype lua_apr_sha1_type = {
   sha1_metamethods          /* metamethods table */
 };
 
+#if APR_HAS_THREADS
+
+static luaL_Reg validator_methods[] = {
+  { "validate", validator_validate },
+  { "results", validator_results },
+  { "close", validator_close },
+  { NULL, NULL }
+};
+
+static luaL_Reg validator_metamethods[] = {
+  { "__tostring", validator_tostring },
+  { "__eq", objects_equal },
+  { "__gc", validator_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_validator_type = {
+  "lua_apr_validator*",             /* metatable name in registry */
+  "password validator",             /* friendly object name */
+  sizeof(lua_apr_validator_object), /* structure size */
+  validator_methods,                /* methods table */
+  validator_metamethods             /* metamethods table */
+};
+
+#endif
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -3,7 +3,7 @@
  * Authors:
  *  - zhiguo zhao <zhaozg@gmail.com>
  *  - Peter Odding <peter@peterodding.com>
- * Last Change: November 6, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -56,6 +56,26 @@
  *     $ lua -e "print(require('apr').dbd('sqlite3'))"
  *     database driver (0x853bdfc)
  *
+ * ### Connection pools
+ *
+ * Opening a connection and preparing statements can take longer than the
+ * queries themselves, so programs that handle many short requests (e.g. web
+ * servers) should use a connection pool created by `apr.dbd_pool()`. Pooled
+ * connections remember the statements prepared on them, so that calling
+ * `driver:prepare()` with the same SQL on a later request reuses the
+ * statement instead of preparing it again:
+ *
+ *     local pool = assert(apr.dbd_pool('sqlite3', '/tmp/test.db', { max = 4 }))
+ *     local driver = assert(pool:acquire())
+ *     local statement = assert(driver:prepare 'SELECT name FROM users WHERE id = %d')
+ *     local results = assert(statement:select(false, 42))
+ *     -- ... use the results ...
+ *     assert(pool:release(driver))
+ *
+ * Connection pools are built on top of [APR resource lists] [reslist] and can
+ * be shared between threads using `apr.thread()`, `apr.ref()` or thread
+ * queues.
+ *
  * [sqlite]: http://en.wikipedia.org/wiki/SQLite
  * [mysql]: http://en.wikipedia.org/wiki/MySQL
  * [pgsql]: http://en.wikipedia.org/wiki/PostgreSQL
@@ -66,10 +86,17 @@
  * [dbd_binary_discuss]: http://marc.info/?l=apr-dev&m=114969441721086&w=2
  * [sqlite3_pkg]: http://packages.ubuntu.com/lucid/libaprutil1-dbd-sqlite3
  * [ld_debug]: http://www.wlug.org.nz/LD_DEBUG
+ * [reslist]: http://apr.apache.org/docs/apr/trunk/group___a_p_r___util___r_l.html
  */
 
 #include "lua_apr.h"
 #include <apr_dbd.h>
+#if APR_HAS_THREADS
+#include <apr_hash.h>
+#include <apr_reslist.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#endif
 
 /* Enable compatibility with APR 1.2? (which doesn't
  * have named columns and explicit transaction modes) */
@@ -86,6 +113,7 @@ typedef struct {
   apr_dbd_t *handle;
   apr_dbd_transaction_t *trans;
   int managed;
+  struct dbd_pooled_conn *pooled; /* see apr.dbd_pool() */
 } lua_apr_dbd_object;
 
 /* XXX The result set object's memory pool must be the same memory pool used
@@ -117,6 +145,11 @@ typedef struct {
   int random_access;
 } lua_apr_dbp_object;
 
+#if APR_HAS_THREADS
+static apr_status_t dbd_pool_discard(lua_apr_dbd_object*);
+static apr_status_t dbd_pool_prepare(lua_apr_dbd_object*, const char*, apr_dbd_prepared_t**);
+#endif
+
 /* Internal functions. {{{1 */
 
 /* check_dbd() {{{2 */
@@ -396,6 +429,11 @@ static int dbr_row_cb(lua_State *L, lua_apr_dbr_object *results, apr_dbd_row_t *
 static apr_status_t dbd_close_impl(lua_apr_dbd_object *driver)
 {
   apr_status_t status = APR_SUCCESS;
+# if APR_HAS_THREADS
+  /* Connections acquired from a pool and never released are discarded. */
+  if (driver->pooled != NULL)
+    return dbd_pool_discard(driver);
+# endif
   if (driver->handle != NULL) {
     status = apr_dbd_close(driver->driver, driver->handle);
     if (status == APR_SUCCESS) {
@@ -406,6 +444,22 @@ static apr_status_t dbd_close_impl(lua_apr_dbd_object *driver)
   return status;
 }
 
+/* dbd_init() {{{2 */
+
+static apr_status_t dbd_init(apr_pool_t *pool)
+{
+  static int ginit = 0;
+  apr_status_t status = APR_SUCCESS;
+
+  if (ginit == 0) {
+    status = apr_dbd_init(pool);
+    if (status == APR_SUCCESS)
+      ginit++;
+  }
+
+  return status;
+}
+
 /* apr.dbd(name) -> driver {{{1
  *
  * Create a database driver object. The string @name decides which database
@@ -428,8 +482,6 @@ static apr_status_t dbd_close_impl(lua_apr_dbd_object *driver)
 
 int lua_apr_dbd(lua_State *L)
 {
-  static int ginit = 0;
-
   apr_status_t status;
   lua_apr_dbd_object *driver;
   apr_pool_t *pool;
@@ -438,12 +490,9 @@ int lua_apr_dbd(lua_State *L)
   pool = to_pool(L);
   name = luaL_checkstring(L, 1);
 
-  if (ginit == 0) {
-    status = apr_dbd_init(pool);
-    if (status != APR_SUCCESS)
-      return push_error_status(L, status);
-    ginit++;
-  }
+  status = dbd_init(pool);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
 
   driver = new_object(L, &lua_apr_dbd_type);
   if (driver == NULL)
@@ -517,6 +566,8 @@ static int dbd_open(lua_State *L)
 
   driver = check_dbd(L, 1, 0, 0);
   params = luaL_checkstring(L, 2);
+  if (driver->pooled != NULL)
+    luaL_error(L, "attempt to reopen a pooled database connection");
 
   if (driver->handle != NULL) {
     /* XXX It's not clear whether apr_dbd_close() returns proper apr_status_t
@@ -775,6 +826,10 @@ static int dbd_transaction_mode(lua_State *L)
  *  - `%pDs`: TIMESTAMP
  *  - `%pDz`: TIMESTAMP WITH TIME ZONE
  *  - `%pDn`: NULL
+ *
+ * On connections acquired from a pool created by `apr.dbd_pool()` prepared
+ * statements are cached by their SQL text, so preparing the same query again
+ * is cheap.
  */
 
 static int dbd_prepare(lua_State *L)
@@ -789,6 +844,11 @@ static int dbd_prepare(lua_State *L)
   query = luaL_checkstring(L, 2);
   random_access = lua_toboolean(L, 3);
   statement = new_statement(L, 1, driver, random_access);
+# if APR_HAS_THREADS
+  if (driver->pooled != NULL)
+    status = dbd_pool_prepare(driver, query, &statement->statement);
+  else
+# endif
   status = apr_dbd_prepare(driver->driver, driver->pool, driver->handle,
       query, NULL, &statement->statement);
   if (status != APR_SUCCESS)
@@ -1115,6 +1175,528 @@ static int dbd_gc(lua_State *L)
   return 0;
 }
 
+#if APR_HAS_THREADS
+
+/* Connection pools. {{{1 */
+
+#define check_dbd_pool(L, idx) \
+  ((lua_apr_dbd_pool*)check_object((L), (idx), &lua_apr_dbd_pool_type))
+
+/* State shared by all references to a connection pool (allocated from the
+ * pool's memory pool so that apr.ref() can move the object around). */
+typedef struct {
+  apr_pool_t *memory_pool;
+  apr_thread_mutex_t *mutex;  /* protects the fields below */
+  apr_reslist_t *reslist;
+  const apr_dbd_driver_t *driver;
+  const char *params;
+  int max, max_statements;
+  lua_Number hits, misses, waits, wait_time;
+  lua_Number statement_hits, statement_misses, evictions;
+  int acquired;               /* number of connections handed out */
+  int closed;                 /* destroy when the last connection returns? */
+} dbd_pool_state;
+
+/* Prepared statement cached by a pooled connection. Each statement has its own
+ * memory pool so that evicting it runs the driver's cleanup handlers. */
+typedef struct dbd_cached_statement {
+  apr_pool_t *pool;
+  const char *sql;
+  apr_dbd_prepared_t *prepared;
+  struct dbd_cached_statement *newer, *older;
+} dbd_cached_statement;
+
+/* Pooled connection (a resource in the resource list). */
+typedef struct dbd_pooled_conn {
+  dbd_pool_state *state;
+  apr_pool_t *pool;
+  apr_dbd_t *handle;
+  apr_hash_t *statements;       /* SQL text -> dbd_cached_statement */
+  dbd_cached_statement *newest, *oldest;
+  int count, reused;
+} dbd_pooled_conn;
+
+/* Structure for connection pool objects. */
+typedef struct {
+  lua_apr_refobj header;
+  dbd_pool_state *state;
+} lua_apr_dbd_pool;
+
+/* dbd_conn_construct() {{{2 */
+
+static apr_status_t dbd_conn_construct(void **resource, void *params, apr_pool_t *unused)
+{
+  dbd_pool_state *state = params;
+  dbd_pooled_conn *conn;
+  apr_dbd_t *handle;
+  apr_pool_t *pool;
+  apr_status_t status;
+
+  /* Each connection gets its own pool so that it can be destroyed on its own. */
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return status;
+  status = apr_dbd_open(state->driver, pool, state->params, &handle);
+  if (status == APR_SUCCESS) {
+    conn = apr_pcalloc(pool, sizeof *conn);
+    conn->state = state;
+    conn->pool = pool;
+    conn->handle = handle;
+    conn->statements = apr_hash_make(pool);
+    *resource = conn;
+  } else
+    apr_pool_destroy(pool);
+
+  return status;
+}
+
+/* evict_statement() -- remove the least recently used statement {{{2 */
+
+static void evict_statement(dbd_pooled_conn *conn)
+{
+  dbd_cached_statement *entry = conn->oldest;
+
+  apr_hash_set(conn->statements, entry->sql, APR_HASH_KEY_STRING, NULL);
+  conn->oldest = entry->newer;
+  if (conn->oldest != NULL)
+    conn->oldest->older = NULL;
+  else
+    conn->newest = NULL;
+  conn->count--;
+  apr_pool_destroy(entry->pool);
+}
+
+/* dbd_conn_destruct() {{{2 */
+
+static apr_status_t dbd_conn_destruct(void *resource, void *params, apr_pool_t *unused)
+{
+  dbd_pooled_conn *conn = resource;
+  apr_status_t status;
+
+  /* Finalize the prepared statements before closing the connection. */
+  while (conn->oldest != NULL)
+    evict_statement(conn);
+  status = apr_dbd_close(conn->state->driver, conn->handle);
+  apr_pool_destroy(conn->pool);
+
+  return status;
+}
+
+/* return_conn() {{{2
+ *
+ * Return a connection to the resource list (or destroy it when it's not
+ * reusable) and destroy the connection pool when it was closed while this
+ * was the last connection handed out.
+ */
+
+static apr_status_t return_conn(dbd_pooled_conn *conn, int reusable)
+{
+  dbd_pool_state *state = conn->state;
+  apr_status_t status;
+  int destroy, evicted = 0;
+
+  if (reusable) {
+    /* Statements are only evicted between uses of a connection, because
+     * prepared statement objects of the current user may refer to them. */
+    while (conn->count > state->max_statements) {
+      evict_statement(conn);
+      evicted++;
+    }
+    conn->reused = 1;
+    status = apr_reslist_release(state->reslist, conn);
+  } else
+    status = apr_reslist_invalidate(state->reslist, conn);
+
+  apr_thread_mutex_lock(state->mutex);
+  state->evictions += evicted;
+  state->acquired--;
+  destroy = state->closed && state->acquired == 0;
+  apr_thread_mutex_unlock(state->mutex);
+  if (destroy)
+    apr_pool_destroy(state->memory_pool);
+
+  return status;
+}
+
+/* detach_conn() -- invalidate the driver object of a pooled connection {{{2 */
+
+static dbd_pooled_conn *detach_conn(lua_apr_dbd_object *driver)
+{
+  dbd_pooled_conn *conn = driver->pooled;
+
+  /* Invalidate prepared statements and result sets of this user. */
+  apr_pool_destroy(driver->pool);
+  driver->pool = NULL;
+  driver->handle = NULL;
+  driver->trans = NULL;
+  driver->pooled = NULL;
+  driver->generation++;
+
+  return conn;
+}
+
+/* dbd_pool_discard() {{{2
+ *
+ * Called by driver:close() and the garbage collector for connections that
+ * were acquired from a pool and never released.
+ */
+
+static apr_status_t dbd_pool_discard(lua_apr_dbd_object *driver)
+{
+  return return_conn(detach_conn(driver), 0);
+}
+
+/* dbd_pool_prepare() -- get a prepared statement from the cache {{{2 */
+
+static apr_status_t dbd_pool_prepare(lua_apr_dbd_object *driver, const char *sql, apr_dbd_prepared_t **prepared)
+{
+  dbd_pooled_conn *conn = driver->pooled;
+  dbd_pool_state *state = conn->state;
+  dbd_cached_statement *entry;
+  apr_status_t status;
+  apr_pool_t *pool;
+
+  entry = apr_hash_get(conn->statements, sql, APR_HASH_KEY_STRING);
+  if (entry != NULL) {
+    /* Move the statement to the front of the list. */
+    if (entry != conn->newest) {
+      entry->newer->older = entry->older;
+      if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+      else
+        conn->oldest = entry->newer;
+      entry->older = conn->newest;
+      entry->newer = NULL;
+      conn->newest->newer = entry;
+      conn->newest = entry;
+    }
+    apr_thread_mutex_lock(state->mutex);
+    state->statement_hits++;
+    apr_thread_mutex_unlock(state->mutex);
+    *prepared = entry->prepared;
+    return APR_SUCCESS;
+  }
+
+  status = apr_pool_create(&pool, conn->pool);
+  if (status != APR_SUCCESS)
+    return status;
+  entry = apr_pcalloc(pool, sizeof *entry);
+  entry->pool = pool;
+  entry->sql = apr_pstrdup(pool, sql);
+  status = apr_dbd_prepare(driver->driver, pool, conn->handle, sql, NULL, &entry->prepared);
+  if (status != APR_SUCCESS) {
+    apr_pool_destroy(pool);
+    return status;
+  }
+  apr_hash_set(conn->statements, entry->sql, APR_HASH_KEY_STRING, entry);
+  entry->older = conn->newest;
+  if (conn->newest != NULL)
+    conn->newest->newer = entry;
+  else
+    conn->oldest = entry;
+  conn->newest = entry;
+  conn->count++;
+
+  apr_thread_mutex_lock(state->mutex);
+  state->statement_misses++;
+  apr_thread_mutex_unlock(state->mutex);
+  *prepared = entry->prepared;
+
+  return APR_SUCCESS;
+}
+
+/* close_dbd_pool() {{{2 */
+
+static void close_dbd_pool(lua_apr_dbd_pool *object)
+{
+  dbd_pool_state *state = object->state;
+  int destroy;
+
+  if (object_collectable((lua_apr_refobj*)object) && state != NULL) {
+    apr_thread_mutex_lock(state->mutex);
+    state->closed = 1;
+    destroy = state->acquired == 0;
+    apr_thread_mutex_unlock(state->mutex);
+    /* Otherwise the last connection to be returned destroys the pool. */
+    if (destroy)
+      apr_pool_destroy(state->memory_pool);
+  }
+  object->state = NULL;
+  release_object((lua_apr_refobj*)object);
+}
+
+/* apr.dbd_pool(name, params [, options]) -> pool {{{1
+ *
+ * Create a pool of database connections. The string @name selects the
+ * database driver (see `apr.dbd()`) and the string @params is used to open
+ * connections (see `driver:open()`). On success the pool object is returned,
+ * otherwise a nil followed by an error message is returned. The optional table
+ * @options supports the following fields:
+ *
+ *  - `min` is the number of connections that are opened right away and kept
+ *    open (defaults to 0)
+ *  - `max` is the maximum number of connections (defaults to 8)
+ *  - `ttl` is the number of seconds after which idle connections above `min`
+ *    are closed when the pool is next used (defaults to 0 which means idle
+ *    connections are kept open); `pool:acquire()` never hands out a
+ *    connection that has been idle longer than `ttl` but opens a new one
+ *  - `timeout` is the maximum number of seconds `pool:acquire()` waits when
+ *    all connections are in use (defaults to 0 which means wait forever)
+ *  - `statements` is the number of prepared statements cached per connection
+ *    (defaults to 32)
+ */
+
+int lua_apr_dbd_pool(lua_State *L)
+{
+  lua_apr_dbd_pool *object;
+  dbd_pool_state *state;
+  const char *name, *params;
+  apr_pool_t *pool;
+  apr_status_t status;
+  int min = 0, max = 8, max_statements = 32;
+  lua_Number ttl = 0, timeout = 0;
+
+  name = luaL_checkstring(L, 1);
+  params = luaL_checkstring(L, 2);
+  lua_settop(L, 3);
+  if (!lua_isnil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_getfield(L, 3, "min");
+    if (!lua_isnil(L, -1))
+      min = luaL_checkint(L, -1);
+    lua_getfield(L, 3, "max");
+    if (!lua_isnil(L, -1))
+      max = luaL_checkint(L, -1);
+    lua_getfield(L, 3, "ttl");
+    if (!lua_isnil(L, -1))
+      ttl = luaL_checknumber(L, -1);
+    lua_getfield(L, 3, "timeout");
+    if (!lua_isnil(L, -1))
+      timeout = luaL_checknumber(L, -1);
+    lua_getfield(L, 3, "statements");
+    if (!lua_isnil(L, -1))
+      max_statements = luaL_checkint(L, -1);
+    lua_settop(L, 3);
+  }
+  luaL_argcheck(L, max > 0, 3, "max must be positive");
+  luaL_argcheck(L, min >= 0 && min <= max, 3, "min must be between 0 and max");
+  luaL_argcheck(L, max_statements >= 0, 3, "statements must not be negative");
+
+  status = dbd_init(to_pool(L));
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  state = apr_pcalloc(pool, sizeof *state);
+  state->memory_pool = pool;
+  state->params = apr_pstrdup(pool, params);
+  state->max = max;
+  state->max_statements = max_statements;
+  status = apr_dbd_get_driver(pool, name, &state->driver);
+  if (status == APR_SUCCESS)
+    status = apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  /* This opens the first `min' connections, so errors are reported here. */
+  if (status == APR_SUCCESS)
+    /* The soft maximum is @min so that idle connections above it expire. */
+    status = apr_reslist_create(&state->reslist, min, min, max,
+        (apr_interval_time_t) (ttl * APR_USEC_PER_SEC),
+        dbd_conn_construct, dbd_conn_destruct, state, pool);
+  if (status != APR_SUCCESS) {
+    apr_pool_destroy(pool);
+    return push_error_status(L, status);
+  }
+  if (timeout > 0)
+    apr_reslist_timeout_set(state->reslist, (apr_interval_time_t) (timeout * APR_USEC_PER_SEC));
+
+  object = new_object(L, &lua_apr_dbd_pool_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->state = state;
+
+  return 1;
+}
+
+/* pool:acquire() -> driver {{{1
+ *
+ * Get a database connection from the pool. An idle connection is reused when
+ * it passes a health check (see `driver:check()`), otherwise a new connection
+ * is opened. On success a driver object is returned, otherwise a nil followed
+ * by an error message is returned. When you're done with the connection, give
+ * it back using `pool:release()`.
+ */
+
+static int dbd_pool_acquire(lua_State *L)
+{
+  lua_apr_dbd_pool *object;
+  lua_apr_dbd_object *driver;
+  dbd_pool_state *state;
+  dbd_pooled_conn *conn = NULL;
+  apr_pool_t *pool = NULL;
+  apr_status_t status;
+  apr_time_t started = 0;
+  int waiting;
+
+  object = check_dbd_pool(L, 1);
+  state = object->state;
+
+  /* Find out whether we'll have to wait for a connection to be released. */
+  apr_thread_mutex_lock(state->mutex);
+  waiting = state->acquired >= state->max;
+  apr_thread_mutex_unlock(state->mutex);
+  if (waiting)
+    started = apr_time_now();
+
+  for (;;) {
+    status = apr_reslist_acquire(state->reslist, (void**)&conn);
+    if (status != APR_SUCCESS || !conn->reused
+        || apr_dbd_check_conn(state->driver, conn->pool, conn->handle) == APR_SUCCESS)
+      break;
+    /* The connection was lost while it was idle. */
+    apr_reslist_invalidate(state->reslist, conn);
+  }
+  if (status == APR_SUCCESS) {
+    /* Result sets and the like are allocated from a pool per use. */
+    status = apr_pool_create(&pool, conn->pool);
+    if (status != APR_SUCCESS)
+      apr_reslist_release(state->reslist, conn);
+  }
+
+  apr_thread_mutex_lock(state->mutex);
+  if (waiting) {
+    state->waits++;
+    state->wait_time += (lua_Number) (apr_time_now() - started) / APR_USEC_PER_SEC;
+  }
+  if (status == APR_SUCCESS) {
+    if (conn->reused)
+      state->hits++;
+    else
+      state->misses++;
+    state->acquired++;
+  }
+  apr_thread_mutex_unlock(state->mutex);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  driver = new_object(L, &lua_apr_dbd_type);
+  if (driver == NULL)
+    raise_error_memory(L);
+  driver->pool = pool;
+  driver->driver = state->driver;
+  driver->handle = conn->handle;
+  driver->managed = 1;
+  driver->pooled = conn;
+  /* Keep the connection pool alive as long as the driver is alive. */
+  object_env_private(L, -1);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "dbd_pool");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* pool:release(driver) -> reused {{{1
+ *
+ * Give a driver object acquired using `pool:acquire()` back to the pool.
+ * Prepared statements and result sets created using the driver can no longer
+ * be used afterwards. Connections with an active transaction are closed
+ * instead of being kept for reuse. Returns true when the connection was kept,
+ * false when it was closed. Either way @driver can no longer be used
+ * afterwards.
+ */
+
+static int dbd_pool_release(lua_State *L)
+{
+  lua_apr_dbd_pool *object;
+  lua_apr_dbd_object *driver;
+  dbd_pooled_conn *conn;
+  int reusable;
+
+  object = check_dbd_pool(L, 1);
+  driver = check_dbd(L, 2, 0, 0);
+  conn = driver->pooled;
+  luaL_argcheck(L, conn != NULL && conn->state == object->state, 2,
+      "driver wasn't acquired from this connection pool");
+
+  /* Don't hand out connections in the middle of a transaction. */
+  reusable = driver->trans == NULL;
+  detach_conn(driver);
+  return_conn(conn, reusable);
+  lua_pushboolean(L, reusable);
+
+  return 1;
+}
+
+/* pool:stats() -> statistics {{{1
+ *
+ * Get statistics about the connection pool. Returns a table with the
+ * following fields:
+ *
+ *  - `hits` is the number of times an idle connection was reused
+ *  - `misses` is the number of times a new connection had to be opened
+ *  - `waits` is the number of times `pool:acquire()` had to wait because
+ *    all connections were in use
+ *  - `wait_time` is the total number of seconds spent waiting
+ *  - `acquired` is the number of connections that are currently handed out
+ *  - `statement_hits` is the number of prepared statements found in a cache
+ *  - `statement_misses` is the number of statements that had to be prepared
+ *  - `evictions` is the number of statements removed from the caches
+ */
+
+static int dbd_pool_stats(lua_State *L)
+{
+  lua_apr_dbd_pool *object;
+  dbd_pool_state *state, copy;
+
+  object = check_dbd_pool(L, 1);
+  state = object->state;
+
+  /* Copy the counters so that no Lua API call (which can raise an error)
+   * happens while the mutex is locked. */
+  apr_thread_mutex_lock(state->mutex);
+  copy = *state;
+  apr_thread_mutex_unlock(state->mutex);
+
+  lua_createtable(L, 0, 8);
+  lua_pushnumber(L, copy.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, copy.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, copy.waits);
+  lua_setfield(L, -2, "waits");
+  lua_pushnumber(L, copy.wait_time);
+  lua_setfield(L, -2, "wait_time");
+  lua_pushinteger(L, copy.acquired);
+  lua_setfield(L, -2, "acquired");
+  lua_pushnumber(L, copy.statement_hits);
+  lua_setfield(L, -2, "statement_hits");
+  lua_pushnumber(L, copy.statement_misses);
+  lua_setfield(L, -2, "statement_misses");
+  lua_pushnumber(L, copy.evictions);
+  lua_setfield(L, -2, "evictions");
+
+  return 1;
+}
+
+/* pool:__tostring() {{{1 */
+
+static int dbd_pool_tostring(lua_State *L)
+{
+  lua_apr_dbd_pool *object = check_dbd_pool(L, 1);
+  lua_pushfstring(L, "%s (%p)", lua_apr_dbd_pool_type.friendlyname, object->state);
+  return 1;
+}
+
+/* pool:__gc() {{{1 */
+
+static int dbd_pool_gc(lua_State *L)
+{
+  close_dbd_pool(check_dbd_pool(L, 1));
+  return 0;
+}
+
+#endif
+
 /* Internal object definitions. {{{1 */
 
 /* Database driver objects. {{{2 */
@@ -1213,6 +1795,34 @@ lua_apr_objtype lua_apr_dbp_type = {
   dbp_metamethods             /* metamethods table */
 };
 
+/* Connection pool objects. {{{2 */
+
+#if APR_HAS_THREADS
+
+static luaL_reg dbd_pool_methods[] = {
+  { "acquire", dbd_pool_acquire },
+  { "release", dbd_pool_release },
+  { "stats", dbd_pool_stats },
+  { NULL, NULL }
+};
+
+static luaL_reg dbd_pool_metamethods[] = {
+  { "__tostring", dbd_pool_tostring },
+  { "__eq", objects_equal },
+  { "__gc", dbd_pool_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_dbd_pool_type = {
+  "lua_apr_dbd_pool*",      /* metatable name in registry */
+  "database connection pool", /* friendly object name */
+  sizeof(lua_apr_dbd_pool), /* structure size */
+  dbd_pool_methods,         /* methods table */
+  dbd_pool_metamethods      /* metamethods table */
+};
+
+#endif
+
 #ifdef SUPPORT_MOD_DBD
 #include "mod_dbd.h"
 
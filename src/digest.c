@@ -0,0 +1,1227 @@
+/* Message digest module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * These functions complement the [MD5] [md5] and [SHA1] [sha1] functions of
+ * the cryptography module with the [SHA-256 and SHA-512] [sha2] cryptographic
+ * hash functions, the [CRC32C] [crc32c] checksum and the [XXH3] [xxh3]
+ * non-cryptographic hash function. Each algorithm is available as a function
+ * that hashes a string, a function that hashes a file and a context object
+ * with the same methods as the MD5 and SHA1 context objects:
+ *
+ *     > = apr.sha256 'The quick brown fox jumps over the lazy dog'
+ *     'd7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592'
+ *     > = apr.crc32c '123456789'
+ *     'e3069283'
+ *     > context = assert(apr.xxh3_init())
+ *     > assert(context:update_from(socket, content_length))
+ *     > = context:digest()
+ *
+ * CRC32C and XXH3 are a lot faster than the cryptographic hash functions but
+ * they only protect against accidental corruption, so use SHA-256 or SHA-512
+ * when the input can be controlled by an attacker.
+ *
+ * When the processor supports them (this is checked at run time) SHA-256 uses
+ * the Intel SHA extensions, CRC32C uses the SSE 4.2 instructions (or the CRC32
+ * instructions on ARMv8 when the compiler targets them) and XXH3 uses AVX2 or
+ * SSE2. Otherwise portable C implementations are used. The script
+ * `benchmarks/digests.lua` measures the throughput of all message digests.
+ *
+ * [md5]: http://en.wikipedia.org/wiki/MD5
+ * [sha1]: http://en.wikipedia.org/wiki/SHA1
+ * [sha2]: http://en.wikipedia.org/wiki/SHA-2
+ * [crc32c]: http://en.wikipedia.org/wiki/Cyclic_redundancy_check
+ * [xxh3]: http://cyan4973.github.io/xxHash/
+ */
+
+#include "lua_apr.h"
+#include <string.h>
+
+#if ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define DIGEST_X86 1
+# include <cpuid.h>
+# include <immintrin.h>
+#else
+# define DIGEST_X86 0
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+# include <arm_acle.h>
+#endif
+
+/* Internal functions {{{1 */
+
+/* Processor features detected by digest_init() (also used by base64.c). */
+int lua_apr_cpu_features = 0;
+
+#define have_sha_ni (lua_apr_cpu_features & LUA_APR_CPU_SHA)
+#define have_sse42 (lua_apr_cpu_features & LUA_APR_CPU_SSE42)
+#define have_avx2 (lua_apr_cpu_features & LUA_APR_CPU_AVX2)
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static apr_uint32_t load_le32(const unsigned char *p)
+{
+  return (apr_uint32_t)p[0] | ((apr_uint32_t)p[1] << 8)
+       | ((apr_uint32_t)p[2] << 16) | ((apr_uint32_t)p[3] << 24);
+}
+
+static apr_uint64_t load_le64(const unsigned char *p)
+{
+  return (apr_uint64_t)load_le32(p) | ((apr_uint64_t)load_le32(p + 4) << 32);
+}
+
+static apr_uint32_t load_be32(const unsigned char *p)
+{
+  return ((apr_uint32_t)p[0] << 24) | ((apr_uint32_t)p[1] << 16)
+       | ((apr_uint32_t)p[2] << 8) | (apr_uint32_t)p[3];
+}
+
+static apr_uint64_t load_be64(const unsigned char *p)
+{
+  return ((apr_uint64_t)load_be32(p) << 32) | (apr_uint64_t)load_be32(p + 4);
+}
+
+static void store_be32(unsigned char *p, apr_uint32_t v)
+{
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static void store_be64(unsigned char *p, apr_uint64_t v)
+{
+  store_be32(p, (apr_uint32_t)(v >> 32));
+  store_be32(p + 4, (apr_uint32_t)v);
+}
+
+/* block_update() -- buffer input for hash functions that work on blocks {{{2 */
+
+typedef void (*block_f)(void*, const unsigned char*, apr_size_t);
+
+static void block_update(void *state, block_f compress, unsigned char *block,
+    apr_size_t blocksize, apr_uint64_t *total, const unsigned char *data, apr_size_t length)
+{
+  apr_size_t used = (apr_size_t)(*total % blocksize), n;
+
+  *total += length;
+  if (used > 0) {
+    n = blocksize - used;
+    if (n > length)
+      n = length;
+    memcpy(block + used, data, n);
+    data += n, length -= n;
+    if (used + n < blocksize)
+      return;
+    compress(state, block, 1);
+  }
+  if (length >= blocksize) {
+    compress(state, data, length / blocksize);
+    data += length - length % blocksize;
+    length %= blocksize;
+  }
+  memcpy(block, data, length);
+}
+
+/* SHA-256 {{{2 */
+
+typedef struct {
+  apr_uint32_t state[8];
+  apr_uint64_t total;
+  unsigned char block[64];
+} sha256_ctx;
+
+static const apr_uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+static void sha256_blocks_c(apr_uint32_t *state, const unsigned char *data, apr_size_t blocks)
+{
+  apr_uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  while (blocks-- > 0) {
+    for (i = 0; i < 16; i++)
+      w[i] = load_be32(data + i * 4);
+    for (i = 16; i < 64; i++)
+      w[i] = (ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10)) + w[i-7]
+           + (ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3)) + w[i-16];
+    a = state[0], b = state[1], c = state[2], d = state[3];
+    e = state[4], f = state[5], g = state[6], h = state[7];
+    for (i = 0; i < 64; i++) {
+      t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + CH(e, f, g) + sha256_k[i] + w[i];
+      t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + MAJ(a, b, c);
+      h = g, g = f, f = e, e = d + t1;
+      d = c, c = b, b = a, a = t1 + t2;
+    }
+    state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+    state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+    data += 64;
+  }
+}
+
+#if DIGEST_X86
+
+/* SHA-256 using the Intel SHA extensions. Each sha256rnds2 instruction
+ * performs two rounds on the state, which is kept in the ABEF/CDGH order the
+ * instructions expect, and sha256msg1/sha256msg2 compute the message schedule
+ * four words at a time. */
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(apr_uint32_t *state, const unsigned char *data, apr_size_t blocks)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+  int i;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  while (blocks-- > 0) {
+    abef = state0, cdgh = state1;
+    for (i = 0; i < 16; i++) {
+      if (i < 4) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), mask);
+      } else {
+        tmp = _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                            _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+        w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+      }
+      msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i*)&sha256_k[i * 4]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += 64;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i*)&state[0], state0);
+  _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+#endif
+
+static void sha256_blocks(void *state, const unsigned char *data, apr_size_t blocks)
+{
+# if DIGEST_X86
+  if (have_sha_ni) {
+    sha256_blocks_shani(state, data, blocks);
+    return;
+  }
+# endif
+  sha256_blocks_c(state, data, blocks);
+}
+
+static void sha256_init(void *context)
+{
+  static const apr_uint32_t initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  sha256_ctx *ctx = context;
+  memcpy(ctx->state, initial, sizeof initial);
+  ctx->total = 0;
+}
+
+static void sha256_update(void *context, const void *data, apr_size_t length)
+{
+  sha256_ctx *ctx = context;
+  block_update(ctx->state, sha256_blocks, ctx->block, sizeof ctx->block, &ctx->total, data, length);
+}
+
+static void sha256_final(void *context, unsigned char *digest)
+{
+  sha256_ctx *ctx = context;
+  apr_size_t used = (apr_size_t)(ctx->total % 64);
+  int i;
+
+  ctx->block[used++] = 0x80;
+  if (used > 56) {
+    memset(ctx->block + used, 0, 64 - used);
+    sha256_blocks(ctx->state, ctx->block, 1);
+    used = 0;
+  }
+  memset(ctx->block + used, 0, 56 - used);
+  store_be64(ctx->block + 56, ctx->total * 8);
+  sha256_blocks(ctx->state, ctx->block, 1);
+  for (i = 0; i < 8; i++)
+    store_be32(digest + i * 4, ctx->state[i]);
+}
+
+/* SHA-512 {{{2 */
+
+typedef struct {
+  apr_uint64_t state[8];
+  apr_uint64_t total;
+  unsigned char block[128];
+} sha512_ctx;
+
+static const apr_uint64_t sha512_k[80] = {
+  APR_UINT64_C(0x428a2f98d728ae22), APR_UINT64_C(0x7137449123ef65cd),
+  APR_UINT64_C(0xb5c0fbcfec4d3b2f), APR_UINT64_C(0xe9b5dba58189dbbc),
+  APR_UINT64_C(0x3956c25bf348b538), APR_UINT64_C(0x59f111f1b605d019),
+  APR_UINT64_C(0x923f82a4af194f9b), APR_UINT64_C(0xab1c5ed5da6d8118),
+  APR_UINT64_C(0xd807aa98a3030242), APR_UINT64_C(0x12835b0145706fbe),
+  APR_UINT64_C(0x243185be4ee4b28c), APR_UINT64_C(0x550c7dc3d5ffb4e2),
+  APR_UINT64_C(0x72be5d74f27b896f), APR_UINT64_C(0x80deb1fe3b1696b1),
+  APR_UINT64_C(0x9bdc06a725c71235), APR_UINT64_C(0xc19bf174cf692694),
+  APR_UINT64_C(0xe49b69c19ef14ad2), APR_UINT64_C(0xefbe4786384f25e3),
+  APR_UINT64_C(0x0fc19dc68b8cd5b5), APR_UINT64_C(0x240ca1cc77ac9c65),
+  APR_UINT64_C(0x2de92c6f592b0275), APR_UINT64_C(0x4a7484aa6ea6e483),
+  APR_UINT64_C(0x5cb0a9dcbd41fbd4), APR_UINT64_C(0x76f988da831153b5),
+  APR_UINT64_C(0x983e5152ee66dfab), APR_UINT64_C(0xa831c66d2db43210),
+  APR_UINT64_C(0xb00327c898fb213f), APR_UINT64_C(0xbf597fc7beef0ee4),
+  APR_UINT64_C(0xc6e00bf33da88fc2), APR_UINT64_C(0xd5a79147930aa725),
+  APR_UINT64_C(0x06ca6351e003826f), APR_UINT64_C(0x142929670a0e6e70),
+  APR_UINT64_C(0x27b70a8546d22ffc), APR_UINT64_C(0x2e1b21385c26c926),
+  APR_UINT64_C(0x4d2c6dfc5ac42aed), APR_UINT64_C(0x53380d139d95b3df),
+  APR_UINT64_C(0x650a73548baf63de), APR_UINT64_C(0x766a0abb3c77b2a8),
+  APR_UINT64_C(0x81c2c92e47edaee6), APR_UINT64_C(0x92722c851482353b),
+  APR_UINT64_C(0xa2bfe8a14cf10364), APR_UINT64_C(0xa81a664bbc423001),
+  APR_UINT64_C(0xc24b8b70d0f89791), APR_UINT64_C(0xc76c51a30654be30),
+  APR_UINT64_C(0xd192e819d6ef5218), APR_UINT64_C(0xd69906245565a910),
+  APR_UINT64_C(0xf40e35855771202a), APR_UINT64_C(0x106aa07032bbd1b8),
+  APR_UINT64_C(0x19a4c116b8d2d0c8), APR_UINT64_C(0x1e376c085141ab53),
+  APR_UINT64_C(0x2748774cdf8eeb99), APR_UINT64_C(0x34b0bcb5e19b48a8),
+  APR_UINT64_C(0x391c0cb3c5c95a63), APR_UINT64_C(0x4ed8aa4ae3418acb),
+  APR_UINT64_C(0x5b9cca4f7763e373), APR_UINT64_C(0x682e6ff3d6b2b8a3),
+  APR_UINT64_C(0x748f82ee5defb2fc), APR_UINT64_C(0x78a5636f43172f60),
+  APR_UINT64_C(0x84c87814a1f0ab72), APR_UINT64_C(0x8cc702081a6439ec),
+  APR_UINT64_C(0x90befffa23631e28), APR_UINT64_C(0xa4506cebde82bde9),
+  APR_UINT64_C(0xbef9a3f7b2c67915), APR_UINT64_C(0xc67178f2e372532b),
+  APR_UINT64_C(0xca273eceea26619c), APR_UINT64_C(0xd186b8c721c0c207),
+  APR_UINT64_C(0xeada7dd6cde0eb1e), APR_UINT64_C(0xf57d4f7fee6ed178),
+  APR_UINT64_C(0x06f067aa72176fba), APR_UINT64_C(0x0a637dc5a2c898a6),
+  APR_UINT64_C(0x113f9804bef90dae), APR_UINT64_C(0x1b710b35131c471b),
+  APR_UINT64_C(0x28db77f523047d84), APR_UINT64_C(0x32caab7b40c72493),
+  APR_UINT64_C(0x3c9ebe0a15c9bebc), APR_UINT64_C(0x431d67c49c100d4c),
+  APR_UINT64_C(0x4cc5d4becb3e42b6), APR_UINT64_C(0x597f299cfc657e2a),
+  APR_UINT64_C(0x5fcb6fab3ad6faec), APR_UINT64_C(0x6c44198c4a475817),
+};
+
+static void sha512_blocks(void *context, const unsigned char *data, apr_size_t blocks)
+{
+  apr_uint64_t *state = context, w[80], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  while (blocks-- > 0) {
+    for (i = 0; i < 16; i++)
+      w[i] = load_be64(data + i * 8);
+    for (i = 16; i < 80; i++)
+      w[i] = (ROTR64(w[i-2], 19) ^ ROTR64(w[i-2], 61) ^ (w[i-2] >> 6)) + w[i-7]
+           + (ROTR64(w[i-15], 1) ^ ROTR64(w[i-15], 8) ^ (w[i-15] >> 7)) + w[i-16];
+    a = state[0], b = state[1], c = state[2], d = state[3];
+    e = state[4], f = state[5], g = state[6], h = state[7];
+    for (i = 0; i < 80; i++) {
+      t1 = h + (ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41)) + CH(e, f, g) + sha512_k[i] + w[i];
+      t2 = (ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39)) + MAJ(a, b, c);
+      h = g, g = f, f = e, e = d + t1;
+      d = c, c = b, b = a, a = t1 + t2;
+    }
+    state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+    state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+    data += 128;
+  }
+}
+
+static void sha512_init(void *context)
+{
+  static const apr_uint64_t initial[8] = {
+    APR_UINT64_C(0x6a09e667f3bcc908), APR_UINT64_C(0xbb67ae8584caa73b),
+    APR_UINT64_C(0x3c6ef372fe94f82b), APR_UINT64_C(0xa54ff53a5f1d36f1),
+    APR_UINT64_C(0x510e527fade682d1), APR_UINT64_C(0x9b05688c2b3e6c1f),
+    APR_UINT64_C(0x1f83d9abfb41bd6b), APR_UINT64_C(0x5be0cd19137e2179),
+  };
+  sha512_ctx *ctx = context;
+  memcpy(ctx->state, initial, sizeof initial);
+  ctx->total = 0;
+}
+
+static void sha512_update(void *context, const void *data, apr_size_t length)
+{
+  sha512_ctx *ctx = context;
+  block_update(ctx->state, sha512_blocks, ctx->block, sizeof ctx->block, &ctx->total, data, length);
+}
+
+static void sha512_final(void *context, unsigned char *digest)
+{
+  sha512_ctx *ctx = context;
+  apr_size_t used = (apr_size_t)(ctx->total % 128);
+  int i;
+
+  ctx->block[used++] = 0x80;
+  if (used > 112) {
+    memset(ctx->block + used, 0, 128 - used);
+    sha512_blocks(ctx->state, ctx->block, 1);
+    used = 0;
+  }
+  memset(ctx->block + used, 0, 112 - used);
+  store_be64(ctx->block + 112, ctx->total >> 61);
+  store_be64(ctx->block + 120, ctx->total << 3);
+  sha512_blocks(ctx->state, ctx->block, 1);
+  for (i = 0; i < 8; i++)
+    store_be64(digest + i * 8, ctx->state[i]);
+}
+
+/* CRC32C {{{2 */
+
+typedef struct {
+  apr_uint32_t crc;
+} crc32c_ctx;
+
+/* Lookup tables for the portable implementation (slicing by 8). */
+static apr_uint32_t crc32c_table[8][256];
+
+static apr_uint32_t crc32c_c(apr_uint32_t crc, const unsigned char *p, apr_size_t n)
+{
+  apr_uint32_t lo, hi;
+
+  while (n >= 8) {
+    lo = load_le32(p) ^ crc;
+    hi = load_le32(p + 4);
+    crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF]
+        ^ crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24]
+        ^ crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF]
+        ^ crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+    p += 8, n -= 8;
+  }
+  while (n-- > 0)
+    crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+  return crc;
+}
+
+#if DIGEST_X86
+
+__attribute__((target("sse4.2")))
+static apr_uint32_t crc32c_sse42(apr_uint32_t crc, const unsigned char *p, apr_size_t n)
+{
+# if defined(__x86_64__)
+  apr_uint64_t crc64 = crc;
+  while (n >= 8) {
+    crc64 = _mm_crc32_u64(crc64, load_le64(p));
+    p += 8, n -= 8;
+  }
+  crc = (apr_uint32_t)crc64;
+# endif
+  while (n >= 4) {
+    crc = _mm_crc32_u32(crc, load_le32(p));
+    p += 4, n -= 4;
+  }
+  while (n-- > 0)
+    crc = _mm_crc32_u8(crc, *p++);
+
+  return crc;
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+static apr_uint32_t crc32c_arm(apr_uint32_t crc, const unsigned char *p, apr_size_t n)
+{
+  while (n >= 8) {
+    crc = __crc32cd(crc, load_le64(p));
+    p += 8, n -= 8;
+  }
+  while (n-- > 0)
+    crc = __crc32cb(crc, *p++);
+
+  return crc;
+}
+
+#endif
+
+static void crc32c_init(void *context)
+{
+  ((crc32c_ctx*)context)->crc = 0xFFFFFFFF;
+}
+
+static void crc32c_update(void *context, const void *data, apr_size_t length)
+{
+  crc32c_ctx *ctx = context;
+# if DIGEST_X86
+  if (have_sse42) {
+    ctx->crc = crc32c_sse42(ctx->crc, data, length);
+    return;
+  }
+# elif defined(__ARM_FEATURE_CRC32)
+  ctx->crc = crc32c_arm(ctx->crc, data, length);
+  return;
+# endif
+  ctx->crc = crc32c_c(ctx->crc, data, length);
+}
+
+static void crc32c_final(void *context, unsigned char *digest)
+{
+  store_be32(digest, ((crc32c_ctx*)context)->crc ^ 0xFFFFFFFF);
+}
+
+/* XXH3 (64 bit variant with the default secret and seed) {{{2 */
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 APR_UINT64_C(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2 APR_UINT64_C(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3 APR_UINT64_C(0x165667B19E3779F9)
+#define XXH_PRIME64_4 APR_UINT64_C(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5 APR_UINT64_C(0x27D4EB2F165667C5)
+#define XXH_PRIME_MX1 APR_UINT64_C(0x165667919E3779F9)
+#define XXH_PRIME_MX2 APR_UINT64_C(0x9FB21C651E98DF25)
+
+#define XXH3_STRIPE 64        /* bytes consumed by each accumulation */
+#define XXH3_BLOCK_STRIPES 16 /* stripes between scrambles */
+#define XXH3_BUFSIZE 256      /* input buffered between updates */
+#define XXH3_MIDSIZE_MAX 240  /* longest input hashed without accumulators */
+
+static const unsigned char xxh3_secret[192] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+  0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+  0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+  0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+  0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+  0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+  0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+  0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+  0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+  0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+  0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+  0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+  0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef struct {
+  apr_uint64_t acc[8];
+  apr_uint64_t total;
+  apr_size_t buffered, stripes;
+  unsigned char buffer[XXH3_BUFSIZE];
+} xxh3_ctx;
+
+static apr_uint64_t xxh3_mul128_fold64(apr_uint64_t a, apr_uint64_t b)
+{
+# if defined(__SIZEOF_INT128__)
+  unsigned __int128 product = (unsigned __int128)a * b;
+  return (apr_uint64_t)product ^ (apr_uint64_t)(product >> 64);
+# else
+  apr_uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  apr_uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+  apr_uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+  apr_uint64_t hi_hi = (a >> 32) * (b >> 32);
+  apr_uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  apr_uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  apr_uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+# endif
+}
+
+static apr_uint64_t xxh64_avalanche(apr_uint64_t h)
+{
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  return h ^ (h >> 32);
+}
+
+static apr_uint64_t xxh3_avalanche(apr_uint64_t h)
+{
+  h ^= h >> 37;
+  h *= XXH_PRIME_MX1;
+  return h ^ (h >> 32);
+}
+
+static apr_uint64_t xxh3_mix16(const unsigned char *input, const unsigned char *secret)
+{
+  return xxh3_mul128_fold64(load_le64(input) ^ load_le64(secret),
+                            load_le64(input + 8) ^ load_le64(secret + 8));
+}
+
+/* Hash inputs of up to XXH3_MIDSIZE_MAX bytes. */
+
+static apr_uint64_t xxh3_short(const unsigned char *input, apr_size_t len)
+{
+  const unsigned char *secret = xxh3_secret;
+  apr_uint64_t acc, acc_end, lo, hi;
+  unsigned char bytes[8];
+  apr_size_t i;
+
+  if (len == 0) {
+    return xxh64_avalanche(load_le64(secret + 56) ^ load_le64(secret + 64));
+  } else if (len <= 3) {
+    apr_uint32_t combined = ((apr_uint32_t)input[0] << 16) | ((apr_uint32_t)input[len >> 1] << 24)
+                          | (apr_uint32_t)input[len - 1] | ((apr_uint32_t)len << 8);
+    return xxh64_avalanche(combined ^ (apr_uint64_t)(load_le32(secret) ^ load_le32(secret + 4)));
+  } else if (len <= 8) {
+    acc = (load_le32(input + len - 4) + ((apr_uint64_t)load_le32(input) << 32))
+        ^ (load_le64(secret + 8) ^ load_le64(secret + 16));
+    acc ^= ROTL64(acc, 49) ^ ROTL64(acc, 24);
+    acc *= XXH_PRIME_MX2;
+    acc ^= (acc >> 35) + len;
+    acc *= XXH_PRIME_MX2;
+    return acc ^ (acc >> 28);
+  } else if (len <= 16) {
+    lo = load_le64(input) ^ (load_le64(secret + 24) ^ load_le64(secret + 32));
+    hi = load_le64(input + len - 8) ^ (load_le64(secret + 40) ^ load_le64(secret + 48));
+    store_be64(bytes, lo); /* byte swap */
+    acc = len + load_le64(bytes) + hi + xxh3_mul128_fold64(lo, hi);
+    return xxh3_avalanche(acc);
+  } else if (len <= 128) {
+    acc = len * XXH_PRIME64_1;
+    for (i = 0; i < 4 && i * 32 < len; i++) {
+      acc += xxh3_mix16(input + 16 * i, secret + 32 * i);
+      acc += xxh3_mix16(input + len - 16 * (i + 1), secret + 32 * i + 16);
+    }
+    return xxh3_avalanche(acc);
+  }
+  acc = len * XXH_PRIME64_1;
+  for (i = 0; i < 8; i++)
+    acc += xxh3_mix16(input + 16 * i, secret + 16 * i);
+  acc = xxh3_avalanche(acc);
+  acc_end = xxh3_mix16(input + len - 16, secret + 119);
+  for (i = 8; i < len / 16; i++)
+    acc_end += xxh3_mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+  return xxh3_avalanche(acc + acc_end);
+}
+
+/* Accumulate a number of stripes into the eight 64 bit lanes. */
+
+#if !(DIGEST_X86 && defined(__SSE2__))
+
+static void xxh3_accumulate_c(apr_uint64_t *acc, const unsigned char *input,
+    const unsigned char *secret, apr_size_t stripes)
+{
+  apr_uint64_t value, key;
+  int i;
+
+  while (stripes-- > 0) {
+    for (i = 0; i < 8; i++) {
+      value = load_le64(input + i * 8);
+      key = value ^ load_le64(secret + i * 8);
+      acc[i ^ 1] += value;
+      acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+    input += XXH3_STRIPE, secret += 8;
+  }
+}
+
+#else
+
+static void xxh3_accumulate_sse2(apr_uint64_t *acc, const unsigned char *input,
+    const unsigned char *secret, apr_size_t stripes)
+{
+  __m128i lanes[4], data, key;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    lanes[i] = _mm_loadu_si128((const __m128i*)(acc + i * 2));
+  while (stripes-- > 0) {
+    for (i = 0; i < 4; i++) {
+      data = _mm_loadu_si128((const __m128i*)(input + i * 16));
+      key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)(secret + i * 16)));
+      lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(
+            _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1))),
+            _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    input += XXH3_STRIPE, secret += 8;
+  }
+  for (i = 0; i < 4; i++)
+    _mm_storeu_si128((__m128i*)(acc + i * 2), lanes[i]);
+}
+
+#endif
+
+#if DIGEST_X86
+
+__attribute__((target("avx2")))
+static void xxh3_accumulate_avx2(apr_uint64_t *acc, const unsigned char *input,
+    const unsigned char *secret, apr_size_t stripes)
+{
+  __m256i lanes[2], data, key;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    lanes[i] = _mm256_loadu_si256((const __m256i*)(acc + i * 4));
+  while (stripes-- > 0) {
+    for (i = 0; i < 2; i++) {
+      data = _mm256_loadu_si256((const __m256i*)(input + i * 32));
+      key = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i*)(secret + i * 32)));
+      lanes[i] = _mm256_add_epi64(lanes[i], _mm256_add_epi64(
+            _mm256_mul_epu32(key, _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1))),
+            _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    input += XXH3_STRIPE, secret += 8;
+  }
+  for (i = 0; i < 2; i++)
+    _mm256_storeu_si256((__m256i*)(acc + i * 4), lanes[i]);
+}
+
+#endif
+
+static void xxh3_accumulate(apr_uint64_t *acc, const unsigned char *input,
+    const unsigned char *secret, apr_size_t stripes)
+{
+# if DIGEST_X86
+  if (have_avx2) {
+    xxh3_accumulate_avx2(acc, input, secret, stripes);
+    return;
+  }
+# endif
+# if DIGEST_X86 && defined(__SSE2__)
+  xxh3_accumulate_sse2(acc, input, secret, stripes);
+# else
+  xxh3_accumulate_c(acc, input, secret, stripes);
+# endif
+}
+
+static void xxh3_scramble(apr_uint64_t *acc)
+{
+  const unsigned char *secret = xxh3_secret + sizeof xxh3_secret - XXH3_STRIPE;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    acc[i] ^= acc[i] >> 47;
+    acc[i] ^= load_le64(secret + i * 8);
+    acc[i] *= XXH_PRIME32_1;
+  }
+}
+
+/* Accumulate stripes, scrambling the accumulators after each block. */
+
+static const unsigned char *xxh3_consume(apr_uint64_t *acc, apr_size_t *stripes_so_far,
+    const unsigned char *input, apr_size_t stripes)
+{
+  apr_size_t n;
+
+  while (stripes > 0) {
+    n = XXH3_BLOCK_STRIPES - *stripes_so_far;
+    if (n > stripes)
+      n = stripes;
+    xxh3_accumulate(acc, input, xxh3_secret + *stripes_so_far * 8, n);
+    input += n * XXH3_STRIPE, stripes -= n;
+    *stripes_so_far += n;
+    if (*stripes_so_far == XXH3_BLOCK_STRIPES) {
+      xxh3_scramble(acc);
+      *stripes_so_far = 0;
+    }
+  }
+
+  return input;
+}
+
+static void xxh3_init(void *context)
+{
+  static const apr_uint64_t initial[8] = {
+    XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+    XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+  };
+  xxh3_ctx *ctx = context;
+  memcpy(ctx->acc, initial, sizeof initial);
+  ctx->total = 0;
+  ctx->buffered = 0;
+  ctx->stripes = 0;
+}
+
+static void xxh3_update(void *context, const void *data, apr_size_t length)
+{
+  xxh3_ctx *ctx = context;
+  const unsigned char *input = data, *end = input + length;
+  apr_size_t n;
+
+  ctx->total += length;
+  if (length <= XXH3_BUFSIZE - ctx->buffered) {
+    memcpy(ctx->buffer + ctx->buffered, input, length);
+    ctx->buffered += length;
+    return;
+  }
+  /* Always keep at least one byte of input buffered so that the last stripe
+   * is handled by xxh3_final(). */
+  if (ctx->buffered > 0) {
+    n = XXH3_BUFSIZE - ctx->buffered;
+    memcpy(ctx->buffer + ctx->buffered, input, n);
+    input += n;
+    xxh3_consume(ctx->acc, &ctx->stripes, ctx->buffer, XXH3_BUFSIZE / XXH3_STRIPE);
+    ctx->buffered = 0;
+  }
+  if (end - input > XXH3_BUFSIZE) {
+    input = xxh3_consume(ctx->acc, &ctx->stripes, input, (apr_size_t)(end - 1 - input) / XXH3_STRIPE);
+    /* The last stripe may be needed to complete a short final stripe. */
+    memcpy(ctx->buffer + XXH3_BUFSIZE - XXH3_STRIPE, input - XXH3_STRIPE, XXH3_STRIPE);
+  }
+  memcpy(ctx->buffer, input, (apr_size_t)(end - input));
+  ctx->buffered = (apr_size_t)(end - input);
+}
+
+static void xxh3_final(void *context, unsigned char *digest)
+{
+  xxh3_ctx *ctx = context;
+  apr_uint64_t acc[8], result;
+  apr_size_t stripes_so_far = ctx->stripes, n;
+  unsigned char last[XXH3_STRIPE];
+  const unsigned char *stripe;
+  int i;
+
+  if (ctx->total <= XXH3_MIDSIZE_MAX) {
+    store_be64(digest, xxh3_short(ctx->buffer, (apr_size_t)ctx->total));
+    return;
+  }
+  memcpy(acc, ctx->acc, sizeof acc);
+  if (ctx->buffered >= XXH3_STRIPE) {
+    xxh3_consume(acc, &stripes_so_far, ctx->buffer, (ctx->buffered - 1) / XXH3_STRIPE);
+    stripe = ctx->buffer + ctx->buffered - XXH3_STRIPE;
+  } else {
+    n = XXH3_STRIPE - ctx->buffered;
+    memcpy(last, ctx->buffer + XXH3_BUFSIZE - n, n);
+    memcpy(last + n, ctx->buffer, ctx->buffered);
+    stripe = last;
+  }
+  xxh3_accumulate(acc, stripe, xxh3_secret + sizeof xxh3_secret - XXH3_STRIPE - 7, 1);
+  result = ctx->total * XXH_PRIME64_1;
+  for (i = 0; i < 4; i++)
+    result += xxh3_mul128_fold64(acc[i * 2] ^ load_le64(xxh3_secret + 11 + i * 16),
+                                 acc[i * 2 + 1] ^ load_le64(xxh3_secret + 11 + i * 16 + 8));
+  store_be64(digest, xxh3_avalanche(result));
+}
+
+/* Lua interface {{{2 */
+
+typedef struct {
+  const char *name;
+  int digestsize;
+  void (*init)(void*);
+  lua_apr_hash_f update;
+  void (*final)(void*, unsigned char*);
+} digest_algorithm;
+
+typedef union {
+  sha256_ctx sha256;
+  sha512_ctx sha512;
+  crc32c_ctx crc32c;
+  xxh3_ctx xxh3;
+} digest_state;
+
+typedef struct {
+  lua_apr_refobj header;
+  const digest_algorithm *algorithm;
+  int finalized;
+  digest_state state;
+} lua_apr_digest_ctx;
+
+static const digest_algorithm sha256_algorithm = {
+  "sha256", 32, sha256_init, sha256_update, sha256_final
+};
+
+static const digest_algorithm sha512_algorithm = {
+  "sha512", 64, sha512_init, sha512_update, sha512_final
+};
+
+static const digest_algorithm crc32c_algorithm = {
+  "crc32c", 4, crc32c_init, crc32c_update, crc32c_final
+};
+
+static const digest_algorithm xxh3_algorithm = {
+  "xxh3", 8, xxh3_init, xxh3_update, xxh3_final
+};
+
+static lua_apr_digest_ctx *digest_check(lua_State *L, int idx, int valid)
+{
+  lua_apr_digest_ctx *context;
+  context = check_object(L, idx, &lua_apr_digest_type);
+  if (valid && context->finalized)
+    luaL_error(L, "attempt to use a finalized %s context", context->algorithm->name);
+  return context;
+}
+
+static int digest_string(lua_State *L, const digest_algorithm *algorithm)
+{
+  digest_state state;
+  unsigned char digest[64];
+  const char *input;
+  size_t length;
+
+  input = luaL_checklstring(L, 1, &length);
+  algorithm->init(&state);
+  algorithm->update(&state, input, length);
+  algorithm->final(&state, digest);
+  memset(&state, 42, sizeof state);
+
+  return push_digest(L, digest, algorithm->digestsize, lua_toboolean(L, 2));
+}
+
+static int digest_path(lua_State *L, const digest_algorithm *algorithm)
+{
+  digest_state state;
+  unsigned char digest[64];
+  apr_status_t status;
+
+  algorithm->init(&state);
+  status = hash_file(L, algorithm->update, &state);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  algorithm->final(&state, digest);
+  memset(&state, 42, sizeof state);
+
+  return push_digest(L, digest, algorithm->digestsize, lua_toboolean(L, 2));
+}
+
+static int digest_new(lua_State *L, const digest_algorithm *algorithm)
+{
+  lua_apr_digest_ctx *object;
+
+  object = new_object(L, &lua_apr_digest_type);
+  if (object == NULL)
+    return push_error_memory(L);
+  object->algorithm = algorithm;
+  algorithm->init(&object->state);
+
+  return 1;
+}
+
+/* digest_init() -- detect processor features and build lookup tables {{{2 */
+
+apr_status_t digest_init(apr_pool_t *pool)
+{
+  apr_uint32_t crc;
+  int i, j;
+# if DIGEST_X86
+  unsigned int eax, ebx, ecx = 0, edx, xcr0 = 0;
+# endif
+
+  (void) pool;
+
+  for (i = 0; i < 256; i++) {
+    crc = (apr_uint32_t)i;
+    for (j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      crc32c_table[j][i] = (crc32c_table[j-1][i] >> 8) ^ crc32c_table[0][crc32c_table[j-1][i] & 0xFF];
+
+# if DIGEST_X86
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    if ((ecx >> 9) & 1)
+      lua_apr_cpu_features |= LUA_APR_CPU_SSSE3;
+    if ((ecx >> 20) & 1)
+      lua_apr_cpu_features |= LUA_APR_CPU_SSE42;
+    /* AVX2 also needs the operating system to save the YMM registers. */
+    if ((ecx >> 27) & 1)
+      __asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+  }
+  if (__get_cpuid_max(0, NULL) >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (((ebx >> 5) & 1) && (xcr0 & 6) == 6)
+      lua_apr_cpu_features |= LUA_APR_CPU_AVX2;
+    if (((ebx >> 29) & 1) && have_sse42)
+      lua_apr_cpu_features |= LUA_APR_CPU_SHA;
+  }
+# endif
+
+  return APR_SUCCESS;
+}
+
+/* apr.sha256(input [, binary]) -> digest {{{1
+ *
+ * Calculate the [SHA-256] [sha2] message digest of the string @input. On
+ * success the digest is returned as a string of 64 hexadecimal characters, or
+ * a string of 32 bytes if @binary evaluates to true. Otherwise a nil followed
+ * by an error message is returned.
+ *
+ * *This function is binary safe.*
+ */
+
+int lua_apr_sha256(lua_State *L)
+{
+  return digest_string(L, &sha256_algorithm);
+}
+
+/* apr.sha256_file(path [, binary]) -> digest {{{1
+ *
+ * Calculate the [SHA-256] [sha2] message digest of the file at @path without
+ * creating any Lua strings (see also `apr.md5_file()`). The return values are
+ * the same as for `apr.sha256()`.
+ */
+
+int lua_apr_sha256_file(lua_State *L)
+{
+  return digest_path(L, &sha256_algorithm);
+}
+
+/* apr.sha256_init() -> digest_context {{{1
+ *
+ * Create and return an object that can be used to calculate [SHA-256] [sha2]
+ * message digests in steps. If an error occurs a nil followed by an error
+ * message is returned. See also the example for `apr.md5_init()`.
+ */
+
+int lua_apr_sha256_init(lua_State *L)
+{
+  return digest_new(L, &sha256_algorithm);
+}
+
+/* apr.sha512(input [, binary]) -> digest {{{1
+ *
+ * Calculate the [SHA-512] [sha2] message digest of the string @input. On
+ * success the digest is returned as a string of 128 hexadecimal characters,
+ * or a string of 64 bytes if @binary evaluates to true. Otherwise a nil
+ * followed by an error message is returned.
+ *
+ * *This function is binary safe.*
+ */
+
+int lua_apr_sha512(lua_State *L)
+{
+  return digest_string(L, &sha512_algorithm);
+}
+
+/* apr.sha512_file(path [, binary]) -> digest {{{1
+ *
+ * Calculate the [SHA-512] [sha2] message digest of the file at @path. The
+ * return values are the same as for `apr.sha512()`.
+ */
+
+int lua_apr_sha512_file(lua_State *L)
+{
+  return digest_path(L, &sha512_algorithm);
+}
+
+/* apr.sha512_init() -> digest_context {{{1
+ *
+ * Create and return an object that can be used to calculate [SHA-512] [sha2]
+ * message digests in steps.
+ */
+
+int lua_apr_sha512_init(lua_State *L)
+{
+  return digest_new(L, &sha512_algorithm);
+}
+
+/* apr.crc32c(input [, binary]) -> checksum {{{1
+ *
+ * Calculate the [CRC32C] [crc32c] (Castagnoli) checksum of the string @input.
+ * On success the checksum is returned as a string of 8 hexadecimal
+ * characters, or a string of 4 bytes (in big endian byte order) if @binary
+ * evaluates to true. Otherwise a nil followed by an error message is
+ * returned.
+ *
+ * *This function is binary safe.*
+ */
+
+int lua_apr_crc32c(lua_State *L)
+{
+  return digest_string(L, &crc32c_algorithm);
+}
+
+/* apr.crc32c_file(path [, binary]) -> checksum {{{1
+ *
+ * Calculate the [CRC32C] [crc32c] checksum of the file at @path. The return
+ * values are the same as for `apr.crc32c()`.
+ */
+
+int lua_apr_crc32c_file(lua_State *L)
+{
+  return digest_path(L, &crc32c_algorithm);
+}
+
+/* apr.crc32c_init() -> digest_context {{{1
+ *
+ * Create and return an object that can be used to calculate [CRC32C]
+ * [crc32c] checksums in steps.
+ */
+
+int lua_apr_crc32c_init(lua_State *L)
+{
+  return digest_new(L, &crc32c_algorithm);
+}
+
+/* apr.xxh3(input [, binary]) -> hash {{{1
+ *
+ * Calculate the 64 bit [XXH3] [xxh3] hash of the string @input (using the
+ * default secret and seed, so the result matches `XXH3_64bits()` from the
+ * reference implementation). On success the hash is returned as a string of
+ * 16 hexadecimal characters, or a string of 8 bytes (in big endian byte
+ * order) if @binary evaluates to true. Otherwise a nil followed by an error
+ * message is returned.
+ *
+ * *This function is binary safe.*
+ */
+
+int lua_apr_xxh3(lua_State *L)
+{
+  return digest_string(L, &xxh3_algorithm);
+}
+
+/* apr.xxh3_file(path [, binary]) -> hash {{{1
+ *
+ * Calculate the [XXH3] [xxh3] hash of the file at @path. The return values
+ * are the same as for `apr.xxh3()`.
+ */
+
+int lua_apr_xxh3_file(lua_State *L)
+{
+  return digest_path(L, &xxh3_algorithm);
+}
+
+/* apr.xxh3_init() -> digest_context {{{1
+ *
+ * Create and return an object that can be used to calculate [XXH3] [xxh3]
+ * hashes in steps.
+ */
+
+int lua_apr_xxh3_init(lua_State *L)
+{
+  return digest_new(L, &xxh3_algorithm);
+}
+
+/* digest_context:update(input) -> status {{{1
+ *
+ * Continue a message digest operation by processing another message block and
+ * updating the context. On success true is returned, otherwise a nil followed
+ * by an error message is returned.
+ */
+
+static int digest_update(lua_State *L)
+{
+  lua_apr_digest_ctx *object;
+  const char *input;
+  size_t length;
+
+  object = digest_check(L, 1, 1);
+  input = luaL_checklstring(L, 2, &length);
+  object->algorithm->update(&object->state, input, length);
+
+  return push_status(L, APR_SUCCESS);
+}
+
+/* digest_context:update_from(stream [, length]) -> count {{{1
+ *
+ * Continue a message digest operation by processing the data read from
+ * @stream, which can be a file, socket or shared memory segment. See
+ * `md5_context:update_from()` for details.
+ */
+
+static int digest_update_from(lua_State *L)
+{
+  lua_apr_digest_ctx *object;
+
+  object = digest_check(L, 1, 1);
+  return hash_stream(L, object->algorithm->update, &object->state);
+}
+
+/* digest_context:digest([binary]) -> digest {{{1
+ *
+ * End a message digest operation. On success the digest is returned as a
+ * string of hexadecimal characters, or a binary string if @binary evaluates
+ * to true. Otherwise a nil followed by an error message is returned.
+ *
+ * If you want to re-use the context object after calling this method
+ * see `digest_context:reset()`.
+ */
+
+static int digest_digest(lua_State *L)
+{
+  lua_apr_digest_ctx *object;
+  unsigned char digest[64];
+
+  object = digest_check(L, 1, 1);
+  object->algorithm->final(&object->state, digest);
+  object->finalized = 1;
+
+  return push_digest(L, digest, object->algorithm->digestsize, lua_toboolean(L, 2));
+}
+
+/* digest_context:reset() -> status {{{1
+ *
+ * Use this method to reset the context after calling
+ * `digest_context:digest()`. This enables you to re-use the same context to
+ * perform another message digest calculation.
+ */
+
+static int digest_reset(lua_State *L)
+{
+  lua_apr_digest_ctx *object;
+
+  object = digest_check(L, 1, 0);
+  object->algorithm->init(&object->state);
+  object->finalized = 0;
+
+  return push_status(L, APR_SUCCESS);
+}
+
+/* digest_context:__tostring() {{{1 */
+
+static int digest_tostring(lua_State *L)
+{
+  lua_apr_digest_ctx *object;
+
+  object = digest_check(L, 1, 0);
+  if (!object->finalized)
+    lua_pushfstring(L, "%s context (%p)", object->algorithm->name, object);
+  else
+    lua_pushfstring(L, "%s context (closed)", object->algorithm->name);
+
+  return 1;
+}
+
+/* digest_context:__gc() {{{1 */
+
+static int digest_gc(lua_State *L)
+{
+  lua_apr_digest_ctx *object = digest_check(L, 1, 0);
+  release_object((lua_apr_refobj*)object);
+  return 1;
+}
+
+/* }}}1 */
+
+static luaL_reg digest_methods[] = {
+  { "reset", digest_reset },
+  { "update", digest_update },
+  { "update_from", digest_update_from },
+  { "digest", digest_digest },
+  { NULL, NULL },
+};
+
+static luaL_reg digest_metamethods[] = {
+  { "__tostring", digest_tostring },
+  { "__eq", objects_equal },
+  { "__gc", digest_gc },
+  { NULL, NULL },
+};
+
+lua_apr_objtype lua_apr_digest_type = {
+  "lua_apr_digest_ctx*",      /* metatable name in registry */
+  "digest context",           /* friendly object name */
+  sizeof(lua_apr_digest_ctx), /* structure size */
+  digest_methods,             /* methods table */
+  digest_metamethods          /* metamethods table */
+};
@@ -1,7 +1,7 @@
 /* HTTP request parsing module for the Lua/APR binding
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: November 6, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -57,6 +57,7 @@
 #if LUA_APR_HAVE_APREQ
 
 #include "lua_apr.h"
+#include <apr_file_info.h>
 #include <apreq_error.h>
 #include <apreq_cookie.h>
 #include <apreq_param.h>
@@ -64,7 +65,13 @@
 #include <apreq_util.h>
 
 #define DEFAULT_TABLE_SIZE 10
-#define MULTIPART_BRIGADE_LIMIT (1024 ^ 2)
+#define MULTIPART_BRIGADE_LIMIT (1024 * 1024)
+
+/* Default in-memory size of uploads in streaming multipart parsers. */
+#define MULTIPART_SPOOL_LIMIT (64 * 1024)
+
+/* Size of reads by multipart_parser:read(). */
+#define MULTIPART_READ_SIZE (16 * 1024)
 
 /* Internal functions. {{{1 */
 
@@ -74,6 +81,20 @@ typedef struct {
   apr_status_t status;
 } multipart_context;
 
+/* Streaming multipart parser object. */
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  apr_bucket_alloc_t *allocator;
+  apr_bucket_brigade *brigade;
+  apreq_parser_t *parser;
+  apr_table_t *table;
+  const char *tempdir;
+  int delivered, done;
+} lua_apr_multipart_object;
+
+static lua_apr_objtype lua_apr_multipart_type;
+
 /* Return (partial) results (followed by error information). */
 #define push_http_result(L, status, nres) \
   (status == APR_SUCCESS ? nres : (nres + push_http_error(L, status, 0)))
@@ -254,6 +275,9 @@ static int push_multipart_entries(void *ctx, const char *key, const char *value)
  *  - If the request string doesn't contain an empty line to separate the
  *    headers from the body, the last header might be silently discarded
  *
+ * To parse requests or responses as they arrive from a socket without first
+ * collecting them in a single string use `apr.http_parser()` instead.
+ *
  * [rfc822]: http://tools.ietf.org/html/rfc822
  */
 
@@ -318,6 +342,9 @@ int lua_apr_parse_headers(lua_State *L)
  * The optional string @tempdir is the directory used for temporary storage of
  * large uploads.
  *
+ * To handle large uploads without keeping the whole request body in memory
+ * use `apr.multipart_parser()` instead.
+ *
  * [mp_formdata]: http://en.wikipedia.org/wiki/MIME#Form_Data
  * [mp_related]: http://en.wikipedia.org/wiki/MIME#Related
  * [rfc2388]: http://tools.ietf.org/html/rfc2388
@@ -496,4 +523,345 @@ int lua_apr_uri_decode(lua_State *L)
   return 1;
 }
 
+/* apr.multipart_parser(enctype, callback [, options]) -> parser {{{1
+ *
+ * Create a streaming parser for [multipart/form-data] [mp_formdata] request
+ * bodies. Unlike `apr.parse_multipart()` the body doesn't have to be in
+ * memory: it's given to `parser:feed()` in pieces or read straight from a
+ * socket with `parser:read()`. The string @enctype is the value of the
+ * `Content-Type` header (it contains the boundary string). On success a
+ * parser object is returned, otherwise a nil followed by an error message is
+ * returned.
+ *
+ * The function @callback is called for each part once it has been received
+ * completely. It gets two arguments: the name of the part and a table with
+ * the fields `headers` (a table with the headers of the part) and either
+ * `value` (a string, for normal form fields) or `file`, `filename` and `size`
+ * (for uploaded files). File parts are never loaded into a Lua string: apreq
+ * spools uploads to a temporary file as soon as they exceed the in-memory
+ * limit and the callback gets a file object opened on that file (positioned
+ * at the start). The file is removed when the file object is closed or
+ * garbage collected, or when the parser is destroyed if that happens first
+ * (on UNIX the file object remains readable in that case).
+ *
+ * The optional table @options supports the fields `limit`, the number of
+ * bytes of an upload kept in memory before it's spooled to disk (defaults to
+ * 64 KB), and `tempdir`, the directory for temporary files.
+ */
+
+int lua_apr_multipart_parser(lua_State *L)
+{
+  lua_apr_multipart_object *object;
+  const char *enctype, *tempdir = NULL;
+  apr_size_t limit = MULTIPART_SPOOL_LIMIT;
+  apr_status_t status;
+
+  apreq_init(L, to_pool(L));
+  lua_settop(L, 3);
+  enctype = luaL_checkstring(L, 1);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  if (!lua_isnil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_getfield(L, 3, "limit");
+    limit = (apr_size_t) luaL_optnumber(L, -1, MULTIPART_SPOOL_LIMIT);
+    lua_getfield(L, 3, "tempdir");
+    tempdir = luaL_optstring(L, -1, NULL);
+    lua_pop(L, 2);
+  }
+
+  /* Create the parser object (at stack index 4). */
+  object = new_object(L, &lua_apr_multipart_type);
+  status = apr_pool_create(&object->pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  if (tempdir != NULL)
+    object->tempdir = apr_pstrdup(object->pool, tempdir);
+  object->allocator = apr_bucket_alloc_create(object->pool);
+  object->brigade = apr_brigade_create(object->pool, object->allocator);
+  object->table = apr_table_make(object->pool, DEFAULT_TABLE_SIZE);
+  object->parser = apreq_parser_make(object->pool, object->allocator,
+      apr_pstrdup(object->pool, enctype), apreq_parse_multipart, limit,
+      object->tempdir, NULL, NULL);
+
+  /* Store the callback in the environment of the parser. */
+  object_env_private(L, 4);
+  lua_pushvalue(L, 2);
+  lua_setfield(L, -2, "callback");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* check_multipart() {{{2 */
+
+static lua_apr_multipart_object *check_multipart(lua_State *L, int idx)
+{
+  lua_apr_multipart_object *object;
+
+  object = check_object(L, idx, &lua_apr_multipart_type);
+  if (object->pool == NULL)
+    luaL_error(L, "attempt to use a destroyed %s", lua_apr_multipart_type.friendlyname);
+
+  return object;
+}
+
+/* upload_to_file() -- get a file object with the contents of an upload {{{2 */
+
+static apr_status_t upload_to_file(lua_State *L, lua_apr_multipart_object *object, apr_bucket_brigade *upload)
+{
+  apr_file_t *spool;
+  lua_apr_file *file;
+  apr_bucket *bucket;
+  apr_status_t status;
+  apr_off_t offset = 0;
+  const char *data, *tempdir;
+  char *template;
+  apr_size_t length;
+
+  file = file_alloc(L, NULL, NULL);
+  spool = apreq_brigade_spoolfile(upload);
+  if (spool != NULL) {
+    /* apreq already spooled the upload to disk: open the file separately so
+     * that the file object has its own offset and removes the file when it's
+     * closed (apreq appends to the spool file and removes it when the parser
+     * is destroyed). */
+    status = apr_file_flush(spool);
+    if (status == APR_SUCCESS)
+      status = apr_file_name_get(&data, spool);
+    if (status == APR_SUCCESS) {
+      file->path = apr_pstrdup(file->pool->ptr, data);
+      status = apr_file_open(&file->handle, file->path, APR_FOPEN_READ
+          | APR_FOPEN_BINARY | APR_FOPEN_DELONCLOSE, APR_OS_DEFAULT, file->pool->ptr);
+    }
+  } else {
+    /* The upload is small enough to be in memory: write it to disk. */
+    tempdir = object->tempdir;
+    status = tempdir != NULL ? APR_SUCCESS : apr_temp_dir_get(&tempdir, file->pool->ptr);
+    if (status == APR_SUCCESS)
+      status = apr_filepath_merge(&template, tempdir, "lua-apr-upload-XXXXXX", 0, file->pool->ptr);
+    if (status == APR_SUCCESS)
+      status = apr_file_mktemp(&file->handle, template, APR_FOPEN_CREATE | APR_FOPEN_READ
+          | APR_FOPEN_WRITE | APR_FOPEN_EXCL | APR_FOPEN_BINARY | APR_FOPEN_DELONCLOSE,
+          file->pool->ptr);
+    if (status == APR_SUCCESS)
+      file->path = template;
+    for (bucket = APR_BRIGADE_FIRST(upload);
+         status == APR_SUCCESS && bucket != APR_BRIGADE_SENTINEL(upload);
+         bucket = APR_BUCKET_NEXT(bucket)) {
+      if (APR_BUCKET_IS_METADATA(bucket))
+        continue;
+      status = apr_bucket_read(bucket, &data, &length, APR_BLOCK_READ);
+      if (status == APR_SUCCESS)
+        status = apr_file_write_full(file->handle, data, length, NULL);
+    }
+  }
+  if (file->handle != NULL)
+    init_file_buffers(L, file, 0);
+  if (status == APR_SUCCESS)
+    status = apr_file_seek(file->handle, APR_SET, &offset);
+
+  return status;
+}
+
+/* deliver_parts() -- call the callback for completed parts {{{2
+ *
+ * Parts are added to the table by apreq when they start (uploads) or end
+ * (other fields), so all parts but the last are complete until the parser
+ * has seen the final boundary.
+ */
+
+static apr_status_t deliver_parts(lua_State *L, lua_apr_multipart_object *object, int idx)
+{
+  const apr_array_header_t *array = apr_table_elts(object->table);
+  const apr_table_entry_t *entries = (const apr_table_entry_t*) array->elts;
+  int last = object->done ? array->nelts : array->nelts - 1;
+  apr_status_t status;
+  apreq_param_t *param;
+  apr_off_t size;
+
+  while (object->delivered < last) {
+    param = apreq_value_to_param(entries[object->delivered].val);
+    object->delivered++;
+    object_env_private(L, idx);
+    lua_getfield(L, -1, "callback");
+    lua_replace(L, -2);
+    lua_pushstring(L, entries[object->delivered - 1].key);
+    lua_createtable(L, 0, 4);
+    lua_newtable(L);
+    if (param->info != NULL)
+      apr_table_do(push_multipart_headers, L, param->info, NULL);
+    lua_setfield(L, -2, "headers");
+    if (param->upload != NULL) {
+      lua_pushlstring(L, param->v.data, param->v.dlen);
+      lua_setfield(L, -2, "filename");
+      status = apr_brigade_length(param->upload, 1, &size);
+      if (status != APR_SUCCESS) {
+        lua_pop(L, 3);
+        return status;
+      }
+      status = upload_to_file(L, object, param->upload);
+      if (status != APR_SUCCESS) {
+        lua_pop(L, 4);
+        return status;
+      }
+      lua_setfield(L, -2, "file");
+      lua_pushnumber(L, (lua_Number) size);
+      lua_setfield(L, -2, "size");
+    } else {
+      lua_pushlstring(L, param->v.data, param->v.dlen);
+      lua_setfield(L, -2, "value");
+    }
+    lua_call(L, 2, 0);
+  }
+
+  return APR_SUCCESS;
+}
+
+/* multipart_feed() {{{2 */
+
+static apr_status_t multipart_feed(lua_State *L, lua_apr_multipart_object *object, int idx, const char *data, size_t length)
+{
+  apr_status_t status;
+
+  if (object->done)
+    return APR_SUCCESS;
+  /* Heap buckets copy the data, apreq may hold on to it between calls. */
+  APR_BRIGADE_INSERT_TAIL(object->brigade,
+      apr_bucket_heap_create(data, length, NULL, object->allocator));
+  status = apreq_parser_run(object->parser, object->table, object->brigade);
+  apr_brigade_cleanup(object->brigade);
+  if (status == APR_SUCCESS)
+    object->done = 1;
+  else if (status != APR_INCOMPLETE)
+    return status;
+
+  return deliver_parts(L, object, idx);
+}
+
+/* multipart_parser:feed(data) -> done {{{1
+ *
+ * Feed the next piece of the request body to the parser. Returns true when
+ * the end of the multipart message has been reached and false when more
+ * input is expected. On error a nil followed by an error message and error
+ * code is returned.
+ */
+
+static int multipart_parser_feed(lua_State *L)
+{
+  lua_apr_multipart_object *object;
+  apr_status_t status;
+  const char *data;
+  size_t length;
+
+  object = check_multipart(L, 1);
+  data = luaL_checklstring(L, 2, &length);
+  status = multipart_feed(L, object, 1, data, length);
+  if (status != APR_SUCCESS)
+    return push_http_error(L, status, 1);
+  lua_pushboolean(L, object->done);
+
+  return 1;
+}
+
+/* multipart_parser:read(stream [, length]) -> done {{{1
+ *
+ * Read the request body from @stream (any object with a `read()` method,
+ * e.g. a socket or file) and feed it to the parser, until the end of the
+ * multipart message, the end of the stream or (when given) @length bytes
+ * have been read. The number @length is usually the value of the
+ * `Content-Length` header of the request. Returns true when the end of the
+ * message was reached, false otherwise. On error a nil followed by an error
+ * message and error code is returned.
+ */
+
+static int multipart_parser_read(lua_State *L)
+{
+  lua_apr_multipart_object *object;
+  lua_Number remaining;
+  apr_status_t status;
+  const char *data;
+  size_t length;
+
+  object = check_multipart(L, 1);
+  luaL_checkany(L, 2);
+  remaining = luaL_optnumber(L, 3, -1);
+  lua_settop(L, 3);
+
+  while (!object->done && remaining != 0) {
+    length = remaining > 0 && remaining < MULTIPART_READ_SIZE ? (size_t) remaining : MULTIPART_READ_SIZE;
+    lua_getfield(L, 2, "read");
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, length);
+    lua_call(L, 2, 3);
+    data = lua_tolstring(L, 4, &length);
+    if (data == NULL) {
+      /* End of stream or error (propagate the error message). */
+      if (!lua_isnil(L, 5))
+        return 3;
+      break;
+    }
+    if (remaining > 0)
+      remaining -= length;
+    status = multipart_feed(L, object, 1, data, length);
+    if (status != APR_SUCCESS)
+      return push_http_error(L, status, 1);
+    lua_settop(L, 3);
+  }
+  lua_pushboolean(L, object->done);
+
+  return 1;
+}
+
+/* multipart_parser:__tostring() {{{1 */
+
+static int multipart_parser_tostring(lua_State *L)
+{
+  lua_apr_multipart_object *object;
+
+  object = check_object(L, 1, &lua_apr_multipart_type);
+  lua_pushfstring(L, "%s (%p)", lua_apr_multipart_type.friendlyname, object);
+
+  return 1;
+}
+
+/* multipart_parser:__gc() {{{1 */
+
+static int multipart_parser_gc(lua_State *L)
+{
+  lua_apr_multipart_object *object;
+
+  object = check_object(L, 1, &lua_apr_multipart_type);
+  if (object->pool != NULL) {
+    /* Also removes temporary files of apreq (file objects have their own handles). */
+    apr_pool_destroy(object->pool);
+    object->pool = NULL;
+  }
+
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg multipart_methods[] = {
+  { "feed", multipart_parser_feed },
+  { "read", multipart_parser_read },
+  { NULL, NULL }
+};
+
+static luaL_reg multipart_metamethods[] = {
+  { "__tostring", multipart_parser_tostring },
+  { "__gc", multipart_parser_gc },
+  { NULL, NULL }
+};
+
+/* Parsers are left out of lua_apr_types[] because the callback lives in the
+ * parser's environment in the Lua state that created it. */
+static lua_apr_objtype lua_apr_multipart_type = {
+  "lua_apr_multipart_parser*",         /* metatable name in registry */
+  "multipart parser",                  /* friendly object name       */
+  sizeof(lua_apr_multipart_object),    /* structure size             */
+  multipart_methods,                   /* methods table              */
+  multipart_metamethods                /* metamethods table          */
+};
+
 #endif
@@ -0,0 +1,815 @@
+/* HTTP client module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * The function `apr.http_request()` performs [HTTP] [http] requests on top of
+ * the socket layer, the connection pools of `apr.connection_pool()` and the
+ * incremental HTTP parser of `apr.http_parser()`. Connections are kept open
+ * and reused by later requests to the same host and port, the response is
+ * parsed in C (including chunked transfer encoding) and large response bodies
+ * can be written straight to a file or passed to a function piece by piece:
+ *
+ *     local response = assert(apr.http_request { url = 'http://localhost:8080/' })
+ *     print(response.status, response.headers['content-type'])
+ *     print(response.body)
+ *
+ * Several requests to the same host and port can be [pipelined] [pipelining]
+ * over a single connection by passing a list of requests.
+ *
+ * [http]: http://en.wikipedia.org/wiki/Hypertext_Transfer_Protocol
+ * [pipelining]: http://en.wikipedia.org/wiki/HTTP_pipelining
+ */
+
+#include "lua_apr.h"
+#if LUAAPR_HAVE_APRUTIL && APR_HAS_THREADS
+#include <apr_lib.h>
+#include <apr_strings.h>
+#include <apr_uri.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Registry key of the connection pool used when a request doesn't name one. */
+#define HTTP_CLIENT_POOL_KEY "Lua/APR HTTP client connection pool"
+
+/* Size of the buffer that coalesces small writes into one packet. */
+#define HTTP_CLIENT_WRITE_SIZE (16 * 1024)
+
+/* Size of reads from request bodies that are streams. */
+#define HTTP_CLIENT_READ_SIZE (16 * 1024)
+
+/* Largest body size for which memory is reserved in advance. */
+#define HTTP_CLIENT_RESERVE_MAX (16 * 1024 * 1024)
+
+/* Stack slots used by lua_apr_http_request(). */
+#define REQUESTS_IDX  1 /* request or list of requests */
+#define HEADS_IDX     2 /* list of request heads */
+#define HOST_IDX      3 /* host name */
+#define POOL_IDX      4 /* connection pool */
+#define SOCKET_IDX    5 /* connection (or nil) */
+#define EXCHANGE_IDX  6 /* http_exchange userdata */
+#define REQUEST_IDX   7 /* first request (options of the connection) */
+#define RESPONSES_IDX 8 /* list of responses */
+
+/* Internal functions {{{1 */
+
+/* Destination of a response body. */
+typedef struct {
+  int output;         /* stack index of function / file object (0 when collecting) */
+  lua_apr_file *file;
+  char *data;
+  size_t size, used;
+} body_sink;
+
+/* State of the requests on a single connection. */
+typedef struct {
+  lua_apr_socket *socket;
+  http_parser parser;
+  apr_status_t status;
+  const char *error;
+  int reused, received, eof, raise;
+  char buffer[HTTP_CLIENT_WRITE_SIZE];
+  size_t buffered;
+} http_exchange;
+
+/* parse_url() -- push the host name and request target of a URL {{{2 */
+
+static const char *parse_url(lua_State *L, const char *url, int *tls, apr_port_t *port, int *default_port)
+{
+  apr_uri_t uri;
+
+  memset(&uri, 0, sizeof uri);
+  if (apr_uri_parse(to_pool(L), url, &uri) != APR_SUCCESS || uri.scheme == NULL || uri.hostname == NULL)
+    return "invalid URL";
+  if (strcasecmp(uri.scheme, "http") == 0)
+    *tls = 0;
+  else if (strcasecmp(uri.scheme, "https") == 0)
+    *tls = 1;
+  else
+    return "unsupported URL scheme";
+  *port = uri.port_str != NULL ? uri.port : apr_uri_port_of_scheme(*tls ? "https" : "http");
+  *default_port = *port == apr_uri_port_of_scheme(*tls ? "https" : "http");
+  lua_pushstring(L, uri.hostname);
+  lua_pushstring(L, uri.path != NULL && *uri.path != '\0' ? uri.path : "/");
+  if (uri.query != NULL) {
+    lua_pushliteral(L, "?");
+    lua_pushstring(L, uri.query);
+    lua_concat(L, 3);
+  }
+
+  return NULL;
+}
+
+/* is_idempotent() -- check whether a request method may be repeated {{{2 */
+
+static int is_idempotent(const char *method)
+{
+  const char *methods[] = { "GET", "HEAD", "PUT", "DELETE", "OPTIONS", "TRACE", NULL };
+  int i;
+
+  for (i = 0; methods[i] != NULL; i++)
+    if (strcmp(method, methods[i]) == 0)
+      return 1;
+
+  return 0;
+}
+
+/* is_token() -- check that a method or header name is an HTTP token {{{2 */
+
+static int is_token(const char *s, size_t length)
+{
+  size_t i;
+
+  if (length == 0)
+    return 0;
+  for (i = 0; i < length; i++)
+    if (!apr_isalnum(s[i]) && strchr("!#$%&'*+-.^_`|~", s[i]) == NULL)
+      return 0;
+
+  return 1;
+}
+
+/* is_field_value() -- check that a string can't split the head of a request {{{2 */
+
+static int is_field_value(const char *s, size_t length)
+{
+  size_t i;
+
+  for (i = 0; i < length; i++)
+    if (s[i] == '\r' || s[i] == '\n' || s[i] == '\0')
+      return 0;
+
+  return 1;
+}
+
+/* check_head() -- validate the parts of a request that end up in its head {{{2
+ *
+ * Returns NULL when the request is valid, otherwise an error message. CR, LF
+ * and NUL bytes would make it possible to inject headers or requests.
+ */
+
+static const char *check_head(lua_State *L, int request, int target)
+{
+  const char *error = NULL, *data;
+  size_t length;
+  int top = lua_gettop(L), i;
+
+  lua_getfield(L, request, "method");
+  if (!lua_isnil(L, -1)) {
+    data = luaL_checklstring(L, -1, &length);
+    if (!is_token(data, length))
+      error = "invalid request method";
+  }
+  data = lua_tolstring(L, target, &length);
+  if (error == NULL && (!is_field_value(data, length) || memchr(data, ' ', length) != NULL))
+    error = "invalid request target";
+  lua_getfield(L, request, "headers");
+  if (error == NULL && lua_istable(L, -1)) {
+    lua_pushnil(L);
+    while (error == NULL && lua_next(L, -2)) {
+      if (lua_type(L, -2) == LUA_TSTRING) {
+        data = lua_tolstring(L, -2, &length);
+        if (!is_token(data, length))
+          error = "invalid header name";
+      }
+      if (lua_istable(L, -1)) {
+        for (i = 1; error == NULL; i++) {
+          lua_rawgeti(L, -1, i);
+          data = lua_tolstring(L, -1, &length);
+          lua_pop(L, 1);
+          if (data == NULL)
+            break;
+          if (!is_field_value(data, length))
+            error = "invalid header value";
+        }
+      } else if (lua_type(L, -1) == LUA_TSTRING) {
+        data = lua_tolstring(L, -1, &length);
+        if (!is_field_value(data, length))
+          error = "invalid header value";
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_settop(L, top);
+
+  return error;
+}
+
+/* add_header() -- add one or more header lines to the pieces of a head {{{2 */
+
+static int add_header(lua_State *L, int pieces, int n, int name, int value)
+{
+  int i;
+
+  if (lua_istable(L, value)) {
+    /* Repeated headers, e.g. { ['Cookie'] = { 'a=1', 'b=2' } }. */
+    for (i = 1; ; i++) {
+      lua_rawgeti(L, value, i);
+      if (lua_isnil(L, -1))
+        break;
+      lua_pushfstring(L, "%s: %s\r\n", lua_tostring(L, name), luaL_checkstring(L, -1));
+      lua_rawseti(L, pieces, ++n);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  } else {
+    lua_pushfstring(L, "%s: %s\r\n", lua_tostring(L, name), luaL_checkstring(L, value));
+    lua_rawseti(L, pieces, ++n);
+  }
+
+  return n;
+}
+
+/* push_head() -- push the head of a request as a single string {{{2 */
+
+static void push_head(lua_State *L, int request, int host, int target, apr_port_t port, int default_port)
+{
+  const char *method, *name, *hostname;
+  char length[32];
+  int pieces, n = 0, has_host = 0, i;
+  luaL_Buffer buffer;
+  size_t size;
+
+  lua_getfield(L, request, "method");
+  method = luaL_optstring(L, -1, "GET");
+  lua_newtable(L);
+  pieces = lua_gettop(L);
+  lua_pushfstring(L, "%s %s HTTP/1.1\r\n", method, lua_tostring(L, target));
+  lua_rawseti(L, pieces, ++n);
+
+  /* Headers given by the caller (the framing of the body is up to us). */
+  lua_getfield(L, request, "headers");
+  if (!lua_isnil(L, -1)) {
+    luaL_checktype(L, -1, LUA_TTABLE);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      if (lua_type(L, -2) != LUA_TSTRING)
+        luaL_error(L, "header names must be strings");
+      name = lua_tostring(L, -2);
+      if (strcasecmp(name, "Host") == 0)
+        has_host = 1;
+      if (strcasecmp(name, "Content-Length") != 0
+          && strcasecmp(name, "Transfer-Encoding") != 0)
+        n = add_header(L, pieces, n, lua_gettop(L) - 1, lua_gettop(L));
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+
+  if (!has_host) {
+    /* IPv6 addresses are enclosed in brackets. */
+    hostname = lua_tostring(L, host);
+    if (default_port)
+      lua_pushfstring(L, strchr(hostname, ':') ? "Host: [%s]\r\n" : "Host: %s\r\n", hostname);
+    else
+      lua_pushfstring(L, strchr(hostname, ':') ? "Host: [%s]:%d\r\n" : "Host: %s:%d\r\n", hostname, (int) port);
+    lua_rawseti(L, pieces, ++n);
+  }
+
+  lua_getfield(L, request, "body");
+  if (lua_isstring(L, -1)) {
+    lua_tolstring(L, -1, &size);
+    apr_snprintf(length, sizeof length, "%" APR_SIZE_T_FMT, (apr_size_t) size);
+    lua_pushfstring(L, "Content-Length: %s\r\n", length);
+  } else if (!lua_isnil(L, -1))
+    lua_pushliteral(L, "Transfer-Encoding: chunked\r\n");
+  else if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0)
+    lua_pushliteral(L, "Content-Length: 0\r\n");
+  else
+    lua_pushnil(L);
+  if (lua_isnil(L, -1))
+    lua_pop(L, 1);
+  else
+    lua_rawseti(L, pieces, ++n);
+  lua_pop(L, 1);
+
+  /* Join the pieces (see table.concat()). */
+  luaL_buffinit(L, &buffer);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, pieces, i);
+    luaL_addvalue(&buffer);
+  }
+  luaL_addlstring(&buffer, "\r\n", 2);
+  luaL_pushresult(&buffer);
+  lua_replace(L, pieces - 1);
+  lua_pop(L, 1);
+}
+
+/* call_method() -- call a method that returns a value or nil, message, code {{{2
+ *
+ * On success the first result is left on the stack and 1 is returned,
+ * otherwise the three results are left on the stack and 0 is returned.
+ */
+
+static int call_method(lua_State *L, int object, const char *name, int nargs)
+{
+  lua_getfield(L, object, name);
+  lua_insert(L, -(nargs + 1));
+  lua_pushvalue(L, object);
+  lua_insert(L, -(nargs + 1));
+  lua_call(L, nargs + 1, 3);
+  if (lua_isnil(L, -3) || (lua_isboolean(L, -3) && !lua_toboolean(L, -3)))
+    return 0;
+  lua_pop(L, 2);
+  return 1;
+}
+
+/* open_connection() -- acquire a (TLS) connection from the connection pool {{{2 */
+
+static int open_connection(lua_State *L, int request, apr_port_t port, int tls)
+{
+  lua_apr_socket *socket;
+  lua_Number timeout;
+  int top;
+
+  lua_pushvalue(L, HOST_IDX);
+  lua_pushinteger(L, port);
+  if (!call_method(L, POOL_IDX, "acquire", 2))
+    return 0;
+  lua_replace(L, SOCKET_IDX);
+  socket = lua_touserdata(L, SOCKET_IDX);
+
+  /* Plain text requests can't use a connection with TLS enabled. */
+  while (!tls && socket->tls != NULL) {
+    top = lua_gettop(L);
+    call_method(L, SOCKET_IDX, "close", 0);
+    lua_settop(L, top);
+    lua_pushvalue(L, HOST_IDX);
+    lua_pushinteger(L, port);
+    if (!call_method(L, POOL_IDX, "acquire", 2))
+      return 0;
+    lua_replace(L, SOCKET_IDX);
+    socket = lua_touserdata(L, SOCKET_IDX);
+  }
+
+  lua_getfield(L, request, "timeout");
+  if (!lua_isnil(L, -1)) {
+    timeout = luaL_checknumber(L, -1);
+    apr_socket_timeout_set(socket->handle, (apr_interval_time_t) (timeout * APR_USEC_PER_SEC));
+  }
+  lua_pop(L, 1);
+
+  if (tls && socket->tls == NULL) {
+    /* Copy the options so that the host name of the URL can be filled in:
+     * without it the server's certificate can't be checked. */
+    lua_getfield(L, request, "tls");
+    lua_newtable(L);
+    if (!lua_isnil(L, -2)) {
+      luaL_checktype(L, -2, LUA_TTABLE);
+      lua_pushnil(L);
+      while (lua_next(L, -3)) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_settable(L, -4);
+      }
+    }
+    lua_pushvalue(L, HOST_IDX);
+    lua_setfield(L, -2, "hostname");
+    lua_remove(L, -2);
+    if (!call_method(L, SOCKET_IDX, "tls_wrap", 1))
+      return 0;
+    lua_pop(L, 1);
+  }
+
+  return 1;
+}
+
+/* close_connection() -- return a connection to the pool or close it {{{2 */
+
+static void close_connection(lua_State *L, int reusable)
+{
+  int top = lua_gettop(L);
+
+  if (lua_isnil(L, SOCKET_IDX))
+    return;
+  if (reusable) {
+    lua_pushvalue(L, SOCKET_IDX);
+    call_method(L, POOL_IDX, "release", 1);
+  } else
+    call_method(L, SOCKET_IDX, "close", 0);
+  lua_settop(L, top);
+  lua_pushnil(L);
+  lua_replace(L, SOCKET_IDX);
+}
+
+/* send_data() -- write data to the connection (coalescing small writes) {{{2 */
+
+static apr_status_t send_flush(http_exchange *ex)
+{
+  lua_apr_writebuf *output = &ex->socket->output;
+  apr_status_t status = APR_SUCCESS;
+  const char *data = ex->buffer;
+  apr_size_t length;
+
+  while (ex->buffered > 0 && status == APR_SUCCESS) {
+    length = ex->buffered;
+    status = output->write(output->object, data, &length);
+    data += length;
+    ex->buffered -= length;
+  }
+
+  return status;
+}
+
+static apr_status_t send_data(http_exchange *ex, const char *data, size_t length)
+{
+  lua_apr_writebuf *output = &ex->socket->output;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n;
+
+  if (ex->buffered + length <= sizeof ex->buffer) {
+    memcpy(&ex->buffer[ex->buffered], data, length);
+    ex->buffered += length;
+    return status;
+  }
+  status = send_flush(ex);
+  while (length > 0 && status == APR_SUCCESS) {
+    n = length;
+    status = output->write(output->object, data, &n);
+    data += n;
+    length -= n;
+  }
+
+  return status;
+}
+
+/* send_requests() -- write all requests to the connection {{{2 */
+
+static apr_status_t send_requests(lua_State *L, http_exchange *ex, int batch, int count)
+{
+  apr_status_t status;
+  const char *data;
+  size_t length;
+  char size[32];
+  int i, request, body;
+
+  status = flush_buffer(L, &ex->socket->output, 1);
+  for (i = 1; i <= count && status == APR_SUCCESS; i++) {
+    lua_rawgeti(L, HEADS_IDX, i);
+    data = lua_tolstring(L, -1, &length);
+    status = send_data(ex, data, length);
+    lua_pop(L, 1);
+    if (batch)
+      lua_rawgeti(L, REQUESTS_IDX, i);
+    else
+      lua_pushvalue(L, REQUESTS_IDX);
+    request = lua_gettop(L);
+    lua_getfield(L, request, "body");
+    body = lua_gettop(L);
+    if (status == APR_SUCCESS && lua_isstring(L, body)) {
+      data = lua_tolstring(L, body, &length);
+      status = send_data(ex, data, length);
+    } else if (status == APR_SUCCESS && !lua_isnil(L, body)) {
+      /* Stream the body using chunked transfer encoding. */
+      for (;;) {
+        lua_pushinteger(L, HTTP_CLIENT_READ_SIZE);
+        if (!call_method(L, body, "read", 1)) {
+          /* End of the stream or an error? */
+          if (!lua_isnil(L, -2)) {
+            ex->error = "failed to read request body";
+            status = APR_EGENERAL;
+          }
+          lua_pop(L, 3);
+          break;
+        }
+        data = luaL_checklstring(L, -1, &length);
+        if (length > 0) {
+          apr_snprintf(size, sizeof size, "%lx\r\n", (unsigned long) length);
+          status = send_data(ex, size, strlen(size));
+          if (status == APR_SUCCESS)
+            status = send_data(ex, data, length);
+          if (status == APR_SUCCESS)
+            status = send_data(ex, "\r\n", 2);
+        }
+        lua_pop(L, 1);
+        if (status != APR_SUCCESS)
+          break;
+      }
+      if (status == APR_SUCCESS)
+        status = send_data(ex, "0\r\n\r\n", 5);
+    }
+    lua_settop(L, request - 1);
+  }
+  if (status == APR_SUCCESS)
+    status = send_flush(ex);
+
+  return status;
+}
+
+/* sink_write() -- pass decoded body data to its destination {{{2 */
+
+static int sink_write(lua_State *L, http_exchange *ex, body_sink *sink, const char *data, size_t length)
+{
+  size_t size;
+  char *newdata;
+
+  if (sink->file != NULL) {
+    ex->status = apr_file_write_full(sink->file->handle, data, length, NULL);
+    return ex->status == APR_SUCCESS;
+  } else if (sink->output != 0) {
+    lua_pushvalue(L, sink->output);
+    lua_pushlstring(L, data, length);
+    if (lua_pcall(L, 1, 0, 0) != 0) {
+      ex->raise = 1;
+      return 0;
+    }
+    return 1;
+  }
+  if (sink->used + length > sink->size) {
+    size = sink->size > 0 ? sink->size * 2 : LUA_APR_BUFSIZE;
+    if (size < sink->used + length)
+      size = sink->used + length;
+    newdata = realloc(sink->data, size);
+    if (newdata == NULL) {
+      ex->status = APR_ENOMEM;
+      return 0;
+    }
+    sink->data = newdata;
+    sink->size = size;
+  }
+  memcpy(&sink->data[sink->used], data, length);
+  sink->used += length;
+
+  return 1;
+}
+
+/* read_response() -- read and decode the response to a request {{{2
+ *
+ * On success the response table is pushed and 1 is returned, otherwise
+ * nothing is pushed (except for the message of an error raised by the output
+ * function) and 0 is returned.
+ */
+
+static int read_response(lua_State *L, http_exchange *ex, int request)
+{
+  lua_apr_readbuf *input = &ex->socket->input;
+  lua_apr_buffer *B = &input->buffer;
+  http_parser *parser = &ex->parser;
+  body_sink sink = { 0, NULL, NULL, 0, 0 };
+  size_t consumed, length;
+  const char *method, *body;
+  int result, no_body, top = lua_gettop(L);
+
+  lua_getfield(L, request, "method");
+  method = lua_tostring(L, -1);
+  no_body = method != NULL && strcmp(method, "HEAD") == 0;
+  lua_getfield(L, request, "output");
+  if (object_has_type(L, -1, &lua_apr_file_type, 1)) {
+    sink.file = lua_touserdata(L, -1);
+    if (sink.file->handle == NULL) {
+      ex->error = "attempt to write to a closed file";
+      goto fail;
+    }
+    /* Written data must follow data buffered by file:write(). */
+    ex->status = flush_buffer(L, &sink.file->output, 1);
+    if (ex->status != APR_SUCCESS)
+      goto fail;
+  } else if (!lua_isnil(L, -1)) {
+    luaL_checktype(L, -1, LUA_TFUNCTION);
+    sink.output = lua_gettop(L);
+  }
+
+  http_parser_reset(parser);
+  parser->no_body = no_body;
+  for (;;) {
+    result = http_parser_execute(parser, B->data != NULL ? B->data + B->index : "",
+        B->limit - B->index, &consumed, &body, &length);
+    if (result == HTTP_PARSE_BODY && !sink_write(L, ex, &sink, body, length))
+      goto fail;
+    if (consumed > 0)
+      drain_input(input, consumed);
+    if (result == HTTP_PARSE_AGAIN) {
+      ex->status = fill_input(input);
+      if (ex->status == APR_SUCCESS) {
+        ex->received = 1;
+        continue;
+      } else if (!APR_STATUS_IS_EOF(ex->status))
+        goto fail;
+      ex->eof = 1;
+      ex->status = APR_SUCCESS;
+      result = http_parser_finish(parser);
+    }
+    if (result == HTTP_PARSE_HEAD) {
+      if (parser->status / 100 == 1 && parser->status != 101) {
+        /* Skip interim responses like "100 Continue". */
+        http_parser_reset(parser);
+        parser->no_body = no_body;
+        continue;
+      }
+      push_http_message(L, parser);
+      if (sink.output == 0 && sink.file == NULL && parser->length > 0 && parser->length <= HTTP_CLIENT_RESERVE_MAX) {
+        sink.data = malloc((size_t) parser->length);
+        sink.size = sink.data != NULL ? (size_t) parser->length : 0;
+      }
+    } else if (result == HTTP_PARSE_DONE) {
+      break;
+    } else if (result == HTTP_PARSE_ERROR) {
+      ex->error = parser->error;
+      goto fail;
+    }
+  }
+
+  /* Leave only the response table on the stack. */
+  if (sink.output == 0 && sink.file == NULL) {
+    lua_pushlstring(L, sink.data != NULL ? sink.data : "", sink.used);
+    lua_setfield(L, -2, "body");
+  }
+  free(sink.data);
+  lua_replace(L, top + 1);
+  lua_settop(L, top + 1);
+
+  return 1;
+
+fail:
+  free(sink.data);
+  if (ex->raise) {
+    lua_replace(L, top + 1);
+    lua_settop(L, top + 1);
+  } else
+    lua_settop(L, top);
+
+  return 0;
+}
+
+/* apr.http_request(request) -> response {{{1
+ *
+ * Perform an HTTP request. The table @request supports the following fields:
+ *
+ *  - `url` is the `http://` or `https://` URL to request (required)
+ *  - `method` is the request method (defaults to `'GET'`)
+ *  - `headers` is a table with request headers, where a table value results
+ *    in a header line for each of the strings in the table
+ *  - `body` is the request body: a string (sent with a `Content-Length`
+ *    header) or any object with a `read()` method like a file or pipe (sent
+ *    using chunked transfer encoding)
+ *  - `output` is a file object or function that receives the response body
+ *    as it arrives, instead of collecting it in a string
+ *  - `pool` is the connection pool to use (see `apr.connection_pool()`);
+ *    by default a connection pool shared by all requests is used
+ *  - `timeout` is the number of seconds network operations may take
+ *  - `tls` is a table of options for `socket:tls_wrap()` (HTTPS only); the
+ *    `hostname` option is always set to the host name in the URL
+ *
+ * On success the response table is returned, otherwise a nil followed by an
+ * error message and error code is returned. The response table contains the
+ * fields `status` (a number), `reason`, `version`, `headers` (a table with
+ * lowercase header names), `keepalive`, `chunked`, `length` (the value of the
+ * `Content-Length` header, if any) and `body` (unless `output` was given).
+ * Chunked response bodies are decoded.
+ *
+ * Persistent connections (including connections using TLS) are returned to
+ * the connection pool after the response has been read. When a reused
+ * connection turns out to have been closed or reset by the server before any
+ * part of the response was received, the request is sent again on a new
+ * connection, but only when all requests use idempotent methods (`GET`,
+ * `HEAD`, `PUT`, `DELETE`, `OPTIONS` and `TRACE`) and none of the bodies is a
+ * stream.
+ *
+ * Instead of a single request a list of requests can be given, in which case
+ * all requests are written to one connection before the responses are read
+ * ([pipelining] [pipelining]) and a list of responses is returned. All
+ * requests in the list must have the same scheme, host name and port number.
+ * Only pipeline requests without large bodies: the requests are sent before
+ * the first response is read.
+ */
+
+int lua_apr_http_request(lua_State *L)
+{
+  http_exchange *ex;
+  const char *url, *error;
+  apr_port_t port = 0, first_port = 0;
+  int count, batch, i, request, tls = 0, first_tls = 0;
+  int default_port, first_default = 0, replayable = 1, attempt, keepalive;
+
+  lua_settop(L, 1);
+  luaL_checktype(L, REQUESTS_IDX, LUA_TTABLE);
+  lua_rawgeti(L, REQUESTS_IDX, 1);
+  batch = lua_istable(L, -1);
+  lua_pop(L, 1);
+  count = batch ? (int) lua_objlen(L, REQUESTS_IDX) : 1;
+  lua_newtable(L);
+  lua_settop(L, SOCKET_IDX);
+
+  /* Check the URLs and prepare the request heads. */
+  for (i = 1; i <= count; i++) {
+    if (batch) {
+      lua_rawgeti(L, REQUESTS_IDX, i);
+      luaL_argcheck(L, lua_istable(L, -1), 1, "list of requests expected");
+    } else
+      lua_pushvalue(L, REQUESTS_IDX);
+    request = lua_gettop(L);
+    lua_getfield(L, request, "url");
+    url = lua_tostring(L, -1);
+    luaL_argcheck(L, url != NULL, 1, "request without url");
+    error = parse_url(L, url, &tls, &port, &default_port);
+    if (error != NULL)
+      return push_error_message(L, error);
+    if (i == 1) {
+      first_tls = tls;
+      first_port = port;
+      first_default = default_port;
+      lua_pushvalue(L, -2);
+      lua_replace(L, HOST_IDX);
+    } else
+      luaL_argcheck(L, tls == first_tls && port == first_port && lua_rawequal(L, -2, HOST_IDX), 1,
+          "pipelined requests must use the same scheme, host and port");
+    error = check_head(L, request, request + 3);
+    if (error != NULL)
+      return push_error_message(L, error);
+    push_head(L, request, request + 2, request + 3, first_port, first_default);
+    lua_rawseti(L, HEADS_IDX, i);
+    lua_getfield(L, request, "method");
+    if (!is_idempotent(luaL_optstring(L, -1, "GET")))
+      replayable = 0;
+    lua_getfield(L, request, "body");
+    if (!lua_isnil(L, -1) && !lua_isstring(L, -1))
+      replayable = 0;
+    lua_settop(L, SOCKET_IDX);
+  }
+
+  /* The state of the exchange lives on the Lua stack. */
+  ex = lua_newuserdata(L, sizeof *ex);
+  memset(ex, 0, sizeof *ex);
+  if (batch)
+    lua_rawgeti(L, REQUESTS_IDX, 1);
+  else
+    lua_pushvalue(L, REQUESTS_IDX);
+
+  /* Get the connection pool. */
+  lua_getfield(L, REQUEST_IDX, "pool");
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, HTTP_CLIENT_POOL_KEY);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_pushcfunction(L, lua_apr_connection_pool);
+      lua_call(L, 0, 2);
+      if (lua_isnil(L, -2))
+        return 2;
+      lua_pop(L, 1);
+      lua_pushvalue(L, -1);
+      lua_setfield(L, LUA_REGISTRYINDEX, HTTP_CLIENT_POOL_KEY);
+    }
+  }
+  lua_replace(L, POOL_IDX);
+
+  for (attempt = 0; ; attempt++) {
+    /* Acquire a connection and send the requests. */
+    if (!open_connection(L, REQUEST_IDX, first_port, first_tls)) {
+      close_connection(L, 0);
+      return 3;
+    }
+    ex->socket = lua_touserdata(L, SOCKET_IDX);
+    ex->reused = connpool_reused(ex->socket);
+    ex->status = APR_SUCCESS;
+    ex->error = NULL;
+    ex->received = 0;
+    ex->eof = 0;
+    ex->buffered = 0;
+    ex->status = send_requests(L, ex, batch, count);
+    if (ex->status == APR_SUCCESS)
+      ex->status = http_parser_init(&ex->parser, HTTP_RESPONSE, NULL);
+    if (ex->status == APR_SUCCESS) {
+      /* Read the responses in the order the requests were sent. */
+      lua_createtable(L, count, 0);
+      for (i = 1; i <= count; i++) {
+        if (batch)
+          lua_rawgeti(L, REQUESTS_IDX, i);
+        else
+          lua_pushvalue(L, REQUESTS_IDX);
+        if (!read_response(L, ex, lua_gettop(L)))
+          break;
+        lua_rawseti(L, RESPONSES_IDX, i);
+        lua_pop(L, 1);
+      }
+      keepalive = ex->parser.keepalive;
+      http_parser_destroy(&ex->parser);
+      if (ex->raise) {
+        /* Don't leave the connection open until it's garbage collected. */
+        close_connection(L, 0);
+        return lua_error(L);
+      }
+      if (i > count) {
+        close_connection(L, keepalive);
+        if (!batch)
+          lua_rawgeti(L, RESPONSES_IDX, 1);
+        return 1;
+      }
+      lua_settop(L, REQUEST_IDX);
+    }
+    close_connection(L, 0);
+    /* Retry once when a reused keep-alive connection turns out to have been
+     * closed by the server (and the requests can safely be sent again). */
+    if (attempt > 0 || !replayable || !ex->reused || ex->received
+        || !(ex->eof || APR_STATUS_IS_EOF(ex->status) || APR_STATUS_IS_ECONNRESET(ex->status)))
+      break;
+  }
+
+  if (ex->error != NULL)
+    return push_error_message(L, ex->error);
+  return push_error_status(L, ex->status);
+}
+
+#endif
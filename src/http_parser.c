@@ -0,0 +1,863 @@
+/* Incremental HTTP parser module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * This is a small incremental parser for HTTP/1.0 and HTTP/1.1 messages that
+ * is used by the HTTP server engine and is available from Lua as parser
+ * objects created by `apr.http_parser()`. It parses the head of a message
+ * (request line or status line and headers) once it has been received
+ * completely and decodes message bodies framed by a `Content-Length` header,
+ * chunked transfer encoding or the end of the connection without copying body
+ * data. Unlike `apr.parse_headers()` the input can be given in pieces as it
+ * arrives from a (non-blocking) socket:
+ *
+ *     local parser = apr.http_parser 'request'
+ *     local request, offset
+ *     repeat
+ *       local data = assert(client:read(1024))
+ *       request, offset = assert(parser:feed(data))
+ *     until request
+ *     print(request.method, request.uri, request.headers.host)
+ *     local body, done = parser:body(data:sub(offset))
+ */
+
+#include "lua_apr.h"
+#include <apr_strings.h>
+#include <apr_lib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum size of the head of a message (request line and headers). */
+#define HTTP_MAX_HEAD (64 * 1024)
+
+/* Maximum length of the line with the size of a chunk. */
+#define HTTP_MAX_CHUNK_LINE 1024
+
+/* Parser states. */
+enum {
+  HP_HEAD, HP_BODY, HP_UNTIL_EOF, HP_CHUNK_SIZE, HP_CHUNK_DATA,
+  HP_CHUNK_END, HP_TRAILERS, HP_DONE, HP_ERROR
+};
+
+/* Lua parser object. */
+typedef struct {
+  lua_apr_refobj header;
+  http_parser parser;
+  char *buffer;         /* incomplete head of the current message */
+  size_t size, used;
+} lua_apr_http_parser_object;
+
+/* Internal functions {{{1 */
+
+/* parse_error() {{{2 */
+
+static int parse_error(http_parser *parser, const char *message)
+{
+  parser->state = HP_ERROR;
+  parser->error = message;
+  return HTTP_PARSE_ERROR;
+}
+
+/* has_token() -- check whether a comma separated header value contains a token {{{2 */
+
+static int has_token(const char *value, const char *token)
+{
+  size_t length = strlen(token);
+
+  while (value != NULL && *value != '\0') {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      value++;
+    if (strncasecmp(value, token, length) == 0) {
+      const char *end = value + length;
+      while (*end == ' ' || *end == '\t')
+        end++;
+      if (*end == '\0' || *end == ',' || *end == ';')
+        return 1;
+    }
+    value = strchr(value, ',');
+  }
+
+  return 0;
+}
+
+/* has_last_token() -- check the last element of a comma separated header value {{{2 */
+
+static int has_last_token(const char *value, const char *token)
+{
+  const char *last = strrchr(value, ',');
+  size_t length = strlen(token);
+
+  for (last = last != NULL ? last + 1 : value; *last == ' ' || *last == '\t'; last++)
+    ;
+  if (strncasecmp(last, token, length) != 0)
+    return 0;
+  for (last += length; *last == ' ' || *last == '\t'; last++)
+    ;
+
+  return *last == '\0';
+}
+
+/* parse_content_length() -- get the value of the Content-Length header(s) {{{2
+ *
+ * Returns 1 when the message has a valid length, 0 when it has no
+ * Content-Length header and -1 or -2 when a header is invalid or repeated
+ * headers (or the elements of a list) disagree.
+ */
+
+static int parse_content_length(http_parser *parser, apr_off_t *length)
+{
+  http_header *headers = (http_header*) parser->headers->elts;
+  apr_off_t value;
+  const char *p;
+  char *endptr;
+  int i, found = 0;
+
+  for (i = 0; i < parser->headers->nelts; i++) {
+    if (strcasecmp(headers[i].name, "Content-Length") != 0)
+      continue;
+    for (p = headers[i].value; ; p = endptr + 1) {
+      while (*p == ' ' || *p == '\t')
+        p++;
+      if (!apr_isdigit(*p) || apr_strtoff(&value, p, &endptr, 10) != APR_SUCCESS || value < 0)
+        return -1;
+      while (*endptr == ' ' || *endptr == '\t')
+        endptr++;
+      if (found && value != *length)
+        return -2;
+      *length = value;
+      found = 1;
+      if (*endptr == '\0')
+        break;
+      if (*endptr != ',')
+        return -1;
+    }
+  }
+
+  return found;
+}
+
+/* parse_version() -- parse "HTTP/x.y" {{{2 */
+
+static int parse_version(http_parser *parser, const char *version)
+{
+  if (strncmp(version, "HTTP/", 5) != 0 || !apr_isdigit(version[5])
+      || version[6] != '.' || !apr_isdigit(version[7]) || version[8] != '\0')
+    return 0;
+  parser->major = version[5] - '0';
+  parser->minor = version[7] - '0';
+  return 1;
+}
+
+/* parse_head() -- parse the request/status line and headers {{{2 */
+
+static int parse_head(http_parser *parser, const char *data, size_t length)
+{
+  char *head, *line, *next, *colon, *value, *end, *space;
+  const char *transfer_encoding, *connection;
+  http_header *header = NULL;
+  apr_off_t content_length = 0;
+  int has_length;
+
+  /* The head is split into lines using string functions. */
+  if (memchr(data, '\0', length) != NULL)
+    return parse_error(parser, "NUL byte in message head");
+  head = apr_pstrmemdup(parser->pool, data, length);
+  apr_array_clear(parser->headers);
+
+  /* Split the start line from the headers. */
+  line = head;
+  next = strchr(line, '\n');
+  if (next == NULL)
+    return parse_error(parser, "incomplete message head");
+  *next++ = '\0';
+  if (next - line >= 2 && next[-2] == '\r')
+    next[-2] = '\0';
+
+  if (parser->type == HTTP_REQUEST) {
+    /* METHOD SP request-target SP HTTP-version */
+    space = strchr(line, ' ');
+    if (space == NULL || space == line)
+      return parse_error(parser, "invalid request line");
+    *space++ = '\0';
+    parser->method = line;
+    line = space;
+    space = strrchr(line, ' ');
+    if (space == NULL || space == line)
+      return parse_error(parser, "invalid request line");
+    *space++ = '\0';
+    parser->uri = line;
+    if (!parse_version(parser, space))
+      return parse_error(parser, "invalid HTTP version");
+  } else {
+    /* HTTP-version SP status-code SP reason-phrase */
+    space = strchr(line, ' ');
+    if (space == NULL)
+      return parse_error(parser, "invalid status line");
+    *space++ = '\0';
+    if (!parse_version(parser, line))
+      return parse_error(parser, "invalid HTTP version");
+    if (!apr_isdigit(space[0]) || !apr_isdigit(space[1]) || !apr_isdigit(space[2])
+        || (space[3] != ' ' && space[3] != '\0'))
+      return parse_error(parser, "invalid status code");
+    parser->status = (space[0] - '0') * 100 + (space[1] - '0') * 10 + (space[2] - '0');
+    parser->reason = space[3] == ' ' ? space + 4 : "";
+  }
+
+  /* Parse the header lines. */
+  for (line = next; line != NULL && *line != '\0' && *line != '\r' && *line != '\n'; line = next) {
+    next = strchr(line, '\n');
+    if (next != NULL) {
+      *next++ = '\0';
+      if (next - line >= 2 && next[-2] == '\r')
+        next[-2] = '\0';
+    }
+    if (*line == ' ' || *line == '\t') {
+      /* Obsolete line folding: append to the previous header. */
+      if (header == NULL)
+        return parse_error(parser, "invalid header continuation");
+      while (*line == ' ' || *line == '\t')
+        line++;
+      header->value = apr_pstrcat(parser->pool, header->value, " ", line, NULL);
+      continue;
+    }
+    colon = strchr(line, ':');
+    if (colon == NULL || colon == line)
+      return parse_error(parser, "invalid header line");
+    for (end = colon; end > line && (end[-1] == ' ' || end[-1] == '\t'); end--)
+      ;
+    if (end != colon)
+      return parse_error(parser, "whitespace before colon in header line");
+    *colon = '\0';
+    for (value = colon + 1; *value == ' ' || *value == '\t'; value++)
+      ;
+    for (end = value + strlen(value); end > value && (end[-1] == ' ' || end[-1] == '\t'); end--)
+      ;
+    *end = '\0';
+    header = apr_array_push(parser->headers);
+    header->name = line;
+    header->value = value;
+  }
+
+  /* Determine how the body is framed. Ambiguous framing is rejected because
+   * it enables request smuggling (see RFC 7230 section 3.3.3). */
+  transfer_encoding = http_parser_header(parser, "Transfer-Encoding");
+  connection = http_parser_header(parser, "Connection");
+  has_length = parse_content_length(parser, &content_length);
+  if (has_length == -2)
+    return parse_error(parser, "conflicting Content-Length headers");
+  else if (has_length < 0)
+    return parse_error(parser, "invalid Content-Length header");
+  parser->chunked = transfer_encoding != NULL && has_last_token(transfer_encoding, "chunked");
+  if (transfer_encoding != NULL && parser->type == HTTP_REQUEST) {
+    if (!parser->chunked)
+      return parse_error(parser, "unsupported Transfer-Encoding");
+    if (has_length)
+      return parse_error(parser, "both Transfer-Encoding and Content-Length headers");
+  }
+
+  if (parser->major == 1 && parser->minor >= 1)
+    parser->keepalive = !has_token(connection, "close");
+  else
+    parser->keepalive = has_token(connection, "keep-alive");
+
+  /* In responses the Transfer-Encoding header overrides Content-Length, but
+   * the connection can't be trusted afterwards. */
+  if (transfer_encoding != NULL && has_length) {
+    parser->keepalive = 0;
+    has_length = 0;
+  }
+
+  if (parser->type == HTTP_RESPONSE && (parser->no_body || parser->status / 100 == 1
+        || parser->status == 204 || parser->status == 304)) {
+    parser->length = 0;
+    parser->state = HP_DONE;
+  } else if (parser->chunked) {
+    parser->length = -1;
+    parser->state = HP_CHUNK_SIZE;
+  } else if (has_length) {
+    parser->length = parser->remaining = content_length;
+    parser->state = parser->remaining > 0 ? HP_BODY : HP_DONE;
+  } else if (parser->type == HTTP_REQUEST) {
+    parser->length = 0;
+    parser->state = HP_DONE;
+  } else {
+    /* The body extends until the server closes the connection. */
+    parser->length = -1;
+    parser->keepalive = 0;
+    parser->state = HP_UNTIL_EOF;
+  }
+
+  return HTTP_PARSE_HEAD;
+}
+
+/* find_line() -- find the end of a line {{{2 */
+
+static const char *find_line(const char *data, size_t length)
+{
+  const char *lf = memchr(data, '\n', length);
+  return lf != NULL ? lf + 1 : NULL;
+}
+
+/* http_parser_init() -- initialize a parser {{{2 */
+
+apr_status_t http_parser_init(http_parser *parser, int type, apr_pool_t *parent)
+{
+  apr_status_t status;
+
+  memset(parser, 0, sizeof *parser);
+  status = apr_pool_create(&parser->pool, parent);
+  if (status != APR_SUCCESS)
+    return status;
+  parser->type = type;
+  parser->headers = apr_array_make(parser->pool, 16, sizeof(http_header));
+  parser->state = HP_HEAD;
+  parser->length = -1;
+
+  return APR_SUCCESS;
+}
+
+/* http_parser_reset() -- prepare a parser for the next message {{{2
+ *
+ * The memory of the previous message is reused for the next one.
+ */
+
+void http_parser_reset(http_parser *parser)
+{
+  apr_pool_t *pool = parser->pool;
+  int type = parser->type;
+
+  apr_pool_clear(pool);
+  memset(parser, 0, sizeof *parser);
+  parser->pool = pool;
+  parser->type = type;
+  parser->headers = apr_array_make(pool, 16, sizeof(http_header));
+  parser->state = HP_HEAD;
+  parser->length = -1;
+}
+
+/* http_parser_destroy() {{{2 */
+
+void http_parser_destroy(http_parser *parser)
+{
+  if (parser->pool != NULL) {
+    apr_pool_destroy(parser->pool);
+    parser->pool = NULL;
+  }
+}
+
+/* http_parser_header() -- get the value of a header (case insensitive) {{{2 */
+
+const char *http_parser_header(http_parser *parser, const char *name)
+{
+  http_header *headers = (http_header*) parser->headers->elts;
+  int i;
+
+  for (i = parser->headers->nelts - 1; i >= 0; i--)
+    if (strcasecmp(headers[i].name, name) == 0)
+      return headers[i].value;
+
+  return NULL;
+}
+
+/* http_parser_execute() -- parse part of a message {{{2
+ *
+ * Parse the given @data. The number of bytes that were processed is stored in
+ * *@consumed; the remaining bytes must be passed again (together with any new
+ * input) on the next call. The return value is one of the following:
+ *
+ *  - HTTP_PARSE_AGAIN: more input is needed
+ *  - HTTP_PARSE_HEAD: the head of the message has been parsed (the head is
+ *    only consumed once it has been received completely)
+ *  - HTTP_PARSE_BODY: *@body and *@body_length point to decoded body data
+ *    (inside @data, nothing is copied)
+ *  - HTTP_PARSE_DONE: the message is complete; call http_parser_reset() to
+ *    parse the next message
+ *  - HTTP_PARSE_ERROR: the message is invalid, see parser->error
+ */
+
+int http_parser_execute(http_parser *parser, const char *data, size_t length,
+    size_t *consumed, const char **body, size_t *body_length)
+{
+  const char *end;
+  size_t pos = 0, n, start;
+  apr_off_t size;
+  char *endptr;
+
+  *consumed = 0;
+  *body = NULL;
+  *body_length = 0;
+
+  for (;;) {
+    switch (parser->state) {
+
+      case HP_HEAD:
+        /* Ignore empty lines before the start line (RFC 2616 section 4.1). */
+        while (parser->scanned == 0 && pos < length && (data[pos] == '\r' || data[pos] == '\n'))
+          *consumed = ++pos;
+        /* Look for the empty line that terminates the head. */
+        start = pos + parser->scanned;
+        for (end = data + start; (end = memchr(end, '\n', data + length - end)) != NULL; end++) {
+          const char *p = end + 1;
+          if (p < data + length && *p == '\r')
+            p++;
+          if (p < data + length && *p == '\n') {
+            n = p + 1 - (data + pos);
+            *consumed = pos + n;
+            parser->scanned = 0;
+            return parse_head(parser, data + pos, n);
+          }
+        }
+        if (length - pos > HTTP_MAX_HEAD)
+          return parse_error(parser, "head of message too large");
+        /* Don't rescan the input we've already seen (except for a partial terminator). */
+        parser->scanned = length > pos + 2 ? length - pos - 2 : 0;
+        return HTTP_PARSE_AGAIN;
+
+      case HP_BODY:
+      case HP_CHUNK_DATA:
+        if (pos >= length)
+          return HTTP_PARSE_AGAIN;
+        n = length - pos;
+        if ((apr_off_t) n > parser->remaining)
+          n = (size_t) parser->remaining;
+        parser->remaining -= n;
+        if (parser->remaining == 0)
+          parser->state = parser->state == HP_BODY ? HP_DONE : HP_CHUNK_END;
+        *body = data + pos;
+        *body_length = n;
+        *consumed = pos + n;
+        return HTTP_PARSE_BODY;
+
+      case HP_UNTIL_EOF:
+        if (pos >= length)
+          return HTTP_PARSE_AGAIN;
+        *body = data + pos;
+        *body_length = length - pos;
+        *consumed = length;
+        return HTTP_PARSE_BODY;
+
+      case HP_CHUNK_SIZE:
+        end = find_line(data + pos, length - pos);
+        if (end == NULL) {
+          if (length - pos > HTTP_MAX_CHUNK_LINE)
+            return parse_error(parser, "chunk size line too long");
+          return HTTP_PARSE_AGAIN;
+        }
+        if (!apr_isxdigit(data[pos]))
+          return parse_error(parser, "invalid chunk size");
+        size = (apr_off_t) apr_strtoi64(data + pos, &endptr, 16);
+        if (size < 0 || endptr == data + pos
+            || (*endptr != ';' && *endptr != '\r' && *endptr != '\n' && *endptr != ' ' && *endptr != '\t'))
+          return parse_error(parser, "invalid chunk size");
+        pos = end - data;
+        *consumed = pos;
+        parser->remaining = size;
+        parser->state = size > 0 ? HP_CHUNK_DATA : HP_TRAILERS;
+        break;
+
+      case HP_CHUNK_END:
+        if (pos >= length || (data[pos] == '\r' && pos + 1 >= length))
+          return HTTP_PARSE_AGAIN;
+        if (data[pos] == '\r')
+          pos++;
+        if (data[pos] != '\n')
+          return parse_error(parser, "missing line break after chunk");
+        *consumed = ++pos;
+        parser->state = HP_CHUNK_SIZE;
+        break;
+
+      case HP_TRAILERS:
+        end = find_line(data + pos, length - pos);
+        if (end == NULL) {
+          if (length - pos > HTTP_MAX_HEAD)
+            return parse_error(parser, "trailer too large");
+          return HTTP_PARSE_AGAIN;
+        }
+        n = end - (data + pos);
+        pos += n;
+        *consumed = pos;
+        /* Trailer fields are ignored; an empty line ends the message. */
+        if (n == 1 || (n == 2 && end[-2] == '\r'))
+          parser->state = HP_DONE;
+        break;
+
+      case HP_DONE:
+        return HTTP_PARSE_DONE;
+
+      default:
+        return HTTP_PARSE_ERROR;
+    }
+  }
+}
+
+/* http_parser_finish() -- tell the parser that the connection was closed {{{2
+ *
+ * Returns HTTP_PARSE_DONE when this completes the message (a response body
+ * delimited by the end of the connection) and HTTP_PARSE_ERROR otherwise.
+ */
+
+int http_parser_finish(http_parser *parser)
+{
+  if (parser->state == HP_UNTIL_EOF || parser->state == HP_DONE) {
+    parser->state = HP_DONE;
+    return HTTP_PARSE_DONE;
+  }
+  return parse_error(parser, parser->state == HP_HEAD && parser->scanned == 0
+      ? "connection closed" : "connection closed before end of message");
+}
+
+/* push_http_headers() -- push a table with the headers of a message {{{2
+ *
+ * Header names are lowercased and repeated headers are joined with commas.
+ */
+
+void push_http_headers(lua_State *L, http_parser *parser)
+{
+  http_header *headers = (http_header*) parser->headers->elts;
+  luaL_Buffer buffer;
+  const char *name;
+  int i;
+
+  lua_createtable(L, 0, parser->headers->nelts);
+  for (i = 0; i < parser->headers->nelts; i++) {
+    luaL_buffinit(L, &buffer);
+    for (name = headers[i].name; *name != '\0'; name++)
+      luaL_addchar(&buffer, apr_tolower(*name));
+    luaL_pushresult(&buffer);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    if (lua_isstring(L, -1)) {
+      lua_pushliteral(L, ", ");
+      lua_pushstring(L, headers[i].value);
+      lua_concat(L, 3);
+    } else {
+      lua_pop(L, 1);
+      lua_pushstring(L, headers[i].value);
+    }
+    lua_rawset(L, -3);
+  }
+}
+
+/* push_http_message() -- push a table describing the head of a message {{{2 */
+
+void push_http_message(lua_State *L, http_parser *parser)
+{
+  lua_createtable(L, 0, 8);
+  if (parser->type == HTTP_REQUEST) {
+    lua_pushstring(L, parser->method);
+    lua_setfield(L, -2, "method");
+    lua_pushstring(L, parser->uri);
+    lua_setfield(L, -2, "uri");
+  } else {
+    lua_pushinteger(L, parser->status);
+    lua_setfield(L, -2, "status");
+    lua_pushstring(L, parser->reason);
+    lua_setfield(L, -2, "reason");
+  }
+  lua_pushfstring(L, "%d.%d", parser->major, parser->minor);
+  lua_setfield(L, -2, "version");
+  push_http_headers(L, parser);
+  lua_setfield(L, -2, "headers");
+  lua_pushboolean(L, parser->keepalive);
+  lua_setfield(L, -2, "keepalive");
+  lua_pushboolean(L, parser->chunked);
+  lua_setfield(L, -2, "chunked");
+  if (parser->length >= 0 && http_parser_header(parser, "Content-Length") != NULL) {
+    lua_pushnumber(L, (lua_Number) parser->length);
+    lua_setfield(L, -2, "length");
+  }
+}
+
+/* check_parser() {{{2 */
+
+static lua_apr_http_parser_object *check_parser(lua_State *L, int idx)
+{
+  lua_apr_http_parser_object *object;
+
+  object = check_object(L, idx, &lua_apr_http_parser_type);
+  if (object->parser.pool == NULL)
+    luaL_error(L, "attempt to use a destroyed %s", lua_apr_http_parser_type.friendlyname);
+
+  return object;
+}
+
+/* input_get() -- get the data to parse, including buffered input {{{2
+ *
+ * Input is parsed straight from the Lua string unless part of the previous
+ * input couldn't be parsed yet (an incomplete head or chunk size line), in
+ * which case the new input is appended to the buffer.
+ */
+
+static const char *input_get(lua_State *L, lua_apr_http_parser_object *object,
+    const char *chunk, size_t length, size_t *size)
+{
+  if (object->used == 0) {
+    *size = length;
+    return chunk;
+  }
+  if (object->used + length > object->size) {
+    char *buffer = realloc(object->buffer, object->used + length);
+    if (buffer == NULL)
+      raise_error_memory(L);
+    object->buffer = buffer;
+    object->size = object->used + length;
+  }
+  memcpy(object->buffer + object->used, chunk, length);
+  object->used += length;
+  *size = object->used;
+  return object->buffer;
+}
+
+/* input_keep() -- buffer input that couldn't be parsed yet {{{2 */
+
+static void input_keep(lua_State *L, lua_apr_http_parser_object *object,
+    const char *data, size_t size, size_t consumed)
+{
+  size -= consumed;
+  if (size > object->size) {
+    /* Only happens when parsing straight from the string. */
+    char *buffer = realloc(object->buffer, size);
+    if (buffer == NULL)
+      raise_error_memory(L);
+    object->buffer = buffer;
+    object->size = size;
+  }
+  if (size > 0)
+    memmove(object->buffer, data + consumed, size);
+  object->used = size;
+}
+
+/* apr.http_parser([type]) -> parser {{{1
+ *
+ * Create an incremental parser for HTTP messages. The string @type is either
+ * `'request'` (the default) or `'response'`. On success a parser object is
+ * returned, otherwise a nil followed by an error message is returned. A
+ * parser can be reused for any number of consecutive messages on the same
+ * (keep-alive) connection; the memory used for one message is reused for the
+ * next. Requests with ambiguous body framing (both `Transfer-Encoding` and
+ * `Content-Length` headers, conflicting `Content-Length` headers or a
+ * `Transfer-Encoding` that doesn't end in `chunked`) are rejected as invalid.
+ */
+
+int lua_apr_http_parser(lua_State *L)
+{
+  const char *options[] = { "request", "response", NULL };
+  const int values[] = { HTTP_REQUEST, HTTP_RESPONSE };
+  lua_apr_http_parser_object *object;
+  apr_status_t status;
+  int type;
+
+  type = values[luaL_checkoption(L, 1, "request", options)];
+  object = new_object(L, &lua_apr_http_parser_type);
+  status = http_parser_init(&object->parser, type, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  return 1;
+}
+
+/* parser:feed(data) -> message, offset {{{1
+ *
+ * Feed the string @data to the parser. As long as the head of the message
+ * isn't complete false is returned (the parser keeps what it's seen so far,
+ * so you only pass new data). Once the head is complete a table describing
+ * the message is returned followed by the offset of the first byte in @data
+ * after the head, i.e. the start of the body. The table contains the fields
+ * `method` and `uri` (requests), `status` and `reason` (responses),
+ * `version` (e.g. `'1.1'`), `headers` (a table with lowercase header names),
+ * `keepalive` (true when the connection can be reused after this message),
+ * `chunked` and `length` (the value of the `Content-Length` header, if any).
+ * If the message is invalid a nil followed by an error message is returned.
+ *
+ * After the head use `parser:body()` to decode the body.
+ */
+
+static int parser_feed(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+  size_t length, size, consumed, before, body_length;
+  const char *chunk, *data, *body;
+  int result;
+
+  object = check_parser(L, 1);
+  chunk = luaL_checklstring(L, 2, &length);
+  if (object->parser.state != HP_HEAD)
+    luaL_error(L, "head of message already parsed, use parser:body()");
+
+  before = object->used;
+  data = input_get(L, object, chunk, length, &size);
+  result = http_parser_execute(&object->parser, data, size, &consumed, &body, &body_length);
+  if (result == HTTP_PARSE_AGAIN) {
+    /* Keep the incomplete head for the next call. */
+    input_keep(L, object, data, size, consumed);
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  object->used = 0;
+  if (result == HTTP_PARSE_ERROR)
+    return push_error_message(L, object->parser.error);
+
+  push_http_message(L, &object->parser);
+  lua_pushinteger(L, consumed - before + 1);
+
+  return 2;
+}
+
+/* parser:body(data) -> body, done, offset {{{1
+ *
+ * Decode (part of) the body of the current message from the string @data,
+ * which should start where the data given to `parser:feed()` or the previous
+ * call to `parser:body()` left off. Returns the decoded body data (which is
+ * empty when @data contains only framing), a boolean which is true when the
+ * end of the message was reached and the offset of the first byte in @data
+ * that wasn't used, i.e. the start of the next message on the connection. When
+ * the message is complete the parser is ready to parse the next message using
+ * `parser:feed()`. If the body is invalid a nil followed by an error message
+ * is returned.
+ */
+
+static int parser_body(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+  size_t length, size, before, consumed, position = 0, body_length;
+  const char *chunk, *data, *body;
+  luaL_Buffer buffer;
+  int result;
+
+  object = check_parser(L, 1);
+  chunk = luaL_checklstring(L, 2, &length);
+  if (object->parser.state == HP_HEAD)
+    luaL_error(L, "head of message hasn't been parsed yet, use parser:feed()");
+
+  before = object->used;
+  data = input_get(L, object, chunk, length, &size);
+  luaL_buffinit(L, &buffer);
+  do {
+    result = http_parser_execute(&object->parser, data + position,
+        size - position, &consumed, &body, &body_length);
+    position += consumed;
+    if (result == HTTP_PARSE_BODY)
+      luaL_addlstring(&buffer, body, body_length);
+  } while (result == HTTP_PARSE_BODY);
+
+  if (result == HTTP_PARSE_ERROR) {
+    object->used = 0;
+    return push_error_message(L, object->parser.error);
+  } else if (result == HTTP_PARSE_AGAIN) {
+    /* Keep an incomplete chunk size line for the next call. */
+    input_keep(L, object, data, size, position);
+    position = size;
+  } else {
+    object->used = 0;
+  }
+
+  luaL_pushresult(&buffer);
+  lua_pushboolean(L, result == HTTP_PARSE_DONE);
+  lua_pushinteger(L, (position > before ? position - before : 0) + 1);
+  if (result == HTTP_PARSE_DONE)
+    http_parser_reset(&object->parser);
+
+  return 3;
+}
+
+/* parser:finish() -> status {{{1
+ *
+ * Tell the parser that the connection was closed. Returns true when this
+ * completes the current message (a response without `Content-Length` header
+ * ends when the server closes the connection), otherwise nil followed by an
+ * error message is returned. Afterwards the parser is ready for a new message.
+ */
+
+static int parser_finish(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+  int nresults = 1;
+
+  object = check_parser(L, 1);
+  /* Push the result first because resetting clears the error message. */
+  if (http_parser_finish(&object->parser) != HTTP_PARSE_DONE)
+    nresults = push_error_message(L, object->parser.error);
+  else
+    lua_pushboolean(L, 1);
+  http_parser_reset(&object->parser);
+  object->used = 0;
+
+  return nresults;
+}
+
+/* parser:reset() -> status {{{1
+ *
+ * Discard the current message so that the parser can be used for a new one.
+ */
+
+static int parser_reset(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+
+  object = check_parser(L, 1);
+  http_parser_reset(&object->parser);
+  object->used = 0;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* parser:__tostring() {{{1 */
+
+static int parser_tostring(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+
+  object = check_object(L, 1, &lua_apr_http_parser_type);
+  lua_pushfstring(L, "%s %s (%p)", lua_apr_http_parser_type.friendlyname,
+      object->parser.type == HTTP_REQUEST ? "request" : "response", object);
+
+  return 1;
+}
+
+/* parser:__gc() {{{1 */
+
+static int parser_gc(lua_State *L)
+{
+  lua_apr_http_parser_object *object;
+
+  object = check_object(L, 1, &lua_apr_http_parser_type);
+  if (object_collectable((lua_apr_refobj*)object)) {
+    http_parser_destroy(&object->parser);
+    free(object->buffer);
+    object->buffer = NULL;
+  }
+  release_object((lua_apr_refobj*)object);
+
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg parser_methods[] = {
+  { "feed", parser_feed },
+  { "body", parser_body },
+  { "finish", parser_finish },
+  { "reset", parser_reset },
+  { NULL, NULL }
+};
+
+static luaL_reg parser_metamethods[] = {
+  { "__tostring", parser_tostring },
+  { "__eq", objects_equal },
+  { "__gc", parser_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_http_parser_type = {
+  "lua_apr_http_parser*",              /* metatable name in registry */
+  "HTTP parser",                       /* friendly object name       */
+  sizeof(lua_apr_http_parser_object),  /* structure size             */
+  parser_methods,                      /* methods table              */
+  parser_metamethods                   /* metamethods table          */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -0,0 +1,1192 @@
+/* HTTP server module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * The HTTP server module implements an HTTP/1.1 server engine in C on top of
+ * APR's pollset and socket layers. Accepting connections, parsing requests,
+ * keep-alive, pipelining, chunked transfer encoding and sending files are all
+ * handled in C; only complete, pre-parsed requests are passed to Lua:
+ *
+ *     local apr = require 'apr'
+ *     local server = assert(apr.http_server {
+ *       port = 8080,
+ *       handler = function(request)
+ *         local body = 'You requested ' .. request.path .. '\n'
+ *         return 200, { ['Content-Type'] = 'text/plain' }, body
+ *       end
+ *     })
+ *     assert(server:run())
+ *
+ * To use more than one processor core start several servers listening on the
+ * same port using `apr.http_server_threads()`.
+ */
+
+#include "lua_apr.h"
+#include <apr_poll.h>
+#include <apr_portable.h>
+#include <apr_strings.h>
+#include <apr_lib.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+/* Default values of options. */
+#define HTTP_DEFAULT_SIZE 1024
+#define HTTP_DEFAULT_BACKLOG 511
+#define HTTP_DEFAULT_TIMEOUT 15
+#define HTTP_DEFAULT_MAX_BODY (1024 * 1024)
+
+/* Size of reads from client sockets. */
+#define HTTP_READ_SIZE 8192
+
+/* Stop parsing pipelined requests while this much output is pending. */
+#define HTTP_OUTPUT_LIMIT (64 * 1024)
+
+/* Maximum number of bytes sent from a file at once. */
+#define HTTP_FILE_CHUNK (1024 * 1024)
+
+/* Growable buffer. Data between @offset and @used hasn't been processed yet.
+ * When memory runs out @failed is set and the connection is closed. */
+typedef struct {
+  char *data;
+  size_t size, used, offset;
+  int failed;
+} http_buffer;
+
+typedef struct http_connection http_connection;
+
+struct http_connection {
+  http_connection *prev, *next;   /* list of open connections            */
+  apr_pool_t *pool;               /* memory pool of the connection       */
+  apr_socket_t *socket;           /* client socket                       */
+  apr_pollfd_t fd;                /* registration in the pollset         */
+  const char *peer;               /* IP address of the client            */
+  http_parser parser;             /* state of the current request        */
+  http_buffer input, body, output;
+  apr_file_t *file;               /* file being sent as response body    */
+  apr_off_t file_offset;          /* position of next byte to send       */
+  apr_off_t file_remaining;       /* number of bytes left to send        */
+  int streaming;                  /* response body generated by function */
+  int chunked;                    /* use chunked encoding for streaming  */
+  int closing;                    /* close after sending pending output  */
+  apr_time_t last_active;         /* time of last network activity       */
+};
+
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  apr_socket_t *listener;
+  apr_pollfd_t listener_fd;
+  apr_pollset_t *pollset;
+  http_connection *connections;
+  int size, count, accepting, running, stopped;
+  apr_interval_time_t timeout;
+  apr_size_t max_body;
+  apr_time_t date_time;
+  char date[APR_RFC822_DATE_LEN];
+  apr_uint64_t accepted, requests, errors, bytes_in, bytes_out;
+} lua_apr_http_server_object;
+
+static lua_apr_objtype lua_apr_http_server_type;
+
+/* Internal functions {{{1 */
+
+/* check_server() {{{2 */
+
+static lua_apr_http_server_object *check_server(lua_State *L, int idx, int open)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_object(L, idx, &lua_apr_http_server_type);
+  if (open && server->listener == NULL)
+    luaL_error(L, "attempt to use a closed %s", lua_apr_http_server_type.friendlyname);
+
+  return server;
+}
+
+/* reason_phrase() {{{2 */
+
+static const char *reason_phrase(int status)
+{
+  static const struct { int status; const char *reason; } phrases[] = {
+    { 100, "Continue" }, { 101, "Switching Protocols" }, { 200, "OK" },
+    { 201, "Created" }, { 202, "Accepted" }, { 204, "No Content" },
+    { 206, "Partial Content" }, { 301, "Moved Permanently" }, { 302, "Found" },
+    { 303, "See Other" }, { 304, "Not Modified" }, { 307, "Temporary Redirect" },
+    { 308, "Permanent Redirect" }, { 400, "Bad Request" },
+    { 401, "Unauthorized" }, { 403, "Forbidden" }, { 404, "Not Found" },
+    { 405, "Method Not Allowed" }, { 408, "Request Timeout" },
+    { 409, "Conflict" }, { 410, "Gone" }, { 411, "Length Required" },
+    { 413, "Payload Too Large" }, { 414, "URI Too Long" },
+    { 415, "Unsupported Media Type" }, { 416, "Range Not Satisfiable" },
+    { 429, "Too Many Requests" }, { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" }, { 501, "Not Implemented" },
+    { 502, "Bad Gateway" }, { 503, "Service Unavailable" },
+    { 504, "Gateway Timeout" }, { 505, "HTTP Version Not Supported" },
+  };
+  size_t i;
+
+  for (i = 0; i < count(phrases); i++)
+    if (phrases[i].status == status)
+      return phrases[i].reason;
+
+  return "Unknown";
+}
+
+/* buffer_reserve() -- make room for @size more bytes in a buffer {{{2 */
+
+static char *buffer_reserve(http_buffer *buffer, size_t size)
+{
+  if (buffer->failed)
+    return NULL;
+  if (buffer->used + size > buffer->size) {
+    size_t newsize = buffer->size > 0 ? buffer->size : 1024;
+    char *data;
+    while (newsize < buffer->used + size)
+      newsize *= 2;
+    data = realloc(buffer->data, newsize);
+    if (data == NULL) {
+      buffer->failed = 1;
+      return NULL;
+    }
+    buffer->data = data;
+    buffer->size = newsize;
+  }
+
+  return buffer->data + buffer->used;
+}
+
+/* buffer_append() {{{2 */
+
+static void buffer_append(http_buffer *buffer, const char *data, size_t size)
+{
+  char *target = buffer_reserve(buffer, size);
+
+  if (target != NULL) {
+    memcpy(target, data, size);
+    buffer->used += size;
+  }
+}
+
+/* buffer_printf() {{{2 */
+
+static void buffer_printf(http_buffer *buffer, const char *format, ...)
+{
+  char temp[512];
+  va_list args;
+  apr_size_t size;
+
+  va_start(args, format);
+  size = apr_vsnprintf(temp, sizeof temp, format, args);
+  va_end(args);
+  buffer_append(buffer, temp, size);
+}
+
+/* buffer_free() {{{2 */
+
+static void buffer_free(http_buffer *buffer)
+{
+  free(buffer->data);
+  memset(buffer, 0, sizeof *buffer);
+}
+
+/* server_date() -- get the value of the Date header (cached per second) {{{2 */
+
+static const char *server_date(lua_apr_http_server_object *server)
+{
+  apr_time_t now = apr_time_now();
+
+  if (apr_time_sec(now) != apr_time_sec(server->date_time)) {
+    apr_rfc822_date(server->date, now);
+    server->date_time = now;
+  }
+
+  return server->date;
+}
+
+/* set_reuseport() -- allow several listeners on the same port {{{2 */
+
+static apr_status_t set_reuseport(apr_socket_t *socket)
+{
+# ifdef SO_REUSEPORT
+  apr_os_sock_t fd;
+  apr_status_t status;
+  int on = 1;
+
+  status = apr_os_sock_get(&fd, socket);
+  if (status == APR_SUCCESS && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*)&on, sizeof on) != 0)
+    status = apr_get_netos_error();
+
+  return status;
+# else
+  (void)socket;
+  return APR_ENOTIMPL;
+# endif
+}
+
+/* conn_watch() -- change the events the pollset reports for a connection {{{2 */
+
+static void conn_watch(lua_apr_http_server_object *server, http_connection *conn, apr_int16_t events)
+{
+  if (conn->fd.reqevents != events) {
+    apr_pollset_remove(server->pollset, &conn->fd);
+    conn->fd.reqevents = events;
+    apr_pollset_add(server->pollset, &conn->fd);
+  }
+}
+
+/* conn_failed() -- check whether a buffer of a connection ran out of memory {{{2 */
+
+static int conn_failed(http_connection *conn)
+{
+  return conn->input.failed || conn->body.failed || conn->output.failed;
+}
+
+/* conn_release() -- forget the body of the response being sent {{{2 */
+
+static void conn_release(lua_State *L, int env, http_connection *conn)
+{
+  if (conn->file != NULL || conn->streaming) {
+    conn->file = NULL;
+    conn->streaming = 0;
+    if (L != NULL) {
+      lua_pushlightuserdata(L, conn);
+      lua_pushnil(L);
+      lua_rawset(L, env);
+    }
+  }
+}
+
+/* conn_close() {{{2 */
+
+static void conn_close(lua_State *L, int env, lua_apr_http_server_object *server, http_connection *conn)
+{
+  conn_release(L, env, conn);
+  apr_pollset_remove(server->pollset, &conn->fd);
+  if (conn->prev != NULL)
+    conn->prev->next = conn->next;
+  else
+    server->connections = conn->next;
+  if (conn->next != NULL)
+    conn->next->prev = conn->prev;
+  buffer_free(&conn->input);
+  buffer_free(&conn->body);
+  buffer_free(&conn->output);
+  apr_socket_close(conn->socket);
+  /* Also destroys the memory pool of the parser. */
+  apr_pool_destroy(conn->pool);
+  server->count--;
+  /* Resume accepting connections when the pollset was full. */
+  if (!server->accepting && !server->stopped && apr_pollset_add(server->pollset, &server->listener_fd) == APR_SUCCESS)
+    server->accepting = 1;
+}
+
+/* server_accept() -- accept pending connections {{{2 */
+
+static void server_accept(lua_apr_http_server_object *server)
+{
+  http_connection *conn;
+  apr_socket_t *socket;
+  apr_sockaddr_t *address;
+  apr_pool_t *pool;
+
+  for (;;) {
+    /* Keep one slot of the pollset for the listener. */
+    if (server->count >= server->size - 1) {
+      if (apr_pollset_remove(server->pollset, &server->listener_fd) == APR_SUCCESS)
+        server->accepting = 0;
+      return;
+    }
+    if (apr_pool_create(&pool, server->pool) != APR_SUCCESS)
+      return;
+    if (apr_socket_accept(&socket, server->listener, pool) != APR_SUCCESS) {
+      apr_pool_destroy(pool);
+      return;
+    }
+    conn = apr_pcalloc(pool, sizeof *conn);
+    if (conn == NULL || http_parser_init(&conn->parser, HTTP_REQUEST, pool) != APR_SUCCESS) {
+      apr_socket_close(socket);
+      apr_pool_destroy(pool);
+      return;
+    }
+    apr_socket_opt_set(socket, APR_SO_NONBLOCK, 1);
+    apr_socket_timeout_set(socket, 0);
+    apr_socket_opt_set(socket, APR_TCP_NODELAY, 1);
+    conn->pool = pool;
+    conn->socket = socket;
+    conn->peer = "";
+    if (apr_socket_addr_get(&address, APR_REMOTE, socket) == APR_SUCCESS)
+      apr_sockaddr_ip_get((char**)&conn->peer, address);
+    conn->last_active = apr_time_now();
+    conn->fd.p = pool;
+    conn->fd.desc_type = APR_POLL_SOCKET;
+    conn->fd.desc.s = socket;
+    conn->fd.reqevents = APR_POLLIN;
+    conn->fd.client_data = conn;
+    if (apr_pollset_add(server->pollset, &conn->fd) != APR_SUCCESS) {
+      apr_socket_close(socket);
+      apr_pool_destroy(pool);
+      return;
+    }
+    conn->next = server->connections;
+    if (conn->next != NULL)
+      conn->next->prev = conn;
+    server->connections = conn;
+    server->count++;
+    server->accepted++;
+  }
+}
+
+/* push_request() -- create the table passed to the handler {{{2 */
+
+static void push_request(lua_State *L, http_connection *conn)
+{
+  http_parser *parser = &conn->parser;
+  const char *query;
+
+  lua_createtable(L, 0, 9);
+  lua_pushstring(L, parser->method);
+  lua_setfield(L, -2, "method");
+  lua_pushstring(L, parser->uri);
+  lua_setfield(L, -2, "uri");
+  query = strchr(parser->uri, '?');
+  if (query != NULL) {
+    lua_pushlstring(L, parser->uri, query - parser->uri);
+    lua_setfield(L, -2, "path");
+    lua_pushstring(L, query + 1);
+    lua_setfield(L, -2, "query");
+  } else {
+    lua_pushstring(L, parser->uri);
+    lua_setfield(L, -2, "path");
+  }
+  lua_pushfstring(L, "%d.%d", parser->major, parser->minor);
+  lua_setfield(L, -2, "version");
+  lua_pushstring(L, conn->peer);
+  lua_setfield(L, -2, "peer");
+
+  push_http_headers(L, parser);
+  lua_setfield(L, -2, "headers");
+
+  if (parser->length != 0) {
+    lua_pushlstring(L, conn->body.data != NULL ? conn->body.data : "", conn->body.used);
+    lua_setfield(L, -2, "body");
+  }
+
+  /* The server object is at stack index 1. */
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "server");
+}
+
+/* send_error() -- send an error response and close the connection {{{2 */
+
+static void send_error(lua_State *L, http_connection *conn, int status)
+{
+  const char *reason = reason_phrase(status);
+
+  buffer_printf(&conn->output,
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: %" APR_SIZE_T_FMT "\r\n"
+      "Connection: close\r\n\r\n"
+      "%d %s\n", status, reason, strlen(reason) + 5, status, reason);
+  conn->closing = 1;
+}
+
+/* handler_failed() -- remember the error raised by a handler {{{2 */
+
+static void handler_failed(lua_State *L, int env, lua_apr_http_server_object *server)
+{
+  server->errors++;
+  lua_setfield(L, env, "error");
+}
+
+/* add_header() -- add a response header returned by a handler {{{2 */
+
+static int add_header(lua_State *L, http_buffer *output, const char *name, int idx, int *keepalive)
+{
+  const char *value;
+  size_t length;
+
+  value = lua_tolstring(L, idx, &length);
+  if (value == NULL || strlen(value) != length || strpbrk(value, "\r\n") != NULL)
+    return 0;
+  if (strcasecmp(name, "Content-Length") == 0 || strcasecmp(name, "Transfer-Encoding") == 0
+      || strcasecmp(name, "Date") == 0)
+    /* Message framing is handled by the server. */
+    return 1;
+  if (strcasecmp(name, "Connection") == 0) {
+    if (strcasecmp(value, "close") == 0)
+      *keepalive = 0;
+    return 1;
+  }
+  buffer_append(output, name, strlen(name));
+  buffer_append(output, ": ", 2);
+  buffer_append(output, value, length);
+  buffer_append(output, "\r\n", 2);
+
+  return 1;
+}
+
+/* add_connection_header() {{{2 */
+
+static void add_connection_header(lua_State *L, http_connection *conn, int keepalive)
+{
+  if (!keepalive)
+    buffer_append(&conn->output, "Connection: close\r\n", 19);
+  else if (conn->parser.minor == 0)
+    buffer_append(&conn->output, "Connection: keep-alive\r\n", 24);
+  buffer_append(&conn->output, "\r\n", 2);
+}
+
+/* conn_respond() -- call the handler and queue the response {{{2 */
+
+static void conn_respond(lua_State *L, int env, lua_apr_http_server_object *server, http_connection *conn)
+{
+  http_parser *parser = &conn->parser;
+  size_t mark = conn->output.used;
+  int status, keepalive, head, no_body, valid = 1, top = lua_gettop(L);
+  apr_finfo_t info;
+  const char *name;
+
+  server->requests++;
+  head = strcmp(parser->method, "HEAD") == 0;
+
+  /* Call the handler. */
+  lua_getfield(L, env, "handler");
+  push_request(L, conn);
+  if (lua_pcall(L, 1, 3, 0) != 0) {
+    handler_failed(L, env, server);
+    send_error(L, conn, 500);
+    return;
+  }
+  if (!lua_isnumber(L, top + 1) || !(lua_isnil(L, top + 2) || lua_istable(L, top + 2))) {
+    lua_pushliteral(L, "HTTP handler should return a status code, headers table and body");
+    handler_failed(L, env, server);
+    send_error(L, conn, 500);
+    lua_settop(L, top);
+    return;
+  }
+  /* Decided after the handler ran so that it can stop the server, headers
+   * returned by the handler can still force the connection to be closed. */
+  keepalive = parser->keepalive && !server->stopped;
+  status = lua_tointeger(L, top + 1);
+  if (status < 100 || status > 999)
+    status = 500;
+  no_body = status / 100 == 1 || status == 204 || status == 304;
+
+  /* Status line and headers. */
+  buffer_printf(&conn->output, "HTTP/1.1 %d %s\r\nDate: %s\r\n",
+      status, reason_phrase(status), server_date(server));
+  if (lua_istable(L, top + 2)) {
+    lua_pushnil(L);
+    while (valid && lua_next(L, top + 2)) {
+      size_t length;
+      /* Check the type first: lua_tostring() would convert numeric keys in
+       * place, which confuses lua_next(). */
+      if (lua_type(L, -2) != LUA_TSTRING) {
+        lua_pop(L, 1);
+        continue;
+      }
+      name = lua_tolstring(L, -2, &length);
+      if (strlen(name) != length || strpbrk(name, ":\r\n") != NULL)
+        valid = 0;
+      else if (lua_istable(L, -1)) {
+        /* Repeated header, e.g. Set-Cookie. */
+        int i;
+        for (i = 1; valid; i++) {
+          lua_rawgeti(L, -1, i);
+          if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+          }
+          valid = add_header(L, &conn->output, name, lua_gettop(L), &keepalive);
+          lua_pop(L, 1);
+        }
+      } else
+        valid = add_header(L, &conn->output, name, lua_gettop(L), &keepalive);
+      lua_pop(L, 1);
+    }
+    if (!valid) {
+      lua_settop(L, top);
+      conn->output.used = mark;
+      lua_pushliteral(L, "HTTP handler returned invalid header");
+      handler_failed(L, env, server);
+      send_error(L, conn, 500);
+      return;
+    }
+  }
+
+  /* Body and framing. */
+  if (lua_isstring(L, top + 3) || lua_isnil(L, top + 3)) {
+    size_t length = 0;
+    const char *body = lua_tolstring(L, top + 3, &length);
+    if (!no_body)
+      buffer_printf(&conn->output, "Content-Length: %" APR_SIZE_T_FMT "\r\n", length);
+    add_connection_header(L, conn, keepalive);
+    if (!head && !no_body && length > 0)
+      buffer_append(&conn->output, body, length);
+  } else if (object_has_type(L, top + 3, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = file_check(L, top + 3, 0);
+    apr_off_t offset = 0;
+    if (file->handle == NULL
+        || apr_file_info_get(&info, APR_FINFO_SIZE, file->handle) != APR_SUCCESS
+        || apr_file_seek(file->handle, APR_CUR, &offset) != APR_SUCCESS) {
+      conn->output.used = mark;
+      lua_settop(L, top);
+      lua_pushliteral(L, "HTTP handler returned closed or unreadable file");
+      handler_failed(L, env, server);
+      send_error(L, conn, 500);
+      return;
+    }
+    buffer_printf(&conn->output, "Content-Length: %" APR_OFF_T_FMT "\r\n", info.size - offset);
+    add_connection_header(L, conn, keepalive);
+    if (!head && !no_body && info.size > offset) {
+      conn->file = file->handle;
+      conn->file_offset = offset;
+      conn->file_remaining = info.size - offset;
+      /* Keep the file object alive while it's being sent. */
+      lua_pushlightuserdata(L, conn);
+      lua_pushvalue(L, top + 3);
+      lua_rawset(L, env);
+    }
+  } else if (lua_isfunction(L, top + 3)) {
+    /* HTTP/1.0 clients don't support chunked encoding. */
+    conn->chunked = parser->minor > 0;
+    if (!conn->chunked)
+      keepalive = 0;
+    if (conn->chunked && !no_body)
+      buffer_append(&conn->output, "Transfer-Encoding: chunked\r\n", 28);
+    add_connection_header(L, conn, keepalive);
+    if (!head && !no_body) {
+      conn->streaming = 1;
+      lua_pushlightuserdata(L, conn);
+      lua_pushvalue(L, top + 3);
+      lua_rawset(L, env);
+    }
+  } else {
+    conn->output.used = mark;
+    lua_settop(L, top);
+    lua_pushliteral(L, "HTTP handler returned invalid body");
+    handler_failed(L, env, server);
+    send_error(L, conn, 500);
+    return;
+  }
+
+  conn->closing = !keepalive;
+  lua_settop(L, top);
+}
+
+/* conn_process() -- parse buffered input and queue responses {{{2 */
+
+static void conn_process(lua_State *L, int env, lua_apr_http_server_object *server, http_connection *conn)
+{
+  http_parser *parser = &conn->parser;
+  const char *data, *expect;
+  size_t consumed, length;
+  int result;
+
+  while (!conn->closing && !conn_failed(conn) && conn->file == NULL && !conn->streaming
+      && conn->output.used - conn->output.offset < HTTP_OUTPUT_LIMIT) {
+    result = http_parser_execute(parser, conn->input.data + conn->input.offset,
+        conn->input.used - conn->input.offset, &consumed, &data, &length);
+    conn->input.offset += consumed;
+    if (result == HTTP_PARSE_AGAIN) {
+      break;
+    } else if (result == HTTP_PARSE_HEAD) {
+      if (parser->length > 0 && (apr_size_t) parser->length > server->max_body) {
+        send_error(L, conn, 413);
+        break;
+      }
+      expect = http_parser_header(parser, "Expect");
+      if (expect != NULL && parser->length != 0 && parser->minor > 0
+          && strcasecmp(expect, "100-continue") == 0)
+        buffer_append(&conn->output, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    } else if (result == HTTP_PARSE_BODY) {
+      if (conn->body.used + length > server->max_body) {
+        send_error(L, conn, 413);
+        break;
+      }
+      buffer_append(&conn->body, data, length);
+    } else if (result == HTTP_PARSE_DONE) {
+      conn_respond(L, env, server, conn);
+      conn->body.used = 0;
+      http_parser_reset(parser);
+    } else {
+      send_error(L, conn, 400);
+      break;
+    }
+  }
+
+  /* Move unprocessed input to the start of the buffer. */
+  if (conn->input.offset > 0) {
+    conn->input.used -= conn->input.offset;
+    memmove(conn->input.data, conn->input.data + conn->input.offset, conn->input.used);
+    conn->input.offset = 0;
+  }
+}
+
+/* conn_flush() -- send pending output {{{2
+ *
+ * Returns APR_SUCCESS when everything has been sent, an EAGAIN status when the
+ * socket buffer is full and any other status when the connection should be
+ * closed.
+ */
+
+static apr_status_t conn_flush(lua_State *L, int env, lua_apr_http_server_object *server, http_connection *conn)
+{
+  apr_status_t status;
+  apr_size_t length;
+  const char *chunk;
+
+  for (;;) {
+    if (conn->output.offset < conn->output.used) {
+      length = conn->output.used - conn->output.offset;
+      status = apr_socket_send(conn->socket, conn->output.data + conn->output.offset, &length);
+      conn->output.offset += length;
+      server->bytes_out += length;
+      if (status != APR_SUCCESS)
+        return status;
+      continue;
+    }
+    conn->output.used = conn->output.offset = 0;
+
+    if (conn->file != NULL) {
+      if (conn->file_remaining == 0) {
+        conn_release(L, env, conn);
+        continue;
+      }
+      length = conn->file_remaining > HTTP_FILE_CHUNK ? HTTP_FILE_CHUNK : (apr_size_t) conn->file_remaining;
+#     if APR_HAS_SENDFILE
+      {
+        apr_off_t offset = conn->file_offset;
+        status = apr_socket_sendfile(conn->socket, conn->file, NULL, &offset, &length, 0);
+        conn->file_offset += length;
+        conn->file_remaining -= length;
+        server->bytes_out += length;
+        if (status != APR_SUCCESS)
+          return status;
+      }
+#     else
+      {
+        apr_off_t offset = conn->file_offset;
+        char *buffer = buffer_reserve(&conn->output, length);
+        if (buffer == NULL)
+          return APR_ENOMEM;
+        status = apr_file_seek(conn->file, APR_SET, &offset);
+        if (status == APR_SUCCESS)
+          status = apr_file_read(conn->file, buffer, &length);
+        if (status != APR_SUCCESS)
+          return status;
+        conn->output.used += length;
+        conn->file_offset += length;
+        conn->file_remaining -= length;
+      }
+#     endif
+      continue;
+    }
+
+    if (conn->streaming) {
+      lua_pushlightuserdata(L, conn);
+      lua_rawget(L, env);
+      if (lua_pcall(L, 0, 1, 0) != 0) {
+        /* The head has already been sent so all we can do is disconnect. */
+        handler_failed(L, env, server);
+        conn_release(L, env, conn);
+        return APR_EGENERAL;
+      }
+      chunk = lua_tolstring(L, -1, &length);
+      if (chunk == NULL) {
+        if (conn->chunked)
+          buffer_append(&conn->output, "0\r\n\r\n", 5);
+        conn_release(L, env, conn);
+      } else if (length > 0) {
+        if (conn->chunked)
+          buffer_printf(&conn->output, "%lx\r\n", (unsigned long) length);
+        buffer_append(&conn->output, chunk, length);
+        if (conn->chunked)
+          buffer_append(&conn->output, "\r\n", 2);
+      }
+      lua_pop(L, 1);
+      continue;
+    }
+
+    return APR_SUCCESS;
+  }
+}
+
+/* conn_run() -- drive a connection as far as possible {{{2 */
+
+static void conn_run(lua_State *L, int env, lua_apr_http_server_object *server, http_connection *conn)
+{
+  apr_status_t status;
+
+  for (;;) {
+    status = conn_failed(conn) ? APR_ENOMEM : conn_flush(L, env, server, conn);
+    if (APR_STATUS_IS_EAGAIN(status)) {
+      conn_watch(server, conn, APR_POLLOUT);
+      return;
+    } else if (status != APR_SUCCESS || conn->closing) {
+      conn_close(L, env, server, conn);
+      return;
+    }
+    conn_process(L, env, server, conn);
+    if (conn->output.used == 0 && conn->file == NULL && !conn->streaming
+        && !conn->closing && !conn_failed(conn)) {
+      /* Wait for the rest of the request. */
+      conn_watch(server, conn, APR_POLLIN);
+      return;
+    }
+  }
+}
+
+/* conn_read() {{{2 */
+
+static apr_status_t conn_read(lua_State *L, lua_apr_http_server_object *server, http_connection *conn)
+{
+  apr_status_t status;
+  apr_size_t length = HTTP_READ_SIZE;
+  char *buffer;
+
+  buffer = buffer_reserve(&conn->input, length);
+  if (buffer == NULL)
+    return APR_ENOMEM;
+  status = apr_socket_recv(conn->socket, buffer, &length);
+  conn->input.used += length;
+  server->bytes_in += length;
+  if (length > 0)
+    return APR_SUCCESS;
+  else if (status == APR_SUCCESS)
+    return APR_EOF;
+
+  return status;
+}
+
+/* server_drain() -- stop accepting and close idle connections {{{2
+ *
+ * Called after server:stop(). Connections that are still sending a response
+ * are closed once it has been sent (or when they time out).
+ */
+
+static void server_drain(lua_State *L, int env, lua_apr_http_server_object *server)
+{
+  http_connection *conn, *next;
+
+  if (server->accepting && apr_pollset_remove(server->pollset, &server->listener_fd) == APR_SUCCESS)
+    server->accepting = 0;
+  for (conn = server->connections; conn != NULL; conn = next) {
+    next = conn->next;
+    if (conn->fd.reqevents == APR_POLLIN)
+      conn_close(L, env, server, conn);
+    else
+      conn->closing = 1;
+  }
+}
+
+/* close_connections() {{{2 */
+
+static void close_connections(lua_State *L, int env, lua_apr_http_server_object *server)
+{
+  while (server->connections != NULL)
+    conn_close(L, env, server, server->connections);
+}
+
+/* server_loop() -- the event loop of server:run() {{{2 */
+
+static int server_loop(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+  http_connection *conn, *next;
+  const apr_pollfd_t *descriptors;
+  apr_status_t status = APR_SUCCESS;
+  apr_time_t now, last_sweep;
+  apr_int32_t num, i;
+  int env = 2;
+
+  server = check_server(L, 1, 1);
+  object_env_private(L, 1);
+  if (!server->accepting && apr_pollset_add(server->pollset, &server->listener_fd) == APR_SUCCESS)
+    server->accepting = 1;
+  last_sweep = apr_time_now();
+
+  while (!server->stopped || server->connections != NULL) {
+    status = apr_pollset_poll(server->pollset, apr_time_from_sec(1), &num, &descriptors);
+    if (APR_STATUS_IS_TIMEUP(status) || APR_STATUS_IS_EINTR(status))
+      num = 0;
+    else if (status != APR_SUCCESS)
+      break;
+    now = apr_time_now();
+    for (i = 0; i < num; i++) {
+      conn = descriptors[i].client_data;
+      if (conn == NULL) {
+        if (!server->stopped)
+          server_accept(server);
+      } else if (conn->fd.reqevents == APR_POLLIN) {
+        status = conn_read(L, server, conn);
+        if (status == APR_SUCCESS) {
+          conn->last_active = now;
+          conn_run(L, env, server, conn);
+        } else if (!APR_STATUS_IS_EAGAIN(status)) {
+          conn_close(L, env, server, conn);
+        }
+      } else {
+        conn->last_active = now;
+        conn_run(L, env, server, conn);
+      }
+    }
+    /* Close idle connections about once a second. */
+    if (now - last_sweep >= APR_USEC_PER_SEC) {
+      for (conn = server->connections; conn != NULL; conn = next) {
+        next = conn->next;
+        if (now - conn->last_active > server->timeout)
+          conn_close(L, env, server, conn);
+      }
+      last_sweep = now;
+    }
+    if (server->stopped)
+      server_drain(L, env, server);
+    status = APR_SUCCESS;
+  }
+
+  return push_status(L, status);
+}
+
+/* destroy_server() {{{2 */
+
+static void destroy_server(lua_apr_http_server_object *server)
+{
+  if (server->pool != NULL) {
+    close_connections(NULL, 0, server);
+    if (server->listener != NULL) {
+      apr_socket_close(server->listener);
+      server->listener = NULL;
+    }
+    apr_pool_destroy(server->pool);
+    server->pool = NULL;
+    server->pollset = NULL;
+  }
+}
+
+/* apr.http_server(options) -> server {{{1
+ *
+ * Create an HTTP server listening for connections. On success a server object
+ * is returned, otherwise a nil followed by an error message is returned. The
+ * table @options supports the following fields:
+ *
+ *  - `handler` is the function that is called for each request (required)
+ *  - `host` is the address to listen on (defaults to `'*'` which means any
+ *    address)
+ *  - `port` is the port number to listen on (defaults to zero which means any
+ *    free port, use `server:addr()` to find out which one you got)
+ *  - `family` is one of the strings `'inet'`, `'inet6'` or `'unspec'` (the
+ *    default is `'inet'`)
+ *  - `backlog` is the length of the queue of pending connections (511)
+ *  - `size` is the maximum number of simultaneous connections (1024)
+ *  - `timeout` is the number of seconds after which idle connections are
+ *    closed (15)
+ *  - `max_body` is the maximum size of request bodies in bytes (1 MB)
+ *  - `reuseport` set to true enables `SO_REUSEPORT` so that several servers
+ *    (usually in different threads) can listen on the same port. The kernel
+ *    then distributes incoming connections between the servers
+ *
+ * The handler is called with a table describing the request that contains the
+ * fields `method`, `uri`, `path`, `query` (only present when the URI contains
+ * a query string), `version` (e.g. `'1.1'`), `peer` (the IP address of the
+ * client), `headers` (a table with lowercase header names, repeated headers
+ * are joined with commas), `body` (only present when the request has a body;
+ * chunked request bodies are decoded) and `server` (the server object).
+ *
+ * The handler should return three values: the status code, a table with
+ * response headers and the body. The body can be a string, a file object or
+ * a function. A file is sent from its current position until the end of the
+ * file using `sendfile()` where available. A function is called repeatedly to
+ * generate the body until it returns nil and the body is sent using chunked
+ * encoding. Repeated response headers can be given as a list of strings. The
+ * headers `Content-Length`, `Transfer-Encoding` and `Date` are generated by
+ * the server and ignored when returned by the handler. When the handler
+ * raises an error the client gets a 500 response and the error message is
+ * available from `server:stats()`.
+ *
+ * Connections are kept alive according to the rules of HTTP/1.0 and HTTP/1.1
+ * and pipelined requests are answered in order. Clients that send an `Expect:
+ * 100-continue` header get an interim response before sending the body.
+ */
+
+int lua_apr_http_server(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+  apr_sockaddr_t *address;
+  const char *host;
+  apr_status_t status;
+  apr_port_t port;
+  int family = APR_INET, backlog, reuseport;
+
+  /* Get the options. */
+  lua_settop(L, 1);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_getfield(L, 1, "handler");
+  luaL_argcheck(L, lua_isfunction(L, -1), 1, "handler function expected");
+  lua_getfield(L, 1, "host");
+  host = luaL_optstring(L, -1, "*");
+  if (strcmp(host, "*") == 0)
+    host = NULL;
+  lua_getfield(L, 1, "port");
+  port = (apr_port_t) luaL_optint(L, -1, 0);
+  lua_getfield(L, 1, "family");
+  if (!lua_isnil(L, -1))
+    family = family_check(L, -1);
+  lua_getfield(L, 1, "backlog");
+  backlog = luaL_optint(L, -1, HTTP_DEFAULT_BACKLOG);
+  lua_getfield(L, 1, "reuseport");
+  reuseport = lua_toboolean(L, -1);
+  lua_settop(L, 1);
+
+  /* Create the server object (at stack index 2). */
+  server = new_object(L, &lua_apr_http_server_type);
+  lua_getfield(L, 1, "size");
+  server->size = luaL_optint(L, -1, HTTP_DEFAULT_SIZE);
+  lua_getfield(L, 1, "timeout");
+  server->timeout = (apr_interval_time_t) (luaL_optnumber(L, -1, HTTP_DEFAULT_TIMEOUT) * APR_USEC_PER_SEC);
+  lua_getfield(L, 1, "max_body");
+  server->max_body = (apr_size_t) luaL_optnumber(L, -1, HTTP_DEFAULT_MAX_BODY);
+  lua_settop(L, 2);
+  if (server->size < 2)
+    server->size = 2;
+
+  status = apr_pool_create(&server->pool, NULL);
+  if (status == APR_SUCCESS)
+    status = dns_resolve(&address, host, family, port, server->pool);
+  if (status == APR_SUCCESS)
+    status = apr_socket_create(&server->listener, address->family, SOCK_STREAM, APR_PROTO_TCP, server->pool);
+  if (status == APR_SUCCESS)
+    status = apr_socket_opt_set(server->listener, APR_SO_REUSEADDR, 1);
+  if (status == APR_SUCCESS && reuseport)
+    status = set_reuseport(server->listener);
+  if (status == APR_SUCCESS)
+    status = apr_socket_bind(server->listener, address);
+  if (status == APR_SUCCESS)
+    status = apr_socket_listen(server->listener, backlog);
+  if (status == APR_SUCCESS)
+    status = apr_socket_opt_set(server->listener, APR_SO_NONBLOCK, 1);
+  if (status == APR_SUCCESS)
+    status = apr_socket_timeout_set(server->listener, 0);
+  if (status == APR_SUCCESS)
+    status = apr_pollset_create(&server->pollset, server->size, server->pool, 0);
+  if (status == APR_SUCCESS) {
+    server->listener_fd.p = server->pool;
+    server->listener_fd.desc_type = APR_POLL_SOCKET;
+    server->listener_fd.desc.s = server->listener;
+    server->listener_fd.reqevents = APR_POLLIN;
+    server->listener_fd.client_data = NULL;
+    status = apr_pollset_add(server->pollset, &server->listener_fd);
+    server->accepting = status == APR_SUCCESS;
+  }
+  if (status != APR_SUCCESS) {
+    destroy_server(server);
+    return push_error_status(L, status);
+  }
+
+  /* Store the handler in the environment of the server. */
+  object_env_private(L, 2);
+  lua_getfield(L, 1, "handler");
+  lua_setfield(L, -2, "handler");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* server:run() -> status {{{1
+ *
+ * Serve requests until `server:stop()` is called (usually by a handler). On
+ * success true is returned, otherwise a nil followed by an error message is
+ * returned. Once the server has been stopped no new connections are accepted
+ * and idle connections are closed, but responses that are still being sent
+ * are finished (subject to the `timeout` option) before this method returns.
+ */
+
+static int server_run(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+  int top;
+
+  lua_settop(L, 1);
+  server = check_server(L, 1, 1);
+  if (server->running)
+    luaL_error(L, "%s is already running", lua_apr_http_server_type.friendlyname);
+  object_env_private(L, 1);
+  server->running = 1;
+  server->stopped = 0;
+
+  /* Run the event loop in protected mode so that the server is never left
+   * marked as running with open connections when an error is raised. */
+  top = lua_gettop(L);
+  lua_pushcfunction(L, server_loop);
+  lua_pushvalue(L, 1);
+  if (lua_pcall(L, 1, LUA_MULTRET, 0) != 0) {
+    close_connections(L, 2, server);
+    server->running = 0;
+    return lua_error(L);
+  }
+  close_connections(L, 2, server);
+  server->running = 0;
+
+  return lua_gettop(L) - top;
+}
+
+/* server:stop() -> status {{{1
+ *
+ * Make `server:run()` return after the current requests have been handled.
+ * Responses to requests handled after this call include `Connection: close`.
+ */
+
+static int server_stop(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_server(L, 1, 1);
+  server->stopped = 1;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* server:addr() -> ip_address, port {{{1
+ *
+ * Get the IP address and port number on which the server is listening.
+ */
+
+static int server_addr(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+  apr_sockaddr_t *address;
+  apr_status_t status;
+  char *ip_address;
+
+  server = check_server(L, 1, 1);
+  status = apr_socket_addr_get(&address, APR_LOCAL, server->listener);
+  if (status == APR_SUCCESS)
+    status = apr_sockaddr_ip_get(&ip_address, address);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  lua_pushstring(L, ip_address);
+  lua_pushinteger(L, address->port);
+
+  return 2;
+}
+
+/* server:stats() -> table {{{1
+ *
+ * Get statistics about the server. The result is a table with the fields
+ * `connections` (the number of open connections), `accepted` (the number of
+ * accepted connections), `requests`, `errors` (the number of handler errors),
+ * `bytes_in`, `bytes_out` and `error` (the message of the last handler error,
+ * if any).
+ */
+
+static int server_stats(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_server(L, 1, 0);
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, server->count);
+  lua_setfield(L, -2, "connections");
+  lua_pushnumber(L, (lua_Number) server->accepted);
+  lua_setfield(L, -2, "accepted");
+  lua_pushnumber(L, (lua_Number) server->requests);
+  lua_setfield(L, -2, "requests");
+  lua_pushnumber(L, (lua_Number) server->errors);
+  lua_setfield(L, -2, "errors");
+  lua_pushnumber(L, (lua_Number) server->bytes_in);
+  lua_setfield(L, -2, "bytes_in");
+  lua_pushnumber(L, (lua_Number) server->bytes_out);
+  lua_setfield(L, -2, "bytes_out");
+  object_env_private(L, 1);
+  lua_getfield(L, -1, "error");
+  lua_setfield(L, -3, "error");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* server:close() -> status {{{1
+ *
+ * Close the listening socket and all connections. This can't be done while
+ * the server is running. Server objects are automatically closed when they
+ * are garbage collected.
+ */
+
+static int server_close(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_server(L, 1, 1);
+  if (server->running)
+    luaL_error(L, "can't close a running %s", lua_apr_http_server_type.friendlyname);
+  destroy_server(server);
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* server:__tostring() {{{1 */
+
+static int server_tostring(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_server(L, 1, 0);
+  if (server->listener != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_http_server_type.friendlyname, server);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_http_server_type.friendlyname);
+
+  return 1;
+}
+
+/* server:__gc() {{{1 */
+
+static int server_gc(lua_State *L)
+{
+  lua_apr_http_server_object *server;
+
+  server = check_server(L, 1, 0);
+  destroy_server(server);
+
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg server_methods[] = {
+  { "run", server_run },
+  { "stop", server_stop },
+  { "addr", server_addr },
+  { "stats", server_stats },
+  { "close", server_close },
+  { NULL, NULL }
+};
+
+static luaL_reg server_metamethods[] = {
+  { "__tostring", server_tostring },
+  { "__gc", server_gc },
+  { NULL, NULL }
+};
+
+/* Servers are deliberately left out of lua_apr_types[] because connections
+ * refer to Lua values in the server's environment and so the server can't be
+ * moved to another thread by apr.ref(). */
+static lua_apr_objtype lua_apr_http_server_type = {
+  "lua_apr_http_server*",              /* metatable name in registry */
+  "HTTP server",                       /* friendly object name       */
+  sizeof(lua_apr_http_server_object),  /* structure size             */
+  server_methods,                      /* methods table              */
+  server_metamethods                   /* metamethods table          */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
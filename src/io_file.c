@@ -879,6 +879,11 @@ static luaL_Reg file_methods[] = {
 # endif
   { "inherit_set", file_inherit_set },
   { "inherit_unset", file_inherit_unset },
+# if LUA_APR_HAVE_ZLIB
+  { "gzip_writer", stream_gzip_writer },
+  { "deflate_writer", stream_deflate_writer },
+  { "inflate_reader", stream_inflate_reader },
+# endif
   { NULL, NULL }
 };
 
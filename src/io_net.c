@@ -1,7 +1,7 @@
 /* Network I/O handling module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: December 7, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -15,11 +15,62 @@
  */
 
 #include "lua_apr.h"
+#include <apr_thread_mutex.h>
 #include <apr_network_io.h>
 #include <apr_portable.h>
 
 /* Internal functions {{{1 */
 
+/* The memory pools of closed sockets are cleared and kept on a free list
+ * shared by all threads so that accepting a connection doesn't have to create
+ * a new memory pool. This is the maximum number of pools on the free list. */
+#define SOCKET_POOL_CACHE_MAX 64
+
+static apr_pool_t *socket_pool_cache[SOCKET_POOL_CACHE_MAX];
+static int socket_pool_count = 0;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *socket_pool_mutex = NULL;
+# define socket_pool_lock() do { \
+  if (socket_pool_mutex != NULL) apr_thread_mutex_lock(socket_pool_mutex); } while (0)
+# define socket_pool_unlock() do { \
+  if (socket_pool_mutex != NULL) apr_thread_mutex_unlock(socket_pool_mutex); } while (0)
+#else
+# define socket_pool_lock() ((void)0)
+# define socket_pool_unlock() ((void)0)
+#endif
+
+/* socket_pool_get() -- take a memory pool from the free list {{{2 */
+
+static apr_status_t socket_pool_get(apr_pool_t **pool)
+{
+  *pool = NULL;
+  socket_pool_lock();
+  if (socket_pool_count > 0)
+    *pool = socket_pool_cache[--socket_pool_count];
+  socket_pool_unlock();
+
+  if (*pool != NULL)
+    return APR_SUCCESS;
+  return apr_pool_create(pool, NULL);
+}
+
+/* socket_pool_put() -- return a memory pool to the free list {{{2 */
+
+static void socket_pool_put(apr_pool_t *pool)
+{
+  apr_pool_clear(pool);
+  socket_pool_lock();
+  if (socket_pool_count < SOCKET_POOL_CACHE_MAX) {
+    socket_pool_cache[socket_pool_count++] = pool;
+    pool = NULL;
+  }
+  socket_pool_unlock();
+
+  if (pool != NULL)
+    apr_pool_destroy(pool);
+}
+
 /* family_check(L, i) -- check for address family on Lua stack {{{2 */
 
 #if APR_HAVE_IPV6
@@ -30,9 +81,6 @@ const char *family_options[] = { "inet", "unspec", NULL };
 const int family_values[] = { APR_INET, APR_UNSPEC };
 #endif
 
-#define family_check(L, i) \
-  family_values[luaL_checkoption(L, i, "inet", family_options)]
-
 /* socket_alloc(L) -- allocate and initialize socket object {{{2 */
 
 static apr_status_t socket_alloc(lua_State *L, lua_apr_socket **p)
@@ -43,7 +91,7 @@ static apr_status_t socket_alloc(lua_State *L, lua_apr_socket **p)
   object = new_object(L, &lua_apr_socket_type);
   if (object == NULL)
     raise_error_memory(L);
-  status = apr_pool_create(&object->pool, NULL);
+  status = socket_pool_get(&object->pool);
   *p = object;
 
   return status;
@@ -86,17 +134,67 @@ static apr_int32_t option_check(lua_State *L, int i)
 static apr_status_t socket_close_impl(lua_State *L, lua_apr_socket *socket)
 {
   apr_status_t status = APR_SUCCESS;
+  if (socket->pooled != NULL) {
+    /* Borrowed from a connection pool which owns the handle and pool. */
+    return connpool_discard(L, socket);
+  }
+# if LUA_APR_HAVE_OPENSSL
+  if (socket->tls != NULL)
+    tls_close(socket);
+# endif
   if (socket->handle != NULL) {
     status = apr_socket_close(socket->handle);
     socket->handle = NULL;
   }
   if (socket->pool != NULL) {
-    apr_pool_destroy(socket->pool);
+    socket_pool_put(socket->pool);
     socket->pool = NULL;
   }
   return status;
 }
 
+/* socket_wrap() -- create socket object for existing socket {{{2 */
+
+lua_apr_socket *socket_wrap(lua_State *L, apr_socket_t *handle, apr_pool_t *pool, int family, int protocol)
+{
+  lua_apr_socket *object;
+
+  object = new_object(L, &lua_apr_socket_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->handle = handle;
+  object->pool = pool;
+  object->family = family;
+  object->protocol = protocol;
+  socket_init(L, object);
+
+  return object;
+}
+
+/* socket_cache_init() -- initialize the free list of memory pools {{{2 */
+
+apr_status_t socket_cache_init(apr_pool_t *pool)
+{
+# if APR_HAS_THREADS
+  return apr_thread_mutex_create(&socket_pool_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+# else
+  return APR_SUCCESS;
+# endif
+}
+
+/* socket_cache_stats() -- get the number of pools on the free list {{{2 */
+
+int socket_cache_stats(void)
+{
+  int count;
+
+  socket_pool_lock();
+  count = socket_pool_count;
+  socket_pool_unlock();
+
+  return count;
+}
+
 /* apr.socket_create([protocol [, family]]) -> socket {{{1
  *
  * Create a network socket. On success the new socket object is returned,
@@ -175,7 +273,8 @@ int lua_apr_hostname_get(lua_State *L)
  * Resolve a host name to one or more IP addresses. On success one or more IP
  * addresses are returned as strings, otherwise a nil followed by an error
  * message is returned. The optional @family argument is documented under
- * `apr.socket_create()`.
+ * `apr.socket_create()`. Results are kept in the cache of resolved host names
+ * described under `apr.dns_cache()`.
  *
  *     > = apr.host_to_addr 'www.lua.org'
  *     '89.238.129.35'
@@ -187,32 +286,25 @@ int lua_apr_hostname_get(lua_State *L)
 
 int lua_apr_host_to_addr(lua_State *L)
 {
-  apr_sockaddr_t *address;
-  apr_pool_t *pool;
-  const char *host;
-  char *ip_address;
   apr_status_t status;
-  int family;
+  const char *host;
+  char *addresses;
+  int family, count;
 
-  pool = to_pool(L);
   host = luaL_checkstring(L, 1);
   family = family_check(L, 2);
 
-  status = apr_sockaddr_info_get(&address, host, family, SOCK_STREAM, 0, pool);
+  /* The answer is served from the cache of resolved host names when possible. */
+  status = dns_resolve_all(host, to_pool(L), &addresses);
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
 
   lua_settop(L, 0);
+  count = push_addresses(L, addresses, family);
+  if (count == 0)
+    return push_error_status(L, APR_EINVAL);
 
-  do {
-    status = apr_sockaddr_ip_get(&ip_address, address);
-    if (status != APR_SUCCESS)
-      return push_error_status(L, status);
-    lua_pushstring(L, ip_address);
-    address = address->next;
-  } while (address != NULL);
-
-  return lua_gettop(L);
+  return count;
 }
 
 /* apr.addr_to_host(ip_address [, family]) -> hostname {{{1
@@ -255,7 +347,8 @@ int lua_apr_addr_to_host(lua_State *L)
  * Issue a connection request to a socket either on the same machine or a
  * different one, as indicated by the @host string and @port number. On success
  * true is returned, otherwise a nil followed by an error message is
- * returned.
+ * returned. Host names are resolved using the cache described under
+ * `apr.dns_cache()`.
  */
 
 static int socket_connect(lua_State *L)
@@ -269,7 +362,7 @@ static int socket_connect(lua_State *L)
   object = socket_check(L, 1, 1);
   host = luaL_checkstring(L, 2);
   port = luaL_checkinteger(L, 3);
-  status = apr_sockaddr_info_get(&address, host, object->family, port, 0, object->pool);
+  status = dns_resolve(&address, host, object->family, port, object->pool);
   if (status == APR_SUCCESS)
     status = apr_socket_connect(object->handle, address);
 
@@ -464,16 +557,20 @@ static int socket_read(lua_State *L)
 /* socket:write(value [, ...]) -> status {{{1
  *
  * This function implements the interface of Lua's `file:write()` function.
+ *
+ * When @socket is non-blocking and writing would block, all values are kept in
+ * the socket's write buffer and true followed by the string `'buffered'` is
+ * returned. Call `socket:write()` without arguments once the socket is
+ * writable to flush the buffered data. The amount of buffered output is
+ * limited: When too much output is already pending, nothing is written and
+ * nil followed by an error message and the error code `'EAGAIN'` is returned,
+ * in which case you should repeat the call once the socket is writable.
  */
 
 static int socket_write(lua_State *L)
 {
   lua_apr_socket *object = socket_check(L, 1, 1);
-  int nresults = write_buffer(L, &object->output);
-  apr_status_t status = flush_buffer(L, &object->output, 1);
-  if (status != APR_SUCCESS)
-    return push_error_status(L, status);
-  return nresults;
+  return write_flush(L, &object->output);
 }
 
 /* socket:lines() -> iterator {{{1
@@ -769,6 +866,21 @@ luaL_reg socket_methods[] = {
   { "fd_set", socket_fd_set },
   { "shutdown", socket_shutdown },
   { "close", socket_close },
+  { "ws_read", socket_ws_read },
+  { "ws_write", socket_ws_write },
+  { "chunked_writer", socket_chunked_writer },
+  { "chunked_reader", socket_chunked_reader },
+# if LUA_APR_HAVE_ZLIB
+  { "gzip_writer", stream_gzip_writer },
+  { "deflate_writer", stream_deflate_writer },
+  { "inflate_reader", stream_inflate_reader },
+# endif
+# if LUA_APR_HAVE_OPENSSL
+  { "tls_wrap", socket_tls_wrap },
+  { "tls_handshake", socket_tls_handshake },
+  { "tls_want", socket_tls_want },
+  { "tls_info", socket_tls_info },
+# endif
   { NULL, NULL },
 };
 
@@ -1,7 +1,7 @@
 /* Miscellaneous functions module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: November 20, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  */
@@ -30,8 +30,15 @@ lua_apr_objtype *lua_apr_types[] = {
 # if APR_HAS_THREADS
   &lua_apr_thread_type,
   &lua_apr_queue_type,
+  &lua_apr_resolver_type,
+# endif
+# if LUAAPR_HAVE_APRUTIL && APR_HAS_THREADS
+  &lua_apr_connpool_type,
+  &lua_apr_validator_type,
+  &lua_apr_dbd_pool_type,
 # endif
   &lua_apr_pollset_type,
+  &lua_apr_http_parser_type,
   &lua_apr_proc_type,
 # if LUAARP_HAVE_APRUTIL
   &lua_apr_dbm_type,
@@ -49,7 +56,15 @@ lua_apr_objtype *lua_apr_types[] = {
 # if LUAAPR_HAVE_APRUTIL
   &lua_apr_md5_type,
   &lua_apr_sha1_type,
+  &lua_apr_digest_type,
+  &lua_apr_base64_type,
+  &lua_apr_xlate_type,
   &lua_apr_xml_type,
+  &lua_apr_xml_elem_type,
+  &lua_apr_xml_writer_type,
+#   if LUA_APR_HAVE_EXPAT
+  &lua_apr_xml_stream_type,
+#   endif
 # endif
   NULL
 };
@@ -58,6 +73,7 @@ lua_apr_objtype *lua_apr_types[] = {
 
 LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
 {
+  apr_pool_t *global_pool;
   apr_status_t status;
 
   /* Table of library functions. */
@@ -69,6 +85,7 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "os_default_encoding", lua_apr_os_default_encoding },
     { "os_locale_encoding", lua_apr_os_locale_encoding },
     { "type", lua_apr_type },
+    { "memory_stats", lua_apr_memory_stats },
 #if LUAAPR_HAVE_APRUTIL
     { "ref", lua_apr_ref },
     { "deref", lua_apr_deref },
@@ -78,15 +95,28 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     /* base64.c -- base64 encoding/decoding. */
     { "base64_encode", lua_apr_base64_encode },
     { "base64_decode", lua_apr_base64_decode },
+    { "base64_encoder", lua_apr_base64_encoder },
+    { "base64_decoder", lua_apr_base64_decoder },
+#endif
+
+#if LUAAPR_HAVE_APRUTIL && APR_HAS_THREADS
+    /* connpool.c -- outbound connection pools. */
+    { "connection_pool", lua_apr_connection_pool },
 #endif
 
 #if LUAAPR_HAVE_APRUTIL
     /* crypt.c -- cryptographic functions. */
     { "md5_init", lua_apr_md5_init },
     { "md5_encode", lua_apr_md5_encode },
+    { "md5_file", lua_apr_md5_file },
     { "password_get", lua_apr_password_get },
     { "password_validate", lua_apr_password_validate },
+#   if APR_HAS_THREADS
+    { "password_validator", lua_apr_password_validator },
+    { "password_validate_batch", lua_apr_password_validate_batch },
+#   endif
     { "sha1_init", lua_apr_sha1_init },
+    { "sha1_file", lua_apr_sha1_file },
 #endif
 
 #if LUAAPR_HAVE_APRUTIL
@@ -98,6 +128,9 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
 #if LUAAPR_HAVE_APRUTIL
     /* dbd.c -- database module. */
     { "dbd", lua_apr_dbd },
+#   if APR_HAS_THREADS
+    { "dbd_pool", lua_apr_dbd_pool },
+#   endif
 #endif
 
 #if LUAAPR_HAVE_APRUTIL
@@ -106,6 +139,22 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "dbm_getnames", lua_apr_dbm_getnames },
 #endif
 
+#if LUAAPR_HAVE_APRUTIL
+    /* digest.c -- message digests. */
+    { "sha256", lua_apr_sha256 },
+    { "sha256_file", lua_apr_sha256_file },
+    { "sha256_init", lua_apr_sha256_init },
+    { "sha512", lua_apr_sha512 },
+    { "sha512_file", lua_apr_sha512_file },
+    { "sha512_init", lua_apr_sha512_init },
+    { "crc32c", lua_apr_crc32c },
+    { "crc32c_file", lua_apr_crc32c_file },
+    { "crc32c_init", lua_apr_crc32c_init },
+    { "xxh3", lua_apr_xxh3 },
+    { "xxh3_file", lua_apr_xxh3_file },
+    { "xxh3_init", lua_apr_xxh3_init },
+#endif
+
     /* env.c -- environment variable handling. */
     { "env_get", lua_apr_env_get },
     { "env_set", lua_apr_env_set },
@@ -132,6 +181,7 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     /* http.c -- HTTP request parsing. */
     { "parse_headers", lua_apr_parse_headers },
     { "parse_multipart", lua_apr_parse_multipart },
+    { "multipart_parser", lua_apr_multipart_parser },
     { "parse_cookie_header", lua_apr_parse_cookie_header },
     { "parse_query_string", lua_apr_parse_query_string },
     { "header_attribute", lua_apr_header_attribute },
@@ -139,6 +189,17 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "uri_decode", lua_apr_uri_decode },
 #   endif
 
+#if LUAAPR_HAVE_APRUTIL && APR_HAS_THREADS
+    /* http_client.c -- HTTP client. */
+    { "http_request", lua_apr_http_request },
+#endif
+
+    /* http_parser.c -- incremental HTTP parser. */
+    { "http_parser", lua_apr_http_parser },
+
+    /* http_server.c -- HTTP/1.1 server engine. */
+    { "http_server", lua_apr_http_server },
+
     /* io_dir.c -- directory manipulation. */
     { "temp_dir_get", lua_apr_temp_dir_get },
     { "dir_make", lua_apr_dir_make },
@@ -182,6 +243,11 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "ldap_url_parse", lua_apr_ldap_url_parse },
 #   endif
 
+#if LUAAPR_HAVE_APRUTIL
+    /* pipeline.c -- native stream pipelines. */
+    { "pipeline", lua_apr_pipeline },
+#endif
+
     /* pollset -- asynchronous network communication. */
     { "pollset", lua_apr_pollset },
 
@@ -192,6 +258,12 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "proc_fork", lua_apr_proc_fork },
 #   endif
 
+    /* resolver.c -- cached and asynchronous host name resolution. */
+    { "dns_cache", lua_apr_dns_cache },
+#   if APR_HAS_THREADS
+    { "resolver", lua_apr_resolver },
+#   endif
+
 #if LUAAPR_HAVE_APRUTIL
     /* shm.c -- shared memory. */
     { "shm_create", lua_apr_shm_create },
@@ -248,14 +320,27 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
     { "uuid_parse", lua_apr_uuid_parse },
 #endif
 
+    /* websocket.c -- WebSocket framing. */
+    { "ws_frame", lua_apr_ws_frame },
+#if LUAAPR_HAVE_APRUTIL
+    { "ws_accept", lua_apr_ws_accept },
+    { "ws_handshake", lua_apr_ws_handshake },
+#endif
+
 #if LUAAPR_HAVE_APRUTIL
     /* xlate.c -- character encoding translation. */
     { "xlate", lua_apr_xlate },
+    { "xlate_open", lua_apr_xlate_open },
 #endif
 
 #if LUAAPR_HAVE_APRUTIL
     /* xml.c -- XML parsing. */
     { "xml", lua_apr_xml },
+    { "xml_writer", lua_apr_xml_writer },
+    { "xml_encode", lua_apr_xml_encode },
+#   if LUA_APR_HAVE_EXPAT
+    { "xml_stream", lua_apr_xml_stream },
+#   endif
 #endif
 
 #   if LUA_APR_HAVE_MEMCACHE
@@ -272,6 +357,17 @@ LUA_APR_EXPORT int luaopen_apr_core(lua_State *L)
       raise_error_status(L, status);
     if (atexit(apr_terminate) != 0)
       raise_error_message(L, "Lua/APR: Failed to register apr_terminate()");
+    /* Initialize the free lists and caches shared by all threads. */
+    if ((status = apr_pool_create(&global_pool, NULL)) != APR_SUCCESS
+        || (status = buffer_cache_init(global_pool)) != APR_SUCCESS
+        || (status = socket_cache_init(global_pool)) != APR_SUCCESS
+        || (status = dns_cache_init(global_pool)) != APR_SUCCESS
+        || (status = digest_init(global_pool)) != APR_SUCCESS)
+      raise_error_status(L, status);
+#   if LUA_APR_HAVE_OPENSSL
+    if ((status = tls_init(global_pool)) != APR_SUCCESS)
+      raise_error_status(L, status);
+#   endif
     apr_was_initialized = 1;
   }
 
@@ -418,11 +514,19 @@ int lua_apr_os_locale_encoding(lua_State *L)
  *  - `'database driver'`
  *  - `'prepared statement'`
  *  - `'result set'`
+ *  - `'database connection pool'`
  *  - `'memcache client'`
  *  - `'memcache server'`
  *  - `'md5 context'`
  *  - `'sha1 context'`
+ *  - `'digest context'`
+ *  - `'base64 codec'`
+ *  - `'password validator'`
+ *  - `'character set converter'`
  *  - `'xml parser'`
+ *  - `'xml element'`
+ *  - `'xml writer'`
+ *  - `'xml stream'`
  */
 
 int lua_apr_type(lua_State *L)
@@ -443,6 +547,38 @@ int lua_apr_type(lua_State *L)
   return 0;
 }
 
+/* apr.memory_stats() -> statistics {{{1
+ *
+ * Get statistics about the memory held by the Lua/APR binding. Returns a table
+ * with the following fields:
+ *
+ *  - `buffers_used` is the number of bytes held in the read and write buffers
+ *    of sockets, files and pipes
+ *  - `buffers_cached` is the number of bytes held in drained buffers kept
+ *    around for reuse
+ *  - `socket_pools_cached` is the number of memory pools of closed sockets
+ *    kept around for reuse by new (e.g. accepted) sockets
+ *
+ * Buffers are released once they have been drained, so with many idle
+ * connections `buffers_used` should stay small.
+ */
+
+int lua_apr_memory_stats(lua_State *L)
+{
+  size_t used, cached;
+
+  buffer_stats(&used, &cached);
+  lua_createtable(L, 0, 3);
+  lua_pushnumber(L, (lua_Number) used);
+  lua_setfield(L, -2, "buffers_used");
+  lua_pushnumber(L, (lua_Number) cached);
+  lua_setfield(L, -2, "buffers_cached");
+  lua_pushinteger(L, socket_cache_stats());
+  lua_setfield(L, -2, "socket_pools_cached");
+
+  return 1;
+}
+
 /* status_to_message() converts APR status codes to error messages. {{{1 */
 
 int status_to_message(lua_State *L, apr_status_t status)
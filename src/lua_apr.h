@@ -168,6 +168,25 @@ typedef apr_status_t (lua_apr_cc *lua_apr_buf_ff)(void*);
 typedef apr_status_t (lua_apr_cc *lua_apr_openpipe_f)(apr_file_t**, apr_pool_t*);
 typedef apr_status_t (lua_apr_cc *lua_apr_setpipe_f)(apr_procattr_t*, apr_file_t*, apr_file_t*);
 
+/* Type definition for the update functions of message digests. */
+typedef void (*lua_apr_hash_f)(void*, const void*, apr_size_t);
+
+/* State of incremental base64 encoding and decoding (see base64.c). */
+typedef struct {
+  apr_uint32_t bits;
+  int count, padding, end;
+} lua_apr_base64_state;
+
+/* Upper bounds on the output of the incremental base64 functions. */
+#define BASE64_ENCODED_MAX(n) (((n) + 2) / 3 * 4)
+#define BASE64_DECODED_MAX(n) ((n) / 4 * 3 + 3)
+
+/* Processor features detected at startup by digest_init(). */
+#define LUA_APR_CPU_SSSE3 0x01
+#define LUA_APR_CPU_SSE42 0x02
+#define LUA_APR_CPU_AVX2  0x04
+#define LUA_APR_CPU_SHA   0x08
+
 /* Structures for (buffered) I/O streams. */
 
 typedef struct {
@@ -209,8 +228,35 @@ typedef struct {
   apr_pool_t *pool;
   apr_socket_t *handle;
   int family, protocol;
+  struct lua_apr_pooled_socket *pooled; /* see connpool.c */
+  struct lua_apr_tls *tls; /* see tls.c */
 } lua_apr_socket;
 
+/* Structures for the incremental HTTP parser (see http_parser.c). */
+
+#define HTTP_REQUEST  0
+#define HTTP_RESPONSE 1
+
+#define HTTP_PARSE_ERROR (-1)
+#define HTTP_PARSE_AGAIN 0
+#define HTTP_PARSE_HEAD  1
+#define HTTP_PARSE_BODY  2
+#define HTTP_PARSE_DONE  3
+
+typedef struct {
+  const char *name, *value;
+} http_header;
+
+typedef struct {
+  apr_pool_t *pool; /* cleared between messages */
+  int type, state, no_body;
+  size_t scanned;
+  const char *method, *uri, *reason, *error;
+  int major, minor, status, keepalive, chunked;
+  apr_array_header_t *headers; /* of http_header */
+  apr_off_t length, remaining;
+} http_parser;
+
 /* Structure used to define Lua userdata types created by Lua/APR. */
 typedef struct {
   const char *typename, *friendlyname;
@@ -226,7 +272,12 @@ extern lua_apr_objtype lua_apr_dir_type;
 extern lua_apr_objtype lua_apr_socket_type;
 extern lua_apr_objtype lua_apr_thread_type;
 extern lua_apr_objtype lua_apr_queue_type;
+extern lua_apr_objtype lua_apr_connpool_type;
+extern lua_apr_objtype lua_apr_validator_type;
+extern lua_apr_objtype lua_apr_dbd_pool_type;
+extern lua_apr_objtype lua_apr_resolver_type;
 extern lua_apr_objtype lua_apr_pollset_type;
+extern lua_apr_objtype lua_apr_http_parser_type;
 extern lua_apr_objtype lua_apr_proc_type;
 extern lua_apr_objtype lua_apr_shm_type;
 extern lua_apr_objtype lua_apr_dbm_type;
@@ -235,7 +286,15 @@ extern lua_apr_objtype lua_apr_dbr_type;
 extern lua_apr_objtype lua_apr_dbp_type;
 extern lua_apr_objtype lua_apr_md5_type;
 extern lua_apr_objtype lua_apr_sha1_type;
+extern lua_apr_objtype lua_apr_digest_type;
+extern lua_apr_objtype lua_apr_base64_type;
+extern lua_apr_objtype lua_apr_xlate_type;
 extern lua_apr_objtype lua_apr_xml_type;
+extern lua_apr_objtype lua_apr_xml_elem_type;
+extern lua_apr_objtype lua_apr_xml_writer_type;
+#if LUA_APR_HAVE_EXPAT
+extern lua_apr_objtype lua_apr_xml_stream_type;
+#endif
 #if LUA_APR_HAVE_MEMCACHE
 extern lua_apr_objtype lua_apr_memcache_type;
 extern lua_apr_objtype lua_apr_memcache_server_type;
@@ -250,6 +309,7 @@ int lua_apr_version_get(lua_State*);
 int lua_apr_os_default_encoding(lua_State*);
 int lua_apr_os_locale_encoding(lua_State*);
 int lua_apr_type(lua_State*);
+int lua_apr_memory_stats(lua_State*);
 int status_to_message(lua_State*, apr_status_t);
 int push_status(lua_State*, apr_status_t);
 int push_error_status(lua_State*, apr_status_t);
@@ -257,6 +317,12 @@ int push_error_status(lua_State*, apr_status_t);
 /* base64.c */
 int lua_apr_base64_encode(lua_State*);
 int lua_apr_base64_decode(lua_State*);
+int lua_apr_base64_encoder(lua_State*);
+int lua_apr_base64_decoder(lua_State*);
+apr_size_t base64_encode_update(lua_apr_base64_state*, char*, const unsigned char*, apr_size_t);
+apr_size_t base64_encode_final(lua_apr_base64_state*, char*);
+apr_status_t base64_decode_update(lua_apr_base64_state*, unsigned char*, apr_size_t*, const char*, apr_size_t);
+apr_status_t base64_decode_final(lua_apr_base64_state*, unsigned char*, apr_size_t*);
 
 /* buffer.c */
 void init_buffers(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*, void*, int,
@@ -265,14 +331,38 @@ void init_unmanaged_buffers(lua_State*, lua_apr_readbuf*, lua_apr_writebuf*, cha
 int read_lines(lua_State*, lua_apr_readbuf*);
 int read_buffer(lua_State*, lua_apr_readbuf*);
 int write_buffer(lua_State*, lua_apr_writebuf*);
+int write_flush(lua_State*, lua_apr_writebuf*);
 apr_status_t flush_buffer(lua_State*, lua_apr_writebuf*, int);
+apr_status_t fill_input(lua_apr_readbuf*);
+void drain_input(lua_apr_readbuf*, size_t);
+apr_status_t write_output(lua_apr_writebuf*, const char*, size_t);
+apr_status_t flush_output(lua_apr_writebuf*, int);
 void free_buffer(lua_State*, lua_apr_buffer*);
+apr_status_t buffer_cache_init(apr_pool_t*);
+void buffer_stats(size_t*, size_t*);
+
+/* chunked.c */
+int socket_chunked_writer(lua_State*);
+int socket_chunked_reader(lua_State*);
+
+/* connpool.c */
+int lua_apr_connection_pool(lua_State*);
+apr_status_t connpool_discard(lua_State*, lua_apr_socket*);
+int connpool_reused(lua_apr_socket*);
 
 /* crypt.c */
 int lua_apr_md5_init(lua_State*);
 int lua_apr_md5_encode(lua_State*);
+int lua_apr_md5_file(lua_State*);
 int lua_apr_sha1_init(lua_State*);
+int lua_apr_sha1_file(lua_State*);
+apr_status_t hash_file(lua_State*, lua_apr_hash_f, void*);
+int hash_stream(lua_State*, lua_apr_hash_f, void*);
+int push_digest(lua_State*, unsigned char*, int, int);
 int lua_apr_password_validate(lua_State*);
+int lua_apr_password_validator(lua_State*);
+int lua_apr_password_validate_batch(lua_State*);
+apr_file_t *validator_signal_get(lua_State*, int);
 int lua_apr_password_get(lua_State*);
 
 /* date.c */
@@ -281,11 +371,28 @@ int lua_apr_date_parse_rfc(lua_State*);
 
 /* dbd.c */
 int lua_apr_dbd(lua_State*);
+int lua_apr_dbd_pool(lua_State*);
 
 /* dbm.c */
 int lua_apr_dbm_open(lua_State*);
 int lua_apr_dbm_getnames(lua_State*);
 
+/* digest.c */
+extern int lua_apr_cpu_features;
+apr_status_t digest_init(apr_pool_t*);
+int lua_apr_sha256(lua_State*);
+int lua_apr_sha256_file(lua_State*);
+int lua_apr_sha256_init(lua_State*);
+int lua_apr_sha512(lua_State*);
+int lua_apr_sha512_file(lua_State*);
+int lua_apr_sha512_init(lua_State*);
+int lua_apr_crc32c(lua_State*);
+int lua_apr_crc32c_file(lua_State*);
+int lua_apr_crc32c_init(lua_State*);
+int lua_apr_xxh3(lua_State*);
+int lua_apr_xxh3_file(lua_State*);
+int lua_apr_xxh3_init(lua_State*);
+
 /* env.c */
 int lua_apr_env_get(lua_State*);
 int lua_apr_env_set(lua_State*);
@@ -314,12 +421,30 @@ int lua_apr_getopt(lua_State*);
 /* http.c */
 int lua_apr_parse_headers(lua_State*);
 int lua_apr_parse_multipart(lua_State*);
+int lua_apr_multipart_parser(lua_State*);
 int lua_apr_parse_cookie_header(lua_State*);
 int lua_apr_parse_query_string(lua_State*);
 int lua_apr_header_attribute(lua_State*);
 int lua_apr_uri_encode(lua_State*);
 int lua_apr_uri_decode(lua_State*);
 
+/* http_client.c */
+int lua_apr_http_request(lua_State*);
+
+/* http_parser.c */
+apr_status_t http_parser_init(http_parser*, int, apr_pool_t*);
+void http_parser_reset(http_parser*);
+void http_parser_destroy(http_parser*);
+const char *http_parser_header(http_parser*, const char*);
+int http_parser_execute(http_parser*, const char*, size_t, size_t*, const char**, size_t*);
+int http_parser_finish(http_parser*);
+void push_http_headers(lua_State*, http_parser*);
+void push_http_message(lua_State*, http_parser*);
+int lua_apr_http_parser(lua_State*);
+
+/* http_server.c */
+int lua_apr_http_server(lua_State*);
+
 /* io_dir.c */
 int lua_apr_temp_dir_get(lua_State*);
 int lua_apr_dir_make(lua_State*);
@@ -349,6 +474,13 @@ int lua_apr_socket_create(lua_State*);
 int lua_apr_hostname_get(lua_State*);
 int lua_apr_host_to_addr(lua_State*);
 int lua_apr_addr_to_host(lua_State*);
+lua_apr_socket *socket_wrap(lua_State*, apr_socket_t*, apr_pool_t*, int, int);
+apr_status_t socket_cache_init(apr_pool_t*);
+int socket_cache_stats(void);
+extern const char *family_options[];
+extern const int family_values[];
+#define family_check(L, i) \
+  family_values[luaL_checkoption(L, i, "inet", family_options)]
 
 /* io_pipe.c */
 int lua_apr_pipe_open_stdin(lua_State*);
@@ -391,6 +523,9 @@ int lua_apr_deref(lua_State*);
 int push_protection(lua_State*, apr_fileperms_t);
 apr_fileperms_t check_permissions(lua_State*, int, int);
 
+/* pipeline.c */
+int lua_apr_pipeline(lua_State*);
+
 /* pollset.c */
 int lua_apr_pollset(lua_State*);
 
@@ -399,6 +534,15 @@ int lua_apr_proc_create(lua_State*);
 int lua_apr_proc_detach(lua_State*);
 int lua_apr_proc_fork(lua_State*);
 
+/* resolver.c */
+int lua_apr_dns_cache(lua_State*);
+int lua_apr_resolver(lua_State*);
+apr_status_t dns_cache_init(apr_pool_t*);
+apr_status_t dns_resolve_all(const char*, apr_pool_t*, char**);
+apr_status_t dns_resolve(apr_sockaddr_t**, const char*, int, apr_port_t, apr_pool_t*);
+int push_addresses(lua_State*, const char*, int);
+apr_file_t *resolver_signal_get(lua_State*, int);
+
 /* serialize.c */
 int lua_apr_ref(lua_State*);
 int lua_apr_deref(lua_State*);
@@ -413,6 +557,7 @@ int push_stat_results(lua_State*, lua_apr_stat_context*, const char*);
 int lua_apr_shm_create(lua_State*);
 int lua_apr_shm_attach(lua_State*);
 int lua_apr_shm_remove(lua_State*);
+int shm_buffers(lua_State*, int, lua_apr_readbuf**, lua_apr_writebuf**);
 
 /* signal.c */
 int lua_apr_signal(lua_State*);
@@ -433,6 +578,20 @@ int lua_apr_thread_yield(lua_State*);
 
 /* thread_queue.c */
 int lua_apr_thread_queue(lua_State*);
+apr_file_t *queue_signal_get(lua_State*, int);
+void queue_signal_drain(lua_State*, int);
+
+/* tls.c */
+apr_status_t tls_init(apr_pool_t*);
+void tls_shutdown(struct lua_apr_tls*);
+struct lua_apr_tls *tls_detach(lua_apr_socket*);
+void tls_attach(lua_apr_socket*, struct lua_apr_tls*);
+int tls_reusable(struct lua_apr_tls*);
+void tls_close(lua_apr_socket*);
+int socket_tls_wrap(lua_State*);
+int socket_tls_handshake(lua_State*);
+int socket_tls_want(lua_State*);
+int socket_tls_info(lua_State*);
 
 /* time.c */
 int lua_apr_sleep(lua_State*);
@@ -459,11 +618,31 @@ int lua_apr_uuid_get(lua_State*);
 int lua_apr_uuid_format(lua_State*);
 int lua_apr_uuid_parse(lua_State*);
 
+/* websocket.c */
+int socket_ws_read(lua_State*);
+int socket_ws_write(lua_State*);
+int lua_apr_ws_frame(lua_State*);
+int lua_apr_ws_accept(lua_State*);
+int lua_apr_ws_handshake(lua_State*);
+
 /* xlate.c */
 int lua_apr_xlate(lua_State*);
+int lua_apr_xlate_open(lua_State*);
 
 /* xml.c */
 int lua_apr_xml(lua_State*);
+int lua_apr_xml_writer(lua_State*);
+int lua_apr_xml_encode(lua_State*);
+#if LUA_APR_HAVE_EXPAT
+int lua_apr_xml_stream(lua_State*);
+#endif
+
+/* zlib.c */
+#if LUA_APR_HAVE_ZLIB
+int stream_gzip_writer(lua_State*);
+int stream_deflate_writer(lua_State*);
+int stream_inflate_reader(lua_State*);
+#endif
 
 /* memcache */
 #if LUA_APR_HAVE_MEMCACHE
@@ -0,0 +1,734 @@
+/* Stream pipeline module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Pipelines copy data from a source to a sink while passing it through a
+ * chain of transformations, without ever converting the data into Lua
+ * strings. Sources and sinks can be files, pipes, sockets and shared memory
+ * segments. The whole chain runs in C with a single read buffer and a small
+ * output buffer per transformation, so memory usage doesn't depend on the
+ * amount of data. For example here's how to compress a file and send it over
+ * a socket while computing the MD5 checksum of the original contents:
+ *
+ *     local input = assert(apr.file_open 'backup.tar')
+ *     local pipeline = apr.pipeline(input, { 'md5', 'gzip' }, socket)
+ *     local result = assert(pipeline:run())
+ *     print(result.md5, result.bytes_in, result.bytes_out)
+ *
+ * The following transformations are supported:
+ *
+ *  - `'md5'` and `'sha1'` compute a checksum of the data passing through
+ *    them, which is returned in hexadecimal form by `pipeline:run()` (the
+ *    data itself is not changed)
+ *  - `'base64_encode'` and `'base64_decode'` convert data to and from base64
+ *  - `{ 'xlate', from = ..., to = ... }` translates between character
+ *    encodings (see `apr.xlate()`)
+ *  - `'gzip'`, `'deflate'` and `'inflate'` compress and decompress data (only
+ *    available when the Lua/APR binding was built with zlib). The
+ *    compression level can be given as `{ 'gzip', level = 9 }`
+ *
+ * When threads are available `pipeline:start()` runs the pipeline on a
+ * separate operating system thread and `pipeline:wait()` returns the results.
+ * The source and sink must not be used until the pipeline has finished.
+ */
+
+#include "lua_apr.h"
+
+#if LUAAPR_HAVE_APRUTIL
+
+#include <apr_md5.h>
+#include <apr_sha1.h>
+#include <apr_xlate.h>
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#endif
+#if LUA_APR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <string.h>
+
+/* Size of the buffer used to read from the source. */
+#define PIPELINE_BUFSIZE (1024 * 64)
+
+/* Size of the output buffers of transformations. */
+#define STAGE_BUFSIZE (1024 * 16)
+
+/* Largest input blocks whose base64 output fits in an output buffer. */
+#define ENCODE_BLOCKSIZE (STAGE_BUFSIZE / 4 * 3)
+#define DECODE_BLOCKSIZE ((STAGE_BUFSIZE / 3 - 1) * 4)
+
+/* Types of transformations. */
+#define STAGE_MD5           0
+#define STAGE_SHA1          1
+#define STAGE_BASE64_ENCODE 2
+#define STAGE_BASE64_DECODE 3
+#define STAGE_XLATE         4
+#define STAGE_DEFLATE       5
+#define STAGE_INFLATE       6
+
+/* States of pipelines. */
+#define PIPELINE_READY   0
+#define PIPELINE_RUNNING 1
+#define PIPELINE_DONE    2
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  int type, active;
+  const char *name;
+  char *buffer;  /* output of the transformation */
+  char *staging; /* input waiting for more data */
+  size_t pending;
+  union {
+    apr_md5_ctx_t md5;
+    apr_sha1_ctx_t sha1;
+    lua_apr_base64_state base64;
+    apr_xlate_t *xlate;
+#   if LUA_APR_HAVE_ZLIB
+    z_stream zlib;
+#   endif
+  } context;
+  unsigned char digest[APR_SHA1_DIGESTSIZE];
+  size_t digestsize;
+} pipeline_stage;
+
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  lua_apr_readbuf *source;
+  lua_apr_writebuf *sink;
+  pipeline_stage *stages;
+  int count, state;
+  apr_off_t length, bytes_in, bytes_out;
+  apr_status_t status;
+  const char *error;
+  char *buffer;
+# if APR_HAS_THREADS
+  apr_thread_t *thread;
+# endif
+} lua_apr_pipeline_object;
+
+static lua_apr_objtype lua_apr_pipeline_type;
+
+static apr_status_t stage_push(lua_apr_pipeline_object*, int, const char*, apr_size_t);
+
+/* check_endpoint() -- get the buffers of a file, socket or shm object {{{2 */
+
+static void check_endpoint(lua_State *L, int idx, lua_apr_readbuf **input, lua_apr_writebuf **output)
+{
+  if (object_has_type(L, idx, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = check_object(L, idx, &lua_apr_file_type);
+    if (file->handle == NULL)
+      luaL_error(L, "attempt to use a closed file");
+    *input = &file->input;
+    *output = &file->output;
+  } else if (object_has_type(L, idx, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    if (socket->handle == NULL)
+      luaL_error(L, "attempt to use a closed socket");
+    *input = &socket->input;
+    *output = &socket->output;
+  } else if (!shm_buffers(L, idx, input, output)) {
+    luaL_argerror(L, idx, "file, socket or shared memory expected");
+  }
+}
+
+/* pipeline_fail() -- remember why a pipeline failed {{{2 */
+
+static apr_status_t pipeline_fail(lua_apr_pipeline_object *P, const char *error)
+{
+  P->error = error;
+  return APR_EGENERAL;
+}
+
+/* emit() -- pass the output of a stage to the next stage or the sink {{{2 */
+
+static apr_status_t emit(lua_apr_pipeline_object *P, int i, const char *data, apr_size_t len)
+{
+  apr_status_t status = APR_SUCCESS;
+
+  if (len == 0)
+    return status;
+  if (i + 1 < P->count)
+    return stage_push(P, i + 1, data, len);
+  if (P->sink != NULL)
+    status = write_output(P->sink, data, len);
+  if (status == APR_SUCCESS)
+    P->bytes_out += len;
+
+  return status;
+}
+
+/* xlate_staged() -- translate the staged input {{{2 */
+
+static apr_status_t xlate_staged(lua_apr_pipeline_object *P, int i)
+{
+  pipeline_stage *S = &P->stages[i];
+  apr_size_t inleft = S->pending, outleft;
+  apr_status_t status = APR_SUCCESS, result;
+
+  while (inleft > 0 && status == APR_SUCCESS) {
+    outleft = STAGE_BUFSIZE;
+    result = apr_xlate_conv_buffer(S->context.xlate,
+        S->staging + (S->pending - inleft), &inleft, S->buffer, &outleft);
+    status = emit(P, i, S->buffer, STAGE_BUFSIZE - outleft);
+    if (APR_STATUS_IS_INCOMPLETE(result))
+      break; /* the rest is the start of a multibyte sequence */
+    else if (result != APR_SUCCESS)
+      return pipeline_fail(P, "invalid input for character encoding");
+    else if (outleft == STAGE_BUFSIZE)
+      break;
+  }
+  memmove(S->staging, S->staging + (S->pending - inleft), inleft);
+  S->pending = inleft;
+  if (status == APR_SUCCESS && S->pending == STAGE_BUFSIZE)
+    return pipeline_fail(P, "invalid input for character encoding");
+
+  return status;
+}
+
+#if LUA_APR_HAVE_ZLIB
+
+/* zlib_run() -- compress or decompress until zlib needs more input {{{2 */
+
+static apr_status_t zlib_run(lua_apr_pipeline_object *P, int i, int flush)
+{
+  pipeline_stage *S = &P->stages[i];
+  z_stream *z = &S->context.zlib;
+  apr_status_t status = APR_SUCCESS;
+  size_t produced;
+  int result;
+
+  while (S->active && status == APR_SUCCESS) {
+    z->next_out = (Bytef*) S->buffer;
+    z->avail_out = STAGE_BUFSIZE;
+    if (S->type == STAGE_DEFLATE)
+      result = deflate(z, flush);
+    else
+      result = inflate(z, Z_NO_FLUSH);
+    produced = STAGE_BUFSIZE - z->avail_out;
+    status = emit(P, i, S->buffer, produced);
+    if (result == Z_STREAM_END) {
+      if (S->type == STAGE_DEFLATE)
+        deflateEnd(z);
+      else
+        inflateEnd(z);
+      S->active = 0;
+    } else if (result == Z_BUF_ERROR && produced == 0) {
+      break; /* more input is needed */
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      return pipeline_fail(P, z->msg != NULL ? z->msg : "invalid compressed data");
+    } else if (z->avail_out > 0 && flush != Z_FINISH && z->avail_in == 0) {
+      break;
+    }
+  }
+
+  return status;
+}
+
+#endif
+
+/* stage_push() -- pass data through a stage {{{2 */
+
+static apr_status_t stage_push(lua_apr_pipeline_object *P, int i, const char *data, apr_size_t len)
+{
+  pipeline_stage *S = &P->stages[i];
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n, size;
+
+  switch (S->type) {
+    case STAGE_MD5:
+      apr_md5_update(&S->context.md5, data, len);
+      return emit(P, i, data, len);
+    case STAGE_SHA1:
+      apr_sha1_update_binary(&S->context.sha1, (const unsigned char*)data, (unsigned int)len);
+      return emit(P, i, data, len);
+    case STAGE_BASE64_ENCODE:
+      while (len > 0 && status == APR_SUCCESS) {
+        n = len < ENCODE_BLOCKSIZE ? len : ENCODE_BLOCKSIZE;
+        status = emit(P, i, S->buffer, base64_encode_update(&S->context.base64,
+              S->buffer, (const unsigned char*)data, n));
+        data += n, len -= n;
+      }
+      return status;
+    case STAGE_BASE64_DECODE:
+      while (len > 0 && status == APR_SUCCESS) {
+        n = len < DECODE_BLOCKSIZE ? len : DECODE_BLOCKSIZE;
+        if (base64_decode_update(&S->context.base64, (unsigned char*)S->buffer,
+              &size, data, n) != APR_SUCCESS)
+          return pipeline_fail(P, "invalid base64 data");
+        status = emit(P, i, S->buffer, size);
+        data += n, len -= n;
+      }
+      return status;
+    case STAGE_XLATE:
+      while (len > 0 && status == APR_SUCCESS) {
+        n = STAGE_BUFSIZE - S->pending;
+        if (n > len)
+          n = len;
+        memcpy(S->staging + S->pending, data, n);
+        S->pending += n;
+        data += n, len -= n;
+        status = xlate_staged(P, i);
+      }
+      return status;
+#   if LUA_APR_HAVE_ZLIB
+    case STAGE_DEFLATE:
+    case STAGE_INFLATE:
+      if (!S->active)
+        return APR_SUCCESS; /* ignore data after the compressed stream */
+      S->context.zlib.next_in = (Bytef*) data;
+      S->context.zlib.avail_in = (uInt) len;
+      status = zlib_run(P, i, Z_NO_FLUSH);
+      if (S->active) {
+        S->context.zlib.next_in = NULL;
+        S->context.zlib.avail_in = 0;
+      }
+      return status;
+#   endif
+  }
+
+  return status;
+}
+
+/* stage_finish() -- flush the remaining output of a stage {{{2 */
+
+static apr_status_t stage_finish(lua_apr_pipeline_object *P, int i)
+{
+  pipeline_stage *S = &P->stages[i];
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t outleft, size;
+
+  switch (S->type) {
+    case STAGE_MD5:
+      apr_md5_final(S->digest, &S->context.md5);
+      S->digestsize = APR_MD5_DIGESTSIZE;
+      break;
+    case STAGE_SHA1:
+      apr_sha1_final(S->digest, &S->context.sha1);
+      S->digestsize = APR_SHA1_DIGESTSIZE;
+      break;
+    case STAGE_BASE64_ENCODE:
+      status = emit(P, i, S->buffer, base64_encode_final(&S->context.base64, S->buffer));
+      break;
+    case STAGE_BASE64_DECODE:
+      if (base64_decode_final(&S->context.base64, (unsigned char*)S->buffer, &size) != APR_SUCCESS)
+        return pipeline_fail(P, "invalid base64 data");
+      status = emit(P, i, S->buffer, size);
+      break;
+    case STAGE_XLATE:
+      if (S->pending > 0)
+        return pipeline_fail(P, "incomplete multibyte sequence at end of input");
+      /* Flush the shift state of stateful character encodings. */
+      outleft = STAGE_BUFSIZE;
+      if (apr_xlate_conv_buffer(S->context.xlate, NULL, NULL, S->buffer, &outleft) == APR_SUCCESS)
+        status = emit(P, i, S->buffer, STAGE_BUFSIZE - outleft);
+      break;
+#   if LUA_APR_HAVE_ZLIB
+    case STAGE_DEFLATE:
+      status = zlib_run(P, i, Z_FINISH);
+      break;
+    case STAGE_INFLATE:
+      if (S->active)
+        return pipeline_fail(P, "compressed stream ended prematurely");
+      break;
+#   endif
+  }
+
+  return status;
+}
+
+/* pipeline_run_impl() -- copy the source to the sink {{{2
+ *
+ * This doesn't touch the Lua state so it can run on a separate thread.
+ */
+
+static apr_status_t pipeline_run_impl(lua_apr_pipeline_object *P)
+{
+  lua_apr_readbuf *source = P->source;
+  lua_apr_buffer *B = &source->buffer;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t n;
+  int i;
+
+  while (status == APR_SUCCESS) {
+    n = PIPELINE_BUFSIZE;
+    if (P->length >= 0 && (apr_off_t) n > P->length - P->bytes_in)
+      n = (apr_size_t) (P->length - P->bytes_in);
+    if (n == 0)
+      break;
+    if (B->index < B->limit) {
+      /* Use data that was already buffered by the source. */
+      if (n > B->limit - B->index)
+        n = B->limit - B->index;
+      status = emit(P, -1, &B->data[B->index], n);
+      drain_input(source, n);
+    } else if (B->unmanaged) {
+      break;
+    } else {
+      /* Read directly into the buffer of the pipeline. */
+      status = source->read(source->object, P->buffer, &n);
+      if (APR_STATUS_IS_EOF(status)) {
+        status = APR_SUCCESS;
+        break;
+      } else if (status == APR_SUCCESS) {
+        status = emit(P, -1, P->buffer, n);
+      }
+    }
+    P->bytes_in += n;
+  }
+
+  for (i = 0; i < P->count && status == APR_SUCCESS; i++)
+    status = stage_finish(P, i);
+  if (status == APR_SUCCESS && P->sink != NULL)
+    status = flush_output(P->sink, 1);
+
+  return status;
+}
+
+#if APR_HAS_THREADS
+
+/* pipeline_worker() -- run a pipeline on a separate thread {{{2 */
+
+static void * lua_apr_cc pipeline_worker(apr_thread_t *thread, void *data)
+{
+  lua_apr_pipeline_object *P = data;
+  P->status = pipeline_run_impl(P);
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+#endif
+
+/* push_results() -- push the results of a pipeline {{{2 */
+
+static int push_results(lua_State *L, lua_apr_pipeline_object *P)
+{
+  static const char hexdigits[] = "0123456789abcdef";
+  char hex[APR_SHA1_DIGESTSIZE * 2];
+  pipeline_stage *S;
+  size_t j;
+  int i;
+
+  if (P->status != APR_SUCCESS) {
+    if (P->error != NULL)
+      return push_error_message(L, P->error);
+    return push_error_status(L, P->status);
+  }
+
+  lua_newtable(L);
+  lua_pushnumber(L, (lua_Number) P->bytes_in);
+  lua_setfield(L, -2, "bytes_in");
+  lua_pushnumber(L, (lua_Number) P->bytes_out);
+  lua_setfield(L, -2, "bytes_out");
+  for (i = 0; i < P->count; i++) {
+    S = &P->stages[i];
+    if (S->digestsize > 0) {
+      for (j = 0; j < S->digestsize; j++) {
+        hex[j * 2] = hexdigits[S->digest[j] >> 4];
+        hex[j * 2 + 1] = hexdigits[S->digest[j] & 15];
+      }
+      lua_pushlstring(L, hex, S->digestsize * 2);
+      lua_setfield(L, -2, S->name);
+    }
+  }
+
+  return 1;
+}
+
+/* cleanup_stages() -- release resources held by transformations {{{2 */
+
+static void cleanup_stages(lua_apr_pipeline_object *P)
+{
+# if LUA_APR_HAVE_ZLIB
+  int i;
+  for (i = 0; i < P->count; i++) {
+    pipeline_stage *S = &P->stages[i];
+    if (S->active && S->type == STAGE_DEFLATE)
+      deflateEnd(&S->context.zlib);
+    else if (S->active && S->type == STAGE_INFLATE)
+      inflateEnd(&S->context.zlib);
+    S->active = 0;
+  }
+# endif
+}
+
+/* init_stage() -- initialize the transformation at the top of the stack {{{2 */
+
+static void init_stage(lua_State *L, lua_apr_pipeline_object *P, pipeline_stage *S, int argidx)
+{
+  const char *options[] = { "md5", "sha1", "base64_encode", "base64_decode",
+    "xlate", "gzip", "deflate", "inflate", NULL };
+  const int types[] = { STAGE_MD5, STAGE_SHA1, STAGE_BASE64_ENCODE,
+    STAGE_BASE64_DECODE, STAGE_XLATE, STAGE_DEFLATE, STAGE_DEFLATE,
+    STAGE_INFLATE };
+  const char *name, *from, *to;
+  apr_status_t status;
+  int option, spec = lua_gettop(L), level;
+
+  if (lua_istable(L, spec))
+    lua_rawgeti(L, spec, 1);
+  else
+    lua_pushvalue(L, spec);
+  name = lua_tostring(L, -1);
+  for (option = 0; name != NULL && options[option] != NULL; option++)
+    if (strcmp(name, options[option]) == 0)
+      break;
+  if (name == NULL || options[option] == NULL)
+    luaL_argerror(L, argidx, lua_pushfstring(L, "unknown transformation %s", name ? name : "?"));
+  S->type = types[option];
+  S->name = options[option];
+  lua_pop(L, 1);
+
+  switch (S->type) {
+    case STAGE_MD5:
+      apr_md5_init(&S->context.md5);
+      break;
+    case STAGE_SHA1:
+      apr_sha1_init(&S->context.sha1);
+      break;
+    case STAGE_XLATE:
+      luaL_argcheck(L, lua_istable(L, spec), argidx, "xlate needs the options from and to");
+      lua_getfield(L, spec, "from");
+      lua_getfield(L, spec, "to");
+      from = luaL_checkstring(L, -2);
+      to = luaL_checkstring(L, -1);
+      status = apr_xlate_open(&S->context.xlate,
+          strcmp(to, "locale") == 0 ? APR_LOCALE_CHARSET : to,
+          strcmp(from, "locale") == 0 ? APR_LOCALE_CHARSET : from, P->pool);
+      if (status != APR_SUCCESS)
+        raise_error_status(L, status);
+      lua_pop(L, 2);
+      break;
+    case STAGE_DEFLATE:
+    case STAGE_INFLATE:
+#     if LUA_APR_HAVE_ZLIB
+      level = Z_DEFAULT_COMPRESSION;
+      if (lua_istable(L, spec)) {
+        lua_getfield(L, spec, "level");
+        level = luaL_optint(L, -1, level);
+        lua_pop(L, 1);
+      }
+      if (S->type == STAGE_INFLATE) {
+        if (inflateInit2(&S->context.zlib, 15 + 32) != Z_OK)
+          raise_error_memory(L);
+      } else if (deflateInit2(&S->context.zlib, level, Z_DEFLATED,
+            strcmp(S->name, "gzip") == 0 ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        luaL_argerror(L, argidx, "invalid compression level");
+      }
+      S->active = 1;
+#     else
+      (void) level;
+      luaL_argerror(L, argidx, "Lua/APR was built without zlib");
+#     endif
+      break;
+  }
+
+  S->buffer = apr_palloc(P->pool, STAGE_BUFSIZE + 1);
+  S->staging = apr_palloc(P->pool, STAGE_BUFSIZE + 1);
+  if (S->buffer == NULL || S->staging == NULL)
+    raise_error_memory(L);
+}
+
+/* check_pipeline() -- get a pipeline that isn't running from the stack {{{2 */
+
+static lua_apr_pipeline_object *check_pipeline(lua_State *L, int idx)
+{
+  lua_apr_pipeline_object *P = check_object(L, idx, &lua_apr_pipeline_type);
+  if (P->state == PIPELINE_RUNNING)
+    luaL_error(L, "attempt to use a running pipeline");
+  else if (P->state == PIPELINE_DONE)
+    luaL_error(L, "attempt to run a pipeline that has already finished");
+  return P;
+}
+
+/* apr.pipeline(source, transformations, sink [, length]) -> pipeline {{{1
+ *
+ * Create a pipeline that reads data from @source, passes it through the
+ * list of @transformations (which may be empty) and writes the result to
+ * @sink. Sources and sinks can be file objects (this includes pipes),
+ * socket objects and shared memory segments. The @sink can be nil in which
+ * case the output is discarded (useful to compute checksums). When the
+ * optional @length is given no more than this number of bytes is read from
+ * @source, otherwise the pipeline runs until the end of @source.
+ *
+ * Data that was already buffered by @source (for example after reading an
+ * HTTP request head from a socket) is used before reading more, and data
+ * written to @sink before the pipeline runs is written first. The sink is
+ * not closed when the pipeline finishes.
+ */
+
+int lua_apr_pipeline(lua_State *L)
+{
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output;
+  lua_apr_pipeline_object *P;
+  apr_status_t status;
+  int i;
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 4);
+
+  /* Create the pipeline object (at stack index 5). */
+  P = new_object(L, &lua_apr_pipeline_type);
+  status = apr_pool_create(&P->pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  P->length = lua_isnil(L, 4) ? -1 : (apr_off_t) luaL_checknumber(L, 4);
+  P->count = (int) lua_objlen(L, 2);
+  P->buffer = apr_palloc(P->pool, PIPELINE_BUFSIZE);
+  P->stages = apr_pcalloc(P->pool, sizeof(pipeline_stage) * (P->count + 1));
+  if (P->buffer == NULL || P->stages == NULL)
+    return push_error_memory(L);
+
+  /* Get the buffers of the source and sink. */
+  check_endpoint(L, 1, &P->source, &output);
+  if (!lua_isnil(L, 3))
+    check_endpoint(L, 3, &input, &P->sink);
+
+  /* Initialize the transformations (the pipeline's __gc cleans up). */
+  for (i = 0; i < P->count; i++) {
+    lua_rawgeti(L, 2, i + 1);
+    init_stage(L, P, &P->stages[i], 2);
+    lua_pop(L, 1);
+  }
+
+  /* Keep the source and sink alive while the pipeline is reachable. */
+  object_env_private(L, 5);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "source");
+  lua_pushvalue(L, 3);
+  lua_setfield(L, -2, "sink");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* pipeline:run() -> result {{{1
+ *
+ * Run the pipeline until the source is exhausted. On success a table is
+ * returned with the fields `bytes_in` (the number of bytes read from the
+ * source), `bytes_out` (the number of bytes written to the sink) and a
+ * hexadecimal checksum for each `'md5'` or `'sha1'` transformation (named
+ * after the transformation). Otherwise a nil followed by an error message is
+ * returned. A pipeline can only be run once.
+ */
+
+static int pipeline_run(lua_State *L)
+{
+  lua_apr_pipeline_object *P = check_pipeline(L, 1);
+
+  P->status = pipeline_run_impl(P);
+  P->state = PIPELINE_DONE;
+  cleanup_stages(P);
+
+  return push_results(L, P);
+}
+
+#if APR_HAS_THREADS
+
+/* pipeline:start() -> status {{{1
+ *
+ * Run the pipeline on a separate operating system thread. On success true is
+ * returned, otherwise a nil followed by an error message is returned. Use
+ * `pipeline:wait()` to get the results. *This function is only available when
+ * APR was compiled with thread support.*
+ */
+
+static int pipeline_start(lua_State *L)
+{
+  lua_apr_pipeline_object *P = check_pipeline(L, 1);
+  apr_status_t status;
+
+  status = apr_thread_create(&P->thread, NULL, pipeline_worker, P, P->pool);
+  if (status == APR_SUCCESS)
+    P->state = PIPELINE_RUNNING;
+
+  return push_status(L, status);
+}
+
+/* pipeline:wait() -> result {{{1
+ *
+ * Wait for a pipeline started with `pipeline:start()` to finish and return
+ * the same results as `pipeline:run()`.
+ */
+
+static int pipeline_wait(lua_State *L)
+{
+  lua_apr_pipeline_object *P = check_object(L, 1, &lua_apr_pipeline_type);
+  apr_status_t status, unused;
+
+  luaL_argcheck(L, P->state == PIPELINE_RUNNING, 1, "pipeline isn't running");
+  status = apr_thread_join(&unused, P->thread);
+  P->state = PIPELINE_DONE;
+  cleanup_stages(P);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  return push_results(L, P);
+}
+
+#endif
+
+/* pipeline:__tostring() {{{1 */
+
+static int pipeline_tostring(lua_State *L)
+{
+  lua_apr_pipeline_object *P = check_object(L, 1, &lua_apr_pipeline_type);
+  lua_pushfstring(L, "%s (%p)", lua_apr_pipeline_type.friendlyname, P);
+  return 1;
+}
+
+/* pipeline:__gc() {{{1 */
+
+static int pipeline_gc(lua_State *L)
+{
+  lua_apr_pipeline_object *P = check_object(L, 1, &lua_apr_pipeline_type);
+
+# if APR_HAS_THREADS
+  if (P->state == PIPELINE_RUNNING) {
+    apr_status_t unused;
+    apr_thread_join(&unused, P->thread);
+  }
+# endif
+  if (P->pool != NULL) {
+    cleanup_stages(P);
+    apr_pool_destroy(P->pool);
+    P->pool = NULL;
+  }
+
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg pipeline_methods[] = {
+  { "run", pipeline_run },
+# if APR_HAS_THREADS
+  { "start", pipeline_start },
+  { "wait", pipeline_wait },
+# endif
+  { NULL, NULL }
+};
+
+static luaL_reg pipeline_metamethods[] = {
+  { "__tostring", pipeline_tostring },
+  { "__gc", pipeline_gc },
+  { NULL, NULL }
+};
+
+/* Pipelines are left out of lua_apr_types[] because they refer to their
+ * source and sink through their environment in the Lua state that created
+ * them. */
+static lua_apr_objtype lua_apr_pipeline_type = {
+  "lua_apr_pipeline_object*",         /* metatable name in registry */
+  "pipeline",                  /* friendly object name */
+  sizeof(lua_apr_pipeline_object), /* structure size */
+  pipeline_methods,            /* methods table */
+  pipeline_metamethods         /* metamethods table */
+};
+
+#endif
@@ -1,7 +1,7 @@
 /* Pollset module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: December 3, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -18,25 +18,109 @@
  * is an example of a [simple asynchronous webserver] [async_server] that uses
  * a pollset.
  *
+ * Besides sockets a pollset can also watch files (in practice this means
+ * pipes: anonymous pipes created with `apr.pipe_create()`, named pipes opened
+ * with `apr.file_open()` and the pipes returned by `process:out_get()` and
+ * friends), thread queues, resolvers created with `apr.resolver()` and
+ * password validators created with `apr.password_validator()`. This makes it
+ * possible to wait for network traffic, child processes, other threads, DNS
+ * lookups and password validations in a single call to `pollset:poll()`. Note
+ * that APR doesn't support polling files on Windows.
+ *
+ * Servers with many mostly idle connections can avoid scanning all of them on
+ * every wakeup by choosing an efficient backend (see `apr.pollset()`) and by
+ * registering objects as *one-shot* so that an object which has been reported
+ * stays quiet until you ask for it again using `pollset:rearm()`.
+ *
  * [wp_async_io]: http://en.wikipedia.org/wiki/Asynchronous_I/O
  * [async_server]: #example_asynchronous_webserver
  */
 
 #include "lua_apr.h"
 #include <apr_poll.h>
+#include <apr_hash.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+/* apr_pollset_create_ex() and friends were added in APR 1.4. */
+#define LUA_APR_POLLSET_EX \
+  (APR_MAJOR_VERSION > 1 || (APR_MAJOR_VERSION == 1 && APR_MINOR_VERSION >= 4))
+
+/* Per descriptor flags. */
+#define POLLFD_ONESHOT 1  /* disarm after the descriptor has been reported */
+#define POLLFD_DISARMED 2 /* descriptor isn't in the kernel's pollset      */
 
 /* Internal functions. {{{1 */
 
+/* The root wheel has 256 slots of one millisecond, each of the four levels
+ * above it has 64 slots covering the complete wheel below it, so timers can
+ * be scheduled up to 2^32 milliseconds (about 49 days) in the future. */
+#define TIMER_ROOT_BITS 8
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVELS 4
+#define TIMER_ROOT_SIZE (1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE (1 << TIMER_LEVEL_BITS)
+#define TIMER_ROOT_MASK (TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_MASK (TIMER_LEVEL_SIZE - 1)
+#define TIMER_LEVEL_SHIFT(level) (TIMER_ROOT_BITS + (level) * TIMER_LEVEL_BITS)
+#define TIMER_MAX_TICKS ((apr_int64_t)1 << TIMER_LEVEL_SHIFT(TIMER_LEVELS))
+
+typedef struct lua_apr_timer lua_apr_timer;
+typedef struct lua_apr_timer_wheel lua_apr_timer_wheel;
+
+struct lua_apr_timer {
+  lua_apr_refobj header;      /* required by new_object()                      */
+  lua_apr_timer_wheel *wheel; /* wheel containing the timer (NULL when idle)   */
+  lua_apr_timer **head;       /* head of the list that contains the timer      */
+  lua_apr_timer *prev, *next; /* neighbours in the list that contains the timer */
+  apr_int64_t expires;        /* tick (millisecond) at which the timer expires */
+};
+
+struct lua_apr_timer_wheel {
+  const void *owner;          /* Lua state that runs the callbacks             */
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;  /* mutex of the pollset that owns the wheel      */
+#endif
+  apr_time_t epoch;           /* time corresponding to tick zero               */
+  apr_int64_t current;        /* next tick to be processed                     */
+  int pending;                /* number of timers that haven't expired yet     */
+  lua_apr_timer *root[TIMER_ROOT_SIZE];
+  lua_apr_timer *levels[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+  lua_apr_timer *expired, *expired_tail;
+};
+
 typedef struct {
   lua_apr_refobj header;   /* required by new_object()                         */
   apr_pollset_t *pollset;  /* opaque pointer allocated by APR from memory pool */
   apr_pool_t *memory_pool; /* standalone memory pool for pollset               */
   apr_pollfd_t *fds;       /* file descriptor array allocated from memory pool */
+  unsigned char *modes;    /* POLLFD_* flags for each file descriptor          */
+  int *free_slots;         /* stack with indexes of unused file descriptors    */
+  int num_free;            /* number of indexes on the stack                   */
+  apr_hash_t *index;       /* maps client data to file descriptors             */
   int size;                /* size of file descriptor array                    */
+  int oneshot;             /* register descriptors as one-shot by default?     */
+  lua_apr_timer_wheel *timers; /* timer wheel allocated from memory pool       */
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;   /* protects the timer wheel (see apr.ref())     */
+#endif
 } lua_apr_pollset_object;
 
-#define check_socket(L, idx) \
-   check_object(L, idx, &lua_apr_socket_type)
+/* Pollsets can be shared between threads, so the timer wheel is protected by
+ * a mutex. Nothing else is: the pollset is created without
+ * APR_POLLSET_THREADSAFE and the descriptor array, modes, free slots and
+ * index are updated without locking, so only the thread that polls may add,
+ * remove or rearm objects (see apr.pollset()). */
+#if APR_HAS_THREADS
+# define wheel_lock(wheel) apr_thread_mutex_lock((wheel)->mutex)
+# define wheel_unlock(wheel) apr_thread_mutex_unlock((wheel)->mutex)
+#else
+# define wheel_lock(wheel) ((void)0)
+# define wheel_unlock(wheel) ((void)0)
+#endif
+
+static lua_apr_objtype lua_apr_timer_type;
 
 /* check_pollset() */
 
@@ -47,33 +131,348 @@ static lua_apr_pollset_object* check_pollset(lua_State *L, int idx, int open) {
   return object;
 }
 
-/* find_fd_by_socket() {{{2 */
+/* check_pollable() {{{2
+ *
+ * Get the Lua/APR object at the given stack index, which must be a socket, a
+ * file (pipe), a thread queue, a resolver or a password validator. When @fd
+ * isn't NULL the descriptor fields of @fd are initialized so that the object
+ * can be added to a pollset. Objects without a memory pool of their own use
+ * the memory pool @pool.
+ */
 
-static apr_pollfd_t* find_fd_by_socket(lua_apr_pollset_object *object, lua_apr_socket *socket)
+static void *check_pollable(lua_State *L, int idx, apr_pollfd_t *fd, apr_pool_t *pool)
 {
-  apr_pollfd_t *fd;
-  int i;
-
-  for (i = 0; i < object->size; i++) {
-    fd = &object->fds[i];
-    if (fd->desc_type == APR_POLL_SOCKET && fd->client_data == socket)
-      return fd;
+  if (object_has_type(L, idx, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    if (fd != NULL) {
+      if (socket->handle == NULL)
+        luaL_error(L, "attempt to use a closed socket");
+      fd->p = socket->pool;
+      fd->desc_type = APR_POLL_SOCKET;
+      fd->desc.s = socket->handle;
+    }
+    return socket;
+  } else if (object_has_type(L, idx, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = file_check(L, idx, fd != NULL);
+    if (fd != NULL) {
+      fd->p = file->pool->ptr;
+      fd->desc_type = APR_POLL_FILE;
+      fd->desc.f = file->handle;
+    }
+    return file;
+  }
+# if APR_HAS_THREADS
+  else if (object_has_type(L, idx, &lua_apr_queue_type, 1)) {
+    if (fd != NULL) {
+      fd->p = pool;
+      fd->desc_type = APR_POLL_FILE;
+      fd->desc.f = queue_signal_get(L, idx);
+    }
+    return check_object(L, idx, &lua_apr_queue_type);
+  } else if (object_has_type(L, idx, &lua_apr_resolver_type, 1)) {
+    if (fd != NULL) {
+      fd->p = pool;
+      fd->desc_type = APR_POLL_FILE;
+      fd->desc.f = resolver_signal_get(L, idx);
+    }
+    return check_object(L, idx, &lua_apr_resolver_type);
   }
+# endif
+# if LUAAPR_HAVE_APRUTIL && APR_HAS_THREADS
+  else if (object_has_type(L, idx, &lua_apr_validator_type, 1)) {
+    if (fd != NULL) {
+      fd->p = pool;
+      fd->desc_type = APR_POLL_FILE;
+      fd->desc.f = validator_signal_get(L, idx);
+    }
+    return check_object(L, idx, &lua_apr_validator_type);
+  }
+# endif
 
-  return NULL;
+  luaL_typerror(L, idx, "socket, file, thread queue, resolver or password validator");
+  return NULL; /* make the compiler happy */
+}
+
+/* find_fd_by_object() {{{2 */
+
+static apr_pollfd_t* find_fd_by_object(lua_apr_pollset_object *object, void *client_data)
+{
+  return apr_hash_get(object->index, &client_data, sizeof client_data);
 }
 
 /* find_empty_fd() {{{2 */
 
 static apr_pollfd_t* find_empty_fd(lua_apr_pollset_object *object)
 {
+  if (object->num_free == 0)
+    return NULL;
+
+  return &object->fds[object->free_slots[--object->num_free]];
+}
+
+/* release_fd() {{{2
+ *
+ * Mark a file descriptor as unused and return it to the stack of free slots.
+ */
+
+static void release_fd(lua_apr_pollset_object *object, apr_pollfd_t *fd)
+{
+  int slot = fd - object->fds;
+
+  apr_hash_set(object->index, &fd->client_data, sizeof fd->client_data, NULL);
+  fd->desc_type = APR_NO_DESC;
+  object->modes[slot] = 0;
+  object->free_slots[object->num_free++] = slot;
+}
+
+/* timer_owner() -- identify the Lua state that runs timer callbacks {{{2
+ *
+ * A timer is kept alive by the environment of the pollset in the Lua state
+ * that created it, so only that Lua state (and its coroutines, which share
+ * its registry) can call the timer's callback.
+ */
+
+static const void *timer_owner(lua_State *L)
+{
+  return lua_topointer(L, LUA_REGISTRYINDEX);
+}
+
+/* owned_timers() -- get the timer wheel if it belongs to the given Lua state {{{2 */
+
+static lua_apr_timer_wheel *owned_timers(lua_State *L, lua_apr_pollset_object *object)
+{
+  lua_apr_timer_wheel *wheel = object->timers;
+  return wheel != NULL && wheel->owner == timer_owner(L) ? wheel : NULL;
+}
+
+/* timer_link() {{{2 */
+
+static void timer_link(lua_apr_timer **head, lua_apr_timer *timer)
+{
+  timer->head = head;
+  timer->prev = NULL;
+  timer->next = *head;
+  if (*head != NULL)
+    (*head)->prev = timer;
+  *head = timer;
+}
+
+/* timer_unlink() {{{2 */
+
+static void timer_unlink(lua_apr_timer *timer)
+{
+  lua_apr_timer_wheel *wheel = timer->wheel;
+
+  if (timer->head == &wheel->expired) {
+    if (wheel->expired_tail == timer)
+      wheel->expired_tail = timer->prev;
+  } else
+    wheel->pending--;
+  if (timer->prev != NULL)
+    timer->prev->next = timer->next;
+  else
+    *timer->head = timer->next;
+  if (timer->next != NULL)
+    timer->next->prev = timer->prev;
+  timer->head = NULL;
+  timer->prev = timer->next = NULL;
+  timer->wheel = NULL;
+}
+
+/* timer_schedule() {{{2
+ *
+ * Put a timer in the slot of the wheel that corresponds to its expiration
+ * time. Timers that are too far in the future for the root wheel go into one
+ * of the coarser levels and are cascaded down as time advances.
+ */
+
+static void timer_schedule(lua_apr_timer_wheel *wheel, lua_apr_timer *timer)
+{
+  apr_int64_t delta = timer->expires - wheel->current;
+  lua_apr_timer **head;
+  int level;
+
+  if (delta < 0) {
+    /* Overdue timers expire on the next tick. */
+    head = &wheel->root[wheel->current & TIMER_ROOT_MASK];
+  } else if (delta < TIMER_ROOT_SIZE) {
+    head = &wheel->root[timer->expires & TIMER_ROOT_MASK];
+  } else {
+    if (delta >= TIMER_MAX_TICKS)
+      timer->expires = wheel->current + TIMER_MAX_TICKS - 1;
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+      if (delta < ((apr_int64_t)1 << TIMER_LEVEL_SHIFT(level + 1)))
+        break;
+    head = &wheel->levels[level][(timer->expires >> TIMER_LEVEL_SHIFT(level)) & TIMER_LEVEL_MASK];
+  }
+
+  timer_link(head, timer);
+}
+
+/* timer_cascade() {{{2 */
+
+static void timer_cascade(lua_apr_timer_wheel *wheel, int level)
+{
+  int index = (wheel->current >> TIMER_LEVEL_SHIFT(level)) & TIMER_LEVEL_MASK;
+  lua_apr_timer *timer, *list = wheel->levels[level][index];
+
+  wheel->levels[level][index] = NULL;
+  while (list != NULL) {
+    timer = list;
+    list = list->next;
+    timer_schedule(wheel, timer);
+  }
+  if (index == 0 && level + 1 < TIMER_LEVELS)
+    timer_cascade(wheel, level + 1);
+}
+
+/* timer_advance() {{{2
+ *
+ * Process all ticks up to and including @now, moving expired timers to the
+ * list of expired timers (in order of expiration).
+ */
+
+static void timer_advance(lua_apr_timer_wheel *wheel, apr_int64_t now)
+{
+  lua_apr_timer *timer, *list;
+  int index;
+
+  while (wheel->current <= now) {
+    if (wheel->pending == 0) {
+      /* Nothing scheduled so we can skip straight to the present. */
+      wheel->current = now + 1;
+      break;
+    }
+    index = wheel->current & TIMER_ROOT_MASK;
+    if (index == 0)
+      timer_cascade(wheel, 0);
+    list = wheel->root[index];
+    wheel->root[index] = NULL;
+    while (list != NULL) {
+      timer = list;
+      list = list->next;
+      wheel->pending--;
+      /* Append the timer to the list of expired timers. */
+      timer->head = &wheel->expired;
+      timer->prev = wheel->expired_tail;
+      timer->next = NULL;
+      if (wheel->expired_tail != NULL)
+        wheel->expired_tail->next = timer;
+      else
+        wheel->expired = timer;
+      wheel->expired_tail = timer;
+    }
+    wheel->current++;
+  }
+}
+
+/* timer_next() {{{2
+ *
+ * Find the earliest expiration time in the first non-empty slot of a wheel,
+ * scanning @size slots starting from @start. Returns -1 when all are empty.
+ */
+
+static apr_int64_t timer_next(lua_apr_timer **slots, int start, int size)
+{
+  apr_int64_t next = -1;
+  lua_apr_timer *timer;
   int i;
 
-  for (i = 0; i < object->size; i++)
-    if (object->fds[i].desc_type == APR_NO_DESC)
-      return &object->fds[i];
+  for (i = 0; i < size; i++) {
+    timer = slots[(start + i) & (size - 1)];
+    if (timer != NULL) {
+      for (; timer != NULL; timer = timer->next)
+        if (next < 0 || timer->expires < next)
+          next = timer->expires;
+      break;
+    }
+  }
+
+  return next;
+}
+
+/* timer_timeout() {{{2
+ *
+ * Limit the timeout given to pollset:poll() by the first pending timer.
+ */
+
+static apr_interval_time_t timer_timeout(lua_apr_timer_wheel *wheel, apr_interval_time_t timeout)
+{
+  apr_int64_t next, candidate;
+  apr_interval_time_t delay;
+  int level;
+
+  if (wheel == NULL)
+    return timeout;
+  if (wheel->expired != NULL)
+    return 0;
+  if (wheel->pending == 0)
+    return timeout;
+
+  next = timer_next(wheel->root, wheel->current & TIMER_ROOT_MASK, TIMER_ROOT_SIZE);
+  for (level = 0; level < TIMER_LEVELS; level++) {
+    candidate = timer_next(wheel->levels[level],
+        ((wheel->current >> TIMER_LEVEL_SHIFT(level)) + 1) & TIMER_LEVEL_MASK,
+        TIMER_LEVEL_SIZE);
+    if (candidate >= 0 && (next < 0 || candidate < next))
+      next = candidate;
+  }
+  if (next < 0)
+    return timeout;
 
-  return NULL;
+  delay = wheel->epoch + next * 1000 - apr_time_now();
+  if (delay < 0)
+    delay = 0;
+  if (timeout < 0 || delay < timeout)
+    return delay;
+  return timeout;
+}
+
+/* timers_run() {{{2
+ *
+ * Call the callbacks of expired timers. The pollset's environment table must
+ * be at stack index @env. The pollset is checked after each callback because
+ * a callback may very well destroy the pollset.
+ */
+
+static void timers_run(lua_State *L, lua_apr_pollset_object *object, int env)
+{
+  lua_apr_timer_wheel *wheel;
+  lua_apr_timer *timer;
+
+  wheel = owned_timers(L, object);
+  if (wheel == NULL)
+    return;
+  wheel_lock(wheel);
+  timer_advance(wheel, (apr_time_now() - wheel->epoch) / 1000);
+  wheel_unlock(wheel);
+
+  /* The wheel is unlocked while callbacks run (they may add timers). */
+  while ((wheel = owned_timers(L, object)) != NULL) {
+    wheel_lock(wheel);
+    timer = wheel->expired;
+    if (timer != NULL)
+      timer_unlink(timer);
+    wheel_unlock(wheel);
+    if (timer == NULL)
+      break;
+    /* Get the timer object and release it from the environment. */
+    lua_pushlightuserdata(L, timer);
+    lua_rawget(L, env);
+    lua_pushlightuserdata(L, timer);
+    lua_pushnil(L);
+    lua_rawset(L, env);
+    if (lua_isnil(L, -1))
+      luaL_error(L, "timer not found in the pollset of its Lua state");
+    /* Call the callback with the timer object as the only argument. */
+    lua_getfenv(L, -1);
+    lua_getfield(L, -1, "callback");
+    lua_pushnil(L);
+    lua_setfield(L, -3, "callback");
+    lua_replace(L, -2);
+    lua_insert(L, -2);
+    lua_call(L, 1, 0);
+  }
 }
 
 /* destroy_pollset() {{{2 */
@@ -81,12 +480,31 @@ static apr_pollfd_t* find_empty_fd(lua_apr_pollset_object *object)
 static apr_status_t destroy_pollset(lua_apr_pollset_object *object)
 {
   apr_status_t status = APR_SUCCESS;
+  lua_apr_timer *timer;
+  int i, j;
 
   if (object_collectable((lua_apr_refobj*)object)) {
+    /* No other references remain, so the timer wheel needs no locking. */
+    if (object->timers != NULL) {
+      /* Detach pending timers from the wheel before its memory is released. */
+      while ((timer = object->timers->expired) != NULL)
+        timer_unlink(timer);
+      for (i = 0; i < TIMER_ROOT_SIZE; i++)
+        while ((timer = object->timers->root[i]) != NULL)
+          timer_unlink(timer);
+      for (i = 0; i < TIMER_LEVELS; i++)
+        for (j = 0; j < TIMER_LEVEL_SIZE; j++)
+          while ((timer = object->timers->levels[i][j]) != NULL)
+            timer_unlink(timer);
+      object->timers = NULL;
+    }
     if (object->pollset != NULL) {
       status = apr_pollset_destroy(object->pollset);
       object->pollset = NULL;
     }
+#   if APR_HAS_THREADS
+    object->mutex = NULL;
+#   endif
     if (object->memory_pool != NULL) {
       apr_pool_destroy(object->memory_pool);
       object->memory_pool = NULL;
@@ -97,30 +515,101 @@ static apr_status_t destroy_pollset(lua_apr_pollset_object *object)
   return status;
 }
 
-/* apr.pollset(size) -> pollset {{{1
+/* apr.pollset(size [, options]) -> pollset {{{1
+ *
+ * Create a pollset object. The number @size is the maximum number of sockets,
+ * files and thread queues that the pollset can hold. On success a pollset
+ * object is returned, otherwise a nil followed by an error message is
+ * returned. Pollsets are not thread safe: When a pollset is shared between
+ * threads (see `apr.ref()`) only `pollset:wakeup()`, `pollset:timer()` and
+ * `timer:cancel()` may be used from threads other than the one that calls
+ * `pollset:poll()`. The optional table @options supports the following
+ * fields:
+ *
+ *  - `method` is one of the strings `'default'`, `'select'`, `'kqueue'`,
+ *    `'port'`, `'epoll'` or `'poll'` and selects the backend used by the
+ *    pollset. When the requested backend isn't available on the current
+ *    platform an error is returned (use `pollset:method()` to find out which
+ *    backend you got)
+ *
+ *  - `nocopy` set to true avoids copying the descriptors into the pollset,
+ *    which saves memory and time when the pollset is large
  *
- * Create a pollset object. The number @size is the maximum number of sockets
- * that the pollset can hold. On success a pollset object is returned,
- * otherwise a nil followed by an error message is returned.
+ *  - `oneshot` set to true makes one-shot registration the default for all
+ *    objects added to the pollset (see `pollset:add()`)
+ *
+ *  - `edge` is an alias for `oneshot`: APR doesn't expose edge triggered
+ *    notification so one-shot registration is the closest equivalent. It
+ *    has the same benefit that reported objects aren't reported again until
+ *    you've handled them
+ *
+ * The `method` field requires APR 1.4 or newer; on older versions it's
+ * silently ignored.
  */
 
 int lua_apr_pollset(lua_State *L)
 {
+  const char *methods[] = { "default", "select", "kqueue", "port", "epoll", "poll", NULL };
   lua_apr_pollset_object *object;
+  apr_uint32_t flags = 0;
   apr_status_t status;
-  int i, size;
+  int i, size, oneshot = 0, method = 0;
 
+# ifdef APR_POLLSET_WAKEABLE
+  flags |= APR_POLLSET_WAKEABLE;
+# endif
+
+  /* Get the arguments. */
+  lua_settop(L, 2);
   size = luaL_checkint(L, 1);
+  if (!lua_isnil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "method");
+    if (!lua_isnil(L, -1))
+      method = luaL_checkoption(L, -1, NULL, methods);
+    lua_getfield(L, 2, "nocopy");
+    if (lua_toboolean(L, -1))
+      flags |= APR_POLLSET_NOCOPY;
+    lua_getfield(L, 2, "oneshot");
+    lua_getfield(L, 2, "edge");
+    oneshot = lua_toboolean(L, -1) || lua_toboolean(L, -2);
+    lua_settop(L, 2);
+  }
+
   object = new_object(L, &lua_apr_pollset_type);
+  object->oneshot = oneshot;
   status = apr_pool_create(&object->memory_pool, NULL);
+# if APR_HAS_THREADS
+  if (status == APR_SUCCESS)
+    status = apr_thread_mutex_create(&object->mutex, APR_THREAD_MUTEX_DEFAULT, object->memory_pool);
+# endif
   if (status == APR_SUCCESS) {
-    status = apr_pollset_create(&object->pollset, size, object->memory_pool, 0);
+#   if LUA_APR_POLLSET_EX
+    if (method != 0) {
+      const apr_pollset_method_e values[] = {
+        APR_POLLSET_DEFAULT, APR_POLLSET_SELECT, APR_POLLSET_KQUEUE,
+        APR_POLLSET_PORT, APR_POLLSET_EPOLL, APR_POLLSET_POLL
+      };
+      /* Don't silently fall back to the default method. */
+      status = apr_pollset_create_ex(&object->pollset, size,
+          object->memory_pool, flags | APR_POLLSET_NODEFAULT, values[method]);
+    } else
+#   endif
+    status = apr_pollset_create(&object->pollset, size, object->memory_pool, flags);
     if (status == APR_SUCCESS) {
       object->fds = apr_pcalloc(object->memory_pool, sizeof object->fds[0] * size);
+      object->modes = apr_pcalloc(object->memory_pool, size);
+      object->free_slots = apr_palloc(object->memory_pool, sizeof object->free_slots[0] * size);
+      object->index = apr_hash_make(object->memory_pool);
+      if (object->fds == NULL || object->modes == NULL || object->free_slots == NULL || object->index == NULL)
+        raise_error_memory(L);
       object->size = size;
       /* Unused descriptors are marked with APR_NO_DESC. */
-      for (i = 0; i < size; i++)
+      for (i = 0; i < size; i++) {
         object->fds[i].desc_type = APR_NO_DESC;
+        object->free_slots[i] = size - i - 1;
+      }
+      object->num_free = size;
       /* Return the new userdata. */
       return 1;
     }
@@ -130,49 +619,70 @@ int lua_apr_pollset(lua_State *L)
   return push_error_status(L, status);
 }
 
-/* pollset:add(socket, flag [, ...]) -> status {{{1
+/* pollset:add(object, flag [, ...]) -> status {{{1
  *
- * Add a network socket to the pollset. On success true is returned, otherwise
- * a nil followed by an error message is returned. One or two of the following
+ * Add a network socket, a file (pipe), a thread queue, a resolver or a
+ * password validator to the pollset. On success true is returned, otherwise a
+ * nil followed by an error message is returned. One or two of the following
  * flags should be provided:
  *
- *  - `'input'` indicates that the socket can be read without blocking
- *  - `'output'` indicates that the socket can be written without blocking
+ *  - `'input'` indicates that the object can be read without blocking
+ *  - `'output'` indicates that the object can be written without blocking
+ *
+ * The flag `'oneshot'` can be added to register the object as one-shot: After
+ * the object has been reported by `pollset:poll()` it's disarmed (it stays in
+ * the pollset but isn't watched) until `pollset:rearm()` is called. This is
+ * the default for pollsets created with the `oneshot` or `edge` option.
  *
- * If the socket is already in the pollset the flags of the existing entry in
- * the pollset will be combined with the new flags. If you want to *change* a
- * socket from readable to writable or the other way around, you have to first
- * remove the socket from the pollset and then add it back with the new flag.
+ * If the object is already in the pollset the flags of the existing entry in
+ * the pollset will be combined with the new flags. If you want to *change* an
+ * object from readable to writable or the other way around, you have to first
+ * remove the object from the pollset and then add it back with the new flag.
+ *
+ * Thread queues can only be polled for `'input'`: A queue is reported as
+ * readable after a value has been pushed onto it (from any thread). Each time
+ * a queue is reported as readable you should call `queue:trypop()` until it
+ * returns the error code `'EAGAIN'`, otherwise you may miss values that were
+ * pushed while you were handling the previous ones. Resolvers created with
+ * `apr.resolver()` can also only be polled for `'input'`: A resolver is
+ * reported as readable when `resolver:results()` has something to return.
+ * The same goes for password validators and `validator:results()`.
  */
 
 static int pollset_add(lua_State *L)
 {
-  const char *options[] = { "input", "output", NULL }; 
-  const apr_int32_t values[] = { APR_POLLIN, APR_POLLOUT };
+  const char *options[] = { "input", "output", "oneshot", NULL };
+  const apr_int32_t values[] = { APR_POLLIN, APR_POLLOUT, 0 };
 
   lua_apr_pollset_object *object;
-  apr_int16_t reqevents;
-  lua_apr_socket *socket;
-  apr_pollfd_t *fd;
+  apr_int16_t reqevents = 0;
+  apr_pollfd_t *fd, desc;
   apr_status_t status;
-
-  /* pollset, socket, flag1 [, flag2] */
-  lua_settop(L, 4);
+  unsigned char *mode;
+  void *client_data;
+  int i, option, top, oneshot;
 
   /* Get the object arguments. */
+  top = lua_gettop(L);
   object = check_pollset(L, 1, 1);
-  socket = check_socket(L, 2);
+  client_data = check_pollable(L, 2, &desc, object->memory_pool);
 
   /* Check the requested event type(s). */
-  reqevents = values[luaL_checkoption(L, 3, NULL, options)];
-  if (!lua_isnil(L, 4))
-    reqevents |= values[luaL_checkoption(L, 4, NULL, options)];
+  oneshot = object->oneshot;
+  luaL_checkstring(L, 3);
+  for (i = 3; i <= top; i++) {
+    option = luaL_checkoption(L, i, NULL, options);
+    reqevents |= values[option];
+    if (values[option] == 0)
+      oneshot = 1;
+  }
+  luaL_argcheck(L, reqevents != 0, 3, "'input' or 'output' expected");
 
   /* Get the private environment of the pollset. */
   object_env_private(L, 1);
 
-  /* Check if the socket is already in the pollset. */
-  fd = find_fd_by_socket(object, socket);
+  /* Check if the object is already in the pollset. */
+  fd = find_fd_by_object(object, client_data);
   if (fd != NULL) {
     /* XXX I couldn't find any documentation on having a socket that is both
      * readable and writable in the file descriptor array, and I also don't
@@ -180,8 +690,17 @@ static int pollset_add(lua_State *L)
      * that is already in the pollset. I assume that removing the socket,
      * OR'ing the flags and adding it back in will work. */
     status = APR_SUCCESS;
-    /* If the flags haven't changed we don't have to do anything :-) */
-    if ((fd->reqevents & reqevents) != reqevents) {
+    mode = &object->modes[fd - object->fds];
+    if (oneshot)
+      *mode |= POLLFD_ONESHOT;
+    if (*mode & POLLFD_DISARMED) {
+      /* Adding a disarmed object rearms it. */
+      fd->reqevents |= reqevents;
+      status = apr_pollset_add(object->pollset, fd);
+      if (status == APR_SUCCESS)
+        *mode &= ~POLLFD_DISARMED;
+    } else if ((fd->reqevents & reqevents) != reqevents) {
+      /* If the flags haven't changed we don't have to do anything :-) */
       status = apr_pollset_remove(object->pollset, fd);
       if (status == APR_SUCCESS) {
         fd->reqevents |= reqevents;
@@ -189,26 +708,31 @@ static int pollset_add(lua_State *L)
       }
     }
   } else {
-    /* Try to add the socket to the pollset. */
+    /* Try to add the object to the pollset. */
     fd = find_empty_fd(object);
     if (fd == NULL) {
       status = APR_ENOMEM;
     } else {
-      fd->p = socket->pool;
-      fd->desc_type = APR_POLL_SOCKET;
+      fd->p = desc.p;
+      fd->desc_type = desc.desc_type;
       fd->reqevents = reqevents;
       fd->rtnevents = 0;
-      fd->desc.s = socket->handle;
-      fd->client_data = socket;
+      fd->desc = desc.desc;
+      fd->client_data = client_data;
       /* Add the file descriptor to the pollset. */
       status = apr_pollset_add(object->pollset, fd);
       if (status == APR_SUCCESS) {
-        /* Add the socket to the environment table of the pollset so that the
-         * socket doesn't get garbage collected as long as it's contained in
+        apr_hash_set(object->index, &fd->client_data, sizeof fd->client_data, fd);
+        object->modes[fd - object->fds] = oneshot ? POLLFD_ONESHOT : 0;
+        /* Add the object to the environment table of the pollset so that the
+         * object doesn't get garbage collected as long as it's contained in
          * the pollset. */
-        lua_pushlightuserdata(L, socket);
+        lua_pushlightuserdata(L, client_data);
         lua_pushvalue(L, 2);
-        lua_rawset(L, 5);
+        lua_rawset(L, top + 1);
+      } else {
+        /* Don't leave a half initialized entry behind. */
+        release_fd(object, fd);
       }
     }
   }
@@ -216,31 +740,32 @@ static int pollset_add(lua_State *L)
   return push_status(L, status);
 }
 
-/* pollset:remove(socket) -> status {{{1
+/* pollset:remove(object) -> status {{{1
  *
- * Remove a @socket from the pollset. On success true is returned, otherwise a
- * nil followed by an error message is returned. It is not an error if the
- * socket is not contained in the pollset.
+ * Remove a socket, file or thread queue from the pollset. On success true is
+ * returned, otherwise a nil followed by an error message is returned. It is
+ * not an error if the object is not contained in the pollset.
  */
 
 static int pollset_remove(lua_State *L)
 {
-  lua_apr_pollset_object *object = APR_SUCCESS;
-  lua_apr_socket *socket;
+  lua_apr_pollset_object *object;
+  apr_status_t status = APR_SUCCESS;
   apr_pollfd_t *fd;
-  apr_status_t status;
+  void *client_data;
 
   object = check_pollset(L, 1, 1);
-  socket = check_socket(L, 2);
-  fd = find_fd_by_socket(object, socket);
+  client_data = check_pollable(L, 2, NULL, NULL);
+  fd = find_fd_by_object(object, client_data);
   if (fd != NULL) {
-    /* Remove it from the pollset. */
-    status = apr_pollset_remove(object->pollset, fd);
+    /* Remove it from the pollset (disarmed objects already are). */
+    if (!(object->modes[fd - object->fds] & POLLFD_DISARMED))
+      status = apr_pollset_remove(object->pollset, fd);
     /* Remove it from our file descriptor array. */
-    fd->desc_type = APR_NO_DESC;
+    release_fd(object, fd);
     /* Remove it from the environment. */
     object_env_private(L, 1);
-    lua_pushlightuserdata(L, socket);
+    lua_pushlightuserdata(L, client_data);
     lua_pushnil(L);
     lua_rawset(L, -3);
   }
@@ -248,22 +773,67 @@ static int pollset_remove(lua_State *L)
   return push_status(L, status);
 }
 
+/* pollset:rearm(object) -> status {{{1
+ *
+ * Start watching a one-shot @object again after it has been reported by
+ * `pollset:poll()`, using the flags it was added with. On success true is
+ * returned, otherwise a nil followed by an error message is returned. It's
+ * not an error to rearm an object that's still armed.
+ */
+
+static int pollset_rearm(lua_State *L)
+{
+  lua_apr_pollset_object *object;
+  apr_status_t status = APR_SUCCESS;
+  void *client_data;
+  apr_pollfd_t *fd;
+  unsigned char *mode;
+
+  object = check_pollset(L, 1, 1);
+  client_data = check_pollable(L, 2, NULL, NULL);
+  fd = find_fd_by_object(object, client_data);
+  if (fd == NULL) {
+    status = APR_NOTFOUND;
+  } else {
+    mode = &object->modes[fd - object->fds];
+    if (*mode & POLLFD_DISARMED) {
+      status = apr_pollset_add(object->pollset, fd);
+      if (status == APR_SUCCESS)
+        *mode &= ~POLLFD_DISARMED;
+    }
+  }
+
+  return push_status(L, status);
+}
+
 /* pollset:poll(timeout) -> readable, writable {{{1
  *
  * Block for activity on the descriptor(s) in a pollset. The @timeout argument
  * gives the amount of time in microseconds to wait. This is a maximum, not a
  * minimum.  If a descriptor is signaled, we will wake up before this time. A
  * negative number means wait until a descriptor is signaled. On success a
- * table with sockets waiting to be read followed by a table with sockets
+ * table with objects waiting to be read followed by a table with objects
  * waiting to be written is returned, otherwise a nil followed by an error
  * message is returned.
+ *
+ * When timers created with `pollset:timer()` are pending, the timeout is
+ * automatically shortened so that the call returns when the first timer
+ * expires. The callbacks of expired timers are called just before
+ * `pollset:poll()` returns. When the poll is interrupted by
+ * `pollset:wakeup()` or by a timer, two empty tables are returned.
+ *
+ * Objects whose other end has been closed (or that are in an error state) are
+ * included in the table of readable objects, so that reading from them returns
+ * the end of file or error condition.
  */
 
 static int pollset_poll(lua_State *L)
 {
   lua_apr_pollset_object *object;
-  apr_interval_time_t timeout;
+  lua_apr_timer_wheel *wheel;
+  apr_interval_time_t timeout, wait;
   const apr_pollfd_t *fds;
+  apr_pollfd_t *fd;
   apr_status_t status;
   apr_int32_t num_fds;
   int i;
@@ -274,35 +844,279 @@ static int pollset_poll(lua_State *L)
   timeout = luaL_checkint(L, 2);
   object_env_private(L, 1); /* environment @ 3 */
 
-  /* Poll the sockets. */
-  status = apr_pollset_poll(object->pollset, timeout, &num_fds, &fds);
+  /* Poll the sockets (no longer than the first pending timer). */
+  wheel = owned_timers(L, object);
+  if (wheel != NULL) {
+    wheel_lock(wheel);
+    wait = timer_timeout(wheel, timeout);
+    wheel_unlock(wheel);
+  } else
+    wait = timeout;
+  status = apr_pollset_poll(object->pollset, wait, &num_fds, &fds);
+  if (APR_STATUS_IS_EINTR(status) || (APR_STATUS_IS_TIMEUP(status) && wait != timeout)) {
+    /* Woken up by pollset:wakeup() or by a timer. */
+    status = APR_SUCCESS;
+    num_fds = 0;
+  }
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
 
-
   /* Create tables to hold the readable/writable sockets. */
   lua_newtable(L); /* readable @ 4 */
   lua_newtable(L); /* writable @ 5 */
 
   for (i = 0; i < num_fds; i++) {
-    /* Find the userdata associated with the socket. */
+    /* Disarm one-shot descriptors. */
+    fd = find_fd_by_object(object, fds[i].client_data);
+    if (fd != NULL && object->modes[fd - object->fds] == POLLFD_ONESHOT) {
+      if (apr_pollset_remove(object->pollset, fd) == APR_SUCCESS)
+        object->modes[fd - object->fds] |= POLLFD_DISARMED;
+    }
+    /* Find the userdata associated with the descriptor. */
     lua_pushlightuserdata(L, fds[i].client_data);
     lua_rawget(L, 3);
-    /* Add the socket to the readable list? */
-    if (fds[i].rtnevents & APR_POLLIN) {
+    /* Add the object to the readable list? */
+    if (fds[i].rtnevents & (APR_POLLIN | APR_POLLHUP | APR_POLLERR)) {
+#     if APR_HAS_THREADS
+      /* Consume the pending wakeups of thread queues. */
+      if (object_has_type(L, -1, &lua_apr_queue_type, 1))
+        queue_signal_drain(L, lua_gettop(L));
+#     endif
       lua_pushvalue(L, -1);
       lua_rawseti(L, 4, lua_objlen(L, 4) + 1);
     }
-    /* Add the socket to the writable list? */
+    /* Add the object to the writable list? */
     if (fds[i].rtnevents & APR_POLLOUT) {
       lua_rawseti(L, 5, lua_objlen(L, 5) + 1);
     } else
       lua_pop(L, 1);
   }
 
+  /* Call the callbacks of expired timers. */
+  timers_run(L, object, 3);
+
   return 2;
 }
 
+/* pollset:method() -> name {{{1
+ *
+ * Get the name of the backend used by the pollset, for example `'epoll'`,
+ * `'kqueue'` or `'poll'`. Requires APR 1.4 or newer; on older versions an
+ * error is returned.
+ */
+
+static int pollset_method(lua_State *L)
+{
+  lua_apr_pollset_object *object;
+
+  object = check_pollset(L, 1, 1);
+# if LUA_APR_POLLSET_EX
+  lua_pushstring(L, apr_pollset_method_name(object->pollset));
+  return 1;
+# else
+  return push_error_status(L, APR_ENOTIMPL);
+# endif
+}
+
+/* pollset:wakeup() -> status {{{1
+ *
+ * Interrupt a blocking call to `pollset:poll()`, causing it to return two
+ * empty tables. On success true is returned, otherwise a nil followed by an
+ * error message is returned. This method is intended to be called from
+ * another thread: Pass the pollset to the other thread (this uses `apr.ref()`
+ * and `apr.deref()` under the hood) and call `pollset:wakeup()` there:
+ *
+ *     local pollset = assert(apr.pollset(10))
+ *     local thread = assert(apr.thread(function()
+ *       -- ... prepare some work ...
+ *       assert(pollset:wakeup())
+ *     end))
+ *     local readable, writable = assert(pollset:poll(-1))
+ *
+ * This requires APR 1.4 or newer; on older versions an error is returned.
+ */
+
+static int pollset_wakeup(lua_State *L)
+{
+  lua_apr_pollset_object *object;
+  apr_status_t status;
+
+  object = check_pollset(L, 1, 1);
+# ifdef APR_POLLSET_WAKEABLE
+  status = apr_pollset_wakeup(object->pollset);
+# else
+  status = APR_ENOTIMPL;
+# endif
+
+  return push_status(L, status);
+}
+
+/* pollset:timer(after, callback) -> timer {{{1
+ *
+ * Schedule the function @callback to be called from `pollset:poll()` after
+ * @after microseconds have passed (just like the timeout of `pollset:poll()`
+ * the delay is given in microseconds, the timer resolution is one
+ * millisecond). The callback receives the timer object as its only argument.
+ * Returns a timer object which can be used to cancel the timer using
+ * `timer:cancel()`. To create a repeating timer, call `pollset:timer()` again
+ * from the callback.
+ *
+ * Timers are managed by a hierarchical timer wheel, so scheduling and
+ * canceling timers takes constant time regardless of the number of pending
+ * timers. You don't need to keep a reference to the timer object, the pollset
+ * does that until the timer fires or is canceled.
+ *
+ * The callbacks are called by `pollset:poll()` in the Lua state that created
+ * the timers, so while timers are pending, a pollset shared with other
+ * threads (see `apr.ref()`) only accepts new timers from that Lua state;
+ * other Lua states get an error.
+ */
+
+static int pollset_timer(lua_State *L)
+{
+  lua_apr_pollset_object *object;
+  lua_apr_timer_wheel *wheel;
+  apr_interval_time_t after;
+  lua_apr_timer *timer;
+  apr_time_t now;
+
+  lua_settop(L, 3);
+  object = check_pollset(L, 1, 1);
+  after = (apr_interval_time_t) luaL_checknumber(L, 2);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  if (after < 0)
+    after = 0;
+
+  /* Create the timer object (at stack index 4). */
+  timer = new_object(L, &lua_apr_timer_type);
+
+  /* Allocate the timer wheel on first use (the pollset may be shared). */
+  now = apr_time_now();
+# if APR_HAS_THREADS
+  apr_thread_mutex_lock(object->mutex);
+# endif
+  wheel = object->timers;
+  if (wheel == NULL) {
+    wheel = apr_pcalloc(object->memory_pool, sizeof *wheel);
+    wheel->epoch = now;
+    wheel->owner = timer_owner(L);
+#   if APR_HAS_THREADS
+    wheel->mutex = object->mutex;
+#   endif
+    object->timers = wheel;
+  }
+
+  /* An idle wheel can be taken over by another Lua state. */
+  if (wheel->owner != timer_owner(L) && wheel->pending == 0 && wheel->expired == NULL)
+    wheel->owner = timer_owner(L);
+  if (wheel->owner != timer_owner(L)) {
+    wheel_unlock(wheel);
+    luaL_error(L, "attempt to add a timer to a pollset whose timers belong to another Lua state");
+  }
+  timer->wheel = wheel;
+  /* Round up so that timers never fire early. */
+  timer->expires = (now + after - wheel->epoch + 999) / 1000;
+  timer_advance(wheel, (now - wheel->epoch) / 1000);
+  timer_schedule(wheel, timer);
+  wheel->pending++;
+  wheel_unlock(wheel);
+
+  /* Store the callback and pollset in the environment of the timer. */
+  object_env_private(L, 4);
+  lua_pushvalue(L, 3);
+  lua_setfield(L, -2, "callback");
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "pollset");
+  lua_pop(L, 1);
+
+  /* Keep the timer alive until it fires or is canceled. */
+  object_env_private(L, 1);
+  lua_pushlightuserdata(L, timer);
+  lua_pushvalue(L, 4);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* timer:cancel() -> status {{{1
+ *
+ * Cancel a timer created with `pollset:timer()`. Returns true when the timer
+ * was pending, false when it already fired or was already canceled.
+ */
+
+static int timer_cancel(lua_State *L)
+{
+  lua_apr_timer_wheel *wheel;
+  lua_apr_timer *timer;
+  int pending = 0;
+
+  timer = check_object(L, 1, &lua_apr_timer_type);
+  wheel = timer->wheel;
+  if (wheel != NULL) {
+    wheel_lock(wheel);
+    /* Check again now that the timer can't fire. */
+    pending = timer->wheel != NULL;
+    if (pending)
+      timer_unlink(timer);
+    wheel_unlock(wheel);
+  }
+  if (!pending) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  /* Release the timer and callback from the pollset's environment. */
+  object_env_private(L, 1);
+  lua_getfield(L, -1, "pollset");
+  lua_pushnil(L);
+  lua_setfield(L, -3, "callback");
+  if (object_has_type(L, -1, &lua_apr_pollset_type, 1)) {
+    object_env_private(L, lua_gettop(L));
+    lua_pushlightuserdata(L, timer);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+  }
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* timer:__tostring() {{{1 */
+
+static int timer_tostring(lua_State *L)
+{
+  lua_apr_timer *timer;
+
+  timer = check_object(L, 1, &lua_apr_timer_type);
+  if (timer->wheel != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_timer_type.friendlyname, timer);
+  else
+    lua_pushfstring(L, "%s (inactive)", lua_apr_timer_type.friendlyname);
+
+  return 1;
+}
+
+/* timer:__gc() {{{1 */
+
+static int timer_gc(lua_State *L)
+{
+  lua_apr_timer_wheel *wheel;
+  lua_apr_timer *timer;
+
+  timer = check_object(L, 1, &lua_apr_timer_type);
+  wheel = timer->wheel;
+  if (object_collectable((lua_apr_refobj*)timer) && wheel != NULL) {
+    wheel_lock(wheel);
+    if (timer->wheel != NULL)
+      timer_unlink(timer);
+    wheel_unlock(wheel);
+  }
+  release_object((lua_apr_refobj*)timer);
+
+  return 0;
+}
+
 /* pollset:destroy() -> status {{{1
  *
  * Destroy a pollset. On success true is returned, otherwise a nil followed by
@@ -353,7 +1167,11 @@ static int pollset_gc(lua_State *L)
 static luaL_reg pollset_methods[] = {
   { "add", pollset_add },
   { "remove", pollset_remove },
+  { "rearm", pollset_rearm },
   { "poll", pollset_poll },
+  { "method", pollset_method },
+  { "wakeup", pollset_wakeup },
+  { "timer", pollset_timer },
   { "destroy", pollset_destroy },
   { NULL, NULL }
 };
@@ -372,4 +1190,25 @@ lua_apr_objtype lua_apr_pollset_type = {
   pollset_metamethods             /* metamethods table          */
 };
 
+static luaL_reg timer_methods[] = {
+  { "cancel", timer_cancel },
+  { NULL, NULL }
+};
+
+static luaL_reg timer_metamethods[] = {
+  { "__tostring", timer_tostring },
+  { "__gc", timer_gc },
+  { NULL, NULL }
+};
+
+/* Timers are deliberately left out of lua_apr_types[] because they're linked
+ * into the timer wheel by address and so can't be moved by apr.ref(). */
+static lua_apr_objtype lua_apr_timer_type = {
+  "lua_apr_timer*",               /* metatable name in registry */
+  "timer",                        /* friendly object name       */
+  sizeof(lua_apr_timer),          /* structure size             */
+  timer_methods,                  /* methods table              */
+  timer_metamethods               /* metamethods table          */
+};
+
 /* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
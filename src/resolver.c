@@ -0,0 +1,726 @@
+/* DNS resolver module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Resolving host names can take anywhere from microseconds to several
+ * seconds, depending on the system resolver and the network. To avoid paying
+ * this price over and over again the Lua/APR binding keeps the results of
+ * forward lookups in a cache that's shared by all threads. The cache is used
+ * by `apr.host_to_addr()`, `socket:connect()` and connection pools. Because
+ * APR doesn't expose the time to live of DNS records the cache uses a fixed
+ * time to live which you can change using `apr.dns_cache()`.
+ *
+ * Even a cached resolver blocks the first time it sees a host name. Programs
+ * that multiplex many sockets using a pollset can use `apr.resolver()` to
+ * perform lookups on a helper thread and get notified through the pollset
+ * when the results are available:
+ *
+ *     local resolver = assert(apr.resolver())
+ *     local pollset = assert(apr.pollset(10))
+ *     assert(pollset:add(resolver, 'input'))
+ *     assert(resolver:lookup 'www.lua.org')
+ *     pollset:poll(-1)
+ *     for _, result in ipairs(resolver:results()) do
+ *       print(result.host, unpack(result.addresses))
+ *     end
+ *
+ * The coroutine scheduler created by `apr.loop()` uses a resolver so that
+ * `socket:connect()` never blocks the loop on DNS lookups.
+ */
+
+#include "lua_apr.h"
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_proc.h>
+#include <apr_portable.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Default time to live of cached host names (in seconds). */
+#define DNS_CACHE_TTL 60
+
+/* Default maximum number of cached host names. */
+#define DNS_CACHE_SIZE 256
+
+/* Internal functions {{{1 */
+
+/* Cached forward lookup. The IP addresses are stored as a single string of
+ * space separated addresses so that copying them out of the cache is cheap. */
+typedef struct dns_entry {
+  struct dns_entry *prev, *next; /* least recently used list */
+  apr_time_t expires;
+  char *addresses;
+  char host[1];
+} dns_entry;
+
+static struct {
+  apr_hash_t *index;             /* host name -> dns_entry */
+  dns_entry *head, *tail;        /* most and least recently used entries */
+  int count, size;
+  apr_interval_time_t ttl;
+  lua_Number hits, misses;
+} dns_cache = { NULL, NULL, NULL, 0, DNS_CACHE_SIZE, apr_time_from_sec(DNS_CACHE_TTL), 0, 0 };
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *dns_cache_mutex = NULL;
+# define dns_cache_lock() do { \
+  if (dns_cache_mutex != NULL) apr_thread_mutex_lock(dns_cache_mutex); } while (0)
+# define dns_cache_unlock() do { \
+  if (dns_cache_mutex != NULL) apr_thread_mutex_unlock(dns_cache_mutex); } while (0)
+#else
+# define dns_cache_lock() ((void)0)
+# define dns_cache_unlock() ((void)0)
+#endif
+
+/* dns_cache_init() -- initialize the cache of resolved host names {{{2 */
+
+apr_status_t dns_cache_init(apr_pool_t *pool)
+{
+  dns_cache.index = apr_hash_make(pool);
+# if APR_HAS_THREADS
+  return apr_thread_mutex_create(&dns_cache_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+# else
+  return APR_SUCCESS;
+# endif
+}
+
+/* dns_cache_unlink() -- remove an entry from the LRU list {{{2 */
+
+static void dns_cache_unlink(dns_entry *entry)
+{
+  if (entry->prev != NULL)
+    entry->prev->next = entry->next;
+  else
+    dns_cache.head = entry->next;
+  if (entry->next != NULL)
+    entry->next->prev = entry->prev;
+  else
+    dns_cache.tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+/* dns_cache_push() -- make an entry the most recently used one {{{2 */
+
+static void dns_cache_push(dns_entry *entry)
+{
+  entry->prev = NULL;
+  entry->next = dns_cache.head;
+  if (dns_cache.head != NULL)
+    dns_cache.head->prev = entry;
+  dns_cache.head = entry;
+  if (dns_cache.tail == NULL)
+    dns_cache.tail = entry;
+}
+
+/* dns_cache_remove() -- remove and free an entry (cache must be locked) {{{2 */
+
+static void dns_cache_remove(dns_entry *entry)
+{
+  dns_cache_unlink(entry);
+  apr_hash_set(dns_cache.index, entry->host, APR_HASH_KEY_STRING, NULL);
+  dns_cache.count--;
+  free(entry);
+}
+
+/* dns_cache_evict() -- shrink the cache to its maximum size (cache must be locked) {{{2 */
+
+static void dns_cache_evict(int size)
+{
+  while (dns_cache.count > size && dns_cache.tail != NULL)
+    dns_cache_remove(dns_cache.tail);
+}
+
+/* dns_cache_get() -- get the cached addresses of a host name {{{2
+ *
+ * Returns APR_NOTFOUND when @host isn't cached or its entry has expired.
+ */
+
+static apr_status_t dns_cache_get(const char *host, apr_pool_t *pool, char **addresses)
+{
+  apr_status_t status = APR_NOTFOUND;
+  dns_entry *entry;
+
+  dns_cache_lock();
+  entry = dns_cache.index != NULL ? apr_hash_get(dns_cache.index, host, APR_HASH_KEY_STRING) : NULL;
+  if (entry != NULL && entry->expires < apr_time_now()) {
+    dns_cache_remove(entry);
+    entry = NULL;
+  }
+  if (entry != NULL) {
+    *addresses = apr_pstrdup(pool, entry->addresses);
+    dns_cache_unlink(entry);
+    dns_cache_push(entry);
+    dns_cache.hits++;
+    status = APR_SUCCESS;
+  } else
+    dns_cache.misses++;
+  dns_cache_unlock();
+
+  return status;
+}
+
+/* dns_cache_put() -- add the addresses of a host name to the cache {{{2 */
+
+static void dns_cache_put(const char *host, const char *addresses)
+{
+  size_t hostlen = strlen(host), addrlen = strlen(addresses);
+  dns_entry *entry;
+
+  dns_cache_lock();
+  if (dns_cache.index != NULL && dns_cache.size > 0 && dns_cache.ttl > 0) {
+    /* Another thread may have resolved the same host name in the meantime. */
+    entry = apr_hash_get(dns_cache.index, host, APR_HASH_KEY_STRING);
+    if (entry != NULL)
+      dns_cache_remove(entry);
+    entry = malloc(sizeof *entry + hostlen + addrlen + 1);
+    if (entry != NULL) {
+      memcpy(entry->host, host, hostlen + 1);
+      entry->addresses = entry->host + hostlen + 1;
+      memcpy(entry->addresses, addresses, addrlen + 1);
+      entry->expires = apr_time_now() + dns_cache.ttl;
+      dns_cache_push(entry);
+      apr_hash_set(dns_cache.index, entry->host, APR_HASH_KEY_STRING, entry);
+      dns_cache.count++;
+      dns_cache_evict(dns_cache.size);
+    }
+  }
+  dns_cache_unlock();
+}
+
+/* address_family() -- get the address family of a numeric IP address {{{2 */
+
+static int address_family(const char *address, size_t length)
+{
+  return memchr(address, ':', length) != NULL ? APR_INET6 : APR_INET;
+}
+
+/* is_numeric() -- check whether a host name is a numeric IP address {{{2 */
+
+static int is_numeric(const char *host)
+{
+  return strchr(host, ':') != NULL || host[strspn(host, "0123456789.")] == '\0';
+}
+
+/* dns_resolve_all() -- resolve a host name to a list of IP addresses {{{2
+ *
+ * On success *@addresses is set to a string of space separated IP addresses
+ * (of any address family) allocated from @pool. The cache is consulted first
+ * and updated after a successful lookup.
+ */
+
+apr_status_t dns_resolve_all(const char *host, apr_pool_t *pool, char **addresses)
+{
+  apr_sockaddr_t *address;
+  apr_status_t status;
+  char *list = NULL, *ip_address;
+  int numeric = is_numeric(host);
+
+  if (!numeric && dns_cache_get(host, pool, addresses) == APR_SUCCESS)
+    return APR_SUCCESS;
+
+  status = apr_sockaddr_info_get(&address, host, APR_UNSPEC, 0, 0, pool);
+  for (; status == APR_SUCCESS && address != NULL; address = address->next) {
+    status = apr_sockaddr_ip_get(&ip_address, address);
+    if (status == APR_SUCCESS)
+      list = list == NULL ? ip_address : apr_pstrcat(pool, list, " ", ip_address, NULL);
+  }
+  if (status != APR_SUCCESS)
+    return status;
+  if (list == NULL)
+    return APR_EINVAL;
+
+  /* Numeric addresses resolve instantly, don't pollute the cache with them. */
+  if (!numeric)
+    dns_cache_put(host, list);
+  *addresses = list;
+
+  return APR_SUCCESS;
+}
+
+/* dns_resolve() -- resolve a host name to a socket address {{{2
+ *
+ * Drop-in replacement for apr_sockaddr_info_get() that uses the cache of
+ * resolved host names. The result is the first address of the requested
+ * @family (any family when @family is APR_UNSPEC).
+ */
+
+apr_status_t dns_resolve(apr_sockaddr_t **result, const char *host, int family, apr_port_t port, apr_pool_t *pool)
+{
+  char *addresses, *address;
+  size_t length;
+
+  if (host != NULL && !is_numeric(host)
+      && dns_resolve_all(host, pool, &addresses) == APR_SUCCESS) {
+    for (address = addresses; *address != '\0'; address += length) {
+      address += strspn(address, " ");
+      length = strcspn(address, " ");
+      if (length > 0 && (family == APR_UNSPEC || family == address_family(address, length))) {
+        address[length] = '\0';
+        return apr_sockaddr_info_get(result, address, family, port, 0, pool);
+      }
+    }
+  }
+
+  /* Numeric address, no address of the requested family or failed lookup. */
+  return apr_sockaddr_info_get(result, host, family, port, 0, pool);
+}
+
+/* push_addresses() -- push the IP addresses of the given family {{{2 */
+
+int push_addresses(lua_State *L, const char *addresses, int family)
+{
+  const char *address;
+  size_t length;
+  int count = 0;
+
+  for (address = addresses; *address != '\0'; address += length) {
+    address += strspn(address, " ");
+    length = strcspn(address, " ");
+    if (length > 0 && (family == APR_UNSPEC || family == address_family(address, length))) {
+      lua_pushlstring(L, address, length);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/* apr.dns_cache([options]) -> statistics {{{1
+ *
+ * Configure the cache of resolved host names and get statistics about it. The
+ * optional table @options supports the following fields:
+ *
+ *  - `ttl` is the number of seconds that host names are cached (defaults to
+ *    60, zero disables the cache)
+ *  - `size` is the maximum number of cached host names (defaults to 256);
+ *    when the cache is full the least recently used host name is forgotten
+ *  - `flush` can be set to true to forget all cached host names
+ *
+ * The return value is a table with the fields `ttl`, `size`, `entries` (the
+ * number of cached host names), `hits` and `misses`. The cache is shared by
+ * all threads, so changing it affects all Lua states in the process.
+ */
+
+int lua_apr_dns_cache(lua_State *L)
+{
+  lua_Number ttl = -1;
+  int size = -1, flush = 0;
+
+  lua_settop(L, 1);
+  if (!lua_isnil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "ttl");
+    if (!lua_isnil(L, -1)) {
+      ttl = luaL_checknumber(L, -1);
+      luaL_argcheck(L, ttl >= 0, 1, "ttl must not be negative");
+    }
+    lua_getfield(L, 1, "size");
+    if (!lua_isnil(L, -1)) {
+      size = luaL_checkint(L, -1);
+      luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+    }
+    lua_getfield(L, 1, "flush");
+    flush = lua_toboolean(L, -1);
+    lua_settop(L, 1);
+  }
+
+  lua_createtable(L, 0, 5);
+  dns_cache_lock();
+  if (ttl >= 0)
+    dns_cache.ttl = (apr_interval_time_t) (ttl * APR_USEC_PER_SEC);
+  if (size >= 0)
+    dns_cache.size = size;
+  dns_cache_evict(flush || dns_cache.ttl == 0 ? 0 : dns_cache.size);
+  lua_pushnumber(L, (lua_Number) dns_cache.ttl / APR_USEC_PER_SEC);
+  lua_setfield(L, -2, "ttl");
+  lua_pushinteger(L, dns_cache.size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, dns_cache.count);
+  lua_setfield(L, -2, "entries");
+  lua_pushnumber(L, dns_cache.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, dns_cache.misses);
+  lua_setfield(L, -2, "misses");
+  dns_cache_unlock();
+
+  return 1;
+}
+
+#if APR_HAS_THREADS
+
+#define check_resolver(L, idx) \
+  ((lua_apr_resolver_object*)check_object((L), (idx), &lua_apr_resolver_type))
+
+/* Queued or completed lookup (allocated using malloc() because requests are
+ * created by one thread and freed by another). */
+typedef struct dns_request {
+  struct dns_request *next;
+  int id, family;
+  apr_status_t status;
+  char *addresses;
+  char host[1];
+} dns_request;
+
+/* State shared by the resolver object and its helper thread. */
+typedef struct {
+  apr_pool_t *memory_pool;
+  apr_thread_mutex_t *mutex;     /* protects the fields below */
+  apr_thread_cond_t *cond;       /* signals new requests to the helper thread */
+  apr_thread_t *thread;
+  apr_file_t *signal_in, *signal_out;
+  dns_request *pending, *pending_tail;
+  dns_request *done, *done_tail;
+  int next_id, shutdown;
+} resolver_state;
+
+/* Structure for resolver objects. */
+typedef struct {
+  lua_apr_refobj header;
+  resolver_state *state;
+} lua_apr_resolver_object;
+
+/* free_requests() {{{2 */
+
+static void free_requests(dns_request *request)
+{
+  dns_request *next;
+
+  for (; request != NULL; request = next) {
+    next = request->next;
+    free(request->addresses);
+    free(request);
+  }
+}
+
+/* resolver_worker() -- the helper thread that performs lookups {{{2 */
+
+static void* APR_THREAD_FUNC resolver_worker(apr_thread_t *thread, void *data)
+{
+  resolver_state *state = data;
+  dns_request *request;
+  apr_pool_t *pool;
+  apr_size_t len;
+  char *addresses;
+
+  apr_thread_mutex_lock(state->mutex);
+  for (;;) {
+    while (state->pending == NULL && !state->shutdown)
+      apr_thread_cond_wait(state->cond, state->mutex);
+    if (state->shutdown)
+      break;
+    request = state->pending;
+    state->pending = request->next;
+    if (state->pending == NULL)
+      state->pending_tail = NULL;
+    apr_thread_mutex_unlock(state->mutex);
+
+    request->next = NULL;
+    request->status = apr_pool_create(&pool, NULL);
+    if (request->status == APR_SUCCESS) {
+      request->status = dns_resolve_all(request->host, pool, &addresses);
+      if (request->status == APR_SUCCESS) {
+        request->addresses = strdup(addresses);
+        if (request->addresses == NULL)
+          request->status = APR_ENOMEM;
+      }
+      apr_pool_destroy(pool);
+    }
+
+    apr_thread_mutex_lock(state->mutex);
+    if (state->done_tail != NULL)
+      state->done_tail->next = request;
+    else
+      state->done = request;
+    state->done_tail = request;
+    /* Wake up the pollset (the pipe is non-blocking so this never stalls). */
+    len = 1;
+    apr_file_write(state->signal_out, "", &len);
+  }
+  apr_thread_mutex_unlock(state->mutex);
+
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+/* close_resolver() {{{2 */
+
+static void close_resolver(lua_apr_resolver_object *object)
+{
+  resolver_state *state = object->state;
+  apr_status_t unused;
+
+  if (object_collectable((lua_apr_refobj*)object) && state != NULL) {
+    apr_thread_mutex_lock(state->mutex);
+    state->shutdown = 1;
+    apr_thread_cond_signal(state->cond);
+    apr_thread_mutex_unlock(state->mutex);
+    /* Waits for the lookup in progress, if any. */
+    apr_thread_join(&unused, state->thread);
+    free_requests(state->pending);
+    free_requests(state->done);
+    apr_pool_destroy(state->memory_pool);
+  }
+  object->state = NULL;
+  release_object((lua_apr_refobj*)object);
+}
+
+/* check_open() {{{2 */
+
+static resolver_state *check_open(lua_State *L, int idx)
+{
+  lua_apr_resolver_object *object = check_resolver(L, idx);
+  if (object->state == NULL)
+    luaL_error(L, "attempt to use a closed resolver");
+  return object->state;
+}
+
+/* resolver_signal_get() {{{2
+ *
+ * Get the pipe used by the helper thread to signal completed lookups, so that
+ * resolvers can be added to pollsets.
+ */
+
+apr_file_t *resolver_signal_get(lua_State *L, int idx)
+{
+  return check_open(L, idx)->signal_in;
+}
+
+/* apr.resolver() -> resolver {{{1
+ *
+ * Create a resolver that looks up host names on a helper thread. On success
+ * the resolver object is returned, otherwise a nil followed by an error
+ * message is returned. Resolvers can be added to a pollset for `'input'`;
+ * the resolver is reported as readable when one or more lookups have
+ * completed and `resolver:results()` should be called.
+ */
+
+int lua_apr_resolver(lua_State *L)
+{
+  lua_apr_resolver_object *object;
+  resolver_state *state;
+  apr_pool_t *pool;
+  apr_status_t status;
+
+  status = apr_pool_create(&pool, NULL);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  state = apr_pcalloc(pool, sizeof *state);
+  state->memory_pool = pool;
+  state->next_id = 1;
+  status = apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+  if (status == APR_SUCCESS)
+    status = apr_thread_cond_create(&state->cond, pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_create(&state->signal_in, &state->signal_out, pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(state->signal_in, 0);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(state->signal_out, 0);
+  if (status == APR_SUCCESS)
+    status = apr_thread_create(&state->thread, NULL, resolver_worker, state, pool);
+  if (status != APR_SUCCESS) {
+    apr_pool_destroy(pool);
+    return push_error_status(L, status);
+  }
+
+  object = new_object(L, &lua_apr_resolver_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->state = state;
+
+  return 1;
+}
+
+/* resolver:lookup(host [, family]) -> id [, ip_address, ...] {{{1
+ *
+ * Queue a lookup of the host name @host. The optional @family argument is
+ * documented under `apr.socket_create()`. On success a number is returned
+ * that identifies the lookup in the table returned by `resolver:results()`,
+ * otherwise a nil followed by an error message is returned. When the host
+ * name is a numeric address or it's found in the cache of resolved host
+ * names the lookup completes immediately: The IP addresses are returned after
+ * the number and no result is queued. A numeric address that doesn't match
+ * @family is an error.
+ */
+
+static int resolver_lookup(lua_State *L)
+{
+  resolver_state *state;
+  dns_request *request;
+  const char *host;
+  char *addresses;
+  size_t length;
+  int family, id, count;
+
+  state = check_open(L, 1);
+  host = luaL_checklstring(L, 2, &length);
+  family = family_check(L, 3);
+
+  apr_thread_mutex_lock(state->mutex);
+  id = state->next_id++;
+  apr_thread_mutex_unlock(state->mutex);
+
+  if (is_numeric(host)) {
+    /* The family defaults to "inet", only check one that was given. */
+    if (!lua_isnoneornil(L, 3) && family != APR_UNSPEC
+        && family != address_family(host, length))
+      return push_error_message(L, "address family doesn't match numeric address");
+    lua_pushinteger(L, id);
+    lua_pushvalue(L, 2);
+    return 2;
+  } else if (dns_cache_get(host, to_pool(L), &addresses) == APR_SUCCESS) {
+    lua_pushinteger(L, id);
+    count = push_addresses(L, addresses, family);
+    if (count > 0)
+      return count + 1;
+    /* No cached address of the requested family, ask the resolver. */
+    lua_pop(L, 1);
+  }
+
+  request = malloc(sizeof *request + length);
+  if (request == NULL)
+    raise_error_memory(L);
+  memset(request, 0, sizeof *request);
+  memcpy(request->host, host, length + 1);
+  request->id = id;
+  request->family = family;
+
+  apr_thread_mutex_lock(state->mutex);
+  if (state->pending_tail != NULL)
+    state->pending_tail->next = request;
+  else
+    state->pending = request;
+  state->pending_tail = request;
+  apr_thread_cond_signal(state->cond);
+  apr_thread_mutex_unlock(state->mutex);
+
+  lua_pushinteger(L, id);
+  return 1;
+}
+
+/* resolver:results() -> results {{{1
+ *
+ * Get the completed lookups. Returns a list of tables with the fields `id`
+ * (the number returned by `resolver:lookup()`) and `host`. Successful lookups
+ * have a field `addresses` containing a list of IP addresses, failed lookups
+ * have the fields `error` and `code` instead (like the error message and
+ * error code returned by other functions). Each completed lookup is returned
+ * only once. When no lookups have completed an empty list is returned.
+ */
+
+static int resolver_results(lua_State *L)
+{
+  resolver_state *state;
+  dns_request *requests, *request;
+  char buffer[LUA_APR_BUFSIZE];
+  apr_size_t len;
+  int i = 0, count;
+
+  state = check_open(L, 1);
+  lua_settop(L, 1);
+
+  apr_thread_mutex_lock(state->mutex);
+  /* Consume the pending wakeups. */
+  do {
+    len = sizeof buffer;
+  } while (apr_file_read(state->signal_in, buffer, &len) == APR_SUCCESS
+      && len == sizeof buffer);
+  requests = state->done;
+  state->done = state->done_tail = NULL;
+  apr_thread_mutex_unlock(state->mutex);
+
+  lua_newtable(L);
+  for (request = requests; request != NULL; request = request->next) {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, request->id);
+    lua_setfield(L, -2, "id");
+    lua_pushstring(L, request->host);
+    lua_setfield(L, -2, "host");
+    count = request->status == APR_SUCCESS
+      ? push_addresses(L, request->addresses, request->family) : 0;
+    if (count > 0) {
+      lua_createtable(L, count, 0);
+      lua_insert(L, -count - 1);
+      for (; count > 0; count--)
+        lua_rawseti(L, -count - 1, count);
+      lua_setfield(L, -2, "addresses");
+    } else {
+      /* push_error_status() pushes nil, message, code. */
+      push_error_status(L, request->status == APR_SUCCESS ? APR_EINVAL : request->status);
+      lua_setfield(L, -4, "code");
+      lua_setfield(L, -3, "error");
+      lua_pop(L, 1);
+    }
+    lua_rawseti(L, 2, ++i);
+  }
+  free_requests(requests);
+
+  return 1;
+}
+
+/* resolver:close() -> status {{{1
+ *
+ * Stop the helper thread and release the resources of the resolver. Pending
+ * lookups are abandoned. Returns true on success.
+ */
+
+static int resolver_close(lua_State *L)
+{
+  check_open(L, 1);
+  close_resolver(check_resolver(L, 1));
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* resolver:__tostring() {{{1 */
+
+static int resolver_tostring(lua_State *L)
+{
+  lua_apr_resolver_object *object = check_resolver(L, 1);
+
+  if (object->state != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_resolver_type.friendlyname, object->state);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_resolver_type.friendlyname);
+
+  return 1;
+}
+
+/* resolver:__gc() {{{1 */
+
+static int resolver_gc(lua_State *L)
+{
+  close_resolver(check_resolver(L, 1));
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_Reg resolver_methods[] = {
+  { "lookup", resolver_lookup },
+  { "results", resolver_results },
+  { "close", resolver_close },
+  { NULL, NULL }
+};
+
+static luaL_Reg resolver_metamethods[] = {
+  { "__tostring", resolver_tostring },
+  { "__eq", objects_equal },
+  { "__gc", resolver_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_resolver_type = {
+  "lua_apr_resolver*",             /* metatable name in registry */
+  "resolver",                      /* friendly object name */
+  sizeof(lua_apr_resolver_object), /* structure size */
+  resolver_methods,                /* methods table */
+  resolver_metamethods             /* metamethods table */
+};
+
+#endif
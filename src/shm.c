@@ -1,7 +1,7 @@
 /* Shared memory module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: November 6, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -44,6 +44,23 @@ static lua_apr_shm* check_shm(lua_State *L, int idx)
   return check_object(L, idx, &lua_apr_shm_type);
 }
 
+/* shm_buffers() -- get the buffers of a shared memory segment (see pipeline.c) {{{2 */
+
+int shm_buffers(lua_State *L, int idx, lua_apr_readbuf **input, lua_apr_writebuf **output)
+{
+  lua_apr_shm *object;
+
+  if (!object_has_type(L, idx, &lua_apr_shm_type, 1))
+    return 0;
+  object = check_shm(L, idx);
+  if (object->handle == NULL)
+    luaL_error(L, "attempt to use a destroyed shared memory segment");
+  *input = &object->input;
+  *output = &object->output;
+
+  return 1;
+}
+
 static apr_status_t shm_destroy_real(lua_apr_shm *object)
 {
   apr_status_t status = APR_SUCCESS;
@@ -1,7 +1,7 @@
 /* Thread queues module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: November 20, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -9,6 +9,12 @@
  * under the [serialization](#serialization) module. The example of a [multi
  * threaded webserver](#example_multi_threaded_webserver) uses a thread queue
  * to pass sockets between the main server thread and several worker threads.
+ *
+ * Thread queues can be added to a [pollset](#pollset) which makes it possible
+ * for a single thread to wait for network traffic, child processes and values
+ * pushed by other threads in a single call to `pollset:poll()`. This works by
+ * writing a byte to an internal pipe whenever a value is pushed onto the
+ * queue; the read end of that pipe is what the pollset actually watches.
  */
 
 #include "lua_apr.h"
@@ -23,10 +29,78 @@ typedef struct {
   lua_apr_refobj header;
   apr_pool_t *pool;
   apr_queue_t *handle;
+  apr_file_t *signal_in, *signal_out;
 } lua_apr_queue;
 
 /* Internal functions. {{{1 */
 
+/* queue_signal_create() {{{2
+ *
+ * Create the non-blocking pipe used to make a thread queue pollable. Failure
+ * to create the pipe isn't fatal: The queue simply won't be pollable.
+ */
+
+static void queue_signal_create(lua_apr_queue *object)
+{
+  apr_status_t status;
+
+  status = apr_file_pipe_create(&object->signal_in, &object->signal_out, object->pool);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(object->signal_in, 0);
+  if (status == APR_SUCCESS)
+    status = apr_file_pipe_timeout_set(object->signal_out, 0);
+  if (status != APR_SUCCESS)
+    object->signal_in = object->signal_out = NULL;
+}
+
+/* queue_signal_raise() {{{2
+ *
+ * Wake up any pollsets watching the queue. When the pipe is full the write is
+ * silently dropped, the read end is readable anyway.
+ */
+
+static void queue_signal_raise(lua_apr_queue *object)
+{
+  apr_size_t len = 1;
+
+  if (object->signal_out != NULL)
+    apr_file_write(object->signal_out, "!", &len);
+}
+
+/* queue_signal_get() {{{2
+ *
+ * Get the read end of the pipe that signals values being pushed onto the
+ * thread queue at the given stack index (used by pollset:add()).
+ */
+
+apr_file_t *queue_signal_get(lua_State *L, int idx)
+{
+  lua_apr_queue *object = check_queue(L, idx);
+  if (object->signal_in == NULL)
+    luaL_error(L, "thread queue cannot be polled");
+  return object->signal_in;
+}
+
+/* queue_signal_drain() {{{2
+ *
+ * Consume all pending wakeups of the thread queue at the given stack index
+ * (used by pollset:poll() before reporting the queue as readable).
+ */
+
+void queue_signal_drain(lua_State *L, int idx)
+{
+  lua_apr_queue *object = check_queue(L, idx);
+  char buffer[LUA_APR_BUFSIZE];
+  apr_size_t len;
+
+  if (object->signal_in != NULL) {
+    do {
+      len = sizeof buffer;
+    } while (apr_file_read(object->signal_in, buffer, &len) == APR_SUCCESS
+        && len == sizeof buffer);
+  }
+}
+
 static void close_queue_real(lua_apr_queue *object)
 {
   if (object_collectable((lua_apr_refobj*)object)) {
@@ -50,6 +124,10 @@ static int queue_push_real(lua_State *L, apr_queue_push_func cb)
   lua_apr_serialize(L, 2);
   data = strdup(lua_tostring(L, -1));
   status = cb(object->handle, data);
+  if (status == APR_SUCCESS)
+    queue_signal_raise(object);
+  else
+    free(data);
 
   return push_status(L, status);
 }
@@ -100,6 +178,7 @@ int lua_apr_thread_queue(lua_State *L)
     status = apr_queue_create(&object->handle, capacity, object->pool);
   if (status != APR_SUCCESS)
     return push_error_status(L, status);
+  queue_signal_create(object);
 
   return 1;
 }
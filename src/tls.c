@@ -0,0 +1,677 @@
+/* TLS module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Network sockets can be encrypted using [Transport Layer Security] [tls]
+ * provided by [OpenSSL] [openssl] (version 1.1 or newer). After calling
+ * `socket:tls_wrap()` the methods `socket:read()`, `socket:write()` and
+ * `socket:lines()` transparently encrypt and decrypt data, so code written for
+ * plain text sockets keeps working:
+ *
+ *     local socket = assert(apr.socket_create())
+ *     assert(socket:connect('www.example.com', 443))
+ *     assert(socket:tls_wrap { hostname = 'www.example.com' })
+ *     assert(socket:write 'GET / HTTP/1.0\r\nHost: www.example.com\r\n\r\n')
+ *     print(socket:read '*a')
+ *
+ * Encryption settings are shared by all sockets wrapped with the same options,
+ * which makes it possible to resume TLS sessions: Servers issue session
+ * tickets and keep a session cache, clients remember the last session per
+ * host and port. Resumed sessions skip the expensive public key operations of
+ * a full handshake.
+ *
+ * Non-blocking sockets (see `socket:timeout_set()`) are supported: When the
+ * handshake or a read or write can't make progress `socket:tls_handshake()`,
+ * `socket:read()` or `socket:write()` return the error code `'EAGAIN'` and
+ * `socket:tls_want()` tells whether to wait until the socket is readable or
+ * writable before trying again. The coroutine scheduler created by
+ * `apr.loop()` takes care of this automatically.
+ *
+ * [tls]: http://en.wikipedia.org/wiki/Transport_Layer_Security
+ * [openssl]: http://www.openssl.org/
+ */
+
+#include "lua_apr.h"
+#if LUA_APR_HAVE_OPENSSL
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of client sessions remembered for resumption. */
+#define TLS_CLIENT_SESSIONS_MAX 256
+
+/* Directions an operation can be waiting for. */
+#define TLS_WANT_INPUT 1
+#define TLS_WANT_OUTPUT 2
+
+/* Internal functions {{{1 */
+
+/* TLS state of a socket (allocated from the socket's memory pool). */
+typedef struct lua_apr_tls {
+  SSL *ssl;
+  apr_socket_t *handle;
+  apr_status_t io_status;   /* status of the last socket operation */
+  unsigned long error;      /* last OpenSSL error */
+  const char *session_key;  /* key in the client session cache */
+  int established, want;    /* want is one of the TLS_WANT_* constants */
+} lua_apr_tls;
+
+/* Client session remembered for resumption. */
+typedef struct {
+  SSL_SESSION *session;
+  char key[1];
+} tls_session;
+
+/* State shared by all threads. */
+static apr_pool_t *tls_pool = NULL;
+static apr_hash_t *tls_contexts = NULL; /* options -> SSL_CTX */
+static apr_hash_t *tls_sessions = NULL; /* host:port -> tls_session */
+static BIO_METHOD *tls_bio_method = NULL;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *tls_mutex = NULL;
+# define tls_lock() do { \
+  if (tls_mutex != NULL) apr_thread_mutex_lock(tls_mutex); } while (0)
+# define tls_unlock() do { \
+  if (tls_mutex != NULL) apr_thread_mutex_unlock(tls_mutex); } while (0)
+#else
+# define tls_lock() ((void)0)
+# define tls_unlock() ((void)0)
+#endif
+
+/* bio_write() -- send encrypted data over the socket {{{2 */
+
+static int bio_write(BIO *bio, const char *data, int length)
+{
+  lua_apr_tls *tls = BIO_get_data(bio);
+  apr_size_t len = length;
+
+  BIO_clear_retry_flags(bio);
+  tls->io_status = apr_socket_send(tls->handle, data, &len);
+  if (len > 0)
+    return (int) len;
+  if (APR_STATUS_IS_EAGAIN(tls->io_status))
+    BIO_set_retry_write(bio);
+
+  return -1;
+}
+
+/* bio_read() -- receive encrypted data from the socket {{{2 */
+
+static int bio_read(BIO *bio, char *data, int length)
+{
+  lua_apr_tls *tls = BIO_get_data(bio);
+  apr_size_t len = length;
+
+  BIO_clear_retry_flags(bio);
+  tls->io_status = apr_socket_recv(tls->handle, data, &len);
+  if (len > 0)
+    return (int) len;
+  if (APR_STATUS_IS_EAGAIN(tls->io_status))
+    BIO_set_retry_read(bio);
+
+  return APR_STATUS_IS_EOF(tls->io_status) ? 0 : -1;
+}
+
+/* bio_ctrl() {{{2 */
+
+static long bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+  return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+}
+
+/* tls_status() -- convert the result of an OpenSSL call to an APR status {{{2 */
+
+static apr_status_t tls_status(lua_apr_tls *tls, int result)
+{
+  tls->want = 0;
+  switch (SSL_get_error(tls->ssl, result)) {
+    case SSL_ERROR_NONE:
+      return APR_SUCCESS;
+    case SSL_ERROR_ZERO_RETURN:
+      return APR_EOF;
+    case SSL_ERROR_WANT_READ:
+      tls->want = TLS_WANT_INPUT;
+      return APR_EAGAIN;
+    case SSL_ERROR_WANT_WRITE:
+      tls->want = TLS_WANT_OUTPUT;
+      return APR_EAGAIN;
+    case SSL_ERROR_SYSCALL:
+      /* The socket reported an error or the peer closed the connection. */
+      return tls->io_status != APR_SUCCESS ? tls->io_status : APR_EOF;
+    default:
+      /* OpenSSL 3 reports a missing close_notify alert as an error. */
+      if (APR_STATUS_IS_EOF(tls->io_status))
+        return APR_EOF;
+      tls->error = ERR_peek_last_error();
+      ERR_clear_error();
+      return APR_EGENERAL;
+  }
+}
+
+/* tls_handshake() -- perform (or continue) the TLS handshake {{{2 */
+
+static apr_status_t tls_handshake(lua_apr_tls *tls)
+{
+  apr_status_t status;
+
+  if (tls->established)
+    return APR_SUCCESS;
+  ERR_clear_error();
+  status = tls_status(tls, SSL_do_handshake(tls->ssl));
+  if (status == APR_SUCCESS)
+    tls->established = 1;
+
+  return status;
+}
+
+/* tls_read() -- read function for lua_apr_readbuf {{{2 */
+
+static apr_status_t lua_apr_cc tls_read(void *object, char *buffer, apr_size_t *length)
+{
+  lua_apr_tls *tls = object;
+  apr_size_t size = *length;
+  apr_status_t status;
+  int result;
+
+  *length = 0;
+  status = tls_handshake(tls);
+  if (status != APR_SUCCESS)
+    return status;
+  ERR_clear_error();
+  result = SSL_read(tls->ssl, buffer, size > INT_MAX ? INT_MAX : (int) size);
+  if (result > 0) {
+    *length = result;
+    return APR_SUCCESS;
+  }
+
+  return tls_status(tls, result);
+}
+
+/* tls_write() -- write function for lua_apr_writebuf {{{2 */
+
+static apr_status_t lua_apr_cc tls_write(void *object, const char *buffer, apr_size_t *length)
+{
+  lua_apr_tls *tls = object;
+  apr_size_t size = *length;
+  apr_status_t status;
+  int result;
+
+  *length = 0;
+  status = tls_handshake(tls);
+  if (status != APR_SUCCESS)
+    return status;
+  ERR_clear_error();
+  result = SSL_write(tls->ssl, buffer, size > INT_MAX ? INT_MAX : (int) size);
+  if (result > 0) {
+    *length = result;
+    return APR_SUCCESS;
+  }
+
+  return tls_status(tls, result);
+}
+
+/* tls_cleanup() -- release the TLS state when the socket's pool is cleared {{{2 */
+
+static apr_status_t tls_cleanup(void *data)
+{
+  lua_apr_tls *tls = data;
+
+  if (tls->ssl != NULL) {
+    SSL_free(tls->ssl);
+    tls->ssl = NULL;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* session_new() -- remember a new client session {{{2
+ *
+ * Called by OpenSSL when the server sends a session (ticket), which may
+ * happen after the handshake has completed (TLS 1.3).
+ */
+
+static int session_new(SSL *ssl, SSL_SESSION *session)
+{
+  lua_apr_tls *tls = SSL_get_app_data(ssl);
+  apr_hash_index_t *hi;
+  tls_session *entry, *old;
+  size_t length;
+
+  if (tls == NULL || tls->session_key == NULL)
+    return 0;
+  length = strlen(tls->session_key);
+  entry = malloc(sizeof *entry + length);
+  if (entry == NULL)
+    return 0;
+  entry->session = session;
+  memcpy(entry->key, tls->session_key, length + 1);
+
+  tls_lock();
+  old = apr_hash_get(tls_sessions, entry->key, APR_HASH_KEY_STRING);
+  if (old == NULL && apr_hash_count(tls_sessions) >= TLS_CLIENT_SESSIONS_MAX) {
+    /* Forget an arbitrary session to make room. */
+    hi = apr_hash_first(NULL, tls_sessions);
+    apr_hash_this(hi, NULL, NULL, (void**)&old);
+  }
+  if (old != NULL) {
+    apr_hash_set(tls_sessions, old->key, APR_HASH_KEY_STRING, NULL);
+    SSL_SESSION_free(old->session);
+    free(old);
+  }
+  apr_hash_set(tls_sessions, entry->key, APR_HASH_KEY_STRING, entry);
+  tls_unlock();
+
+  /* Keep the reference to the session. */
+  return 1;
+}
+
+/* tls_error() -- push nil followed by the last OpenSSL error message {{{2 */
+
+static int tls_error(lua_State *L, unsigned long error, const char *context)
+{
+  char message[256];
+
+  if (error == 0)
+    error = ERR_peek_last_error();
+  ERR_clear_error();
+  if (error == 0)
+    return push_error_message(L, context);
+  ERR_error_string_n(error, message, sizeof message);
+  lua_pushnil(L);
+  lua_pushfstring(L, "%s (%s)", context, message);
+
+  return 2;
+}
+
+/* tls_status_error() -- push the result of a failed TLS operation {{{2 */
+
+static int tls_status_error(lua_State *L, lua_apr_tls *tls, apr_status_t status)
+{
+  if (status == APR_EGENERAL && tls->error != 0)
+    return tls_error(L, tls->error, "TLS error");
+  return push_error_status(L, status);
+}
+
+/* tls_context() -- get the OpenSSL context for a set of options {{{2 */
+
+static SSL_CTX *tls_context(lua_State *L, int server, const char *cert,
+    const char *key, const char *ca, int verify)
+{
+  SSL_CTX *context;
+  const char *options;
+  int ok;
+
+  options = lua_pushfstring(L, "%s\n%s\n%s\n%s\n%d", server ? "server" : "client",
+      cert ? cert : "", key ? key : "", ca ? ca : "", verify);
+
+  tls_lock();
+  context = apr_hash_get(tls_contexts, options, APR_HASH_KEY_STRING);
+  if (context == NULL) {
+    context = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+    ok = context != NULL && SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    if (ok && cert != NULL)
+      ok = SSL_CTX_use_certificate_chain_file(context, cert) == 1;
+    if (ok && key != NULL)
+      ok = SSL_CTX_use_PrivateKey_file(context, key, SSL_FILETYPE_PEM) == 1
+        && SSL_CTX_check_private_key(context) == 1;
+    if (ok && ca != NULL) {
+      ok = SSL_CTX_load_verify_locations(context, ca, NULL) == 1;
+      if (ok && server) {
+        STACK_OF(X509_NAME) *names = SSL_load_client_CA_file(ca);
+        ok = names != NULL;
+        if (ok)
+          SSL_CTX_set_client_CA_list(context, names);
+      }
+    } else if (ok && verify)
+      ok = SSL_CTX_set_default_verify_paths(context) == 1;
+    if (ok) {
+      SSL_CTX_set_verify(context, !verify ? SSL_VERIFY_NONE : server
+          ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_PEER, NULL);
+      SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE
+          | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+      if (server) {
+        /* Session tickets are enabled by default; sessions of clients that
+         * don't support tickets are kept in the internal session cache. */
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(context, (const unsigned char*)"lua-apr", 7);
+      } else {
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT
+            | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(context, session_new);
+      }
+      apr_hash_set(tls_contexts, apr_pstrdup(tls_pool, options), APR_HASH_KEY_STRING, context);
+    } else if (context != NULL) {
+      SSL_CTX_free(context);
+      context = NULL;
+    }
+  }
+  tls_unlock();
+  lua_pop(L, 1);
+
+  return context;
+}
+
+/* tls_check() -- get a socket with TLS enabled from the Lua stack {{{2 */
+
+static lua_apr_socket *tls_check(lua_State *L, int idx)
+{
+  lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+  if (socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  if (socket->tls == NULL)
+    luaL_error(L, "TLS is not enabled on this socket");
+  return socket;
+}
+
+/* tls_init() -- initialize the state shared by all threads {{{2 */
+
+apr_status_t tls_init(apr_pool_t *pool)
+{
+  if (OPENSSL_init_ssl(0, NULL) != 1)
+    return APR_EGENERAL;
+  tls_bio_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "apr_socket");
+  if (tls_bio_method == NULL)
+    return APR_ENOMEM;
+  BIO_meth_set_write(tls_bio_method, bio_write);
+  BIO_meth_set_read(tls_bio_method, bio_read);
+  BIO_meth_set_ctrl(tls_bio_method, bio_ctrl);
+  tls_pool = pool;
+  tls_contexts = apr_hash_make(pool);
+  tls_sessions = apr_hash_make(pool);
+# if APR_HAS_THREADS
+  return apr_thread_mutex_create(&tls_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+# else
+  return APR_SUCCESS;
+# endif
+}
+
+/* tls_shutdown() -- send the close_notify alert {{{2 */
+
+void tls_shutdown(lua_apr_tls *tls)
+{
+  /* Best effort: don't wait for the peer's close_notify alert. */
+  if (tls->established) {
+    ERR_clear_error();
+    SSL_shutdown(tls->ssl);
+    ERR_clear_error();
+  }
+}
+
+/* tls_detach() -- stop using TLS on a socket but keep the TLS state {{{2
+ *
+ * The TLS state is allocated from the socket's memory pool, so sockets
+ * acquired from a connection pool must detach it before the connection is
+ * returned: Afterwards the memory pool belongs to the connection pool.
+ */
+
+lua_apr_tls *tls_detach(lua_apr_socket *socket)
+{
+  lua_apr_tls *tls = socket->tls;
+
+  socket->tls = NULL;
+  socket->input.object = socket->handle;
+  socket->input.read = (lua_apr_buf_rf) apr_socket_recv;
+  socket->output.object = socket->handle;
+  socket->output.write = (lua_apr_buf_wf) apr_socket_send;
+
+  return tls;
+}
+
+/* tls_attach() -- make a socket use existing TLS state {{{2 */
+
+void tls_attach(lua_apr_socket *socket, lua_apr_tls *tls)
+{
+  tls->want = 0;
+  socket->tls = tls;
+  socket->input.object = tls;
+  socket->input.read = tls_read;
+  socket->output.object = tls;
+  socket->output.write = tls_write;
+}
+
+/* tls_reusable() -- check whether a TLS connection can be reused {{{2 */
+
+int tls_reusable(lua_apr_tls *tls)
+{
+  /* Decrypted data that nobody read would be passed to the next user. */
+  return tls->established && SSL_pending(tls->ssl) == 0;
+}
+
+/* tls_close() -- send the close_notify alert before a socket is closed {{{2 */
+
+void tls_close(lua_apr_socket *socket)
+{
+  tls_shutdown(tls_detach(socket));
+}
+
+/* socket:tls_wrap([options]) -> status {{{1
+ *
+ * Enable TLS on a connected socket. On success true is returned, otherwise a
+ * nil followed by an error message is returned. The optional table @options
+ * supports the following fields:
+ *
+ *  - `server` should be true on the server side of the connection (the
+ *    default is to act as a client)
+ *  - `cert` is the pathname of a PEM file containing the certificate (chain)
+ *    used to identify this side of the connection; required for servers
+ *  - `key` is the pathname of a PEM file containing the private key that
+ *    belongs to the certificate
+ *  - `ca` is the pathname of a PEM file containing the certificates of
+ *    trusted certificate authorities (clients use the system's default
+ *    trusted authorities when this isn't given)
+ *  - `verify` can be set to false to disable verification of the peer's
+ *    certificate (this defaults to true for clients and to false for servers,
+ *    which then don't ask for client certificates)
+ *  - `hostname` is the host name (or IP address) that clients send to the
+ *    server and check the server's certificate against; required for clients
+ *    that verify the server's certificate, because otherwise any certificate
+ *    issued by a trusted authority would be accepted
+ *
+ * The handshake is performed by the first call to `socket:tls_handshake()`,
+ * `socket:read()` or `socket:write()`. Output that was buffered before
+ * calling this method is sent unencrypted; buffered input results in an
+ * error because it would be lost.
+ */
+
+int socket_tls_wrap(lua_State *L)
+{
+  lua_apr_socket *socket;
+  lua_apr_tls *tls;
+  const char *cert = NULL, *key = NULL, *ca = NULL, *hostname = NULL;
+  apr_sockaddr_t *address;
+  apr_status_t status;
+  SSL_CTX *context;
+  char *ip_address;
+  BIO *bio;
+  int server = 0, verify = -1;
+
+  lua_settop(L, 2);
+  socket = check_object(L, 1, &lua_apr_socket_type);
+  if (socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  luaL_argcheck(L, socket->tls == NULL, 1, "TLS is already enabled on this socket");
+  if (!lua_isnil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "server");
+    server = lua_toboolean(L, -1);
+    lua_getfield(L, 2, "cert");
+    cert = luaL_optstring(L, -1, NULL);
+    lua_getfield(L, 2, "key");
+    key = luaL_optstring(L, -1, NULL);
+    lua_getfield(L, 2, "ca");
+    ca = luaL_optstring(L, -1, NULL);
+    lua_getfield(L, 2, "verify");
+    if (!lua_isnil(L, -1))
+      verify = lua_toboolean(L, -1);
+    lua_getfield(L, 2, "hostname");
+    hostname = luaL_optstring(L, -1, NULL);
+  }
+  if (verify < 0)
+    verify = !server;
+  luaL_argcheck(L, !server || cert != NULL, 2, "servers need a certificate");
+  luaL_argcheck(L, server || !verify || hostname != NULL, 2,
+      "clients that verify the server need a hostname");
+  if (socket->input.buffer.index < socket->input.buffer.limit)
+    return push_error_message(L, "can't enable TLS with buffered input");
+  status = flush_buffer(L, &socket->output, 1);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+
+  context = tls_context(L, server, cert, key, ca, verify);
+  if (context == NULL)
+    return tls_error(L, 0, "failed to initialize TLS");
+
+  tls = apr_pcalloc(socket->pool, sizeof *tls);
+  tls->handle = socket->handle;
+  tls->ssl = SSL_new(context);
+  bio = tls->ssl != NULL ? BIO_new(tls_bio_method) : NULL;
+  if (bio == NULL) {
+    tls_cleanup(tls);
+    return tls_error(L, 0, "failed to initialize TLS");
+  }
+  BIO_set_data(bio, tls);
+  BIO_set_init(bio, 1);
+  SSL_set_bio(tls->ssl, bio, bio);
+  SSL_set_app_data(tls->ssl, tls);
+  apr_pool_cleanup_register(socket->pool, tls, tls_cleanup, apr_pool_cleanup_null);
+
+  if (server)
+    SSL_set_accept_state(tls->ssl);
+  else {
+    SSL_set_connect_state(tls->ssl);
+    if (hostname != NULL) {
+      /* IP addresses are checked against the addresses in the certificate
+       * and aren't sent as server name. */
+      int ok = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(tls->ssl), hostname) == 1;
+      if (!ok)
+        ok = SSL_set_tlsext_host_name(tls->ssl, hostname) == 1
+          && (!verify || SSL_set1_host(tls->ssl, hostname) == 1);
+      if (!ok)
+        return tls_error(L, 0, "failed to set TLS host name");
+    }
+    /* Try to resume the last session with this server. */
+    if (apr_socket_addr_get(&address, APR_REMOTE, socket->handle) == APR_SUCCESS
+        && apr_sockaddr_ip_get(&ip_address, address) == APR_SUCCESS) {
+      tls_session *entry;
+      tls->session_key = apr_psprintf(socket->pool, "%pp %s %s:%d", (void*)context,
+          hostname ? hostname : "", ip_address, (int) address->port);
+      tls_lock();
+      entry = apr_hash_get(tls_sessions, tls->session_key, APR_HASH_KEY_STRING);
+      if (entry != NULL)
+        SSL_set_session(tls->ssl, entry->session);
+      tls_unlock();
+    }
+  }
+
+  tls_attach(socket, tls);
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* socket:tls_handshake() -> status {{{1
+ *
+ * Perform the TLS handshake. On success true is returned, otherwise a nil
+ * followed by an error message is returned. On non-blocking sockets the error
+ * code `'EAGAIN'` means that the handshake should be continued once the socket
+ * is ready for the direction reported by `socket:tls_want()`. Calling this
+ * method is optional because the first read or write performs the handshake
+ * when needed, but it can be used to detect problems with certificates early.
+ */
+
+int socket_tls_handshake(lua_State *L)
+{
+  lua_apr_socket *socket;
+  apr_status_t status;
+
+  socket = tls_check(L, 1);
+  status = tls_handshake(socket->tls);
+  if (status != APR_SUCCESS)
+    return tls_status_error(L, socket->tls, status);
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* socket:tls_want() -> direction {{{1
+ *
+ * Get the direction a TLS socket is waiting for after an operation failed
+ * with the error code `'EAGAIN'`: `'input'` when the socket should become
+ * readable, `'output'` when it should become writable. Returns nil when TLS
+ * isn't enabled or the socket isn't waiting for anything.
+ */
+
+int socket_tls_want(lua_State *L)
+{
+  lua_apr_socket *socket = check_object(L, 1, &lua_apr_socket_type);
+
+  if (socket->tls == NULL || socket->tls->want == 0)
+    lua_pushnil(L);
+  else
+    lua_pushstring(L, socket->tls->want == TLS_WANT_INPUT ? "input" : "output");
+
+  return 1;
+}
+
+/* socket:tls_info() -> info {{{1
+ *
+ * Get information about the TLS connection of a socket. Returns a table with
+ * the following fields:
+ *
+ *  - `established` is true when the handshake has completed
+ *  - `version` is the protocol version (e.g. `'TLSv1.3'`)
+ *  - `cipher` is the name of the negotiated cipher suite
+ *  - `resumed` is true when a previous session was resumed
+ *  - `verified` is true when the peer presented a certificate that was
+ *    verified successfully
+ *  - `peer` is the subject of the peer's certificate (if any)
+ */
+
+int socket_tls_info(lua_State *L)
+{
+  lua_apr_socket *socket;
+  SSL *ssl;
+  X509 *cert;
+  char subject[256];
+
+  socket = tls_check(L, 1);
+  ssl = socket->tls->ssl;
+  lua_createtable(L, 0, 6);
+  lua_pushboolean(L, socket->tls->established);
+  lua_setfield(L, -2, "established");
+  if (socket->tls->established) {
+    lua_pushstring(L, SSL_get_version(ssl));
+    lua_setfield(L, -2, "version");
+    lua_pushstring(L, SSL_get_cipher_name(ssl));
+    lua_setfield(L, -2, "cipher");
+    lua_pushboolean(L, SSL_session_reused(ssl));
+    lua_setfield(L, -2, "resumed");
+#   if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    cert = SSL_get1_peer_certificate(ssl);
+#   else
+    cert = SSL_get_peer_certificate(ssl);
+#   endif
+    lua_pushboolean(L, cert != NULL && SSL_get_verify_result(ssl) == X509_V_OK);
+    lua_setfield(L, -2, "verified");
+    if (cert != NULL) {
+      X509_NAME_oneline(X509_get_subject_name(cert), subject, sizeof subject);
+      lua_pushstring(L, subject);
+      lua_setfield(L, -2, "peer");
+      X509_free(cert);
+    }
+  }
+
+  return 1;
+}
+
+#endif
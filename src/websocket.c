@@ -0,0 +1,545 @@
+/* WebSocket module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * This module implements the framing of the [WebSocket protocol] [rfc6455] in
+ * C on top of the buffered input and output of socket objects. The HTTP
+ * upgrade itself is up to you (for example using `apr.http_parser()`), after
+ * which `socket:ws_read()` and `socket:ws_write()` exchange messages:
+ *
+ *     local parser = apr.http_parser()
+ *     local request = assert(parser:feed(assert(client:read(4096))))
+ *     assert(client:write(assert(apr.ws_handshake(request.headers))))
+ *     while true do
+ *       local opcode, payload = assert(client:ws_read())
+ *       if opcode == 'close' then break end
+ *       assert(client:ws_write(opcode, payload))
+ *     end
+ *
+ * Unmasking the payload of client frames is done 16 bytes at a time using
+ * SSE2 or NEON instructions when the compiler supports them (with a portable
+ * fallback that works on 8 bytes at a time). Frames are decoded straight from
+ * the socket's input buffer without copying them into intermediate Lua
+ * strings. Fan-out servers that send the same message to many clients can
+ * encode it once using `apr.ws_frame()` and pass the result to
+ * `socket:write()`.
+ *
+ * Non-blocking sockets are supported: When a message hasn't been received
+ * completely `socket:ws_read()` returns the error code `'EAGAIN'` and keeps
+ * the partial message buffered until the next call.
+ *
+ * [rfc6455]: http://tools.ietf.org/html/rfc6455
+ */
+
+#include "lua_apr.h"
+#include <apr_general.h>
+#if LUAAPR_HAVE_APRUTIL
+#include <apr_base64.h>
+#include <apr_sha1.h>
+#endif
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define LUA_APR_WS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define LUA_APR_WS_NEON 1
+#endif
+
+/* Default limit on the size of received messages. */
+#define WS_MAX_MESSAGE (16 * 1024 * 1024)
+
+/* Largest payload of a control frame. */
+#define WS_MAX_CONTROL 125
+
+/* Magic string used to compute Sec-WebSocket-Accept. */
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* Frame opcodes. */
+#define WS_CONTINUATION 0x0
+#define WS_TEXT         0x1
+#define WS_BINARY       0x2
+#define WS_CLOSE        0x8
+#define WS_PING         0x9
+#define WS_PONG         0xA
+
+/* Results of ws_scan(). */
+#define WS_SCAN_ERROR  (-1)
+#define WS_SCAN_AGAIN   0
+#define WS_SCAN_MESSAGE 1
+#define WS_SCAN_CONTROL 2
+
+/* Internal functions {{{1 */
+
+static const char *const opcode_options[] = {
+  "continuation", "text", "binary", "close", "ping", "pong", NULL
+};
+
+static const int opcode_values[] = {
+  WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_CLOSE, WS_PING, WS_PONG
+};
+
+/* Header of a single frame. */
+typedef struct {
+  int fin, opcode, masked;
+  size_t size;         /* of the header itself */
+  apr_uint64_t length; /* of the payload */
+} ws_header;
+
+/* Result of scanning the buffered input. */
+typedef struct {
+  int opcode;
+  size_t offset;       /* start of the control frame or end of the message */
+  size_t size;         /* size of the control frame */
+  size_t length;       /* payload length of the message or control frame */
+  const char *error;
+} ws_scan_result;
+
+/* ws_mask() -- apply a masking key (masking and unmasking are the same) {{{2
+ *
+ * The @phase is the offset in the payload of the first byte. The data may be
+ * moved down while unmasking (@dst <= @src).
+ */
+
+static void ws_mask(unsigned char *dst, const unsigned char *src, size_t length,
+    const unsigned char *key, size_t phase)
+{
+  unsigned char k[4];
+  apr_uint32_t k32;
+  apr_uint64_t k64, word;
+  size_t i;
+
+  /* Rotate the key so that k[0] applies to src[0]. */
+  for (i = 0; i < 4; i++)
+    k[i] = key[(phase + i) & 3];
+  memcpy(&k32, k, 4);
+  i = 0;
+
+# if LUA_APR_WS_SSE2
+  {
+    __m128i m = _mm_set1_epi32((int) k32);
+    for (; i + 16 <= length; i += 16)
+      _mm_storeu_si128((__m128i*) (dst + i),
+          _mm_xor_si128(_mm_loadu_si128((const __m128i*) (src + i)), m));
+  }
+# elif LUA_APR_WS_NEON
+  {
+    uint8x16_t m = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+    for (; i + 16 <= length; i += 16)
+      vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), m));
+  }
+# endif
+
+  /* Both halves hold the key in memory order, regardless of byte order. */
+  k64 = ((apr_uint64_t) k32 << 32) | k32;
+  for (; i + 8 <= length; i += 8) {
+    memcpy(&word, src + i, 8);
+    word ^= k64;
+    memcpy(dst + i, &word, 8);
+  }
+  for (; i < length; i++)
+    dst[i] = src[i] ^ k[i & 3];
+}
+
+/* ws_parse_header() -- parse the header of a frame {{{2
+ *
+ * Returns zero when more input is needed.
+ */
+
+static int ws_parse_header(const unsigned char *data, size_t avail, ws_header *header)
+{
+  int i;
+
+  if (avail < 2)
+    return 0;
+  header->fin = (data[0] & 0x80) != 0;
+  header->opcode = data[0] & 0x0F;
+  header->masked = (data[1] & 0x80) != 0;
+  header->length = data[1] & 0x7F;
+  header->size = 2 + (header->masked ? 4 : 0);
+  if (header->length == 126)
+    header->size += 2;
+  else if (header->length == 127)
+    header->size += 8;
+  if (avail < header->size)
+    return 0;
+  if (header->length == 126) {
+    header->length = ((apr_uint64_t) data[2] << 8) | data[3];
+  } else if (header->length == 127) {
+    header->length = 0;
+    for (i = 0; i < 8; i++)
+      header->length = (header->length << 8) | data[2 + i];
+  }
+
+  return 1;
+}
+
+/* ws_scan() -- find a complete message or control frame in the buffer {{{2 */
+
+static int ws_scan(lua_apr_buffer *B, size_t limit, ws_scan_result *result)
+{
+  const unsigned char *data = (const unsigned char*) B->data + B->index;
+  size_t avail = B->data != NULL ? B->limit - B->index : 0, offset = 0;
+  int fragmented = 0;
+  ws_header header;
+
+  result->length = 0;
+  while (ws_parse_header(data + offset, avail - offset, &header)) {
+    if (data[offset] & 0x70) {
+      result->error = "reserved bits set in frame (no extensions were negotiated)";
+      return WS_SCAN_ERROR;
+    }
+    if (header.opcode & 0x08) {
+      /* Control frames may be injected in the middle of fragmented messages. */
+      if (header.opcode != WS_CLOSE && header.opcode != WS_PING && header.opcode != WS_PONG) {
+        result->error = "unknown opcode in frame";
+        return WS_SCAN_ERROR;
+      } else if (!header.fin || header.length > WS_MAX_CONTROL) {
+        result->error = "invalid control frame";
+        return WS_SCAN_ERROR;
+      } else if (avail - offset - header.size < header.length)
+        return WS_SCAN_AGAIN;
+      result->opcode = header.opcode;
+      result->offset = offset;
+      result->size = header.size + (size_t) header.length;
+      result->length = (size_t) header.length;
+      return WS_SCAN_CONTROL;
+    }
+    if (header.opcode == WS_CONTINUATION) {
+      if (!fragmented) {
+        result->error = "continuation frame without message";
+        return WS_SCAN_ERROR;
+      }
+    } else if (header.opcode == WS_TEXT || header.opcode == WS_BINARY) {
+      if (fragmented) {
+        result->error = "new message in the middle of a fragmented message";
+        return WS_SCAN_ERROR;
+      }
+      result->opcode = header.opcode;
+      fragmented = 1;
+    } else {
+      result->error = "unknown opcode in frame";
+      return WS_SCAN_ERROR;
+    }
+    if (header.length > limit - result->length) {
+      result->error = "message too large";
+      return WS_SCAN_ERROR;
+    }
+    if (avail - offset - header.size < header.length)
+      return WS_SCAN_AGAIN;
+    result->length += (size_t) header.length;
+    offset += header.size + (size_t) header.length;
+    if (header.fin) {
+      result->offset = offset;
+      return WS_SCAN_MESSAGE;
+    }
+  }
+
+  return WS_SCAN_AGAIN;
+}
+
+/* ws_unmask_message() -- unmask and join the payloads of a message in place {{{2 */
+
+static void ws_unmask_message(unsigned char *data, size_t end)
+{
+  unsigned char *dst = data;
+  size_t offset = 0, length;
+  ws_header header;
+
+  while (offset < end) {
+    ws_parse_header(data + offset, end - offset, &header);
+    length = (size_t) header.length;
+    if (header.masked)
+      ws_mask(dst, data + offset + header.size, length, data + offset + header.size - 4, 0);
+    else
+      memmove(dst, data + offset + header.size, length);
+    dst += length;
+    offset += header.size + length;
+  }
+}
+
+/* ws_check() -- get an open socket from the Lua stack {{{2 */
+
+static lua_apr_socket *ws_check(lua_State *L, int idx)
+{
+  lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+  if (socket->handle == NULL)
+    luaL_error(L, "attempt to use a closed socket");
+  return socket;
+}
+
+/* push_frame() -- push a frame as a string {{{2 */
+
+static void push_frame(lua_State *L, int opcode, int payload, int mask, int fin)
+{
+  unsigned char header[14], *key = header;
+  size_t length, size = 2, offset, n;
+  const char *data;
+  luaL_Buffer buffer;
+  int i;
+
+  data = luaL_optlstring(L, payload, "", &length);
+  if (opcode & 0x08)
+    luaL_argcheck(L, fin && length <= WS_MAX_CONTROL, payload,
+        "control frames can't be fragmented or longer than 125 bytes");
+  header[0] = (unsigned char) ((fin ? 0x80 : 0) | opcode);
+  if (length < 126) {
+    header[1] = (unsigned char) length;
+  } else if (length <= 0xFFFF) {
+    header[1] = 126;
+    header[2] = (unsigned char) (length >> 8);
+    header[3] = (unsigned char) length;
+    size = 4;
+  } else {
+    header[1] = 127;
+    for (i = 0; i < 8; i++)
+      header[2 + i] = (unsigned char) ((apr_uint64_t) length >> (56 - 8 * i));
+    size = 10;
+  }
+
+  if (!mask) {
+    lua_pushlstring(L, (const char*) header, size);
+    lua_pushvalue(L, payload);
+    lua_concat(L, 2);
+    return;
+  }
+
+  /* Frames sent by clients are masked with an unpredictable key. */
+  header[1] |= 0x80;
+  key = header + size;
+# if APR_HAS_RANDOM
+  if (apr_generate_random_bytes(key, 4) != APR_SUCCESS)
+# endif
+  {
+    apr_time_t now = apr_time_now();
+    memcpy(key, &now, 4);
+  }
+  size += 4;
+  luaL_buffinit(L, &buffer);
+  luaL_addlstring(&buffer, (const char*) header, size);
+  for (offset = 0; offset < length; offset += n) {
+    n = length - offset;
+    if (n > LUAL_BUFFERSIZE)
+      n = LUAL_BUFFERSIZE;
+    ws_mask((unsigned char*) luaL_prepbuffer(&buffer),
+        (const unsigned char*) data + offset, n, key, offset);
+    luaL_addsize(&buffer, n);
+  }
+  luaL_pushresult(&buffer);
+}
+
+/* socket:ws_read([limit]) -> opcode, payload {{{1
+ *
+ * Read the next WebSocket message or control frame from the socket. On
+ * success two values are returned: the string @opcode which is one of
+ * `'text'`, `'binary'`, `'close'`, `'ping'` or `'pong'` and the @payload
+ * string. Fragmented messages are joined together. For `'close'` frames the
+ * payload is the reason given by the peer and a third value is returned: the
+ * status code (a number, if the peer gave one).
+ *
+ * Control frames can arrive in the middle of fragmented messages; they're
+ * returned as soon as they've been received. It's up to you to answer `'ping'`
+ * frames with `'pong'` frames and `'close'` frames with a `'close'` frame.
+ *
+ * The optional number @limit is the maximum size of a message in bytes (it
+ * defaults to 16 MB). Masked frames (sent by clients) and unmasked frames
+ * (sent by servers) are both accepted. The payload of `'text'` messages is not
+ * checked to be valid UTF-8. On error a nil followed by an error message is
+ * returned; protocol errors leave the connection in an undefined state so you
+ * should close it.
+ */
+
+int socket_ws_read(lua_State *L)
+{
+  lua_apr_socket *socket;
+  ws_scan_result result;
+  lua_apr_buffer *B;
+  apr_status_t status;
+  unsigned char *data, payload[WS_MAX_CONTROL];
+  ws_header header;
+  size_t limit;
+
+  socket = ws_check(L, 1);
+  limit = (size_t) luaL_optnumber(L, 2, WS_MAX_MESSAGE);
+  B = &socket->input.buffer;
+
+  for (;;) {
+    switch (ws_scan(B, limit, &result)) {
+      case WS_SCAN_AGAIN:
+        status = fill_input(&socket->input);
+        if (status != APR_SUCCESS)
+          return push_error_status(L, status);
+        break;
+      case WS_SCAN_ERROR:
+        return push_error_message(L, result.error);
+      case WS_SCAN_MESSAGE:
+        data = (unsigned char*) B->data + B->index;
+        ws_unmask_message(data, result.offset);
+        lua_pushstring(L, result.opcode == WS_TEXT ? "text" : "binary");
+        lua_pushlstring(L, (const char*) data, result.length);
+        drain_input(&socket->input, result.offset);
+        return 2;
+      case WS_SCAN_CONTROL:
+        /* Copy the payload and cut the frame out of the buffer. */
+        data = (unsigned char*) B->data + B->index + result.offset;
+        ws_parse_header(data, result.size, &header);
+        if (header.masked)
+          ws_mask(payload, data + header.size, result.length, data + header.size - 4, 0);
+        else
+          memcpy(payload, data + header.size, result.length);
+        if (result.offset == 0)
+          drain_input(&socket->input, result.size);
+        else {
+          memmove(data, data + result.size, B->limit - B->index - result.offset - result.size);
+          B->limit -= result.size;
+        }
+        if (result.opcode == WS_CLOSE) {
+          lua_pushliteral(L, "close");
+          if (result.length >= 2) {
+            lua_pushlstring(L, (const char*) payload + 2, result.length - 2);
+            lua_pushinteger(L, (payload[0] << 8) | payload[1]);
+            return 3;
+          }
+          lua_pushliteral(L, "");
+          return 2;
+        }
+        lua_pushstring(L, result.opcode == WS_PING ? "ping" : "pong");
+        lua_pushlstring(L, (const char*) payload, result.length);
+        return 2;
+    }
+  }
+}
+
+/* socket:ws_write(opcode, payload [, mask [, final]]) -> status {{{1
+ *
+ * Send a WebSocket frame with the given @opcode (one of the strings `'text'`,
+ * `'binary'`, `'close'`, `'ping'`, `'pong'` or `'continuation'`) and @payload
+ * string. Clients must set @mask to true, servers must not mask their frames.
+ * To send a fragmented message set @final to false for all but the last frame
+ * and use the opcode `'continuation'` for all but the first frame. On success
+ * true is returned, otherwise a nil followed by an error message is returned.
+ * Like `socket:write()` a non-blocking socket may return true followed by the
+ * string `'buffered'`, in which case the rest of the frame is buffered and
+ * `socket:write()` flushes it, or the error code `'EAGAIN'` when nothing was
+ * written because too much output is already pending.
+ */
+
+int socket_ws_write(lua_State *L)
+{
+  lua_apr_socket *socket;
+  int opcode;
+
+  socket = ws_check(L, 1);
+  opcode = opcode_values[luaL_checkoption(L, 2, NULL, opcode_options)];
+  luaL_checkstring(L, 3);
+  lua_settop(L, 5);
+  push_frame(L, opcode, 3, lua_toboolean(L, 4), lua_isnil(L, 5) || lua_toboolean(L, 5));
+  lua_replace(L, 2);
+  lua_settop(L, 2);
+  return write_flush(L, &socket->output);
+}
+
+/* apr.ws_frame(opcode, payload [, mask [, final]]) -> frame {{{1
+ *
+ * Encode a WebSocket frame as a string. The arguments are the same as those
+ * of `socket:ws_write()`. This is useful to send the same message to many
+ * clients: encode it once and pass the frame to `socket:write()`.
+ */
+
+int lua_apr_ws_frame(lua_State *L)
+{
+  int opcode;
+
+  opcode = opcode_values[luaL_checkoption(L, 1, NULL, opcode_options)];
+  luaL_checkstring(L, 2);
+  lua_settop(L, 4);
+  push_frame(L, opcode, 2, lua_toboolean(L, 3), lua_isnil(L, 4) || lua_toboolean(L, 4));
+
+  return 1;
+}
+
+#if LUAAPR_HAVE_APRUTIL
+
+/* push_accept() -- push the Sec-WebSocket-Accept value for a key {{{2 */
+
+static void push_accept(lua_State *L, const char *key, size_t length)
+{
+  unsigned char digest[APR_SHA1_DIGESTSIZE];
+  char encoded[32]; /* apr_base64_encode_len(20) == 29 */
+  apr_sha1_ctx_t context;
+  int size;
+
+  apr_sha1_init(&context);
+  apr_sha1_update_binary(&context, (const unsigned char*) key, (unsigned int) length);
+  apr_sha1_update(&context, WS_GUID, sizeof(WS_GUID) - 1);
+  apr_sha1_final(digest, &context);
+  size = apr_base64_encode(encoded, (const char*) digest, sizeof digest);
+  if (size > 0 && encoded[size - 1] == '\0')
+    size--;
+  lua_pushlstring(L, encoded, size);
+}
+
+/* apr.ws_accept(key) -> accept {{{1
+ *
+ * Compute the value of the `Sec-WebSocket-Accept` header for the value of the
+ * `Sec-WebSocket-Key` header sent by a client. Clients can use this to check
+ * the response of a server.
+ */
+
+int lua_apr_ws_accept(lua_State *L)
+{
+  size_t length;
+  const char *key;
+
+  key = luaL_checklstring(L, 1, &length);
+  push_accept(L, key, length);
+
+  return 1;
+}
+
+/* apr.ws_handshake(headers) -> response {{{1
+ *
+ * Check the headers of a WebSocket upgrade request and generate the response
+ * that completes the handshake. The table @headers should have lowercase
+ * header names, like the tables produced by `apr.http_parser()` and
+ * `apr.http_server()`. On success the response (a string with the status line
+ * and headers) is returned, ready to be written to the socket. Otherwise a nil
+ * followed by an error message is returned.
+ */
+
+int lua_apr_ws_handshake(lua_State *L)
+{
+  const char *upgrade, *version, *key;
+  size_t length;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_getfield(L, 1, "upgrade");
+  upgrade = lua_tostring(L, -1);
+  lua_getfield(L, 1, "sec-websocket-version");
+  version = lua_tostring(L, -1);
+  lua_getfield(L, 1, "sec-websocket-key");
+  key = lua_tolstring(L, -1, &length);
+
+  if (upgrade == NULL || strcasecmp(upgrade, "websocket") != 0)
+    return push_error_message(L, "not a WebSocket upgrade request");
+  if (version == NULL || strcmp(version, "13") != 0)
+    return push_error_message(L, "unsupported WebSocket version");
+  if (key == NULL || length == 0)
+    return push_error_message(L, "missing Sec-WebSocket-Key header");
+
+  lua_pushliteral(L, "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: ");
+  push_accept(L, key, length);
+  lua_pushliteral(L, "\r\n\r\n");
+  lua_concat(L, 3);
+
+  return 1;
+}
+
+#endif
@@ -1,22 +1,414 @@
 /* Character encoding translation module for the Lua/APR binding.
  *
  * Author: Peter Odding <peter@peterodding.com>
- * Last Change: February 13, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
+ *
+ * Opening a translation context is a lot more expensive than translating a
+ * short string, so programs that convert many strings between the same
+ * character encodings should use a converter created by `apr.xlate_open()`
+ * (`apr.xlate()` keeps a cache of converters). Converters can also translate
+ * text that arrives in chunks, for example from a socket:
+ *
+ *     > converter = assert(apr.xlate_open('ISO-8859-1', 'UTF-8'))
+ *     > = converter:convert 'caf\233'
+ *     'café'
+ *     > for chunk in socket:lines() do
+ *     >>  output:write(assert(converter:feed(chunk)))
+ *     >> end
+ *     > output:write(assert(converter:finish()))
+ *
+ * Translations between identical character encodings only validate the input
+ * and translations between [ASCII compatible] [ascii_compatible] encodings
+ * return text that consists entirely of ASCII characters as is, without
+ * involving iconv at all.
+ *
+ * [ascii_compatible]: http://en.wikipedia.org/wiki/ASCII#Character_set
  */
 
 #include "lua_apr.h"
+#include <apr_lib.h>
+#include <apr_portable.h>
+#include <apr_strings.h>
 #include <apr_xlate.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Registry key of the table with converters used by apr.xlate(). */
+#define XLATE_CACHE_KEY "Lua/APR character set converters"
+
+/* Output buffers larger than this are released after each translation. */
+#define XLATE_BUFSIZE (1024 * 64)
+
+/* Longest partial multibyte sequence carried between calls to feed(). */
+#define XLATE_PENDING_MAX 16
+
+/* How a converter translates its input. */
+#define XLATE_ICONV 0 /* translate using apr_xlate_conv_buffer() */
+#define XLATE_COPY  1 /* identical single byte encodings: nothing to do */
+#define XLATE_ASCII 2 /* ASCII to an ASCII compatible encoding: validate */
+#define XLATE_UTF8  3 /* UTF-8 to UTF-8: validate */
 
 /* Internal functions {{{1 */
 
+typedef struct {
+  lua_apr_refobj header;
+  apr_pool_t *pool;
+  apr_xlate_t *convset;
+  int mode, ascii_compatible;
+  apr_size_t min_from, max_to;
+  char *buffer;
+  apr_size_t size, used;
+  unsigned char pending[XLATE_PENDING_MAX];
+  apr_size_t pending_len;
+} lua_apr_xlate_object;
+
+/* Classes of character encodings recognized by name. */
+typedef enum {
+  CHARSET_UNKNOWN,
+  CHARSET_ASCII,
+  CHARSET_UTF8,
+  CHARSET_SINGLE_BYTE, /* ASCII compatible single byte encodings */
+  CHARSET_UTF16,
+  CHARSET_UTF32
+} charset_class;
+
 static const char *check_codepage(lua_State *L, int idx)
 {
   const char *codepage = luaL_checkstring(L, idx);
   return strcmp(codepage, "locale") == 0 ? APR_LOCALE_CHARSET : codepage;
 }
 
+/* classify_charset() -- recognize common character encodings by name {{{2 */
+
+static charset_class classify_charset(const char *name)
+{
+  char normalized[32];
+  apr_size_t i = 0;
+
+  /* Ignore case and punctuation, so "utf-8", "UTF8" and "Utf_8" are equal. */
+  for (; *name != '\0' && i < sizeof normalized - 1; name++)
+    if (*name != '-' && *name != '_' && *name != ' ')
+      normalized[i++] = (char) apr_toupper(*name);
+  if (*name != '\0')
+    return CHARSET_UNKNOWN;
+  normalized[i] = '\0';
+
+  if (strcmp(normalized, "UTF8") == 0)
+    return CHARSET_UTF8;
+  if (strcmp(normalized, "ASCII") == 0 || strcmp(normalized, "USASCII") == 0
+      || strcmp(normalized, "ANSIX3.41968") == 0 || strcmp(normalized, "646") == 0)
+    return CHARSET_ASCII;
+  if (strncmp(normalized, "ISO8859", 7) == 0 || strncmp(normalized, "LATIN", 5) == 0
+      || strncmp(normalized, "WINDOWS125", 10) == 0 || strncmp(normalized, "CP125", 5) == 0
+      || strncmp(normalized, "KOI8", 4) == 0 || strcmp(normalized, "CP437") == 0
+      || strcmp(normalized, "CP850") == 0)
+    return CHARSET_SINGLE_BYTE;
+  if (strncmp(normalized, "UTF16", 5) == 0 || strncmp(normalized, "UCS2", 4) == 0)
+    return CHARSET_UTF16;
+  if (strncmp(normalized, "UTF32", 5) == 0 || strncmp(normalized, "UCS4", 4) == 0)
+    return CHARSET_UTF32;
+
+  return CHARSET_UNKNOWN;
+}
+
+/* is_ascii() -- check whether a string consists of ASCII characters {{{2 */
+
+static int is_ascii(const char *s, apr_size_t len)
+{
+  apr_uint64_t word, bits = 0;
+  apr_size_t i = 0;
+
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&word, s + i, 8);
+    bits |= word;
+  }
+  for (; i < len; i++)
+    bits |= (unsigned char) s[i];
+
+  return (bits & APR_UINT64_C(0x8080808080808080)) == 0;
+}
+
+/* utf8_valid() -- get the length of the valid UTF-8 prefix of a string {{{2
+ *
+ * Returns the length of the longest prefix of @s that consists of complete
+ * and valid UTF-8 sequences. When the rest of @s is the start of a valid
+ * sequence that was cut off @incomplete is set to true.
+ */
+
+static apr_size_t utf8_valid(const unsigned char *s, apr_size_t len, int *incomplete)
+{
+  apr_size_t i = 0, n, j;
+  unsigned char c, lo, hi;
+
+  *incomplete = 0;
+  while (i < len) {
+    c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+      n = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+      n = 3;
+      if (c == 0xE0) lo = 0xA0; /* overlong */
+      if (c == 0xED) hi = 0x9F; /* surrogates */
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 4;
+      if (c == 0xF0) lo = 0x90; /* overlong */
+      if (c == 0xF4) hi = 0x8F; /* above U+10FFFF */
+    } else
+      return i;
+    for (j = 1; j < n; j++, lo = 0x80, hi = 0xBF) {
+      if (i + j == len) {
+        *incomplete = 1;
+        return i;
+      }
+      if (s[i + j] < lo || s[i + j] > hi)
+        return i;
+    }
+    i += n;
+  }
+
+  return i;
+}
+
+/* xlate_reserve() -- make room in the output buffer of a converter {{{2 */
+
+static apr_status_t xlate_reserve(lua_apr_xlate_object *X, apr_size_t needed)
+{
+  apr_size_t size;
+  char *buffer;
+
+  if (X->size - X->used >= needed)
+    return APR_SUCCESS;
+  size = X->size * 2;
+  if (size < X->used + needed)
+    size = X->used + needed;
+  buffer = realloc(X->buffer, size);
+  if (buffer == NULL)
+    return APR_ENOMEM;
+  X->buffer = buffer;
+  X->size = size;
+
+  return APR_SUCCESS;
+}
+
+/* xlate_append() -- copy validated input to the output buffer {{{2 */
+
+static apr_status_t xlate_append(lua_apr_xlate_object *X, const void *data, apr_size_t length)
+{
+  apr_status_t status = xlate_reserve(X, length);
+  if (status == APR_SUCCESS) {
+    memcpy(X->buffer + X->used, data, length);
+    X->used += length;
+  }
+  return status;
+}
+
+/* xlate_run() -- translate input, growing the output buffer as needed {{{2
+ *
+ * Returns APR_INCOMPLETE when the input ends in a partial multibyte sequence,
+ * in which case @remaining is set to the length of the partial sequence.
+ */
+
+static apr_status_t xlate_run(lua_apr_xlate_object *X, const char *input,
+    apr_size_t length, apr_size_t *remaining)
+{
+  apr_size_t todo = length, unused;
+  apr_status_t status;
+
+  /* Presize the buffer for the worst case of the known character encodings. */
+  status = xlate_reserve(X, length / X->min_from * X->max_to + 16);
+  while (status == APR_SUCCESS) {
+    unused = X->size - X->used;
+    status = apr_xlate_conv_buffer(X->convset, input + (length - todo), &todo,
+        X->buffer + X->used, &unused);
+    X->used = X->size - unused;
+    if (status != APR_SUCCESS || todo == 0)
+      break;
+    /* The output buffer is full. */
+    status = xlate_reserve(X, X->size);
+  }
+  *remaining = todo;
+
+  return status;
+}
+
+/* xlate_flush() -- write the sequence that ends a stateful encoding {{{2 */
+
+static apr_status_t xlate_flush(lua_apr_xlate_object *X)
+{
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t unused;
+
+  if (X->mode == XLATE_ICONV) {
+    status = xlate_reserve(X, 16);
+    if (status == APR_SUCCESS) {
+      unused = X->size - X->used;
+      status = apr_xlate_conv_buffer(X->convset, NULL, NULL, X->buffer + X->used, &unused);
+      X->used = X->size - unused;
+    }
+  }
+
+  return status;
+}
+
+/* xlate_result() -- push the output of a converter {{{2 */
+
+static int xlate_result(lua_State *L, lua_apr_xlate_object *X, apr_status_t status)
+{
+  int pushed = 1;
+
+  if (status == APR_SUCCESS)
+    lua_pushlstring(L, X->buffer != NULL ? X->buffer : "", X->used);
+  else
+    pushed = push_error_status(L, status);
+  X->used = 0;
+  if (X->size > XLATE_BUFSIZE) {
+    free(X->buffer);
+    X->buffer = NULL;
+    X->size = 0;
+  }
+
+  return pushed;
+}
+
+/* xlate_validate() -- translate without iconv {{{2
+ *
+ * Sets @length to the length of the prefix of @input that was translated and
+ * @incomplete to true when the rest of @input is a partial UTF-8 sequence.
+ */
+
+static apr_status_t xlate_validate(lua_apr_xlate_object *X, const char *input,
+    apr_size_t *length, int *incomplete)
+{
+  apr_size_t valid = *length;
+
+  *incomplete = 0;
+  if (X->mode == XLATE_ASCII && !is_ascii(input, *length))
+    return APR_EINVAL;
+  if (X->mode == XLATE_UTF8) {
+    valid = utf8_valid((const unsigned char*)input, *length, incomplete);
+    if (valid < *length && !*incomplete)
+      return APR_EINVAL;
+  }
+  *length = valid;
+
+  return APR_SUCCESS;
+}
+
+/* xlate_open() -- create a converter object {{{2 */
+
+static lua_apr_xlate_object *xlate_open(lua_State *L, int from_idx, int to_idx, apr_status_t *status)
+{
+  lua_apr_xlate_object *X;
+  const char *frompage, *topage;
+  charset_class from, to;
+
+  frompage = check_codepage(L, from_idx);
+  topage = check_codepage(L, to_idx);
+  X = new_object(L, &lua_apr_xlate_type);
+  if (X == NULL)
+    raise_error_memory(L);
+  *status = apr_pool_create(&X->pool, NULL);
+  if (*status != APR_SUCCESS)
+    return NULL;
+
+  /* Resolve the character encoding of the current locale to its name. */
+  from = classify_charset(frompage == APR_LOCALE_CHARSET ? apr_os_locale_encoding(X->pool) : frompage);
+  to = classify_charset(topage == APR_LOCALE_CHARSET ? apr_os_locale_encoding(X->pool) : topage);
+  X->min_from = from == CHARSET_UTF16 ? 2 : from == CHARSET_UTF32 ? 4 : 1;
+  X->max_to = to == CHARSET_ASCII || to == CHARSET_SINGLE_BYTE ? 1 : 4;
+  X->ascii_compatible = (from == CHARSET_ASCII || from == CHARSET_UTF8 || from == CHARSET_SINGLE_BYTE)
+                     && (to == CHARSET_ASCII || to == CHARSET_UTF8 || to == CHARSET_SINGLE_BYTE);
+
+  if (from == CHARSET_ASCII && X->ascii_compatible)
+    X->mode = XLATE_ASCII;
+  else if (from == CHARSET_UTF8 && to == CHARSET_UTF8)
+    X->mode = XLATE_UTF8;
+  else if (from == CHARSET_SINGLE_BYTE && to == CHARSET_SINGLE_BYTE
+      && frompage != APR_LOCALE_CHARSET && topage != APR_LOCALE_CHARSET
+      && classify_charset(frompage) == classify_charset(topage)
+      && apr_strnatcasecmp(frompage, topage) == 0)
+    X->mode = XLATE_COPY;
+  else {
+    X->mode = XLATE_ICONV;
+    *status = apr_xlate_open(&X->convset, topage, frompage, X->pool);
+    if (*status != APR_SUCCESS)
+      return NULL;
+  }
+
+  return X;
+}
+
+/* check_xlate() {{{2 */
+
+static lua_apr_xlate_object *check_xlate(lua_State *L, int idx)
+{
+  lua_apr_xlate_object *X = check_object(L, idx, &lua_apr_xlate_type);
+  if (X->pool == NULL)
+    luaL_error(L, "attempt to use a closed converter");
+  return X;
+}
+
+/* close_xlate() {{{2 */
+
+static void close_xlate(lua_apr_xlate_object *X)
+{
+  if (object_collectable((lua_apr_refobj*)X) && X->pool != NULL) {
+    apr_pool_destroy(X->pool);
+    free(X->buffer);
+  }
+  X->pool = NULL;
+  X->convset = NULL;
+  X->buffer = NULL;
+  X->size = X->used = X->pending_len = 0;
+}
+
+/* xlate_convert() -- translate a complete string {{{2 */
+
+static int xlate_convert(lua_State *L, lua_apr_xlate_object *X, int idx)
+{
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t length, remaining;
+  const char *input;
+  int incomplete;
+
+  input = luaL_checklstring(L, idx, &length);
+
+  /* Apparently apr-iconv doesn't like empty input strings. */
+  if (length == 0) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+
+  /* Return the input as is when there's nothing to translate. */
+  if (X->mode != XLATE_ICONV) {
+    status = xlate_validate(X, input, &length, &incomplete);
+    if (status == APR_SUCCESS && incomplete)
+      status = APR_INCOMPLETE;
+    if (status != APR_SUCCESS)
+      return push_error_status(L, status);
+    lua_pushvalue(L, idx);
+    return 1;
+  } else if (X->ascii_compatible && is_ascii(input, length)) {
+    lua_pushvalue(L, idx);
+    return 1;
+  }
+
+  X->used = 0;
+  status = xlate_run(X, input, length, &remaining);
+  /* Correctly terminate the output for some multibyte character set encodings. */
+  if (status == APR_SUCCESS)
+    status = xlate_flush(X);
+
+  return xlate_result(L, X, status);
+}
+
 /* apr.xlate(input, from, to) -> translated {{{1
  *
  * Translate a string of text from one [character encoding] [charenc] to
@@ -24,7 +416,8 @@ static const char *check_codepage(lua_State *L, int idx)
  * target character encoding. The special value `'locale'` indicates the
  * character set of the [current locale] [locale]. On success the translated
  * string is returned, otherwise a nil followed by an error message is
- * returned.
+ * returned. The converters used by this function are cached, see
+ * `apr.xlate_open()` for details.
  *
  * Which character encodings are supported by `apr.xlate()` is system dependent
  * because APR can use both the system's [iconv] [iconv] implementation and the
@@ -43,80 +436,239 @@ static const char *check_codepage(lua_State *L, int idx)
 
 int lua_apr_xlate(lua_State *L)
 {
-  apr_pool_t *pool;
-  const char *input, *frompage, *topage;
-  size_t length, bufsize, extra;
-  apr_xlate_t *convset;
+  lua_apr_xlate_object *X = NULL;
   apr_status_t status;
-  apr_size_t todo, unused;
-  char *output, *temp;
 
-  apr_pool_create(&pool,to_pool(L));
-  input = luaL_checklstring(L, 1, &length);
-  frompage = check_codepage(L, 2);
-  topage = check_codepage(L, 3);
+  luaL_checkstring(L, 1);
+  luaL_checkstring(L, 2);
+  luaL_checkstring(L, 3);
+  lua_settop(L, 3);
 
-  /* Apparently apr-iconv doesn't like empty input strings. */
-  if (length == 0) {
-    lua_pushliteral(L, "");
-    return 1;
+  /* Get the cache of converters (a table with weak values). */
+  lua_getfield(L, LUA_REGISTRYINDEX, XLATE_CACHE_KEY);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, XLATE_CACHE_KEY);
   }
 
-  /* Initialize the output buffer and related variables. */
-  output = malloc(bufsize = length);
-  if (output == NULL) {
-    status = APR_ENOMEM;
-    goto fail;
+  /* Find or create a converter. Stateful encodings are flushed after every
+   * translation and converters aren't shared between Lua states, so cached
+   * converters can be reused as is. */
+  lua_pushfstring(L, "%s\n%s", lua_tostring(L, 2), lua_tostring(L, 3));
+  lua_pushvalue(L, -1);
+  lua_rawget(L, 4);
+  if (object_has_type(L, 6, &lua_apr_xlate_type, 0))
+    X = lua_touserdata(L, 6);
+  if (X == NULL || X->pool == NULL || X->pending_len > 0) {
+    lua_pop(L, 1);
+    X = xlate_open(L, 2, 3, &status);
+    if (X == NULL)
+      return push_error_status(L, status);
+    lua_pushvalue(L, 5);
+    lua_pushvalue(L, 6);
+    lua_rawset(L, 4);
   }
-  todo = unused = length;
 
-  /* Initialize the translation context. */
-  status = apr_xlate_open(&convset, topage, frompage, pool);
-  if (status != APR_SUCCESS)
-    goto fail;
+  return xlate_convert(L, X, 1);
+}
 
-  /* Perform the conversion in one or more passes. */
-  for (;;) {
-    status = apr_xlate_conv_buffer(convset,
-        &input[length - todo], &todo,
-        &output[bufsize - unused], &unused);
-    if (status != APR_SUCCESS)
-      goto fail;
-    else if (todo == 0)
+/* apr.xlate_open(from, to) -> converter {{{1
+ *
+ * Create a converter that translates text from the [character encoding]
+ * [charenc] @from to the character encoding @to (see `apr.xlate()`). On
+ * success the converter object is returned, otherwise a nil followed by an
+ * error message is returned. Converters keep their translation context and
+ * output buffer around between calls, which makes them a lot faster than
+ * `apr.xlate()` when you're translating many short strings.
+ */
+
+int lua_apr_xlate_open(lua_State *L)
+{
+  apr_status_t status;
+
+  lua_settop(L, 2);
+  if (xlate_open(L, 1, 2, &status) == NULL)
+    return push_error_status(L, status);
+
+  return 1;
+}
+
+/* converter:convert(input) -> translated {{{1
+ *
+ * Translate the complete string @input. On success the translated string is
+ * returned, otherwise a nil followed by an error message is returned. Don't
+ * mix this method with `converter:feed()` unless `converter:finish()` was
+ * called in between.
+ */
+
+static int xlate_convert_method(lua_State *L)
+{
+  return xlate_convert(L, check_xlate(L, 1), 2);
+}
+
+/* converter:feed(chunk) -> translated {{{1
+ *
+ * Translate the string @chunk, which can end in the middle of a multibyte
+ * sequence: The partial sequence is kept by the converter and translated
+ * together with the next chunk. On success the translated text available so
+ * far is returned (possibly an empty string), otherwise a nil followed by an
+ * error message is returned.
+ */
+
+static int xlate_feed_method(lua_State *L)
+{
+  lua_apr_xlate_object *X;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t length, valid, remaining;
+  const char *input;
+  int incomplete;
+
+  X = check_xlate(L, 1);
+  input = luaL_checklstring(L, 2, &length);
+  X->used = 0;
+
+  /* Complete the partial sequence left over from the previous chunk. */
+  while (X->pending_len > 0 && length > 0 && status == APR_SUCCESS) {
+    if (X->pending_len == XLATE_PENDING_MAX) {
+      status = APR_EINVAL;
       break;
-    /* Grow the output buffer by one third. */
-    extra = bufsize < 10 ? 10 : bufsize / 3;
-    temp = realloc(output, bufsize + extra);
-    if (temp == NULL) {
-      status = APR_ENOMEM;
-      goto fail;
     }
-    output = temp;
-    bufsize += extra;
-    unused += extra;
+    X->pending[X->pending_len++] = *input++;
+    length--;
+    if (X->mode == XLATE_ICONV) {
+      status = xlate_run(X, (const char*)X->pending, X->pending_len, &remaining);
+    } else {
+      valid = X->pending_len;
+      status = xlate_validate(X, (const char*)X->pending, &valid, &incomplete);
+      if (status == APR_SUCCESS)
+        status = xlate_append(X, X->pending, valid);
+      remaining = X->pending_len - valid;
+    }
+    if (status == APR_INCOMPLETE)
+      status = APR_SUCCESS;
+    memmove(X->pending, X->pending + X->pending_len - remaining, remaining);
+    X->pending_len = remaining;
   }
 
-  /* Correctly terminate the output buffer for some multibyte character set encodings. */
-  status = apr_xlate_conv_buffer(convset, NULL, NULL,
-      &output[bufsize - unused], &unused);
-  if (status != APR_SUCCESS)
-    goto fail;
+  if (status == APR_SUCCESS && length > 0 && X->pending_len == 0) {
+    if (X->mode != XLATE_ICONV) {
+      valid = length;
+      status = xlate_validate(X, input, &valid, &incomplete);
+      remaining = length - valid;
+      if (status == APR_SUCCESS && remaining == 0 && X->used == 0) {
+        /* Nothing to translate and nothing to prepend. */
+        lua_pushvalue(L, 2);
+        return 1;
+      }
+      if (status == APR_SUCCESS)
+        status = xlate_append(X, input, valid);
+    } else if (X->ascii_compatible && X->used == 0 && is_ascii(input, length)) {
+      lua_pushvalue(L, 2);
+      return 1;
+    } else {
+      status = xlate_run(X, input, length, &remaining);
+      if (status == APR_INCOMPLETE)
+        status = remaining <= XLATE_PENDING_MAX ? APR_SUCCESS : APR_EINVAL;
+    }
+    if (status == APR_SUCCESS) {
+      memcpy(X->pending, input + length - remaining, remaining);
+      X->pending_len = remaining;
+    }
+  }
 
-  /* Close the translation context. */
-  status = apr_xlate_close(convset);
   if (status != APR_SUCCESS)
-    goto fail;
-
-  lua_pushlstring(L, output, bufsize - unused);
-  free(output);
-  /* I'm not sure whether any resources remain in memory after the call to
-   * apr_xlate_close(). Just to make sure, we clear the global memory pool
-   * now instead of waiting until the next time it's used. */
-  apr_pool_destroy(pool);
+    X->pending_len = 0;
+
+  return xlate_result(L, X, status);
+}
+
+/* converter:finish() -> translated {{{1
+ *
+ * Finish translating the chunks given to `converter:feed()`. On success the
+ * remaining output is returned (for stateful encodings this is the sequence
+ * that returns to the initial state), otherwise a nil followed by an error
+ * message is returned, for example when the last chunk ended in a partial
+ * multibyte sequence. Afterwards the converter can be used again.
+ */
+
+static int xlate_finish_method(lua_State *L)
+{
+  lua_apr_xlate_object *X;
+  apr_status_t status;
+
+  X = check_xlate(L, 1);
+  X->used = 0;
+  status = X->pending_len > 0 ? APR_INCOMPLETE : xlate_flush(X);
+  X->pending_len = 0;
+
+  return xlate_result(L, X, status);
+}
+
+/* converter:close() -> status {{{1
+ *
+ * Release the translation context of the converter. Returns true on success.
+ */
+
+static int xlate_close_method(lua_State *L)
+{
+  close_xlate(check_xlate(L, 1));
+  lua_pushboolean(L, 1);
   return 1;
+}
+
+/* converter:__tostring() {{{1 */
+
+static int xlate_tostring(lua_State *L)
+{
+  lua_apr_xlate_object *X = check_object(L, 1, &lua_apr_xlate_type);
 
-fail:
-  free(output);
-  apr_pool_destroy(pool);
-  return push_status(L, status);
+  if (X->pool != NULL)
+    lua_pushfstring(L, "%s (%p)", lua_apr_xlate_type.friendlyname, X);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_xlate_type.friendlyname);
+
+  return 1;
+}
+
+/* converter:__gc() {{{1 */
+
+static int xlate_gc(lua_State *L)
+{
+  lua_apr_xlate_object *X = check_object(L, 1, &lua_apr_xlate_type);
+  close_xlate(X);
+  release_object((lua_apr_refobj*)X);
+  return 0;
 }
+
+/* }}}1 */
+
+static luaL_Reg xlate_methods[] = {
+  { "convert", xlate_convert_method },
+  { "feed", xlate_feed_method },
+  { "finish", xlate_finish_method },
+  { "close", xlate_close_method },
+  { NULL, NULL }
+};
+
+static luaL_Reg xlate_metamethods[] = {
+  { "__tostring", xlate_tostring },
+  { "__eq", objects_equal },
+  { "__gc", xlate_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_xlate_type = {
+  "lua_apr_xlate_object*",      /* metatable name in registry */
+  "character set converter",    /* friendly object name */
+  sizeof(lua_apr_xlate_object), /* structure size */
+  xlate_methods,                /* methods table */
+  xlate_metamethods             /* metamethods table */
+};
+
+/* vim: set ts=2 sw=2 et tw=79 fen fdm=marker : */
@@ -3,7 +3,7 @@
  * Authors:
  *  - zhiguo zhao <zhaozg@gmail.com>
  *  - Peter Odding <peter@peterodding.com>
- * Last Change: June 16, 2011
+ * Last Change: October 18, 2026
  * Homepage: http://peterodding.com/code/lua/apr/
  * License: MIT
  *
@@ -20,28 +20,65 @@
  *    `xml_parser:done()`
  * 4. Get the parse information by calling `xml_parser:getinfo()`
  *
- * Right now the only way to get the parse information is by calling
- * `xml_parser:getinfo()` which converts the information to a Lua table
- * following the [Lua object model] [lom] defined by [LuaExpat] [lxp]. The Lua
- * object model is a mapping of XML to Lua tables that's not 100% complete
- * (e.g. it doesn't include namespaces) but makes it a lot easier to deal with
- * XML in Lua.
+ * There are two ways to get the parse information. `xml_parser:getinfo()`
+ * converts the whole document to a Lua table following the [Lua object model]
+ * [lom] defined by [LuaExpat] [lxp]. The Lua object model is a mapping of XML
+ * to Lua tables that's not 100% complete (e.g. it doesn't include namespaces)
+ * but makes it a lot easier to deal with XML in Lua.
  *
- * In the future this module might expose the full XML parse tree to Lua as
- * userdata objects, so that Lua has access to all parse information. This
- * would also make it possible to expose the [apr\_xml\_to\_text()]
- * [xml_to_text] function.
+ * Alternatively `xml_parser:root()` and `xml_parser:select()` give access to
+ * the parse tree through element objects, which only convert the names,
+ * attributes, text and children that you actually ask for:
+ *
+ *     > parser = apr.xml()
+ *     > parser:feed '<feed><entry><title>One</title></entry><entry><title>Two</title></entry></feed>'
+ *     > parser:done()
+ *     > for _, title in ipairs(parser:select 'feed/entry/title') do print(title:text()) end
+ *     One
+ *     Two
+ *
+ * To produce XML you can use `apr.xml_encode()`, which converts tables in the
+ * format of `xml_parser:getinfo()` to XML, or `apr.xml_writer()` to write
+ * elements one at a time. Both escape text in C and can write directly to the
+ * buffer of a file, socket or shared memory segment.
+ *
+ * Because `apr.xml()` keeps the whole document in memory (twice, once the
+ * parse tree and once the Lua tables) it's not suitable for large documents.
+ * For those you can use `apr.xml_stream()` which calls Lua functions for the
+ * start and end of elements and for text as the document is fed to the
+ * parser, so memory usage doesn't depend on the size of the document:
+ *
+ *     > stream = apr.xml_stream {
+ *     >>   start = function(name, attr) print('start', name, attr.id) end,
+ *     >>   ['end'] = function(name) print('end', name) end,
+ *     >>   text = function(text) print('text', text) end,
+ *     >> }
+ *     > = stream:feed '<item id="1">one</item>'
+ *     start   item    1
+ *     text    one
+ *     end     item
+ *     true
+ *
+ * XML streams are only available when the Lua/APR binding was built with
+ * [Expat] [expat] (see `LUA_APR_HAVE_EXPAT` in the makefiles).
  *
  * [xml]: http://en.wikipedia.org/wiki/XML
  * [lxp]: http://www.keplerproject.org/luaexpat/
  * [lom]: http://www.keplerproject.org/luaexpat/lom.html
  * [dom]: http://en.wikipedia.org/wiki/XML#Document_Object_Model_.28DOM.29
- * [xml_to_text]: http://apr.apache.org/docs/apr/trunk/group___a_p_r___util___x_m_l.html#g4485edce130dc1e9a3da3a633a75ffb3
+ * [expat]: http://expat.sourceforge.net/
  */
 
 #include "lua_apr.h"
 #include <apr_xml.h>
 #include <apr_xlate.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if LUA_APR_HAVE_EXPAT
+#include <expat.h>
+#include <limits.h>
+#endif
 
 typedef struct {
   lua_apr_refobj header;
@@ -96,9 +133,30 @@ static void reverse_table(lua_State *L, int idx, int len)
   }
 }
 
-static void dump_xml(lua_State *L, apr_xml_elem *elem)
+/* push_attributes() -- convert the attributes of an element to a table {{{2 */
+
+static void push_attributes(lua_State *L, apr_xml_elem *elem)
 {
   apr_xml_attr *attr;
+  int i;
+
+  lua_newtable(L);
+  for (i = 1, attr = elem->attr; attr != NULL; attr = attr->next, i++) {
+    lua_pushstring(L, attr->name);
+    lua_rawseti(L, -2, i);
+    lua_pushstring(L, attr->value);
+    lua_setfield(L, -2, attr->name);
+  }
+  /* XXX Reverse the order of the attributes in the array part of the table.
+   * The apr_xml.h header doesn't document that attributes are reversed, in
+   * fact the apr_xml_elem.attr field is documented as the "first attribute",
+   * but in the definition of start_handler() in the apr_xml.c implementation
+   * it _is_ mentioned that attributes end up in reverse order. */
+  reverse_table(L, lua_gettop(L), i - 1);
+}
+
+static void dump_xml(lua_State *L, apr_xml_elem *elem)
+{
   apr_xml_elem *child;
   apr_text *text;
   int i;
@@ -110,24 +168,7 @@ static void dump_xml(lua_State *L, apr_xml_elem *elem)
     lua_rawset(L, -3);
   }
   if (elem->attr != NULL) {
-    lua_newtable(L);
-    i = 1;
-    attr = elem->attr;
-    while (attr != NULL) {
-      lua_pushstring(L, attr->name);
-      lua_rawseti(L, -2, i);
-      lua_pushstring(L, attr->name);
-      lua_pushstring(L, attr->value);
-      lua_rawset(L, -3);
-      attr = attr->next;
-      i++;
-    }
-    /* XXX Reverse the order of the attributes in the array part of the table.
-     * The apr_xml.h header doesn't document that attributes are reversed, in
-     * fact the apr_xml_elem.attr field is documented as the "first attribute",
-     * but in the definition of start_handler() in the apr_xml.c implementation
-     * it _is_ mentioned that attributes end up in reverse order. */
-    reverse_table(L, lua_gettop(L), i - 1);
+    push_attributes(L, elem);
     lua_setfield(L, -2, "attr");
   }
   i = 1;
@@ -155,11 +196,166 @@ static void xml_close_real(lua_apr_xml_object *object)
 {
   if (object->parser != NULL) {
     object->parser = NULL;
+    object->doc = NULL;
     apr_pool_destroy(object->pool);
     object->pool = NULL;
   }
 }
 
+/* Element objects refer to the parse tree of an XML parser object, which is
+ * kept alive by storing it in the environment table shared between the parser
+ * and all of its elements. */
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_xml_object *parser;
+  apr_xml_elem *elem;
+} lua_apr_xml_elem_object;
+
+/* Context for evaluating path queries. */
+typedef struct {
+  lua_State *L;
+  int owner_idx, result_idx, count;
+  lua_apr_xml_object *parser;
+} xml_select_t;
+
+/* check_xml_elem() -- get an element from the Lua stack {{{2 */
+
+static lua_apr_xml_elem_object *check_xml_elem(lua_State *L, int idx)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_object(L, idx, &lua_apr_xml_elem_type);
+  if (object->parser->doc == NULL)
+    luaL_error(L, "attempt to use an element of a closed XML document");
+
+  return object;
+}
+
+/* share_document() -- prepare an XML parser for creating elements {{{2 */
+
+static void share_document(lua_State *L, int idx)
+{
+  object_env_private(L, idx);
+  lua_pushvalue(L, idx);
+  lua_setfield(L, -2, "document");
+  lua_pop(L, 1);
+}
+
+/* push_xml_elem() -- create an element object {{{2
+ *
+ * The object at @owner_idx is the XML parser (after share_document()) or
+ * another element of the same document.
+ */
+
+static void push_xml_elem(lua_State *L, int owner_idx, lua_apr_xml_object *parser, apr_xml_elem *elem)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = new_object(L, &lua_apr_xml_elem_type);
+  if (object == NULL)
+    raise_error_memory(L);
+  object->parser = parser;
+  object->elem = elem;
+  lua_getfenv(L, owner_idx);
+  lua_setfenv(L, -2);
+}
+
+/* append_text() -- add the text in an element to a buffer {{{2 */
+
+static void append_text(luaL_Buffer *B, apr_xml_elem *elem)
+{
+  apr_xml_elem *child;
+  apr_text *text;
+
+  for (text = elem->first_cdata.first; text != NULL; text = text->next)
+    luaL_addstring(B, text->text);
+  for (child = elem->first_child; child != NULL; child = child->next) {
+    append_text(B, child);
+    for (text = child->following_cdata.first; text != NULL; text = text->next)
+      luaL_addstring(B, text->text);
+  }
+}
+
+/* select_path() -- evaluate a path query {{{2
+ *
+ * Matches the first step of @path against the elements @first and its next
+ * siblings (or the attributes of @context) and recurses for the other steps.
+ */
+
+static void select_path(xml_select_t *S, apr_xml_elem *context, apr_xml_elem *first, const char *path)
+{
+  lua_State *L = S->L;
+  apr_xml_elem *elem;
+  apr_xml_attr *attr;
+  const char *next;
+  size_t length;
+
+  next = strchr(path, '/');
+  length = next != NULL ? (size_t)(next - path) : strlen(path);
+
+  if (*path == '@') {
+    if (context == NULL)
+      return;
+    for (attr = context->attr; attr != NULL; attr = attr->next) {
+      if (strlen(attr->name) == length - 1 && memcmp(attr->name, path + 1, length - 1) == 0) {
+        lua_pushstring(L, attr->value);
+        lua_rawseti(L, S->result_idx, ++S->count);
+        break;
+      }
+    }
+    return;
+  }
+
+  for (elem = first; elem != NULL; elem = elem->next) {
+    if ((length == 1 && *path == '*')
+        || (strlen(elem->name) == length && memcmp(elem->name, path, length) == 0)) {
+      if (next != NULL) {
+        select_path(S, elem, elem->first_child, next + 1);
+      } else {
+        push_xml_elem(L, S->owner_idx, S->parser, elem);
+        lua_rawseti(L, S->result_idx, ++S->count);
+      }
+    }
+  }
+}
+
+/* push_selection() -- push the results of a path query {{{2 */
+
+static int push_selection(lua_State *L, int owner_idx, lua_apr_xml_object *parser, apr_xml_elem *context, int path_idx)
+{
+  xml_select_t S;
+  const char *path, *step, *next;
+
+  path = luaL_checkstring(L, path_idx);
+  /* Absolute paths start at the root element. */
+  if (*path == '/') {
+    path++;
+    context = NULL;
+  }
+  /* Check the syntax of the path so select_path() doesn't have to. */
+  for (step = path; ; step = next + 1) {
+    next = strchr(step, '/');
+    if (step == next || *step == '\0' || (*step == '@' && (next != NULL || step[1] == '\0')))
+      luaL_argerror(L, path_idx, "invalid path");
+    if (next == NULL)
+      break;
+  }
+
+  S.L = L;
+  S.owner_idx = owner_idx;
+  S.parser = parser;
+  S.count = 0;
+  lua_newtable(L);
+  S.result_idx = lua_gettop(L);
+  if (context != NULL)
+    select_path(&S, context, context->first_child, path);
+  else
+    select_path(&S, NULL, parser->doc->root, path);
+
+  return 1;
+}
+
 /* apr.xml([filename]) -> xml_parser {{{1
  *
  * Create an XML parser. If the optional string @filename is given, the file
@@ -277,6 +473,49 @@ static int xml_getinfo(lua_State *L)
   return 1;
 }
 
+/* xml_parser:root() -> element {{{1
+ *
+ * Get the root element of the parsed document as an element object, see
+ * `element:name()` and the other methods of elements.
+ */
+
+static int xml_root(lua_State *L)
+{
+  lua_apr_xml_object *object;
+
+  object = check_xml_parser(L, 1, CHECK_DOCUMENT);
+  share_document(L, 1);
+  push_xml_elem(L, 1, object, object->doc->root);
+
+  return 1;
+}
+
+/* xml_parser:select(path) -> elements {{{1
+ *
+ * Find the elements in the parsed document that match the string @path and
+ * return them in a table, in document order. A path consists of element names
+ * separated by slashes, where the first name is matched against the root
+ * element. The name `*` matches any element. When the last step of the path
+ * starts with `@` the values of the named attribute of the matching elements
+ * are returned instead of the elements. For example:
+ *
+ *  - `'feed/entry/title'` matches the titles of all entries in a feed
+ *  - `'feed/entry/link/@href'` gives the links of all entries
+ *
+ * Names are matched against the local names of elements and attributes, i.e.
+ * without a namespace prefix.
+ */
+
+static int xml_select(lua_State *L)
+{
+  lua_apr_xml_object *object;
+
+  object = check_xml_parser(L, 1, CHECK_DOCUMENT);
+  share_document(L, 1);
+
+  return push_selection(L, 1, object, NULL, 2);
+}
+
 /* xml_parser:close() -> status {{{1
  *
  * Close the XML parser and destroy any parse information. This will be done
@@ -328,6 +567,8 @@ static luaL_reg xml_methods[] = {
   { "feed", xml_feed },
   { "done", xml_done },
   { "getinfo", xml_getinfo },
+  { "root", xml_root },
+  { "select", xml_select },
   { "geterror", xml_geterror },
   { "close", xml_close },
   { NULL, NULL }
@@ -347,3 +588,1144 @@ lua_apr_objtype lua_apr_xml_type = {
   xml_methods,                /* methods table */
   xml_metamethods             /* metamethods table */
 };
+
+/* element:name() -> name {{{1
+ *
+ * Get the name of the element (without a namespace prefix).
+ */
+
+static int elem_name(lua_State *L)
+{
+  lua_pushstring(L, check_xml_elem(L, 1)->elem->name);
+  return 1;
+}
+
+/* element:attr(name) -> value {{{1
+ *
+ * Get the value of the attribute @name as a string. If the element doesn't
+ * have the attribute nil is returned.
+ */
+
+static int elem_attr(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+  apr_xml_attr *attr;
+  const char *name;
+
+  object = check_xml_elem(L, 1);
+  name = luaL_checkstring(L, 2);
+  for (attr = object->elem->attr; attr != NULL; attr = attr->next) {
+    if (strcmp(attr->name, name) == 0) {
+      lua_pushstring(L, attr->value);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* element:attributes() -> table {{{1
+ *
+ * Get all attributes of the element in a table, using the same format as
+ * `xml_parser:getinfo()`.
+ */
+
+static int elem_attributes(lua_State *L)
+{
+  push_attributes(L, check_xml_elem(L, 1)->elem);
+  return 1;
+}
+
+/* element:text() -> string {{{1
+ *
+ * Get the text in the element and all of its descendants.
+ */
+
+static int elem_text(lua_State *L)
+{
+  luaL_Buffer B;
+
+  luaL_buffinit(L, &B);
+  append_text(&B, check_xml_elem(L, 1)->elem);
+  luaL_pushresult(&B);
+
+  return 1;
+}
+
+/* element:parent() -> element {{{1
+ *
+ * Get the parent of the element. For the root element nothing is returned.
+ */
+
+static int elem_parent(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_xml_elem(L, 1);
+  if (object->elem->parent == NULL)
+    return 0;
+  push_xml_elem(L, 1, object->parser, object->elem->parent);
+
+  return 1;
+}
+
+/* element:children() -> iterator {{{1
+ *
+ * Get an iterator over the child elements of the element, for use in a
+ * generic `for` statement.
+ */
+
+static int elem_children_iter(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+  apr_xml_elem *child;
+
+  object = check_xml_elem(L, lua_upvalueindex(1));
+  child = lua_touserdata(L, lua_upvalueindex(2));
+  if (child == NULL)
+    return 0;
+  lua_pushlightuserdata(L, child->next);
+  lua_replace(L, lua_upvalueindex(2));
+  push_xml_elem(L, lua_upvalueindex(1), object->parser, child);
+
+  return 1;
+}
+
+static int elem_children(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_xml_elem(L, 1);
+  lua_settop(L, 1);
+  lua_pushlightuserdata(L, object->elem->first_child);
+  lua_pushcclosure(L, elem_children_iter, 2);
+
+  return 1;
+}
+
+/* element:select(path) -> elements {{{1
+ *
+ * Find the descendants of the element that match the string @path, see
+ * `xml_parser:select()`. The first name in the path is matched against the
+ * children of the element. Paths starting with a slash are matched from the
+ * root element of the document.
+ */
+
+static int elem_select(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_xml_elem(L, 1);
+  return push_selection(L, 1, object->parser, object->elem, 2);
+}
+
+/* element:getinfo() -> table {{{1
+ *
+ * Convert the element and its descendants to a Lua table, using the same
+ * format as `xml_parser:getinfo()`.
+ */
+
+static int elem_getinfo(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_xml_elem(L, 1);
+  lua_newtable(L);
+  dump_xml(L, object->elem);
+
+  return 1;
+}
+
+/* tostring(element) -> string {{{1 */
+
+static int elem_tostring(lua_State *L)
+{
+  lua_apr_xml_elem_object *object;
+
+  object = check_object(L, 1, &lua_apr_xml_elem_type);
+  if (object->parser->doc != NULL)
+    lua_pushfstring(L, "%s <%s> (%p)", lua_apr_xml_elem_type.friendlyname, object->elem->name, object->elem);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_xml_elem_type.friendlyname);
+
+  return 1;
+}
+
+/* element:__eq() {{{1 */
+
+static int elem_equal(lua_State *L)
+{
+  lua_apr_xml_elem_object *a, *b;
+
+  a = check_object(L, 1, &lua_apr_xml_elem_type);
+  b = check_object(L, 2, &lua_apr_xml_elem_type);
+  lua_pushboolean(L, a->elem == b->elem);
+
+  return 1;
+}
+
+/* element:__gc() {{{1 */
+
+static int elem_gc(lua_State *L)
+{
+  lua_apr_xml_elem_object *object = check_object(L, 1, &lua_apr_xml_elem_type);
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_reg elem_methods[] = {
+  { "name", elem_name },
+  { "attr", elem_attr },
+  { "attributes", elem_attributes },
+  { "text", elem_text },
+  { "parent", elem_parent },
+  { "children", elem_children },
+  { "select", elem_select },
+  { "getinfo", elem_getinfo },
+  { NULL, NULL }
+};
+
+static luaL_reg elem_metamethods[] = {
+  { "__tostring", elem_tostring },
+  { "__eq", elem_equal },
+  { "__gc", elem_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_xml_elem_type = {
+  "lua_apr_xml_elem_object*",      /* metatable name in registry */
+  "xml element",                   /* friendly object name */
+  sizeof(lua_apr_xml_elem_object), /* structure size */
+  elem_methods,                    /* methods table */
+  elem_metamethods                 /* metamethods table */
+};
+
+/* Maximum nesting depth of tables converted by apr.xml_encode(). */
+#define XML_ENCODE_MAXDEPTH 200
+
+/* Internal functions for XML output. {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_writebuf *output;
+  int depth;    /* number of open elements */
+  int open_tag; /* is the start tag of the innermost element unfinished? */
+} lua_apr_xml_writer_object;
+
+/* Output of XML goes directly to the write buffer of a file, socket or shared
+ * memory segment, or to a memory buffer for apr.xml_encode(). The memory
+ * buffer is a userdata on the Lua stack so that it's garbage collected when
+ * an error is raised halfway. */
+
+typedef struct {
+  lua_apr_writebuf *output;
+  lua_State *L;
+  int buffer_idx; /* stack index of the memory buffer */
+  char *data;
+  size_t length, size;
+  apr_status_t status;
+  const char *error;
+} xml_sink_t;
+
+/* check_sink() -- get the write buffer of a file, socket or shm object {{{2 */
+
+static lua_apr_writebuf *check_sink(lua_State *L, int idx)
+{
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output = NULL;
+
+  if (object_has_type(L, idx, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = check_object(L, idx, &lua_apr_file_type);
+    if (file->handle == NULL)
+      luaL_error(L, "attempt to use a closed file");
+    output = &file->output;
+  } else if (object_has_type(L, idx, &lua_apr_socket_type, 1)) {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    if (socket->handle == NULL)
+      luaL_error(L, "attempt to use a closed socket");
+    output = &socket->output;
+  } else if (!shm_buffers(L, idx, &input, &output)) {
+    luaL_argerror(L, idx, "file, socket or shared memory expected");
+  }
+
+  return output;
+}
+
+/* sink_write() -- append data to the output {{{2 */
+
+static void sink_write(xml_sink_t *S, const char *data, size_t length)
+{
+  size_t size;
+  char *buffer;
+
+  if (S->status != APR_SUCCESS || length == 0)
+    return;
+  if (S->output != NULL) {
+    S->status = write_output(S->output, data, length);
+    return;
+  }
+  if (S->length + length > S->size) {
+    size = S->size > 0 ? S->size * 2 : LUA_APR_BUFSIZE;
+    while (size < S->length + length)
+      size *= 2;
+    buffer = lua_newuserdata(S->L, size);
+    if (S->length > 0)
+      memcpy(buffer, S->data, S->length);
+    lua_replace(S->L, S->buffer_idx);
+    S->data = buffer;
+    S->size = size;
+  }
+  memcpy(S->data + S->length, data, length);
+  S->length += length;
+}
+
+#define sink_literal(S, s) sink_write((S), (s), sizeof(s) - 1)
+
+/* sink_escaped() -- append text or an attribute value, escaping as needed {{{2
+ *
+ * Runs of characters that don't need escaping are copied as a whole. Control
+ * characters that can't be represented in XML 1.0 are rejected.
+ */
+
+static void sink_escaped(xml_sink_t *S, const char *data, size_t length, int attribute)
+{
+  const char *end = data + length, *run = data, *entity;
+  unsigned char c;
+
+  for (; data < end; data++) {
+    c = (unsigned char) *data;
+    switch (c) {
+      case '&': entity = "&amp;"; break;
+      case '<': entity = "&lt;"; break;
+      case '>': entity = "&gt;"; break;
+      case '"': entity = attribute ? "&quot;" : NULL; break;
+      case '\t': entity = attribute ? "&#9;" : NULL; break;
+      case '\n': entity = attribute ? "&#10;" : NULL; break;
+      case '\r': entity = "&#13;"; break;
+      default:
+        if (c < 0x20) {
+          if (S->status == APR_SUCCESS) {
+            S->status = APR_EINVAL;
+            S->error = "invalid character in XML output";
+          }
+          return;
+        }
+        entity = NULL;
+    }
+    if (entity != NULL) {
+      sink_write(S, run, data - run);
+      sink_write(S, entity, strlen(entity));
+      run = data + 1;
+    }
+  }
+  sink_write(S, run, end - run);
+}
+
+/* check_xml_name() -- check that a string is usable as an XML name {{{2 */
+
+static const char *check_xml_name(lua_State *L, int idx, size_t *length)
+{
+  const char *name;
+  size_t i;
+
+  name = lua_tolstring(L, idx, length);
+  if (name == NULL || *length == 0)
+    return NULL;
+  for (i = 0; i < *length; i++)
+    if (strchr(" \t\r\n<>&\"'=/", name[i]) != NULL || (unsigned char) name[i] < 0x20)
+      return NULL;
+
+  return name;
+}
+
+/* sink_attribute() -- append the attribute with the name at the top of the
+ * stack and the value in the table at @idx {{{2 */
+
+static void sink_attribute(lua_State *L, xml_sink_t *S, int idx)
+{
+  const char *name, *value;
+  size_t length;
+
+  name = check_xml_name(L, -1, &length);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, idx);
+  if (name == NULL || (value = lua_tolstring(L, -1, &length)) == NULL) {
+    if (S->status == APR_SUCCESS) {
+      S->status = APR_EINVAL;
+      S->error = "invalid XML attribute";
+    }
+  } else {
+    sink_literal(S, " ");
+    sink_write(S, name, strlen(name));
+    sink_literal(S, "=\"");
+    sink_escaped(S, value, length, 1);
+    sink_literal(S, "\"");
+  }
+  lua_pop(L, 1);
+}
+
+/* sink_attributes() -- append the attributes in the table at @idx {{{2
+ *
+ * Supports the format produced by xml_parser:getinfo() (the array part gives
+ * the order of the attributes) and plain tables that map names to values.
+ */
+
+static void sink_attributes(lua_State *L, xml_sink_t *S, int idx)
+{
+  int i, n;
+
+  n = (int) lua_objlen(L, idx);
+  if (n > 0) {
+    for (i = 1; i <= n; i++) {
+      lua_rawgeti(L, idx, i);
+      sink_attribute(L, S, idx);
+      lua_pop(L, 1);
+    }
+  } else {
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      lua_pop(L, 1);
+      if (lua_type(L, -1) == LUA_TSTRING)
+        sink_attribute(L, S, idx);
+    }
+  }
+}
+
+/* sink_element() -- append the element in the table at @idx {{{2 */
+
+static void sink_element(lua_State *L, xml_sink_t *S, int idx, int depth)
+{
+  const char *tag, *text;
+  size_t length;
+  int i, n, top;
+
+  if (depth > XML_ENCODE_MAXDEPTH || !lua_checkstack(L, 10)) {
+    S->status = APR_EINVAL;
+    S->error = "XML elements nested too deeply";
+    return;
+  }
+  top = lua_gettop(L);
+  lua_getfield(L, idx, "tag");
+  tag = check_xml_name(L, -1, &length);
+  if (tag == NULL) {
+    S->status = APR_EINVAL;
+    S->error = "invalid XML element";
+    lua_settop(L, top);
+    return;
+  }
+  sink_literal(S, "<");
+  sink_write(S, tag, length);
+  lua_getfield(L, idx, "attr");
+  if (lua_istable(L, -1))
+    sink_attributes(L, S, lua_gettop(L));
+  lua_pop(L, 1);
+
+  n = (int) lua_objlen(L, idx);
+  if (n == 0) {
+    sink_literal(S, "/>");
+  } else {
+    sink_literal(S, ">");
+    for (i = 1; i <= n && S->status == APR_SUCCESS; i++) {
+      lua_rawgeti(L, idx, i);
+      if (lua_istable(L, -1)) {
+        sink_element(L, S, lua_gettop(L), depth + 1);
+      } else if ((text = lua_tolstring(L, -1, &length)) != NULL) {
+        sink_escaped(S, text, length, 0);
+      } else {
+        S->status = APR_EINVAL;
+        S->error = "invalid XML child node";
+      }
+      lua_pop(L, 1);
+    }
+    sink_literal(S, "</");
+    sink_write(S, tag, strlen(tag));
+    sink_literal(S, ">");
+  }
+  lua_settop(L, top);
+}
+
+/* push_sink_status() -- push the result of writing XML {{{2 */
+
+static int push_sink_status(lua_State *L, xml_sink_t *S)
+{
+  if (S->error != NULL)
+    return push_error_message(L, S->error);
+  return push_status(L, S->status);
+}
+
+/* check_xml_writer() -- get an XML writer from the Lua stack {{{2 */
+
+static lua_apr_xml_writer_object *check_xml_writer(lua_State *L, int idx, xml_sink_t *S)
+{
+  lua_apr_xml_writer_object *object;
+
+  object = check_object(L, idx, &lua_apr_xml_writer_type);
+  /* Make sure the underlying file or socket hasn't been closed. */
+  lua_getfenv(L, idx);
+  lua_getfield(L, -1, "stream");
+  check_sink(L, lua_gettop(L));
+  lua_pop(L, 2);
+
+  memset(S, 0, sizeof *S);
+  S->output = object->output;
+  S->status = APR_SUCCESS;
+
+  return object;
+}
+
+/* writer_close_tag() -- finish the start tag of the innermost element {{{2 */
+
+static void writer_close_tag(lua_apr_xml_writer_object *object, xml_sink_t *S)
+{
+  if (object->open_tag) {
+    sink_literal(S, ">");
+    object->open_tag = 0;
+  }
+}
+
+/* apr.xml_writer(stream) -> writer {{{1
+ *
+ * Create an object that writes XML to @stream, which can be a file, socket or
+ * shared memory segment. Markup and escaped text are written directly to the
+ * write buffer of the stream. Use `writer:start()`, `writer:text()` and
+ * `writer:finish()` to produce elements, for example:
+ *
+ *     > writer = apr.xml_writer(file)
+ *     > writer:start('entry', { id = 42 })
+ *     > writer:start 'title'
+ *     > writer:text 'Tom & Jerry'
+ *     > writer:finish()
+ *     > writer:start 'link'
+ *     > writer:finish()
+ *     > writer:finish()
+ *
+ * This writes `<entry id="42"><title>Tom &amp; Jerry</title><link/></entry>`.
+ * The writer doesn't write an XML declaration.
+ */
+
+int lua_apr_xml_writer(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+  lua_apr_writebuf *output;
+
+  output = check_sink(L, 1);
+  object = new_object(L, &lua_apr_xml_writer_type);
+  if (object == NULL)
+    return push_error_memory(L);
+  object->output = output;
+
+  /* Keep the stream alive and remember the names of open elements. */
+  object_env_private(L, -1);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "stream");
+  lua_newtable(L);
+  lua_setfield(L, -2, "open");
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* apr.xml_encode(table [, stream]) -> string {{{1
+ *
+ * Convert a table in the format produced by `xml_parser:getinfo()` to XML.
+ * When @stream is given the XML is written to the file, socket or shared
+ * memory segment and true is returned, otherwise the XML is returned as a
+ * string. Attributes can also be given as a table that maps names to values,
+ * in which case their order is undefined. On error a nil followed by an error
+ * message is returned.
+ */
+
+int lua_apr_xml_encode(lua_State *L)
+{
+  xml_sink_t S;
+  int pushed;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 3);
+  memset(&S, 0, sizeof S);
+  S.status = APR_SUCCESS;
+  S.L = L;
+  S.buffer_idx = 3;
+  if (!lua_isnil(L, 2))
+    S.output = check_sink(L, 2);
+
+  sink_element(L, &S, 1, 1);
+
+  if (S.status == APR_SUCCESS && S.output == NULL) {
+    lua_pushlstring(L, S.data, S.length);
+    pushed = 1;
+  } else {
+    pushed = push_sink_status(L, &S);
+  }
+
+  return pushed;
+}
+
+/* writer:start(name [, attributes]) -> status {{{1
+ *
+ * Write the start of an element with the given @name. The optional table
+ * @attributes has the same format as the attributes accepted by
+ * `apr.xml_encode()`. On success true is returned, otherwise a nil followed by
+ * an error message is returned.
+ */
+
+static int xml_writer_start(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+  xml_sink_t S;
+  const char *name;
+  size_t length;
+
+  object = check_xml_writer(L, 1, &S);
+  name = check_xml_name(L, 2, &length);
+  if (name == NULL)
+    luaL_argerror(L, 2, "invalid XML name");
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TTABLE);
+  lua_settop(L, 3);
+
+  writer_close_tag(object, &S);
+  sink_literal(&S, "<");
+  sink_write(&S, name, length);
+  if (lua_istable(L, 3))
+    sink_attributes(L, &S, 3);
+
+  /* Remember the name for writer:finish(). */
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "open");
+  lua_pushvalue(L, 2);
+  lua_rawseti(L, -2, ++object->depth);
+  object->open_tag = 1;
+
+  return push_sink_status(L, &S);
+}
+
+/* writer:text(string) -> status {{{1
+ *
+ * Write the escaped @string as text in the current element. On success true
+ * is returned, otherwise a nil followed by an error message is returned.
+ */
+
+static int xml_writer_text(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+  xml_sink_t S;
+  const char *text;
+  size_t length;
+
+  object = check_xml_writer(L, 1, &S);
+  text = luaL_checklstring(L, 2, &length);
+  writer_close_tag(object, &S);
+  sink_escaped(&S, text, length, 0);
+
+  return push_sink_status(L, &S);
+}
+
+/* writer:finish() -> status {{{1
+ *
+ * Write the end of the innermost open element. Elements without content are
+ * written as empty element tags. On success true is returned, otherwise a nil
+ * followed by an error message is returned.
+ */
+
+static int xml_writer_finish(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+  xml_sink_t S;
+  const char *name;
+  size_t length;
+
+  object = check_xml_writer(L, 1, &S);
+  if (object->depth == 0)
+    luaL_error(L, "no open XML elements");
+  if (object->open_tag) {
+    sink_literal(&S, "/>");
+    object->open_tag = 0;
+  } else {
+    lua_getfenv(L, 1);
+    lua_getfield(L, -1, "open");
+    lua_rawgeti(L, -1, object->depth);
+    name = lua_tolstring(L, -1, &length);
+    sink_literal(&S, "</");
+    sink_write(&S, name, length);
+    sink_literal(&S, ">");
+  }
+  object->depth--;
+
+  return push_sink_status(L, &S);
+}
+
+/* writer:flush() -> status {{{1
+ *
+ * Flush the write buffer of the underlying stream. On success true is
+ * returned, otherwise a nil followed by an error message is returned.
+ */
+
+static int xml_writer_flush(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+  xml_sink_t S;
+
+  object = check_xml_writer(L, 1, &S);
+  return push_status(L, flush_buffer(L, object->output, 0));
+}
+
+/* tostring(writer) -> string {{{1 */
+
+static int xml_writer_tostring(lua_State *L)
+{
+  lua_apr_xml_writer_object *object;
+
+  object = check_object(L, 1, &lua_apr_xml_writer_type);
+  lua_pushfstring(L, "%s (%p)", lua_apr_xml_writer_type.friendlyname, object);
+
+  return 1;
+}
+
+/* writer:__gc() {{{1 */
+
+static int xml_writer_gc(lua_State *L)
+{
+  lua_apr_xml_writer_object *object = check_object(L, 1, &lua_apr_xml_writer_type);
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_reg xml_writer_methods[] = {
+  { "start", xml_writer_start },
+  { "text", xml_writer_text },
+  { "finish", xml_writer_finish },
+  { "flush", xml_writer_flush },
+  { NULL, NULL }
+};
+
+static luaL_reg xml_writer_metamethods[] = {
+  { "__tostring", xml_writer_tostring },
+  { "__eq", objects_equal },
+  { "__gc", xml_writer_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_xml_writer_type = {
+  "lua_apr_xml_writer_object*",      /* metatable name in registry */
+  "xml writer",                      /* friendly object name */
+  sizeof(lua_apr_xml_writer_object), /* structure size */
+  xml_writer_methods,                /* methods table */
+  xml_writer_metamethods             /* metamethods table */
+};
+
+#if LUA_APR_HAVE_EXPAT
+
+/* Character data is passed to Lua in pieces of at most this size. */
+#define XML_STREAM_TEXTMAX (1024 * 64)
+
+/* States of XML streams. */
+#define XML_STREAM_OPEN    0
+#define XML_STREAM_STOPPED 1 /* a callback returned false */
+#define XML_STREAM_FAILED  2 /* a callback raised an error */
+#define XML_STREAM_DONE    3
+#define XML_STREAM_CLOSED  4
+
+/* Internal functions for XML streams. {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  XML_Parser parser;
+  int state;
+  lua_State *L;  /* state of the feed() or done() call in progress */
+  int error_idx; /* stack index for the error raised by a callback */
+  char *text;
+  apr_size_t text_len, text_size;
+} lua_apr_xml_stream_object;
+
+/* A parse event passed to a Lua callback. */
+typedef struct {
+  lua_apr_xml_stream_object *object;
+  const char *name;              /* name of the callback */
+  const XML_Char *element;       /* name of the element (start and end) */
+  const XML_Char **attr;         /* attributes of the element (start) */
+  const char *text;              /* character data (text) */
+  apr_size_t length;
+  int stop;                      /* did the callback return false? */
+} xml_stream_event;
+
+/* check_xml_stream() -- get an XML stream from the Lua stack {{{2 */
+
+static lua_apr_xml_stream_object *check_xml_stream(lua_State *L, int idx, int open)
+{
+  lua_apr_xml_stream_object *object;
+
+  object = check_object(L, idx, &lua_apr_xml_stream_type);
+  if (object->L != NULL)
+    luaL_error(L, "attempt to use an XML stream from one of its callbacks");
+  if (open && object->state == XML_STREAM_CLOSED)
+    luaL_error(L, "attempt to use a closed XML stream");
+
+  return object;
+}
+
+/* stream_event() -- call the Lua function for a parse event {{{2
+ *
+ * Runs in protected mode (see stream_callback()) so that errors raised by the
+ * callback or the Lua API never unwind through the stack frames of Expat.
+ */
+
+static int stream_event(lua_State *L)
+{
+  xml_stream_event *event = lua_touserdata(L, 1);
+  int i, nargs = 1;
+
+  if (event->name == NULL)
+    raise_error_memory(L);
+  /* The callbacks are in the registry while stream_parse() is running. */
+  lua_pushlightuserdata(L, event->object);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  lua_getfield(L, -1, event->name);
+  if (lua_isnil(L, -1))
+    return 0;
+  if (event->text != NULL) {
+    lua_pushlstring(L, event->text, event->length);
+  } else {
+    lua_pushstring(L, event->element);
+    if (event->attr != NULL) {
+      /* Attributes use the same format as xml_parser:getinfo(), but in
+       * document order because Expat reports them in document order. */
+      lua_newtable(L);
+      for (i = 0; event->attr[i] != NULL; i += 2) {
+        lua_pushstring(L, event->attr[i]);
+        lua_rawseti(L, -2, i / 2 + 1);
+        lua_pushstring(L, event->attr[i + 1]);
+        lua_setfield(L, -2, event->attr[i]);
+      }
+      nargs++;
+    }
+  }
+  lua_call(L, nargs, 1);
+  event->stop = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+
+  return 0;
+}
+
+/* stream_callback() -- call a Lua function for a parse event {{{2
+ *
+ * When the callback raises an error or returns false the parser is stopped.
+ */
+
+static void stream_callback(xml_stream_event *event)
+{
+  lua_apr_xml_stream_object *object = event->object;
+  lua_State *L = object->L;
+
+  event->stop = 0;
+  if (lua_cpcall(L, stream_event, event) != 0) {
+    lua_replace(L, object->error_idx);
+    object->state = XML_STREAM_FAILED;
+    XML_StopParser(object->parser, XML_FALSE);
+  } else if (event->stop) {
+    object->state = XML_STREAM_STOPPED;
+    XML_StopParser(object->parser, XML_FALSE);
+  }
+}
+
+/* flush_text() -- pass buffered character data to Lua {{{2 */
+
+static void flush_text(lua_apr_xml_stream_object *object)
+{
+  xml_stream_event event = { NULL };
+
+  if (object->text_len > 0 && object->state == XML_STREAM_OPEN) {
+    event.object = object;
+    event.name = "text";
+    event.text = object->text;
+    event.length = object->text_len;
+    stream_callback(&event);
+  }
+  object->text_len = 0;
+}
+
+/* Expat handlers. {{{2 */
+
+static void XMLCALL stream_start(void *context, const XML_Char *name, const XML_Char **attr)
+{
+  xml_stream_event event = { NULL };
+
+  event.object = context;
+  flush_text(event.object);
+  if (event.object->state != XML_STREAM_OPEN)
+    return;
+  event.name = "start";
+  event.element = name;
+  event.attr = attr;
+  stream_callback(&event);
+}
+
+static void XMLCALL stream_end(void *context, const XML_Char *name)
+{
+  xml_stream_event event = { NULL };
+
+  event.object = context;
+  flush_text(event.object);
+  if (event.object->state != XML_STREAM_OPEN)
+    return;
+  event.name = "end";
+  event.element = name;
+  stream_callback(&event);
+}
+
+static void XMLCALL stream_text(void *context, const XML_Char *data, int length)
+{
+  lua_apr_xml_stream_object *object = context;
+  xml_stream_event event = { NULL };
+  apr_size_t size;
+  char *text;
+
+  if (object->state != XML_STREAM_OPEN)
+    return;
+  /* Expat splits text at line breaks and entities so coalesce the pieces. */
+  if (object->text_len + length > object->text_size) {
+    size = object->text_size > 0 ? object->text_size * 2 : 1024;
+    while (size < object->text_len + length)
+      size *= 2;
+    text = realloc(object->text, size);
+    if (text == NULL) {
+      /* An event without a name reports the allocation error. */
+      event.object = object;
+      stream_callback(&event);
+      return;
+    }
+    object->text = text;
+    object->text_size = size;
+  }
+  memcpy(object->text + object->text_len, data, length);
+  object->text_len += length;
+  if (object->text_len >= XML_STREAM_TEXTMAX)
+    flush_text(object);
+}
+
+/* stream_parse() -- feed input to Expat and push the results {{{2 */
+
+static int stream_parse(lua_State *L, lua_apr_xml_stream_object *object,
+    const char *data, apr_size_t size, int final)
+{
+  enum XML_Status status = XML_STATUS_OK;
+  char message[LUA_APR_MSGSIZE];
+  int length;
+
+  if (object->state == XML_STREAM_STOPPED) {
+    lua_pushboolean(L, 0);
+    return 1;
+  } else if (object->state != XML_STREAM_OPEN) {
+    return push_error_message(L, "XML stream is no longer usable");
+  }
+
+  /* Make the callbacks and a slot for errors available to the handlers. */
+  lua_pushlightuserdata(L, object);
+  lua_getfenv(L, 1);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+  lua_pushnil(L);
+  object->error_idx = lua_gettop(L);
+  object->L = L;
+
+  do {
+    length = size > INT_MAX ? INT_MAX : (int) size;
+    status = XML_Parse(object->parser, data, length, final && length == (int) size);
+    data += length;
+    size -= length;
+  } while (status == XML_STATUS_OK && size > 0);
+  if (status == XML_STATUS_OK && final) {
+    flush_text(object);
+    if (object->state == XML_STREAM_OPEN)
+      object->state = XML_STREAM_DONE;
+  }
+  object->L = NULL;
+  lua_pushlightuserdata(L, object);
+  lua_pushnil(L);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+
+  if (object->state == XML_STREAM_STOPPED) {
+    free(object->text);
+    object->text = NULL;
+    object->text_len = object->text_size = 0;
+    lua_pushboolean(L, 0);
+    return 1;
+  } else if (object->state == XML_STREAM_FAILED) {
+    lua_pushnil(L);
+    lua_pushvalue(L, object->error_idx);
+    return 2;
+  } else if (status != XML_STATUS_OK) {
+    object->state = XML_STREAM_FAILED;
+    apr_snprintf(message, sizeof message, "%s at line %lu, column %lu",
+        XML_ErrorString(XML_GetErrorCode(object->parser)),
+        (unsigned long) XML_GetCurrentLineNumber(object->parser),
+        (unsigned long) XML_GetCurrentColumnNumber(object->parser));
+    return push_error_message(L, message);
+  }
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* close_xml_stream() {{{2 */
+
+static void close_xml_stream(lua_apr_xml_stream_object *object)
+{
+  if (object->parser != NULL) {
+    XML_ParserFree(object->parser);
+    object->parser = NULL;
+  }
+  free(object->text);
+  object->text = NULL;
+  object->text_len = object->text_size = 0;
+  object->state = XML_STREAM_CLOSED;
+}
+
+/* apr.xml_stream(callbacks) -> stream {{{1
+ *
+ * Create an event driven XML parser. The table @callbacks can contain the
+ * following functions, which are called while the document is fed to the
+ * parser:
+ *
+ *  - `start(name, attributes)` is called for the start of every element. The
+ *    attributes are given as a table in the same format used by
+ *    `xml_parser:getinfo()`
+ *  - `end(name)` is called for the end of every element
+ *  - `text(text)` is called for character data. Adjacent pieces of text are
+ *    combined up to a limit of 64 KB
+ *
+ * When a callback returns false the parser stops, which makes it possible to
+ * stop parsing early without reading the rest of the document. On success
+ * the parser object is returned, otherwise a nil followed by an error message
+ * is returned.
+ */
+
+int lua_apr_xml_stream(lua_State *L)
+{
+  lua_apr_xml_stream_object *object;
+  const char *events[] = { "start", "end", "text" };
+  int i;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  object = new_object(L, &lua_apr_xml_stream_type);
+  if (object == NULL)
+    return push_error_memory(L);
+  object->parser = XML_ParserCreate(NULL);
+  if (object->parser == NULL)
+    return push_error_memory(L);
+  XML_SetUserData(object->parser, object);
+  XML_SetElementHandler(object->parser, stream_start, stream_end);
+  XML_SetCharacterDataHandler(object->parser, stream_text);
+
+  /* Copy the callbacks to the private environment of the parser. */
+  object_env_private(L, 2);
+  for (i = 0; i < (int) count(events); i++) {
+    lua_getfield(L, 1, events[i]);
+    if (!lua_isnil(L, -1))
+      luaL_checktype(L, -1, LUA_TFUNCTION);
+    lua_setfield(L, -2, events[i]);
+  }
+  lua_pop(L, 1);
+
+  return 1;
+}
+
+/* stream:feed(input) -> status {{{1
+ *
+ * Parse the string @input, calling the callbacks for the elements and text
+ * it completes. Returns true on success, false when a callback stopped the
+ * parser (now or before) and nil followed by an error message when the input
+ * isn't well formed XML or a callback raised an error.
+ */
+
+static int xml_stream_feed(lua_State *L)
+{
+  lua_apr_xml_stream_object *object;
+  const char *data;
+  apr_size_t size;
+
+  object = check_xml_stream(L, 1, 1);
+  data = luaL_checklstring(L, 2, &size);
+
+  return stream_parse(L, object, data, size, 0);
+}
+
+/* stream:done() -> status {{{1
+ *
+ * Tell the parser that the whole document has been fed to it. The return
+ * values are the same as those of `stream:feed()`. An incomplete document is
+ * reported as an error.
+ */
+
+static int xml_stream_done(lua_State *L)
+{
+  return stream_parse(L, check_xml_stream(L, 1, 1), NULL, 0, 1);
+}
+
+/* stream:close() -> status {{{1
+ *
+ * Free the resources of the parser. This will be done automatically when the
+ * @stream object is garbage collected.
+ */
+
+static int xml_stream_close(lua_State *L)
+{
+  close_xml_stream(check_xml_stream(L, 1, 0));
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* tostring(stream) -> string {{{1 */
+
+static int xml_stream_tostring(lua_State *L)
+{
+  lua_apr_xml_stream_object *object;
+
+  object = check_object(L, 1, &lua_apr_xml_stream_type);
+  if (object->state != XML_STREAM_CLOSED)
+    lua_pushfstring(L, "%s (%p)", lua_apr_xml_stream_type.friendlyname, object);
+  else
+    lua_pushfstring(L, "%s (closed)", lua_apr_xml_stream_type.friendlyname);
+
+  return 1;
+}
+
+/* stream:__gc() {{{1 */
+
+static int xml_stream_gc(lua_State *L)
+{
+  lua_apr_xml_stream_object *object = check_object(L, 1, &lua_apr_xml_stream_type);
+  if (object_collectable((lua_apr_refobj*)object))
+    close_xml_stream(object);
+  release_object((lua_apr_refobj*)object);
+  return 0;
+}
+
+/* }}}1 */
+
+static luaL_reg xml_stream_methods[] = {
+  { "feed", xml_stream_feed },
+  { "done", xml_stream_done },
+  { "close", xml_stream_close },
+  { NULL, NULL }
+};
+
+static luaL_reg xml_stream_metamethods[] = {
+  { "__tostring", xml_stream_tostring },
+  { "__eq", objects_equal },
+  { "__gc", xml_stream_gc },
+  { NULL, NULL }
+};
+
+lua_apr_objtype lua_apr_xml_stream_type = {
+  "lua_apr_xml_stream_object*",      /* metatable name in registry */
+  "xml stream",                      /* friendly object name */
+  sizeof(lua_apr_xml_stream_object), /* structure size */
+  xml_stream_methods,                /* methods table */
+  xml_stream_metamethods             /* metamethods table */
+};
+
+#endif
@@ -0,0 +1,560 @@
+/* Compression module for the Lua/APR binding.
+ *
+ * Author: Peter Odding <peter@peterodding.com>
+ * Last Change: October 18, 2026
+ * Homepage: http://peterodding.com/code/lua/apr/
+ * License: MIT
+ *
+ * Files and sockets can be wrapped in streams that compress or decompress data
+ * on the fly using [zlib] [zlib]. Compression happens in the write buffer of
+ * the stream and decompression in its read buffer, so memory usage is bounded
+ * no matter how large the data is and no intermediate Lua strings are created:
+ *
+ *     local input = assert(apr.file_open('server.log'))
+ *     local output = assert(apr.file_open('server.log.gz', 'w'))
+ *     local writer = assert(output:gzip_writer(9))
+ *     for line in input:lines() do
+ *       assert(writer:write(line, '\n'))
+ *     end
+ *     assert(writer:close())
+ *     assert(output:close())
+ *
+ *     local reader = assert(apr.file_open('server.log.gz')):inflate_reader()
+ *     for line in reader:lines() do print(line) end
+ *
+ * Writers support the methods `writer:write()`, `writer:flush()` and
+ * `writer:close()`, readers support `reader:read()`, `reader:lines()` and
+ * `reader:close()`. Closing a stream doesn't close the underlying file or
+ * socket: Closing a writer writes the end of the compressed stream and any
+ * data following the end of a compressed stream is left unread. This makes
+ * it possible to use the streams for HTTP bodies on keep-alive connections.
+ *
+ * These streams are only available when the Lua/APR binding was built with
+ * zlib (see `LUA_APR_HAVE_ZLIB` in the makefiles).
+ *
+ * [zlib]: http://zlib.net/
+ */
+
+#include "lua_apr.h"
+
+#if LUA_APR_HAVE_ZLIB
+
+#include <zlib.h>
+#include <string.h>
+
+/* Size of the buffer for compressed data waiting to be written. */
+#define ZSTREAM_BUFSIZE (1024 * 16)
+
+/* States of compression streams. */
+#define ZSTREAM_OPEN   0
+#define ZSTREAM_END    1 /* end of compressed data seen (readers) */
+#define ZSTREAM_CLOSED 2
+
+/* Internal functions. {{{1 */
+
+typedef struct {
+  lua_apr_refobj header;
+  lua_apr_readbuf input;   /* decompressed data (readers) */
+  lua_apr_writebuf output; /* data to be compressed (writers) */
+  lua_apr_readbuf *source; /* input buffer of the underlying file or socket */
+  lua_apr_writebuf *sink;  /* output buffer of the underlying file or socket */
+  z_stream stream;
+  int state;
+  const char *error;
+  size_t index, limit;     /* compressed data in pending[index..limit) */
+  unsigned char pending[ZSTREAM_BUFSIZE];
+} lua_apr_zstream;
+
+static lua_apr_objtype lua_apr_zreader_type;
+static lua_apr_objtype lua_apr_zwriter_type;
+
+/* get_buffers() -- get the buffers of an open file or socket {{{2 */
+
+static void get_buffers(lua_State *L, int idx, lua_apr_readbuf **input, lua_apr_writebuf **output)
+{
+  if (object_has_type(L, idx, &lua_apr_file_type, 1)) {
+    lua_apr_file *file = check_object(L, idx, &lua_apr_file_type);
+    if (file->handle == NULL)
+      luaL_error(L, "attempt to use a closed file");
+    *input = &file->input;
+    *output = &file->output;
+  } else {
+    lua_apr_socket *socket = check_object(L, idx, &lua_apr_socket_type);
+    if (socket->handle == NULL)
+      luaL_error(L, "attempt to use a closed socket");
+    *input = &socket->input;
+    *output = &socket->output;
+  }
+}
+
+/* new_zstream() -- create a stream on top of the file or socket at index 1 {{{2 */
+
+static lua_apr_zstream *new_zstream(lua_State *L, lua_apr_objtype *T)
+{
+  lua_apr_zstream *object;
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output;
+
+  get_buffers(L, 1, &input, &output);
+  object = new_object(L, T);
+  object->source = input;
+  object->sink = output;
+  object->state = ZSTREAM_OPEN;
+
+  /* Keep the file or socket alive for as long as the stream is reachable. */
+  object_env_private(L, -1);
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "stream");
+  lua_pop(L, 1);
+
+  return object;
+}
+
+/* check_zstream() -- get an open stream from the Lua stack {{{2 */
+
+static lua_apr_zstream *check_zstream(lua_State *L, int idx, lua_apr_objtype *T)
+{
+  lua_apr_zstream *object;
+  lua_apr_readbuf *input;
+  lua_apr_writebuf *output;
+
+  object = check_object(L, idx, T);
+  if (object->state == ZSTREAM_CLOSED)
+    luaL_error(L, "attempt to use a closed %s", T->friendlyname);
+  /* Make sure the underlying file or socket hasn't been closed. */
+  lua_getfenv(L, idx);
+  lua_getfield(L, -1, "stream");
+  get_buffers(L, lua_gettop(L), &input, &output);
+  lua_pop(L, 2);
+
+  return object;
+}
+
+/* push_zstream_error() -- push the error message of a stream {{{2 */
+
+static int push_zstream_error(lua_State *L, lua_apr_zstream *object, apr_status_t status)
+{
+  if (object->error != NULL)
+    return push_error_message(L, object->error);
+  return push_error_status(L, status);
+}
+
+/* set_zlib_error() -- remember why zlib failed {{{2 */
+
+static apr_status_t set_zlib_error(lua_apr_zstream *object, const char *fallback)
+{
+  object->error = object->stream.msg != NULL ? object->stream.msg : fallback;
+  return APR_EGENERAL;
+}
+
+/* write_pending() -- write compressed data to the file or socket {{{2 */
+
+static apr_status_t write_pending(lua_apr_zstream *object)
+{
+  lua_apr_writebuf *sink = object->sink;
+  apr_status_t status = APR_SUCCESS;
+  apr_size_t len;
+
+  while (object->index < object->limit && status == APR_SUCCESS) {
+    len = object->limit - object->index;
+    status = sink->write(sink->object, (const char*) &object->pending[object->index], &len);
+    object->index += len;
+  }
+  if (object->index == object->limit)
+    object->index = object->limit = 0;
+
+  return status;
+}
+
+/* compress_input() -- run the compressor until it needs more input {{{2 */
+
+static apr_status_t compress_input(lua_apr_zstream *object, int flush)
+{
+  z_stream *stream = &object->stream;
+  apr_status_t status;
+  size_t produced;
+  int result;
+
+  for (;;) {
+    if (object->limit == ZSTREAM_BUFSIZE) {
+      status = write_pending(object);
+      if (status != APR_SUCCESS)
+        return status;
+    }
+    stream->next_out = &object->pending[object->limit];
+    stream->avail_out = (uInt) (ZSTREAM_BUFSIZE - object->limit);
+    result = deflate(stream, flush);
+    produced = ZSTREAM_BUFSIZE - object->limit - stream->avail_out;
+    object->limit += produced;
+    if (result == Z_STREAM_END)
+      return APR_SUCCESS;
+    else if (result == Z_BUF_ERROR && produced == 0 && stream->avail_in == 0)
+      return APR_SUCCESS; /* nothing left to do */
+    else if (result != Z_OK && result != Z_BUF_ERROR)
+      return set_zlib_error(object, "compression failed");
+    if (flush != Z_FINISH && stream->avail_out > 0)
+      return APR_SUCCESS;
+  }
+}
+
+/* zstream_write() -- compress data (called by flush_buffer()) {{{2 */
+
+static apr_status_t lua_apr_cc zstream_write(void *data, const char *buffer, apr_size_t *len)
+{
+  lua_apr_zstream *object = data;
+  apr_status_t status;
+
+  /* Compressed data is only written once the pending buffer is full. */
+  object->stream.next_in = (Bytef*) buffer;
+  object->stream.avail_in = (uInt) *len;
+  status = compress_input(object, Z_NO_FLUSH);
+  *len -= object->stream.avail_in;
+  object->stream.next_in = NULL;
+  object->stream.avail_in = 0;
+
+  return status;
+}
+
+/* zstream_read() -- decompress data (called by fill_buffer()) {{{2 */
+
+static apr_status_t lua_apr_cc zstream_read(void *data, char *buffer, apr_size_t *len)
+{
+  lua_apr_zstream *object = data;
+  lua_apr_readbuf *source = object->source;
+  lua_apr_buffer *B = &source->buffer;
+  z_stream *stream = &object->stream;
+  apr_status_t status;
+  apr_size_t wanted = *len, avail;
+  int result;
+
+  *len = 0;
+  if (object->error != NULL)
+    return APR_EGENERAL;
+  else if (object->state != ZSTREAM_OPEN)
+    return APR_EOF;
+
+  stream->next_out = (Bytef*) buffer;
+  stream->avail_out = (uInt) wanted;
+  while (stream->avail_out == wanted) {
+    avail = B->index < B->limit ? B->limit - B->index : 0;
+    if (avail == 0) {
+      /* Read more compressed data into the buffer of the file or socket. */
+      status = fill_input(source);
+      if (APR_STATUS_IS_EOF(status)) {
+        object->error = "compressed stream ended prematurely";
+        return APR_EGENERAL;
+      } else if (status != APR_SUCCESS) {
+        return status;
+      }
+      continue;
+    }
+    /* Decompress straight from the buffer of the file or socket. */
+    stream->next_in = (Bytef*) &B->data[B->index];
+    stream->avail_in = (uInt) avail;
+    result = inflate(stream, Z_NO_FLUSH);
+    drain_input(source, avail - stream->avail_in);
+    stream->next_in = NULL;
+    stream->avail_in = 0;
+    if (result == Z_STREAM_END) {
+      object->state = ZSTREAM_END;
+      break;
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      return set_zlib_error(object, "invalid compressed data");
+    }
+  }
+  *len = wanted - stream->avail_out;
+
+  return *len > 0 ? APR_SUCCESS : APR_EOF;
+}
+
+/* new_writer() -- create a compressing stream {{{2 */
+
+static int new_writer(lua_State *L, int gzip)
+{
+  lua_apr_zstream *object;
+  apr_status_t status;
+  int level;
+
+  level = luaL_optint(L, 2, Z_DEFAULT_COMPRESSION);
+  luaL_argcheck(L, level >= -1 && level <= 9, 2, "compression level must be between 0 and 9");
+  lua_settop(L, 1);
+  object = new_zstream(L, &lua_apr_zwriter_type);
+
+  /* Data written before the stream was created goes first. */
+  status = flush_buffer(L, object->sink, 1);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  if (deflateInit2(&object->stream, level, Z_DEFLATED, gzip ? 15 + 16 : 15,
+        8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    object->state = ZSTREAM_CLOSED;
+    return push_error_memory(L);
+  }
+  init_buffers(L, &object->input, &object->output, object, 0,
+      NULL, zstream_write, NULL);
+
+  return 1;
+}
+
+/* file:gzip_writer([level]) -> writer {{{1
+ *
+ * Create a stream that compresses everything written to it in the gzip format
+ * (as used by [gzip] [gzip] and the `Content-Encoding: gzip` header of HTTP)
+ * before writing it to the file. The optional @level is a number between 0
+ * (no compression) and 9 (best compression), the default is 6. On success the
+ * writer is returned, otherwise a nil followed by an error message is
+ * returned. This method is also available on socket objects.
+ *
+ * The writer supports the methods `writer:write()` (which works like
+ * `file:write()`), `writer:flush()` (which writes all data compressed so far
+ * so that the other side can decompress it without waiting for more data)
+ * and `writer:close()` (which writes the end of the compressed stream). The
+ * file or socket is not closed by `writer:close()`.
+ *
+ * [gzip]: http://en.wikipedia.org/wiki/Gzip
+ */
+
+int stream_gzip_writer(lua_State *L)
+{
+  return new_writer(L, 1);
+}
+
+/* file:deflate_writer([level]) -> writer {{{1
+ *
+ * Create a stream that compresses everything written to it in the zlib
+ * format (as used by the `Content-Encoding: deflate` header of HTTP). This
+ * works the same as `file:gzip_writer()` and is also available on socket
+ * objects.
+ */
+
+int stream_deflate_writer(lua_State *L)
+{
+  return new_writer(L, 0);
+}
+
+/* file:inflate_reader() -> reader {{{1
+ *
+ * Create a stream that decompresses data read from the file. Both the gzip
+ * and zlib formats are supported (the format is detected automatically). On
+ * success the reader is returned, otherwise a nil followed by an error
+ * message is returned. This method is also available on socket objects.
+ *
+ * The reader supports the methods `reader:read()` and `reader:lines()` which
+ * work like `file:read()` and `file:lines()` and `reader:close()`. The end of
+ * the compressed stream is reported as the end of the file and any data that
+ * follows it can still be read from the file or socket. Corrupt and
+ * truncated data is reported by returning a nil followed by an error message.
+ */
+
+int stream_inflate_reader(lua_State *L)
+{
+  lua_apr_zstream *object;
+
+  lua_settop(L, 1);
+  object = new_zstream(L, &lua_apr_zreader_type);
+  if (inflateInit2(&object->stream, 15 + 32) != Z_OK) {
+    object->state = ZSTREAM_CLOSED;
+    return push_error_memory(L);
+  }
+  init_buffers(L, &object->input, &object->output, object, 0,
+      zstream_read, NULL, NULL);
+
+  return 1;
+}
+
+/* writer:write(value [, ...]) -> status {{{1 */
+
+static int zwriter_write(lua_State *L)
+{
+  lua_apr_zstream *object;
+  apr_status_t status;
+  int nresults;
+
+  object = check_zstream(L, 1, &lua_apr_zwriter_type);
+  status = flush_buffer(L, object->sink, 1);
+  if (status != APR_SUCCESS)
+    return push_error_status(L, status);
+  nresults = write_buffer(L, &object->output);
+  if (object->error != NULL)
+    return push_error_message(L, object->error);
+
+  return nresults;
+}
+
+/* writer:flush() -> status {{{1 */
+
+static int zwriter_flush(lua_State *L)
+{
+  lua_apr_zstream *object;
+  lua_apr_writebuf *sink;
+  apr_status_t status;
+
+  object = check_zstream(L, 1, &lua_apr_zwriter_type);
+  sink = object->sink;
+  status = flush_buffer(L, sink, 1);
+  if (status == APR_SUCCESS)
+    status = flush_buffer(L, &object->output, 1);
+  if (status == APR_SUCCESS)
+    status = compress_input(object, Z_SYNC_FLUSH);
+  if (status == APR_SUCCESS)
+    status = write_pending(object);
+  if (status == APR_SUCCESS && sink->flush != NULL)
+    status = sink->flush(sink->object);
+  if (status != APR_SUCCESS)
+    return push_zstream_error(L, object, status);
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* writer:close() -> status {{{1 */
+
+static int zwriter_close(lua_State *L)
+{
+  lua_apr_zstream *object;
+  apr_status_t status;
+
+  object = check_zstream(L, 1, &lua_apr_zwriter_type);
+  status = flush_buffer(L, object->sink, 1);
+  if (status == APR_SUCCESS)
+    status = flush_buffer(L, &object->output, 1);
+  if (status == APR_SUCCESS)
+    status = compress_input(object, Z_FINISH);
+  if (status == APR_SUCCESS)
+    status = write_pending(object);
+  if (status != APR_SUCCESS)
+    return push_zstream_error(L, object, status);
+  deflateEnd(&object->stream);
+  free_buffer(L, &object->output.buffer);
+  object->state = ZSTREAM_CLOSED;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* reader:read([format, ...]) -> mixed value {{{1 */
+
+static int zreader_read(lua_State *L)
+{
+  lua_apr_zstream *object;
+  int nresults;
+
+  object = check_zstream(L, 1, &lua_apr_zreader_type);
+  nresults = read_buffer(L, &object->input);
+  if (object->error != NULL) {
+    lua_settop(L, 1);
+    return push_error_message(L, object->error);
+  }
+
+  return nresults;
+}
+
+/* reader:lines() -> iterator {{{1 */
+
+static int zreader_lines(lua_State *L)
+{
+  lua_apr_zstream *object;
+
+  object = check_zstream(L, 1, &lua_apr_zreader_type);
+  return read_lines(L, &object->input);
+}
+
+/* reader:close() -> status {{{1 */
+
+static int zreader_close(lua_State *L)
+{
+  lua_apr_zstream *object;
+
+  object = check_zstream(L, 1, &lua_apr_zreader_type);
+  inflateEnd(&object->stream);
+  free_buffer(L, &object->input.buffer);
+  object->state = ZSTREAM_CLOSED;
+  lua_pushboolean(L, 1);
+
+  return 1;
+}
+
+/* stream:__tostring() {{{1 */
+
+static int zstream_tostring(lua_State *L)
+{
+  lua_apr_objtype *T = &lua_apr_zreader_type;
+  lua_apr_zstream *object;
+
+  if (!object_has_type(L, 1, T, 1))
+    T = &lua_apr_zwriter_type;
+  object = check_object(L, 1, T);
+  if (object->state != ZSTREAM_CLOSED)
+    lua_pushfstring(L, "%s (%p)", T->friendlyname, object);
+  else
+    lua_pushfstring(L, "%s (closed)", T->friendlyname);
+
+  return 1;
+}
+
+/* stream:__gc() {{{1 */
+
+static int zstream_gc(lua_State *L)
+{
+  lua_apr_objtype *T = &lua_apr_zreader_type;
+  lua_apr_zstream *object;
+
+  if (!object_has_type(L, 1, T, 1))
+    T = &lua_apr_zwriter_type;
+  object = check_object(L, 1, T);
+  if (object->state != ZSTREAM_CLOSED) {
+    /* Unfinished compressed data is discarded. */
+    if (T == &lua_apr_zwriter_type)
+      deflateEnd(&object->stream);
+    else
+      inflateEnd(&object->stream);
+    object->state = ZSTREAM_CLOSED;
+  }
+  free_buffer(L, &object->input.buffer);
+  free_buffer(L, &object->output.buffer);
+
+  return 0;
+}
+
+/* Internal object definitions. {{{1 */
+
+static luaL_reg zreader_methods[] = {
+  { "read", zreader_read },
+  { "lines", zreader_lines },
+  { "close", zreader_close },
+  { NULL, NULL }
+};
+
+static luaL_reg zwriter_methods[] = {
+  { "write", zwriter_write },
+  { "flush", zwriter_flush },
+  { "close", zwriter_close },
+  { NULL, NULL }
+};
+
+static luaL_reg zstream_metamethods[] = {
+  { "__tostring", zstream_tostring },
+  { "__gc", zstream_gc },
+  { NULL, NULL }
+};
+
+/* Compression streams are left out of lua_apr_types[] because they refer to
+ * their file or socket through their environment in the Lua state that
+ * created them. */
+
+static lua_apr_objtype lua_apr_zreader_type = {
+  "lua_apr_zreader*",          /* metatable name in registry */
+  "inflate reader",            /* friendly object name */
+  sizeof(lua_apr_zstream),     /* structure size */
+  zreader_methods,             /* methods table */
+  zstream_metamethods          /* metamethods table */
+};
+
+static lua_apr_objtype lua_apr_zwriter_type = {
+  "lua_apr_zwriter*",          /* metatable name in registry */
+  "compression writer",        /* friendly object name */
+  sizeof(lua_apr_zstream),     /* structure size */
+  zwriter_methods,             /* methods table */
+  zstream_metamethods          /* metamethods table */
+};
+
+#endif
@@ -3,7 +3,7 @@
  Unit tests for the Base64 encoding module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: March 27, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -24,3 +24,63 @@ assert(apr.base64_encode(plain) == coded)
 
 -- Check that Base64 decoding returns the expected result.
 assert(apr.base64_decode(coded) == plain)
+
+-- Base64 encoding and decoding are binary safe.
+local binary = {}
+for i = 0, 255 do binary[#binary + 1] = string.char(i) end
+binary = table.concat(binary):rep(41) -- not a multiple of three bytes
+assert(apr.base64_decode(apr.base64_encode(binary)) == binary)
+assert(apr.base64_encode '' == '')
+assert(apr.base64_encode 'f' == 'Zg==')
+assert(apr.base64_encode 'fo' == 'Zm8=')
+assert(apr.base64_encode 'foo' == 'Zm9v')
+
+-- Whitespace and missing padding are accepted, other characters aren't.
+local wrapped = apr.base64_encode(binary):gsub('(' .. ('.'):rep(76) .. ')', '%1\r\n')
+assert(apr.base64_decode(wrapped) == binary)
+assert(apr.base64_decode 'Zm8' == 'fo')
+assert(apr.base64_decode 'Zm8=\n' == 'fo')
+local result, message = apr.base64_decode 'Zm9v!'
+assert(result == nil and message:find 'invalid base64')
+assert(not apr.base64_decode 'Zm8=Zm8=')
+assert(not apr.base64_decode 'Zm9vY')
+
+-- Incremental encoding and decoding with arbitrary chunk boundaries.
+local encoder, decoder = apr.base64_encoder(), apr.base64_decoder()
+assert(apr.type(encoder) == 'base64 codec')
+assert(tostring(encoder):find '^base64 encoder %(')
+assert(tostring(decoder):find '^base64 decoder %(')
+for _, size in ipairs { 1, 2, 5, 64, 1000 } do
+  local coded, decoded = {}, {}
+  for i = 1, #binary, size do
+    table.insert(coded, encoder:update(binary:sub(i, i + size - 1)))
+  end
+  table.insert(coded, encoder:finish())
+  coded = table.concat(coded)
+  assert(coded == apr.base64_encode(binary))
+  for i = 1, #coded, size do
+    table.insert(decoded, assert(decoder:update(coded:sub(i, i + size - 1))))
+  end
+  table.insert(decoded, assert(decoder:finish()))
+  assert(table.concat(decoded) == binary)
+end
+assert(not decoder:update 'Zm9v*')
+assert(decoder:update 'Z' == '')
+assert(not decoder:finish())
+assert(decoder:update 'Zm9v' == 'foo')
+
+-- Encoding and decoding files (and other streams).
+local helpers = require 'apr.test.helpers'
+local tmpfile = helpers.tmpname()
+helpers.writefile(tmpfile, binary)
+local handle = assert(apr.file_open(tmpfile))
+local coded = assert(encoder:update_from(handle)) .. encoder:finish()
+assert(coded == apr.base64_encode(binary))
+assert(handle:close())
+helpers.writefile(tmpfile, wrapped)
+handle = assert(apr.file_open(tmpfile))
+-- The first 100 characters contain 98 base64 digits: 24 groups of four digits.
+assert(decoder:update_from(handle, 100) == binary:sub(1, 72))
+assert(assert(decoder:update_from(handle)) .. assert(decoder:finish()) == binary:sub(73))
+assert(handle:close())
+os.remove(tmpfile)
@@ -0,0 +1,93 @@
+--[[
+
+ Unit tests for the chunked transfer encoding module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+-- Connect a client and a server socket.
+local port = math.random(10000, 40000)
+local listener = assert(apr.socket_create())
+assert(listener:bind('127.0.0.1', port))
+assert(listener:listen(1))
+local client = assert(apr.socket_create())
+assert(client:connect('127.0.0.1', port))
+local server = assert(listener:accept())
+
+-- Each write is framed as a single chunk.
+local writer = assert(server:chunked_writer())
+assert(tostring(writer):find '^chunked writer %(')
+assert(writer:write('Hello', ' ', 'world!'))
+assert(writer:write '')
+assert(writer:write(string.rep('x', 300)))
+assert(writer:close { ['X-Checksum'] = 'abc' })
+assert(tostring(writer) == 'chunked writer (closed)')
+assert(not pcall(writer.write, writer, 'more'))
+assert(client:read '*l' == 'c\r')
+assert(client:read(14) == 'Hello world!\r\n')
+assert(client:read '*l' == '12c\r')
+assert(client:read(302) == string.rep('x', 300) .. '\r\n')
+assert(client:read(22) == '0\r\nX-Checksum: abc\r\n\r\n')
+
+-- Chunked readers decode what chunked writers encode.
+local message = string.rep('Lua/APR ', 10000)
+writer = assert(server:chunked_writer())
+for i = 1, #message, 999 do
+  assert(writer:write(message:sub(i, i + 998)))
+end
+assert(writer:close())
+assert(server:write 'next message')
+local reader = assert(client:chunked_reader())
+assert(reader:read '*a' == message)
+assert(reader:read(1) == nil)
+assert(reader:close())
+assert(client:read(12) == 'next message')
+
+-- Lines, chunk extensions and trailers.
+assert(server:write '5;name=value\r\none\nt\r\n09\r\nwo\nthree\n\r\n0\r\nFoo: bar\r\n\r\nafter')
+reader = assert(client:chunked_reader())
+local lines = {}
+for line in reader:lines() do table.insert(lines, line) end
+assert(#lines == 3 and lines[1] == 'one' and lines[2] == 'two' and lines[3] == 'three')
+assert(client:read(5) == 'after')
+
+-- Closing a reader skips the remaining chunks.
+assert(server:write '3\r\nabc\r\n3\r\ndef\r\n0\r\n\r\nrest')
+reader = assert(client:chunked_reader())
+assert(reader:read(2) == 'ab')
+assert(reader:close())
+assert(tostring(reader) == 'chunked reader (closed)')
+assert(client:read(4) == 'rest')
+
+-- Invalid framing is reported as an error.
+assert(server:write 'xyz\r\n')
+reader = assert(client:chunked_reader())
+local result, errmsg = reader:read '*a'
+assert(result == nil and errmsg:find 'invalid chunk header')
+assert(client:read '*l' == 'xyz\r')
+assert(server:write '3\r\nabcdef\r\n')
+reader = assert(client:chunked_reader())
+result, errmsg = reader:read '*a'
+assert(result == nil and errmsg:find 'missing CRLF')
+assert(client:read '*l' == 'def\r')
+
+-- Bodies that end prematurely are reported as an error.
+assert(server:write '10\r\nshort')
+assert(server:close())
+reader = assert(client:chunked_reader())
+result, errmsg = reader:read '*a'
+assert(result == nil and errmsg:find 'prematurely')
+
+assert(client:close())
+assert(listener:close())
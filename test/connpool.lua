@@ -0,0 +1,85 @@
+--[[
+
+ Unit tests for the connection pool module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not (apr.connection_pool and apr.thread) then
+  helpers.warning "Connection pool module not available!\n"
+  return false
+end
+
+local port = math.random(10000, 40000)
+
+-- Start an echo server that serves three connections one after another.
+local server = assert(apr.thread(function()
+  local apr = require 'apr'
+  local server = assert(apr.socket_create())
+  assert(server:opt_set('reuse-addr', true))
+  assert(server:bind('*', port))
+  assert(server:listen(5))
+  for i = 1, 3 do
+    local client = assert(server:accept())
+    for line in client:lines() do
+      assert(client:write(line, '\n'))
+    end
+    assert(client:close())
+  end
+  assert(server:close())
+end))
+apr.sleep(0.25)
+
+local pool = assert(apr.connection_pool { max_per_host = 1, idle_timeout = 60 })
+assert(apr.type(pool) == 'connection pool')
+
+-- The first request makes a new connection.
+local socket = assert(pool:acquire('127.0.0.1', port))
+assert(socket:write 'first\n')
+assert(socket:read() == 'first')
+assert(pool:release(socket) == true)
+assert(not pcall(socket.read, socket)) -- released sockets are closed
+
+-- The second request reuses the connection.
+socket = assert(pool:acquire('127.0.0.1', port))
+assert(socket:write 'second\n')
+assert(socket:read() == 'second')
+local stats = pool:stats()
+assert(stats.hits == 1 and stats.misses == 1)
+assert(stats.acquired == 1 and stats.hosts == 1)
+
+-- Connections with unread input aren't reused.
+assert(socket:write 'third\nfourth\n')
+apr.sleep(0.1)
+assert(socket:read() == 'third') -- leaves 'fourth' in the read buffer
+assert(pool:release(socket) == false)
+
+-- Closing an acquired socket discards the connection (the server closes the
+-- second connection when it sees end of file).
+socket = assert(pool:acquire('127.0.0.1', port))
+assert(pool:stats().misses == 2)
+assert(socket:close())
+assert(pool:stats().acquired == 0)
+
+-- Input that's still in the kernel's receive buffer also prevents reuse.
+socket = assert(pool:acquire('127.0.0.1', port))
+assert(socket:write 'fifth\n')
+apr.sleep(0.1)
+assert(pool:release(socket) == false)
+assert(server:join())
+
+-- Sockets can only be released to the pool they were acquired from.
+local other = assert(apr.socket_create())
+assert(not pcall(pool.release, pool, other))
+assert(other:close())
@@ -3,7 +3,7 @@
  Unit tests for the cryptography module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: March 27, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -47,3 +47,83 @@ assert(context:digest() == '2fd4e1c67a2d28fced849ee1bb76e7391b93eb12')
 assert(context:reset())
 assert(context:update 'The quick brown fox jumps over the lazy cog')
 assert(context:digest() == 'de9f2c7fd25e1b3afad3e85a0bd17d9b100db4b3')
+
+-- Test hashing of files and streams without Lua strings.
+local helpers = require 'apr.test.helpers'
+local tmpfile = helpers.tmpname()
+local data = string.rep('The quick brown fox jumps over the lazy dog\n', 100000)
+helpers.writefile(tmpfile, data)
+assert(apr.md5_file(tmpfile) == apr.md5(data))
+assert(apr.sha1_file(tmpfile) == apr.sha1(data))
+assert(apr.md5_file(tmpfile, true) == apr.md5(data, true))
+assert(apr.sha1_file(tmpfile, true) == apr.sha1(data, true))
+helpers.writefile(tmpfile, '')
+assert(apr.md5_file(tmpfile) == 'd41d8cd98f00b204e9800998ecf8427e')
+helpers.writefile(tmpfile, data)
+local handle = assert(apr.file_open(tmpfile))
+assert(handle:read '*l' == 'The quick brown fox jumps over the lazy dog')
+context = assert(apr.md5_init())
+assert(context:update_from(handle, 100) == 100)
+assert(context:update_from(handle) == #data - 144)
+assert(context:update_from(handle) == 0)
+assert(context:digest() == apr.md5(data:sub(45)))
+assert(handle:seek('set', 0))
+context = assert(apr.sha1_init())
+assert(context:update_from(handle) == #data)
+assert(context:digest() == apr.sha1(data))
+assert(not pcall(context.update_from, context, handle))
+assert(handle:close())
+assert(not pcall(assert(apr.md5_init()).update_from, assert(apr.md5_init()), handle))
+os.remove(tmpfile)
+assert(not apr.md5_file(tmpfile))
+
+-- Test password validation on helper threads.
+if apr.password_validator then
+  local credentials, expected = {}, {}
+  for i = 1, 20 do
+    local password = 'password ' .. i
+    local digest = apr.md5_encode(password, 'salt' .. i)
+    if i % 3 == 0 then password = password .. '!' end
+    credentials[i], expected[i] = { password, digest }, i % 3 ~= 0
+  end
+  local results = assert(apr.password_validate_batch(credentials))
+  for i = 1, #credentials do assert(results[i] == expected[i]) end
+  results = assert(apr.password_validate_batch(credentials, 1))
+  for i = 1, #credentials do assert(results[i] == expected[i]) end
+  assert(#apr.password_validate_batch {} == 0)
+  assert(not pcall(apr.password_validate_batch, { 'password' }))
+  assert(not pcall(apr.password_validate_batch, credentials, 0))
+
+  local validator = assert(apr.password_validator(2))
+  assert(apr.type(validator) == 'password validator')
+  local pollset = assert(apr.pollset(1))
+  assert(pollset:add(validator, 'input'))
+  local pending = {}
+  for i, pair in ipairs(credentials) do
+    pending[assert(validator:validate(pair[1], pair[2]))] = i
+  end
+  local remaining = #credentials
+  while remaining > 0 do
+    assert(pollset:poll(-1))
+    for _, result in ipairs(validator:results()) do
+      local i = assert(pending[result.id])
+      pending[result.id] = nil
+      assert(result.valid == expected[i])
+      assert(result.valid or (result.error and result.code))
+      remaining = remaining - 1
+    end
+  end
+  assert(#validator:results() == 0)
+  assert(pollset:remove(validator))
+  assert(validator:close())
+  assert(tostring(validator) == 'password validator (closed)')
+  assert(not pcall(validator.validate, validator, pass, hash))
+
+  -- The coroutine scheduler validates passwords without blocking.
+  local loop = assert(apr.loop())
+  local outcome = {}
+  loop:spawn(function() outcome.good = loop:password_validate(pass, hash) end)
+  loop:spawn(function() outcome.bad = loop:password_validate('wrong', hash) end)
+  assert(loop:run())
+  assert(outcome.good == true and outcome.bad == nil)
+end
@@ -250,3 +250,49 @@ assert(apr.type(statement_results) == 'result set')
 driver:close()
 check_reinitialized(function() results:tuple() end)
 check_reinitialized(function() statement:select() end)
+
+-- Connection pools with prepared statement caches. {{{1
+
+if apr.dbd_pool then
+  local pool = assert(apr.dbd_pool('sqlite3', ':memory:', { max = 2, statements = 1 }))
+  assert(apr.type(pool) == 'database connection pool')
+  assert(tostring(pool):find '^database connection pool %(')
+
+  local conn = assert(pool:acquire())
+  assert(apr.type(conn) == 'database driver')
+  assert(conn:check())
+  local first = assert(conn:prepare 'SELECT 1, 2, 3')
+  local second = assert(conn:prepare 'SELECT 1, 2, 3')
+  helpers.checktuple({ '1', '2', '3' }, assert(second:select()):tuple(1))
+  assert(conn:prepare 'SELECT 4, 5, 6')
+  local stats = pool:stats()
+  assert(stats.misses == 1 and stats.hits == 0 and stats.acquired == 1)
+  assert(stats.statement_misses == 2 and stats.statement_hits == 1)
+
+  -- Released connections are reused, their prepared statements invalidated.
+  assert(pool:release(conn) == true)
+  check_reinitialized(function() first:select() end)
+  assert(not pcall(pool.release, pool, conn))
+  stats = pool:stats()
+  assert(stats.acquired == 0 and stats.evictions == 1)
+
+  conn = assert(pool:acquire())
+  assert(conn:prepare 'SELECT 4, 5, 6')
+  stats = pool:stats()
+  assert(stats.hits == 1 and stats.statement_hits == 2)
+
+  -- Connections in the middle of a transaction aren't reused.
+  assert(conn:transaction_start())
+  assert(pool:release(conn) == false)
+  conn = assert(pool:acquire())
+  stats = pool:stats()
+  assert(stats.misses == 2 and stats.acquired == 1)
+  assert(pool:release(conn))
+
+  -- Drivers of other pools are rejected.
+  local other = assert(apr.dbd_pool('sqlite3', ':memory:'))
+  conn = assert(other:acquire())
+  assert(not pcall(pool.release, pool, conn))
+  assert(conn:close())
+  assert(other:stats().acquired == 0)
+end
@@ -0,0 +1,86 @@
+--[[
+
+ Unit tests for the message digest module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+local fox = 'The quick brown fox jumps over the lazy dog'
+local large = string.rep('Lua/APR ', 100000)
+
+-- Known answers from the specifications and reference implementations.
+local samples = {
+  sha256 = {
+    [''] = 'e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855',
+    ['abc'] = 'ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad',
+    [fox] = 'd7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592',
+    [large] = 'da2c7454a5f3fa4b6b9d49d13933704e812a2cad4f39e98a71c453a56ddcecab',
+  },
+  sha512 = {
+    [''] = 'cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e',
+    ['abc'] = 'ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f',
+    [fox] = '07e547d9586f6a73f73fbac0435ed76951218fb7d0c8d788a309d785436bbb642e93a252a954f23912547d1e8a3b5ed6e1bfd7097821233fa0538f3db854fee6',
+    [large] = '4770f59f2c573c96c60cf6d880d4ffde5a7f70677ecee917b3aab05e98a90b28d707b4b38a25630df5e6fffd15ba376d1a9d6d6ea5d3ad57a37161e096e0c26b',
+  },
+  crc32c = {
+    [''] = '00000000',
+    ['123456789'] = 'e3069283',
+    [large] = '1e9f17eb',
+  },
+  xxh3 = {
+    [''] = '2d06800538d394c2',
+    ['abc'] = '78af5f94892f3950',
+    [fox] = 'ce7d19a5418fb365',
+    [large] = 'ab74c043b9aebb2a',
+  },
+}
+
+local tmpfile = helpers.tmpname()
+for name, answers in pairs(samples) do
+  local hash, hash_file, hash_init = apr[name], apr[name .. '_file'], apr[name .. '_init']
+  for input, expected in pairs(answers) do
+    -- One shot interface.
+    assert(hash(input) == expected)
+    assert(hash(input, true):gsub('.', function(c)
+      return string.format('%02x', c:byte())
+    end) == expected)
+    -- Incremental interface, feeding the input in pieces of different sizes.
+    local context = assert(hash_init())
+    assert(tostring(context):find('^' .. name .. ' context %('))
+    local offset, size = 1, 1
+    while offset <= #input do
+      assert(context:update(input:sub(offset, offset + size - 1)))
+      offset, size = offset + size, size * 3 + 1
+    end
+    assert(context:digest() == expected)
+    assert(tostring(context) == name .. ' context (closed)')
+    assert(not pcall(context.update, context, 'more'))
+    assert(context:reset())
+    assert(context:update(input))
+    assert(context:digest() == expected)
+    -- Files and streams.
+    helpers.writefile(tmpfile, input)
+    assert(hash_file(tmpfile) == expected)
+    local handle = assert(apr.file_open(tmpfile))
+    assert(context:reset())
+    assert(context:update_from(handle) == #input)
+    assert(context:digest() == expected)
+    assert(handle:close())
+  end
+end
+os.remove(tmpfile)
+assert(not apr.sha256_file(tmpfile))
+
+-- Contexts are reported by apr.type().
+assert(apr.type(apr.sha256_init()) == 'digest context')
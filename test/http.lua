@@ -3,7 +3,7 @@
  Unit tests for the HTTP request parsing module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: March 27, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -136,7 +136,7 @@ local expected = {
  }
 }
 
-local actual = assert(apr.parse_multipart(nl2crlf [[
+local multipart = nl2crlf [[
 --AaB03x
 content-disposition: form-data; name="field1"
 content-type: text/plain;charset=windows-1250
@@ -157,10 +157,55 @@ content-transfer-encoding: quoted-printable
 
 Joe owes =80100.
 --AaB03x--
-]], 'multipart/form-data; charset="iso-8859-1"; boundary="AaB03x"'))
+]]
+
+local enctype = 'multipart/form-data; charset="iso-8859-1"; boundary="AaB03x"'
+local actual = assert(apr.parse_multipart(multipart, enctype))
 
 assert(helpers.deepequal(expected, actual))
 
+-- Test apr.multipart_parser() {{{1
+
+-- Feed the body in small pieces, with uploads kept in memory and spooled to disk.
+for _, limit in ipairs { 4, 1024 } do
+  for size = 1, 50, 7 do
+    local parts = {}
+    local parser = assert(apr.multipart_parser(enctype, function(name, part)
+      table.insert(parts, { name = name, part = part })
+    end, { limit = limit }))
+    local done
+    for i = 1, #multipart, size do
+      local result, message = parser:feed(multipart:sub(i, i + size - 1))
+      assert(result ~= nil, message)
+      done = result
+    end
+    assert(done)
+    assert(#parts == 3)
+    assert(parts[1].name == 'field1')
+    assert(parts[1].part.value == 'Joe owes =80100.')
+    assert(parts[1].part.headers['content-type'] == 'text/plain;charset=windows-1250')
+    assert(parts[2].name == 'pics')
+    assert(parts[2].part.filename == 'file1.txt')
+    assert(parts[2].part.size == 31)
+    assert(parts[2].part.headers['Content-Type'] == 'text/plain')
+    assert(parts[2].part.file:read '*a' == '... contents of file1.txt ...\r\n')
+    assert(parts[2].part.file:close())
+    assert(parts[3].name == '')
+    assert(parts[3].part.value == 'Joe owes =80100.')
+  end
+end
+
+-- Read the body from a file object.
+local tempfile = helpers.tmpname()
+helpers.writefile(tempfile, multipart)
+local handle = assert(apr.file_open(tempfile, 'rb'))
+local names = {}
+local parser = assert(apr.multipart_parser(enctype, function(name) table.insert(names, name) end))
+assert(parser:read(handle, #multipart))
+assert(handle:close())
+assert(table.concat(names, ',') == 'field1,pics,')
+os.remove(tempfile)
+
 -- Test apr.header_attribute() {{{1
 
 local header = 'text/plain; boundary="-foo-", charset=ISO-8859-1';
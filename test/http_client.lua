@@ -0,0 +1,189 @@
+--[[
+
+ Unit tests for the HTTP client module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not (apr.thread and apr.http_request) then
+  helpers.warning "HTTP client module not available!\n"
+  return false
+end
+
+local port = math.random(10000, 40000)
+local base = 'http://127.0.0.1:' .. port
+local largedata = string.rep('Lua/APR HTTP client ', 8192)
+
+-- Run a server in a separate thread so that we can be its client.
+local thread = assert(apr.thread(function(port, largedata)
+  local apr = require 'apr'
+  local server = assert(apr.http_server {
+    host = '127.0.0.1',
+    port = port,
+    handler = function(request)
+      if request.path == '/hello' then
+        return 200, { ['Content-Type'] = 'text/plain' }, 'Hello world!'
+      elseif request.path == '/echo' then
+        local body = request.method .. ' ' .. (request.query or '') .. ' ' .. (request.body or '')
+        return 200, { ['X-Test'] = request.headers['x-test'] }, body
+      elseif request.path == '/large' then
+        return 200, {}, largedata
+      elseif request.path == '/stream' then
+        local parts = { 'one', 'two', 'three' }
+        return 200, {}, function() return table.remove(parts, 1) end
+      elseif request.path == '/stop' then
+        request.server:stop()
+        return 200, {}, 'bye'
+      end
+      return 404, {}, 'not found'
+    end
+  })
+  assert(server:run())
+  assert(server:close())
+end, port, largedata))
+
+-- Wait for the server to start.
+local pool = assert(apr.connection_pool())
+for i = 1, 50 do
+  if apr.http_request { url = base .. '/hello', pool = pool } then break end
+  apr.sleep(0.1)
+end
+
+-- Simple requests reuse the same connection.
+local response = assert(apr.http_request { url = base .. '/hello', pool = pool })
+assert(response.status == 200 and response.reason == 'OK')
+assert(response.headers['content-type'] == 'text/plain')
+assert(response.length == 12 and response.body == 'Hello world!')
+assert(pool:stats().hits >= 1)
+
+-- Bytes that could inject headers or requests are rejected.
+for _, request in ipairs {
+  { url = base .. '/hello', headers = { ['X-Test'] = 'a\r\nX-Injected: 1' } },
+  { url = base .. '/hello', headers = { ['X-Test'] = { 'ok', 'a\0b' } } },
+  { url = base .. '/hello', headers = { ['X Test'] = 'a' } },
+  { url = base .. '/hello', method = 'GET / HTTP/1.1\r\n' },
+} do
+  request.pool = pool
+  local response, message = apr.http_request(request)
+  assert(response == nil and message:find '^invalid ')
+end
+
+-- Request bodies, query strings and request headers.
+response = assert(apr.http_request {
+  method = 'POST', url = base .. '/echo?x=1', pool = pool,
+  headers = { ['X-Test'] = 'yes' }, body = 'hello',
+})
+assert(response.status == 200 and response.headers['x-test'] == 'yes')
+assert(response.body == 'POST x=1 hello')
+
+-- Request bodies read from a stream are sent using chunked encoding.
+local tmpfile = helpers.tmpname()
+helpers.writefile(tmpfile, 'streamed body')
+local handle = assert(apr.file_open(tmpfile))
+response = assert(apr.http_request { method = 'PUT', url = base .. '/echo', body = handle })
+assert(response.body == 'PUT  streamed body')
+assert(handle:close())
+
+-- Chunked responses are decoded.
+response = assert(apr.http_request { url = base .. '/stream' })
+assert(response.chunked and response.body == 'onetwothree')
+
+-- Responses to HEAD requests have no body.
+response = assert(apr.http_request { method = 'HEAD', url = base .. '/hello' })
+assert(response.status == 200 and response.body == '')
+
+-- Large bodies can be written to a file...
+handle = assert(apr.file_open(tmpfile, 'w+'))
+response = assert(apr.http_request { url = base .. '/large', output = handle })
+assert(response.body == nil)
+assert(handle:seek('set', 0))
+assert(handle:read '*a' == largedata)
+assert(handle:close())
+os.remove(tmpfile)
+
+-- ... or passed to a function.
+local pieces = {}
+response = assert(apr.http_request {
+  url = base .. '/large',
+  output = function(data) table.insert(pieces, data) end,
+})
+assert(#pieces >= 1 and table.concat(pieces) == largedata)
+
+-- Errors raised by the output function are propagated.
+local ok, message = pcall(apr.http_request, {
+  url = base .. '/hello', output = function() error 'Output failed!' end,
+})
+assert(not ok and message:find 'Output failed!')
+
+-- Pipelined requests return a list of responses in order.
+local responses = assert(apr.http_request {
+  { url = base .. '/hello' },
+  { url = base .. '/missing' },
+  { url = base .. '/echo', method = 'POST', body = 'pipelined' },
+})
+assert(#responses == 3)
+assert(responses[1].status == 200 and responses[1].body == 'Hello world!')
+assert(responses[2].status == 404)
+assert(responses[3].body == 'POST  pipelined')
+assert(not pcall(apr.http_request, { { url = base .. '/hello' }, { url = 'http://example.com/' } }))
+
+-- Invalid URLs are reported as errors.
+local result, message = apr.http_request { url = 'ftp://example.com/' }
+assert(result == nil and message:find 'scheme')
+assert(not apr.http_request { url = 'not a url' })
+
+-- Stop the server.
+response = assert(apr.http_request { url = base .. '/stop' })
+assert(response.body == 'bye')
+assert(thread:join())
+
+-- Requests on reused connections that the server closed are only retried
+-- when the method is idempotent.
+port = port + 1
+thread = assert(apr.thread(function(port)
+  local apr = require 'apr'
+  local server = assert(apr.socket_create())
+  assert(server:opt_set('reuse-addr', true))
+  assert(server:bind('127.0.0.1', port))
+  assert(server:listen(5))
+  local function read_head(client)
+    for line in client:lines() do
+      if line:gsub('\r$', '') == '' then return true end
+    end
+  end
+  for i = 1, 2 do
+    -- Answer the first request, then close the connection on the next.
+    local client = assert(server:accept())
+    assert(read_head(client))
+    assert(client:write 'HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok')
+    assert(read_head(client))
+    assert(client:close())
+  end
+  assert(server:close())
+end, port))
+pool = assert(apr.connection_pool())
+base = 'http://127.0.0.1:' .. port
+for i = 1, 50 do
+  response = apr.http_request { url = base .. '/', pool = pool }
+  if response then break end
+  apr.sleep(0.1)
+end
+assert(response and response.body == 'ok')
+response = assert(apr.http_request { url = base .. '/', pool = pool })
+assert(response.body == 'ok')
+result, message = apr.http_request { url = base .. '/', method = 'POST', body = 'x', pool = pool }
+assert(result == nil and message)
+local stats = pool:stats()
+assert(stats.hits == 2 and stats.misses == 2)
+assert(thread:join())
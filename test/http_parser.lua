@@ -0,0 +1,119 @@
+--[[
+
+ Unit tests for the incremental HTTP parser module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+
+-- Two pipelined requests, the second with a chunked body.
+local input = 'GET /index.html?x=1 HTTP/1.1\r\nHost: localhost\r\nAccept: text/html\r\nAccept: text/plain\r\n\r\n'
+           .. 'POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n'
+           .. '5\r\nHello\r\n7;ext=1\r\n, world\r\n0\r\n\r\n'
+
+-- Feed the input in pieces of every size between one byte and all of it.
+for size = 1, #input do
+  local parser = assert(apr.http_parser 'request')
+  local messages, bodies = {}, {}
+  local position, message, body = 1
+  while position <= #input do
+    local data = input:sub(position, position + size - 1)
+    position = position + #data
+    local offset = 1
+    while offset <= #data do
+      if not message then
+        local result, next_offset = assert(parser:feed(data:sub(offset)))
+        if not result then break end
+        message, body = result, {}
+        offset = offset + next_offset - 1
+      end
+      if message then
+        local decoded, done, next_offset = assert(parser:body(data:sub(offset)))
+        table.insert(body, decoded)
+        offset = offset + next_offset - 1
+        if done then
+          table.insert(messages, message)
+          table.insert(bodies, table.concat(body))
+          message = nil
+        end
+      end
+    end
+  end
+  assert(#messages == 2)
+  assert(messages[1].method == 'GET')
+  assert(messages[1].uri == '/index.html?x=1')
+  assert(messages[1].version == '1.1')
+  assert(messages[1].keepalive)
+  assert(messages[1].headers.host == 'localhost')
+  assert(messages[1].headers.accept == 'text/html, text/plain')
+  assert(bodies[1] == '')
+  assert(messages[2].method == 'POST')
+  assert(messages[2].chunked)
+  assert(bodies[2] == 'Hello, world')
+end
+
+-- Responses with a Content-Length header.
+local parser = assert(apr.http_parser 'response')
+local response, offset = assert(parser:feed 'HTTP/1.0 404 Not Found\r\nContent-Length: 4\r\n\r\noops')
+assert(response.status == 404)
+assert(response.reason == 'Not Found')
+assert(response.version == '1.0')
+assert(not response.keepalive)
+assert(response.length == 4)
+assert(offset == 46)
+local body, done, rest = parser:body 'oops'
+assert(body == 'oops' and done and rest == 5)
+
+-- Responses that end when the connection is closed.
+response = assert(parser:feed 'HTTP/1.1 200 OK\r\n\r\n')
+assert(response.length == nil and not response.keepalive)
+body, done = parser:body 'some data'
+assert(body == 'some data' and not done)
+assert(parser:finish())
+
+-- Invalid messages are reported as errors.
+parser = assert(apr.http_parser())
+local result, message = parser:feed 'GET / HTTP/1.1\r\nNo colon\r\n\r\n'
+assert(result == nil and message:find 'header')
+assert(parser:reset())
+assert(parser:feed 'GET / HTTP/1.1\r\nContent-Length: 3\r\n\r\n')
+result, message = parser:finish()
+assert(result == nil and message == 'connection closed before end of message')
+assert(not pcall(parser.body, parser, ''))
+
+-- NUL bytes in the head are rejected instead of truncating the lines.
+assert(parser:reset())
+result, message = parser:feed 'GET /\0 HTTP/1.1\r\n\r\n'
+assert(result == nil and message:find 'NUL')
+
+-- Ambiguous body framing is rejected (request smuggling).
+local function rejected(head, pattern)
+  assert(parser:reset())
+  local result, message = parser:feed(head)
+  assert(result == nil and message:find(pattern))
+end
+rejected('POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n', 'Content%-Length')
+rejected('POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n', 'conflicting')
+rejected('POST / HTTP/1.1\r\nContent-Length: 5, 6\r\n\r\n', 'conflicting')
+rejected('POST / HTTP/1.1\r\nContent-Length: 5x\r\n\r\n', 'invalid Content%-Length')
+rejected('POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n', 'Transfer%-Encoding')
+rejected('POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n', 'Transfer%-Encoding')
+
+-- Repeated Content-Length headers that agree are fine.
+assert(parser:reset())
+local request = assert(parser:feed 'POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\n')
+assert(request.length == 2)
+
+-- In responses Transfer-Encoding overrides Content-Length, but the connection isn't reused.
+parser = assert(apr.http_parser 'response')
+response = assert(parser:feed 'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n')
+assert(response.chunked and not response.keepalive)
@@ -0,0 +1,230 @@
+--[[
+
+ Unit tests for the HTTP server module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not apr.thread then
+  helpers.warning "Multi threading module not available!\n"
+  return false
+end
+
+local port = math.random(10000, 40000)
+local tmpfile = helpers.tmpname()
+local filedata = string.rep('Lua/APR HTTP server ', 4096)
+helpers.writefile(tmpfile, filedata)
+
+-- Run the server in a separate thread so that we can be its client.
+local thread = assert(apr.thread(function(port, tmpfile)
+  local apr = require 'apr'
+  local server = assert(apr.http_server {
+    host = '127.0.0.1',
+    port = port,
+    max_body = 1024,
+    handler = function(request)
+      if request.path == '/hello' then
+        return 200, { ['Content-Type'] = 'text/plain' }, 'Hello world!'
+      elseif request.path == '/echo' then
+        local body = request.method .. ' ' .. (request.query or '') .. ' ' .. (request.body or '')
+        return 200, { ['X-Test'] = request.headers['x-test'] }, body
+      elseif request.path == '/file' then
+        return 200, {}, assert(apr.file_open(tmpfile))
+      elseif request.path == '/stream' then
+        local parts = { 'one', 'two', 'three' }
+        return 200, { ['Set-Cookie'] = { 'a=1', 'b=2' } }, function()
+          return table.remove(parts, 1)
+        end
+      elseif request.path == '/error' then
+        error 'Handler failed!'
+      elseif request.path == '/numeric' then
+        return 200, { 'ignored', ['X-Test'] = 'yes' }, 'ok'
+      elseif request.path == '/close' then
+        return 200, { Connection = 'close' }, 'closing'
+      elseif request.path == '/stop' then
+        request.server:stop()
+        return 200, {}, 'bye'
+      end
+      return 404, {}, 'not found'
+    end
+  })
+  local ip, port_number = assert(server:addr())
+  assert(ip == '127.0.0.1' and port_number == port)
+  assert(server:run())
+  local stats = server:stats()
+  assert(server:close())
+  return stats.requests, stats.errors, stats.error
+end, port, tmpfile))
+
+local function connect()
+  local socket = assert(apr.socket_create())
+  for i = 1, 50 do
+    if socket:connect('127.0.0.1', port) then return socket end
+    apr.sleep(0.1)
+  end
+  error "Failed to connect to HTTP server!"
+end
+
+-- Read a response and decode its body.
+local function read_response(socket)
+  local status = assert(socket:read()):gsub('\r$', '')
+  local code = tonumber(status:match '^HTTP/1%.1 (%d%d%d) ')
+  local headers = {}
+  for line in socket:lines() do
+    line = line:gsub('\r$', '')
+    if line == '' then break end
+    local name, value = line:match '^([^:]+):%s*(.-)$'
+    name = name:lower()
+    headers[name] = headers[name] and (headers[name] .. ', ' .. value) or value
+  end
+  local body
+  if headers['transfer-encoding'] == 'chunked' then
+    local chunks = {}
+    repeat
+      local size = tonumber(socket:read():gsub('\r$', ''), 16)
+      if size > 0 then table.insert(chunks, socket:read(size)) end
+      socket:read()
+    until size == 0
+    body = table.concat(chunks)
+  else
+    body = socket:read(tonumber(headers['content-length']))
+  end
+  return code, headers, body
+end
+
+local client = connect()
+
+-- Simple request on a persistent connection.
+assert(client:write 'GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n')
+local code, headers, body = read_response(client)
+assert(code == 200)
+assert(headers['content-type'] == 'text/plain')
+assert(headers['content-length'] == '12')
+assert(headers['date'])
+assert(body == 'Hello world!')
+
+-- Request body, query string and request headers.
+assert(client:write 'POST /echo?x=1 HTTP/1.1\r\nContent-Length: 5\r\nX-Test: yes\r\n\r\nhello')
+code, headers, body = read_response(client)
+assert(code == 200 and headers['x-test'] == 'yes')
+assert(body == 'POST x=1 hello')
+
+-- Chunked request body.
+assert(client:write 'PUT /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and body == 'PUT  abcde')
+
+-- Pipelined requests are answered in order.
+assert(client:write 'GET /hello HTTP/1.1\r\n\r\nGET /missing HTTP/1.1\r\n\r\nHEAD /hello HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and body == 'Hello world!')
+code, headers, body = read_response(client)
+assert(code == 404 and body == 'not found')
+code = assert(client:read()):match '^HTTP/1%.1 (%d+)'
+assert(code == '200')
+for line in client:lines() do
+  if line:gsub('\r$', '') == '' then break end
+end
+
+-- Static file bodies.
+assert(client:write 'GET /file HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and body == filedata)
+
+-- Bodies generated by a function use chunked encoding.
+assert(client:write 'GET /stream HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and body == 'onetwothree')
+assert(headers['set-cookie'] == 'a=1, b=2')
+
+-- Errors in handlers result in a 500 response.
+assert(client:write 'GET /error HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 500)
+assert(client:close())
+
+-- Bodies that are too large are rejected and the connection is closed.
+client = connect()
+assert(client:write 'POST /echo HTTP/1.1\r\nContent-Length: 4096\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 413 and headers['connection'] == 'close')
+assert(client:close())
+
+-- Malformed requests get a 400 response.
+client = connect()
+assert(client:write 'NONSENSE\r\n\r\n')
+code = read_response(client)
+assert(code == 400)
+assert(client:close())
+
+-- NUL bytes in the request line and ambiguous body framing are rejected.
+for _, request in ipairs {
+  'GET /\0 HTTP/1.1\r\n\r\n',
+  'POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n0\r\n\r\n',
+  'POST /echo HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd',
+  'POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n',
+} do
+  client = connect()
+  assert(client:write(request))
+  code = read_response(client)
+  assert(code == 400)
+  assert(client:close())
+end
+
+-- HTTP/1.0 connections are closed unless the client asks for keep-alive.
+client = connect()
+assert(client:write 'GET /hello HTTP/1.0\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and headers['connection'] == 'close')
+assert(client:read() == nil)
+assert(client:close())
+
+-- Header tables with numeric keys don't break the server.
+client = connect()
+assert(client:write 'GET /numeric HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and headers['x-test'] == 'yes' and body == 'ok')
+assert(client:close())
+
+-- Handlers can close the connection after the response.
+client = connect()
+assert(client:write 'GET /close HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and headers['connection'] == 'close' and body == 'closing')
+assert(client:read() == nil)
+assert(client:close())
+
+-- Stopping the server finishes responses that are still being sent.
+local slow_client = connect()
+assert(slow_client:write 'GET /file HTTP/1.1\r\n\r\n')
+apr.sleep(0.2)
+
+-- Stop the server.
+client = connect()
+assert(client:write 'GET /stop HTTP/1.1\r\n\r\n')
+code, headers, body = read_response(client)
+assert(code == 200 and body == 'bye')
+assert(headers['connection'] == 'close')
+assert(client:read() == nil)
+assert(client:close())
+code, headers, body = read_response(slow_client)
+assert(code == 200 and body == filedata)
+assert(slow_client:read() == nil)
+assert(slow_client:close())
+local ok, requests, errors, message = thread:join()
+assert(ok, requests)
+assert(requests == 14)
+assert(errors == 1 and message:find 'Handler failed!')
+
+os.remove(tmpfile)
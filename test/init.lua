@@ -23,23 +23,31 @@
 -- enable automatic rebasing between git feature branches and master branch).
 local modules = {
   'base64',
+  'chunked',
+  'connpool',
   'crypt',
   'date',
   'dbd',
   'dbm',
+  'digest',
   'env',
   'filepath',
   'fnmatch',
   'getopt',
   'http',
+  'http_client',
+  'http_parser',
+  'http_server',
   'io_dir',
   'io_file',
   'io_net',
   'ldap',
   'memcache',
   'misc',
+  'pipeline',
   'pollset',
   'proc',
+  'resolver',
   'serialize',
   'shm',
   'signal',
@@ -47,11 +55,14 @@ local modules = {
   'thread',
   'thread_queue',
   'time',
+  'tls',
   'uri',
   'user',
   'uuid',
+  'websocket',
   'xlate',
-  'xml'
+  'xml',
+  'zlib'
 }
 
 local modname = ...
@@ -3,7 +3,7 @@
  Unit tests for the network I/O handling module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: December 7, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -43,6 +43,49 @@ for _, msg in ipairs { 'First line', 'Second line', 'Third line' } do
   assert(msg:upper() == assert(client:read()))
 end
 
+-- Test non-blocking writes to a peer that doesn't read. {{{1
+local listener = assert(apr.socket_create())
+local nb_port = math.random(10000, 50000)
+assert(listener:bind('127.0.0.1', nb_port))
+assert(listener:listen(1))
+local writer = assert(apr.socket_create())
+assert(writer:connect('127.0.0.1', nb_port))
+local reader = assert(listener:accept())
+assert(writer:timeout_set(0))
+local block = ('x'):rep(64 * 1024)
+local written, buffered = 0
+while true do
+  local status, errmsg, errcode = writer:write(block)
+  if errcode == 'EAGAIN' then break end
+  assert(status)
+  written = written + #block
+  buffered = buffered or errmsg == 'buffered'
+  -- Pending output is limited so eventually writes are refused.
+  assert(written <= 1024 * 1024 * 64, "Non-blocking writes never refused!")
+end
+assert(buffered, "Non-blocking write didn't report buffered output!")
+-- The refused write wasn't queued: the reader receives exactly what was accepted.
+local reader_fd = assert(reader:fd_get())
+local counter = assert(apr.thread(function()
+  local apr = require 'apr'
+  local socket = assert(apr.socket_create())
+  assert(socket:fd_set(reader_fd))
+  local received = 0
+  while true do
+    local data = socket:read(65536)
+    if not data then break end
+    received = received + #data
+  end
+  assert(socket:close())
+  return received
+end))
+assert(writer:timeout_set(-1))
+assert(writer:write() == true)
+assert(writer:close())
+local _, received = assert(counter:join())
+assert(received == written)
+assert(listener:close())
+
 -- Test socket:fd_get() and socket:fd_set(). {{{1
 local fd = assert(client:fd_get())
 local thread = assert(apr.thread(function()
@@ -3,7 +3,7 @@
  Unit tests for the miscellaneous routines of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: July 1, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -37,3 +37,21 @@ local default = apr.os_default_encoding()
 local locale = apr.os_locale_encoding()
 assert(type(default) == 'string' and default:find '%S')
 assert(type(locale) == 'string' and locale:find '%S')
+
+-- Test apr.memory_stats()
+local stats = apr.memory_stats()
+assert(type(stats.buffers_used) == 'number')
+assert(type(stats.buffers_cached) == 'number')
+local handle = assert(apr.file_open(selfpath))
+assert(handle:read() == '--[[') -- leaves the rest of the file buffered
+local used = apr.memory_stats().buffers_used
+assert(used > stats.buffers_used)
+assert(handle:read '*a')
+-- Small drained buffers are kept for the next read until the file is closed.
+assert(apr.memory_stats().buffers_used >= used)
+assert(handle:close())
+assert(apr.memory_stats().buffers_used < used)
+-- Closed sockets leave their memory pool behind for reuse.
+local socket = assert(apr.socket_create())
+assert(socket:close())
+assert(apr.memory_stats().socket_pools_cached >= 1)
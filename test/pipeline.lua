@@ -0,0 +1,125 @@
+--[[
+
+ Unit tests for the stream pipeline module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+if not apr.pipeline then
+  helpers.warning "Stream pipelines not available!\n"
+  return false
+end
+
+local lines = {}
+for i = 1, 20000 do lines[i] = 'Line ' .. i .. ' of the Lua/APR pipeline test' end
+local text = table.concat(lines, '\n') .. '\n'
+local infile = helpers.tmpname()
+local outfile = helpers.tmpname()
+helpers.writefile(infile, text)
+
+local function run(transforms, input, length)
+  helpers.writefile(infile, input or text)
+  local source = assert(apr.file_open(infile))
+  local sink = assert(apr.file_open(outfile, 'w'))
+  local pipeline = assert(apr.pipeline(source, transforms, sink, length))
+  local result, message = pipeline:run()
+  assert(source:close())
+  assert(sink:close())
+  return result, message, helpers.readfile(outfile)
+end
+
+-- Copy a file without transformations.
+local result, message, output = run {}
+assert(output == text)
+assert(result.bytes_in == #text and result.bytes_out == #text)
+
+-- Checksums don't change the data.
+result, message, output = run { 'md5', 'sha1' }
+assert(output == text)
+assert(result.md5 == apr.md5(text))
+assert(result.sha1 == apr.sha1(text))
+
+-- Copy part of a file.
+result, message, output = run({ 'md5' }, text, 100)
+assert(output == text:sub(1, 100))
+assert(result.bytes_in == 100 and result.md5 == apr.md5(output))
+
+-- Base64 encoding and decoding.
+result, message, output = run { 'base64_encode' }
+assert(output == apr.base64_encode(text))
+result, message, output = run({ 'base64_decode' }, output)
+assert(output == text)
+result, message = run({ 'base64_decode' }, 'not base64!')
+assert(result == nil and message:find 'invalid base64')
+
+-- Character encodings.
+result, message, output = run({ { 'xlate', from = 'UTF-8', to = 'ISO-8859-1' } }, 'caf\195\169')
+assert(output == 'caf\233')
+
+-- Compression (only when Lua/APR was built with zlib).
+if pcall(apr.pipeline, assert(apr.file_open(infile)), { 'gzip' }) then
+  result, message, output = run { 'gzip' }
+  assert(output:sub(1, 2) == '\031\139' and #output < #text / 4)
+  result, message, output = run({ 'md5', 'inflate', 'sha1' }, output)
+  assert(output == text and result.sha1 == apr.sha1(text))
+  result, message = run({ 'inflate' }, 'not compressed')
+  assert(result == nil)
+end
+
+-- Without a sink only the checksums are computed.
+local handle = assert(apr.file_open(infile))
+result = assert(apr.pipeline(handle, { 'md5' }):run())
+assert(result.md5 == apr.md5(text) and result.bytes_out == #text)
+
+-- Data buffered by the source is used first and pipelines run only once.
+assert(handle:seek('set', 0))
+assert(handle:read '*l' == lines[1])
+local pipeline = assert(apr.pipeline(handle, { 'md5' }))
+assert(tostring(pipeline):find '^pipeline %(')
+result = assert(pipeline:run())
+assert(result.md5 == apr.md5(text:sub(#lines[1] + 2)))
+assert(not pcall(pipeline.run, pipeline))
+assert(handle:close())
+
+-- Invalid arguments raise errors.
+handle = assert(apr.file_open(infile))
+assert(not pcall(apr.pipeline, handle, { 'rot13' }))
+assert(not pcall(apr.pipeline, handle, { 'xlate' }))
+assert(not pcall(apr.pipeline, handle, {}, 'not a stream'))
+assert(handle:close())
+assert(not pcall(apr.pipeline, handle, {}))
+
+-- Copy a file to a socket on a separate thread.
+if apr.thread and pipeline.start then
+  local port = math.random(10000, 40000)
+  local listener = assert(apr.socket_create())
+  assert(listener:bind('127.0.0.1', port))
+  assert(listener:listen(1))
+  local client = assert(apr.socket_create())
+  assert(client:connect('127.0.0.1', port))
+  local server = assert(listener:accept())
+  handle = assert(apr.file_open(infile))
+  pipeline = assert(apr.pipeline(handle, { 'sha1' }, server))
+  assert(pipeline:start())
+  assert(client:read(#text) == text)
+  result = assert(pipeline:wait())
+  assert(result.sha1 == apr.sha1(text))
+  assert(handle:close())
+  assert(client:close())
+  assert(server:close())
+  assert(listener:close())
+end
+
+os.remove(infile)
+os.remove(outfile)
@@ -3,7 +3,7 @@
  Unit tests for the pollset module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: November 20, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -12,7 +12,8 @@
 local apr = require 'apr'
 local SERVER_PORT = math.random(10000, 40000)
 local NUM_CLIENTS = 25
-local main, server_loop, client_loop
+local main, server_loop, client_loop, test_pipes, test_queues, test_timers,
+      test_wakeup, test_loop, test_oneshot
 
 function main() -- {{{1
   local server_thread = assert(apr.thread(server_loop))
@@ -76,8 +77,191 @@ function client_loop() -- {{{1
   assert(socket:close())
 end
 
+function test_pipes() -- {{{1
+  local pollset = assert(apr.pollset(2))
+  local input, output = assert(apr.pipe_create())
+  assert(pollset:add(input, 'input'))
+  -- The pipe is empty so it shouldn't be readable.
+  local readable = assert(pollset:poll(0))
+  assert(#readable == 0)
+  -- Make the pipe readable.
+  assert(output:write 'through a pipe\n')
+  assert(output:flush())
+  readable = assert(pollset:poll(-1))
+  assert(#readable == 1 and readable[1] == input)
+  assert(input:read() == 'through a pipe')
+  -- Closing the write end makes the read end report end of file.
+  assert(output:close())
+  readable = assert(pollset:poll(-1))
+  assert(#readable == 1 and readable[1] == input)
+  assert(input:read() == nil)
+  assert(pollset:remove(input))
+  assert(pollset:destroy())
+end
+
+function test_queues() -- {{{1
+  local pollset = assert(apr.pollset(1))
+  local queue = assert(apr.thread_queue(10))
+  assert(pollset:add(queue, 'input'))
+  assert(#assert(pollset:poll(0)) == 0)
+  local thread = assert(apr.thread(function()
+    for i = 1, 5 do assert(queue:push(i)) end
+  end))
+  local received = {}
+  while #received < 5 do
+    local readable = assert(pollset:poll(-1))
+    assert(#readable == 1 and readable[1] == queue)
+    while true do
+      local value, errmsg, errcode = queue:trypop()
+      if errcode == 'EAGAIN' then break end
+      table.insert(received, assert(value))
+    end
+  end
+  assert(thread:join())
+  for i = 1, 5 do assert(received[i] == i) end
+  -- Once all values have been popped the queue is no longer readable.
+  assert(#assert(pollset:poll(0)) == 0)
+  assert(pollset:remove(queue))
+  assert(pollset:destroy())
+end
+
+function test_timers() -- {{{1
+  local pollset = assert(apr.pollset(1))
+  local fired = {}
+  local function record(name)
+    return function(timer) table.insert(fired, name) end
+  end
+  -- Schedule timers out of order (one far enough to use a higher level).
+  assert(pollset:timer(300000, record 'third'))
+  assert(pollset:timer(10000, record 'first'))
+  assert(pollset:timer(50000, record 'second'))
+  local canceled = assert(pollset:timer(20000, record 'canceled'))
+  assert(canceled:cancel() == true)
+  assert(canceled:cancel() == false)
+  -- An infinite timeout is limited by the first pending timer.
+  local start = apr.time_now()
+  while #fired < 3 do
+    local readable, writable = assert(pollset:poll(-1))
+    assert(#readable == 0 and #writable == 0)
+  end
+  assert(fired[1] == 'first' and fired[2] == 'second' and fired[3] == 'third')
+  assert(apr.time_now() - start >= 0.3)
+  -- A finite timeout without timers still times out.
+  local status, errmsg, errcode = pollset:poll(1000)
+  assert(errcode == 'TIMEUP')
+  -- Timers belong to the Lua state that created them; other threads that
+  -- share the pollset can't add timers while they're pending.
+  assert(pollset:timer(10000, record 'fourth'))
+  local thread = assert(apr.thread(function()
+    local ok, message = pcall(pollset.timer, pollset, 0, function() end)
+    assert(not ok and message:find 'another Lua state')
+  end))
+  assert(thread:join())
+  while #fired < 4 do assert(pollset:poll(-1)) end
+  assert(fired[4] == 'fourth')
+  assert(pollset:destroy())
+end
+
+function test_wakeup() -- {{{1
+  local pollset = assert(apr.pollset(1))
+  local thread = assert(apr.thread(function()
+    local apr = require 'apr'
+    apr.sleep(0.1)
+    assert(pollset:wakeup())
+  end))
+  -- Without the wake up this would block forever.
+  local readable, writable = assert(pollset:poll(-1))
+  assert(#readable == 0 and #writable == 0)
+  assert(thread:join())
+  assert(pollset:destroy())
+end
+
+function test_loop() -- {{{1
+  local loop = assert(apr.loop(NUM_CLIENTS + 1))
+  local port = SERVER_PORT + 1
+  local server = assert(apr.socket_create())
+  assert(server:bind('*', port))
+  assert(server:listen(NUM_CLIENTS))
+  local served, finished = 0, 0
+  -- The server accepts clients and serves each of them in its own coroutine.
+  loop:spawn(function()
+    while served < NUM_CLIENTS do
+      local client = assert(server:accept())
+      served = served + 1
+      loop:spawn(function()
+        for line in client:lines() do
+          assert(client:write(line:upper(), '\n'))
+        end
+        assert(client:close())
+      end)
+    end
+    assert(server:close())
+  end)
+  -- The clients send a large payload to exercise buffering of blocked writes.
+  local payload = string.rep('x', 1024 * 256)
+  for i = 1, NUM_CLIENTS do
+    loop:spawn(function(id)
+      local socket = assert(apr.socket_create())
+      assert(socket:connect('127.0.0.1', port))
+      assert(socket:write('client ', id, '\n'))
+      assert(socket:write(payload, '\n'))
+      local greeting, echo = socket:read('*l', '*l')
+      assert(greeting == 'CLIENT ' .. id)
+      assert(echo == payload:upper())
+      assert(socket:close())
+      finished = finished + 1
+    end, i)
+  end
+  -- Sleeping coroutines don't block the other coroutines.
+  local order = {}
+  loop:spawn(function() loop:sleep(0.2); table.insert(order, 2) end)
+  loop:spawn(function() loop:sleep(0.1); table.insert(order, 1) end)
+  assert(loop:run())
+  assert(served == NUM_CLIENTS and finished == NUM_CLIENTS)
+  assert(order[1] == 1 and order[2] == 2)
+  -- Errors raised by coroutines are propagated by loop:run().
+  loop:spawn(function() error 'oops' end)
+  local ok, errmsg = pcall(loop.run, loop)
+  assert(not ok and errmsg:find 'oops')
+end
+
+function test_oneshot() -- {{{1
+  local pollset = assert(apr.pollset(2, { method = 'poll', nocopy = true, edge = true }))
+  assert(pollset:method() == 'poll')
+  local input, output = assert(apr.pipe_create())
+  assert(pollset:add(input, 'input'))
+  assert(output:write 'still readable\n')
+  assert(output:flush())
+  -- One-shot objects are reported once ...
+  local readable = assert(pollset:poll(-1))
+  assert(#readable == 1 and readable[1] == input)
+  -- ... and then stay quiet even though they're still readable ...
+  readable = assert(pollset:poll(0))
+  assert(#readable == 0)
+  -- ... until they are rearmed.
+  assert(pollset:rearm(input))
+  readable = assert(pollset:poll(-1))
+  assert(#readable == 1 and readable[1] == input)
+  -- Disarmed objects can still be removed.
+  assert(pollset:remove(input))
+  local status, errmsg, errcode = pollset:rearm(input)
+  assert(not status and errmsg)
+  assert(input:close() and output:close())
+  assert(pollset:destroy())
+end
+
 -- }}}
 
 main()
+test_timers()
+if apr.platform_get() ~= 'WIN32' then
+  test_pipes()
+  test_queues()
+  test_oneshot()
+end
+if apr.thread then
+  test_wakeup()
+end
+test_loop()
 
 -- vim: ts=2 sw=2 et tw=79 fen fdm=marker
@@ -0,0 +1,103 @@
+--[[
+
+ Unit tests for the DNS resolver module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+local function contains(list, value)
+  for _, v in ipairs(list) do
+    if v == value then return true end
+  end
+end
+
+-- Check that resolved host names are cached.
+local stats = apr.dns_cache { flush = true }
+assert(stats.entries == 0)
+local addresses = { assert(apr.host_to_addr('localhost', 'inet')) }
+assert(contains(addresses, '127.0.0.1'))
+stats = apr.dns_cache()
+assert(stats.entries == 1)
+local hits = stats.hits
+assert(apr.host_to_addr('localhost', 'inet') == '127.0.0.1')
+assert(apr.dns_cache().hits == hits + 1)
+
+-- Numeric addresses bypass the cache.
+assert(apr.host_to_addr '127.0.0.1' == '127.0.0.1')
+assert(apr.dns_cache().entries == 1)
+
+-- Shrinking the cache evicts the least recently used host names.
+assert(apr.dns_cache { size = 0 }.entries == 0)
+assert(apr.host_to_addr('localhost', 'inet'))
+assert(apr.dns_cache().entries == 0)
+assert(apr.dns_cache { size = 256, ttl = 60 }.size == 256)
+
+if not apr.resolver then
+  helpers.warning "Asynchronous resolver not available!\n"
+  return
+end
+
+-- Lookups of cached host names and numeric addresses complete immediately.
+local resolver = assert(apr.resolver())
+assert(apr.type(resolver) == 'resolver')
+local id, address = assert(resolver:lookup('127.0.0.1'))
+assert(type(id) == 'number' and address == '127.0.0.1')
+id, address = assert(resolver:lookup('127.0.0.1', 'inet'))
+assert(address == '127.0.0.1')
+-- The requested address family must match a numeric address.
+local status, message = resolver:lookup('127.0.0.1', 'inet6')
+assert(status == nil and message:find 'address family')
+id, address = assert(resolver:lookup('::1'))
+assert(address == '::1')
+assert(apr.host_to_addr('localhost', 'inet'))
+id, address = assert(resolver:lookup('localhost', 'inet'))
+assert(address == '127.0.0.1')
+
+-- Other lookups complete through the pollset.
+apr.dns_cache { flush = true }
+local pollset = assert(apr.pollset(1))
+assert(pollset:add(resolver, 'input'))
+id, address = assert(resolver:lookup('localhost', 'inet'))
+assert(address == nil)
+local results = {}
+while #results == 0 do
+  local readable = assert(pollset:poll(5 * 1000000))
+  if readable[1] then
+    assert(readable[1] == resolver)
+    results = resolver:results()
+  end
+end
+assert(#results == 1)
+assert(results[1].id == id)
+assert(results[1].host == 'localhost')
+assert(contains(results[1].addresses, '127.0.0.1'))
+assert(#resolver:results() == 0)
+
+-- The result was added to the cache shared by all threads.
+assert(apr.dns_cache().entries == 1)
+
+-- Failed lookups report an error message.
+id = assert(resolver:lookup('host.that.does.not.exist.invalid'))
+results = {}
+while #results == 0 do
+  if pollset:poll(30 * 1000000)[1] then results = resolver:results() end
+end
+assert(results[1].id == id)
+assert(results[1].addresses == nil)
+assert(type(results[1].error) == 'string')
+
+assert(pollset:remove(resolver))
+assert(resolver:close())
+assert(not pcall(resolver.lookup, resolver, 'localhost'))
+assert(pollset:destroy())
@@ -0,0 +1,104 @@
+--[[
+
+ Unit tests for the WebSocket module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+-- Handshake (the example from RFC 6455).
+if apr.ws_handshake then
+  assert(apr.ws_accept 'dGhlIHNhbXBsZSBub25jZQ==' == 's3pPLMBiTxaQ9kK+sOzYbo0IfPo=')
+  local response = assert(apr.ws_handshake {
+    upgrade = 'websocket',
+    connection = 'Upgrade',
+    ['sec-websocket-key'] = 'dGhlIHNhbXBsZSBub25jZQ==',
+    ['sec-websocket-version'] = '13',
+  })
+  assert(response:find '^HTTP/1%.1 101 ')
+  assert(response:find 'Sec%-WebSocket%-Accept: s3pPLMBiTxaQ9kK%+sOzYbo0IfPo=\r\n\r\n$')
+  assert(not apr.ws_handshake { upgrade = 'websocket' })
+end
+
+-- Frame encoding (examples from RFC 6455 section 5.7).
+assert(apr.ws_frame('text', 'Hello') == '\129\005Hello')
+assert(apr.ws_frame('text', 'Hel', false, false) == '\001\003Hel')
+assert(apr.ws_frame('continuation', 'lo') == '\128\002lo')
+assert(apr.ws_frame('binary', string.rep('x', 256)):sub(1, 4) == '\130\126\001\000')
+assert(apr.ws_frame('binary', string.rep('x', 65536)):sub(1, 10) == '\130\127\000\000\000\000\000\001\000\000')
+assert(#apr.ws_frame('text', 'Hello', true) == 2 + 4 + 5)
+assert(not pcall(apr.ws_frame, 'ping', string.rep('x', 126)))
+
+-- Connect a client and a server socket.
+local port = math.random(10000, 40000)
+local listener = assert(apr.socket_create())
+assert(listener:bind('127.0.0.1', port))
+assert(listener:listen(1))
+local client = assert(apr.socket_create())
+assert(client:connect('127.0.0.1', port))
+local server = assert(listener:accept())
+
+-- Masked messages from the client are unmasked by the server.
+for _, size in ipairs { 0, 1, 5, 15, 16, 17, 125, 126, 1000, 65535, 65536, 100000 } do
+  local message = string.rep('Lua/APR ', math.ceil(size / 8)):sub(1, size)
+  assert(client:ws_write('binary', message, true))
+  local opcode, payload = assert(server:ws_read())
+  assert(opcode == 'binary' and payload == message)
+end
+
+-- Unmasked messages from the server.
+assert(server:ws_write('text', 'Hello client!'))
+local opcode, payload = assert(client:ws_read())
+assert(opcode == 'text' and payload == 'Hello client!')
+
+-- Fragmented messages are joined and interleaved control frames come first.
+assert(client:ws_write('text', 'one ', true, false))
+assert(client:ws_write('continuation', 'two ', true, false))
+assert(client:ws_write('ping', 'are you there?', true))
+assert(client:ws_write('continuation', 'three', true))
+opcode, payload = assert(server:ws_read())
+assert(opcode == 'ping' and payload == 'are you there?')
+assert(server:ws_write('pong', payload))
+opcode, payload = assert(server:ws_read())
+assert(opcode == 'text' and payload == 'one two three')
+opcode, payload = assert(client:ws_read())
+assert(opcode == 'pong' and payload == 'are you there?')
+
+-- Frames encoded once can be written to any number of sockets.
+assert(server:write(apr.ws_frame('binary', 'broadcast')))
+opcode, payload = assert(client:ws_read())
+assert(opcode == 'binary' and payload == 'broadcast')
+
+-- Messages larger than the limit are rejected.
+assert(client:ws_write('binary', string.rep('x', 1024), true))
+local result, message = server:ws_read(100)
+assert(result == nil and message:find 'too large')
+assert(server:close())
+
+-- Close frames carry a status code and reason.
+client = assert(apr.socket_create())
+assert(client:connect('127.0.0.1', port))
+server = assert(listener:accept())
+assert(client:ws_write('close', '\003\232going away', true))
+local reason, code
+opcode, reason, code = assert(server:ws_read())
+assert(opcode == 'close' and reason == 'going away' and code == 1000)
+
+-- Protocol errors.
+assert(client:write '\128\000')
+result, message = server:ws_read()
+assert(result == nil and message:find 'continuation')
+
+assert(client:close())
+assert(server:close())
+assert(listener:close())
@@ -3,7 +3,7 @@
  Unit tests for the character encoding translation module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: July 3, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -35,3 +35,45 @@ assert(latin1 == assert(apr.xlate(latin2, 'ISO-8859-2', 'ISO-8859-1')))
 -- 4. Transformation using character set aliases
 assert(utf7 == assert(apr.xlate(utf8, 'UTF-8', 'UTF-7')))
 assert(utf8 == assert(apr.xlate(utf7, 'UTF-7', 'UTF-8')))
+
+-- 5. Reusable converters
+local converter = assert(apr.xlate_open('UTF-8', 'ISO-8859-1'))
+assert(apr.type(converter) == 'character set converter')
+assert(tostring(converter):find '^character set converter %(')
+for _ = 1, 3 do
+  assert(converter:convert(utf8) == latin1)
+  assert(converter:convert '' == '')
+  assert(converter:convert 'plain ASCII' == 'plain ASCII')
+end
+
+-- 6. Streaming conversion with multibyte sequences split between chunks
+local output = {}
+for i = 1, #utf8 do
+  table.insert(output, assert(converter:feed(utf8:sub(i, i))))
+end
+table.insert(output, assert(converter:finish()))
+assert(table.concat(output) == latin1)
+assert(converter:feed(utf8:sub(1, -2)) == latin1:sub(1, -2))
+local status, message = converter:finish()
+assert(not status and message)
+assert(converter:convert(utf8) == latin1)
+
+-- 7. Stateful encodings are terminated by finish()
+local converter = assert(apr.xlate_open('UTF-8', 'UTF-7'))
+assert(converter:feed(utf8:sub(1, 8)) .. converter:feed(utf8:sub(9)) .. converter:finish() == utf7)
+
+-- 8. Validation only: identical and ASCII compatible encodings
+local converter = assert(apr.xlate_open('UTF-8', 'UTF-8'))
+assert(converter:convert(utf8) == utf8)
+assert(not converter:convert 'invalid \192\128 UTF-8')
+assert(not converter:convert(utf8:sub(1, -2)))
+assert(converter:feed(utf8:sub(1, -2)) == utf8:sub(1, -2))
+assert(converter:feed(utf8:sub(-1)) == utf8:sub(-1))
+assert(converter:finish() == '')
+local converter = assert(apr.xlate_open('ASCII', 'ISO-8859-1'))
+assert(converter:convert 'plain ASCII' == 'plain ASCII')
+assert(not converter:convert(latin1))
+assert(apr.xlate(latin1, 'ISO-8859-1', 'iso-8859-1') == latin1)
+assert(converter:close())
+assert(tostring(converter) == 'character set converter (closed)')
+assert(not pcall(converter.convert, converter, 'closed'))
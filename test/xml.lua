@@ -3,7 +3,7 @@
  Unit tests for the XML parsing module of the Lua/APR binding.
 
  Author: Peter Odding <peter@peterodding.com>
- Last Change: March 27, 2011
+ Last Change: October 18, 2026
  Homepage: http://peterodding.com/code/lua/apr/
  License: MIT
 
@@ -61,3 +61,160 @@ local parser = assert(apr.xml())
 assert(tostring(parser):find '^xml parser %([x%x]+%)$')
 assert(parser:close())
 assert(tostring(parser):find '^xml parser %(closed%)$')
+
+-- Lazy access to the parse tree using element objects.
+local parser = assert(apr.xml())
+assert(parser:feed [[
+<feed version="1.0">
+  <entry id="1"><title>One</title><link href="/one"/></entry>
+  <entry id="2"><title>Two <b>and</b> a half</title><link href="/two"/></entry>
+</feed>]])
+assert(parser:done())
+local root = assert(parser:root())
+assert(apr.type(root) == 'xml element')
+assert(tostring(root):find '^xml element <feed> %(')
+assert(root:name() == 'feed')
+assert(root:attr 'version' == '1.0')
+assert(root:attr 'missing' == nil)
+assert(root:parent() == nil)
+local names = {}
+for child in root:children() do
+  assert(child:parent() == root)
+  table.insert(names, child:name() .. child:attr 'id')
+end
+assert(helpers.deepequal(names, { 'entry1', 'entry2' }))
+
+-- Path queries.
+local titles = parser:select 'feed/entry/title'
+assert(#titles == 2)
+assert(titles[1]:text() == 'One')
+assert(titles[2]:text() == 'Two and a half')
+assert(helpers.deepequal(parser:select 'feed/entry/link/@href', { '/one', '/two' }))
+assert(helpers.deepequal(parser:select 'feed/*/@id', { '1', '2' }))
+assert(#parser:select 'entry/title' == 0)
+local entry = titles[2]:parent()
+assert(entry:select('title')[1] == titles[2])
+assert(entry:select('@id')[1] == '2')
+assert(#entry:select '/feed/entry' == 2)
+assert(helpers.deepequal(entry:attributes(), { 'id', id = '2' }))
+assert(helpers.deepequal(entry:select('link')[1]:getinfo(),
+    { tag = 'link', attr = { 'href', href = '/two' } }))
+assert(not pcall(parser.select, parser, 'feed//title'))
+assert(not pcall(parser.select, parser, 'feed/@id/title'))
+
+-- Elements keep the document alive but not after it's closed.
+parser = nil
+collectgarbage 'collect'
+assert(root:select('entry/title')[1]:text() == 'One')
+local parser = assert(apr.xml())
+assert(parser:feed '<root/>')
+assert(parser:done())
+local root = parser:root()
+assert(parser:close())
+assert(not pcall(root.name, root))
+
+-- Generating XML using apr.xml_encode() and apr.xml_writer().
+local document = { tag = 'entry', attr = { 'id', 'class', id = '1', class = 'a"b' },
+  'Tom & Jerry ', { tag = 'b', '<bold>' }, { tag = 'empty' } }
+local xml = '<entry id="1" class="a&quot;b">Tom &amp; Jerry <b>&lt;bold&gt;</b><empty/></entry>'
+assert(apr.xml_encode(document) == xml)
+assert(apr.xml_encode { tag = 'x', attr = { n = 42 } } == '<x n="42"/>')
+assert(not apr.xml_encode { tag = 'x', 'control \1 character' })
+assert(not apr.xml_encode { tag = 'invalid name' })
+local recursive = { tag = 'loop' }
+recursive[1] = recursive
+assert(not apr.xml_encode(recursive))
+
+local xml_path = helpers.tmpname()
+local handle = assert(apr.file_open(xml_path, 'w'))
+assert(apr.xml_encode(document, handle))
+local writer = assert(apr.xml_writer(handle))
+assert(apr.type(writer) == 'xml writer')
+assert(writer:start('list', { 'a', a = '<1>' }))
+for i = 1, 3 do
+  assert(writer:start 'item')
+  assert(writer:text(tostring(i)))
+  assert(writer:finish())
+end
+assert(writer:start 'empty')
+assert(writer:finish())
+assert(writer:finish())
+assert(not pcall(writer.finish, writer))
+assert(writer:flush())
+assert(handle:close())
+assert(helpers.readfile(xml_path) == xml ..
+    '<list a="&lt;1&gt;"><item>1</item><item>2</item><item>3</item><empty/></list>')
+assert(not pcall(writer.text, writer, 'closed'))
+os.remove(xml_path)
+
+-- Event driven parsing using apr.xml_stream().
+if not apr.xml_stream then
+  helpers.warning "XML stream parser not available!\n"
+  return
+end
+
+local events = {}
+local stream = assert(apr.xml_stream {
+  start = function(name, attr)
+    table.insert(events, { 'start', name, attr })
+  end,
+  ['end'] = function(name)
+    table.insert(events, { 'end', name })
+  end,
+  text = function(text)
+    table.insert(events, { 'text', text })
+  end,
+})
+assert(apr.type(stream) == 'xml stream')
+assert(tostring(stream):find '^xml stream %([x%x]+%)$')
+
+-- Feed the document in small pieces; text split between pieces is combined.
+local document = '<root a="1" b="2"><item>some text</item><empty/></root>'
+for i = 1, #document, 5 do
+  assert(stream:feed(document:sub(i, i + 4)) == true)
+end
+assert(stream:done() == true)
+assert(helpers.deepequal(events, {
+  { 'start', 'root', { 'a', 'b', a = '1', b = '2' } },
+  { 'start', 'item', {} },
+  { 'text', 'some text' },
+  { 'end', 'item' },
+  { 'start', 'empty', {} },
+  { 'end', 'empty' },
+  { 'end', 'root' },
+}))
+assert(stream:close())
+assert(tostring(stream):find '^xml stream %(closed%)$')
+assert(not pcall(stream.feed, stream, '<more/>'))
+
+-- Callbacks can stop the parser by returning false.
+local seen = 0
+local stream = assert(apr.xml_stream {
+  start = function(name)
+    seen = seen + 1
+    if name == 'stop' then return false end
+  end,
+})
+assert(stream:feed '<root><a/><stop/><b/>' == false)
+assert(stream:feed '<c/></root>' == false)
+assert(seen == 3)
+
+-- Errors in the document and in callbacks are reported.
+local stream = assert(apr.xml_stream {})
+assert(stream:feed '<root>')
+local status, message = stream:done()
+assert(status == nil and message:find 'line')
+local stream = assert(apr.xml_stream {
+  text = function(text) error 'callback failed' end,
+})
+local status, message = stream:feed '<root>text</root>'
+assert(status == nil and message:find 'callback failed')
+local status, message = stream:feed '<root/>'
+assert(status == nil and message)
+local stream = assert(apr.xml_stream {
+  start = function(name, attributes) error 'start failed' end,
+})
+local status, message = stream:feed '<root a="1"><b/></root>'
+assert(status == nil and message:find 'start failed')
+-- Failed callbacks don't leave the stream in use by the parser.
+assert(stream:close())
@@ -0,0 +1,115 @@
+--[[
+
+ Unit tests for the compression module of the Lua/APR binding.
+
+ Author: Peter Odding <peter@peterodding.com>
+ Last Change: October 18, 2026
+ Homepage: http://peterodding.com/code/lua/apr/
+ License: MIT
+
+--]]
+
+local status, apr = pcall(require, 'apr')
+if not status then
+  pcall(require, 'luarocks.require')
+  apr = require 'apr'
+end
+local helpers = require 'apr.test.helpers'
+
+local tmpfile = helpers.tmpname()
+local handle = assert(apr.file_open(tmpfile, 'w+'))
+if not handle.gzip_writer then
+  assert(handle:close())
+  os.remove(tmpfile)
+  helpers.warning "Compression streams not available!\n"
+  return false
+end
+
+local lines = {}
+for i = 1, 10000 do lines[i] = 'Line ' .. i .. ' of the Lua/APR compression test' end
+local text = table.concat(lines, '\n') .. '\n'
+
+-- Compress to a file, with some plain text before and after the stream.
+assert(handle:write 'header\n')
+local writer = assert(handle:gzip_writer(9))
+assert(tostring(writer):find '^compression writer %(')
+for i = 1, #lines do assert(writer:write(lines[i], '\n')) end
+assert(writer:close())
+assert(tostring(writer) == 'compression writer (closed)')
+assert(not pcall(writer.write, writer, 'more'))
+assert(handle:write 'trailer\n')
+
+-- The output should be in the gzip format and a lot smaller than the input.
+local size = assert(handle:seek('end'))
+assert(size < #text / 4)
+assert(handle:seek('set', 0))
+assert(handle:read '*l' == 'header')
+assert(handle:read(2) == '\031\139')
+
+-- Decompress line by line; data after the stream can still be read.
+assert(handle:seek('set', 7))
+local reader = assert(handle:inflate_reader())
+local i = 0
+for line in reader:lines() do
+  i = i + 1
+  assert(line == lines[i])
+end
+assert(i == #lines)
+assert(reader:close())
+assert(handle:read '*a' == 'trailer\n')
+assert(handle:close())
+
+-- The zlib format using different compression levels.
+for _, level in ipairs { 0, 1, 6, 9 } do
+  handle = assert(apr.file_open(tmpfile, 'w+'))
+  writer = assert(handle:deflate_writer(level))
+  assert(writer:write(text))
+  assert(writer:close())
+  assert(handle:seek('set', 0))
+  assert(handle:read(1) == '\120')
+  assert(handle:seek('set', 0))
+  reader = assert(handle:inflate_reader())
+  assert(reader:read '*a' == text)
+  assert(reader:read(1) == nil)
+  assert(handle:close())
+end
+assert(not pcall(handle.gzip_writer, assert(apr.file_open(tmpfile)), 10))
+
+-- Corrupt and truncated data is reported as an error.
+helpers.writefile(tmpfile, 'this is not compressed')
+handle = assert(apr.file_open(tmpfile))
+local result, message = handle:inflate_reader():read '*a'
+assert(result == nil and message:find 'header')
+assert(handle:close())
+handle = assert(apr.file_open(tmpfile, 'w+'))
+writer = assert(handle:gzip_writer())
+assert(writer:write(text))
+assert(writer:close())
+assert(handle:truncate(assert(handle:seek('end')) - 100))
+assert(handle:seek('set', 0))
+result, message = handle:inflate_reader():read '*a'
+assert(result == nil and message:find 'prematurely')
+assert(handle:close())
+os.remove(tmpfile)
+
+-- Compressed streams over a socket, flushed while the writer is in use.
+local port = math.random(10000, 40000)
+local listener = assert(apr.socket_create())
+assert(listener:bind('127.0.0.1', port))
+assert(listener:listen(1))
+local client = assert(apr.socket_create())
+assert(client:connect('127.0.0.1', port))
+local server = assert(listener:accept())
+writer = assert(server:gzip_writer())
+reader = assert(client:inflate_reader())
+assert(writer:write 'first line\n')
+assert(writer:flush())
+assert(reader:read '*l' == 'first line')
+assert(writer:write(text))
+assert(writer:close())
+assert(server:write 'after')
+assert(reader:read '*a' == text)
+assert(client:read(5) == 'after')
+assert(client:close())
+assert(server:close())
+assert(listener:close())